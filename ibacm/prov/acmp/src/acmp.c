@@ -39,6 +39,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <infiniband/acm.h>
@@ -49,7 +50,6 @@
 #include <infiniband/umad_sa_mcm.h>
 #include <ifaddrs.h>
 #include <dlfcn.h>
-#include <search.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -66,6 +66,9 @@
 
 #define MAX_EP_ADDR 4
 #define MAX_EP_MC   2
+#define ACMP_DEST_SHARDS     16
+#define ACMP_DEST_MIN_BUCKETS 16
+#define ACMP_DEST_EXPIRE_BATCH 8
 
 enum acmp_state {
 	ACMP_INIT,
@@ -100,7 +103,7 @@ enum acmp_addr_preload {
 };
 
 /*
- * Nested locking order: dest -> ep, dest -> port
+ * Nested locking order: dest -> ep, dest -> port, dest -> dest cache shard
  */
 struct acmp_ep;
 
@@ -121,6 +124,26 @@ struct acmp_dest {
 	uint64_t	       route_timeout;
 	uint8_t                addr_type;
 	struct acmp_ep         *ep;
+	/* dest cache linkage, protected by the shard lock */
+	struct acmp_dest       *hnext;
+	uint32_t               hash;
+	bool                   cached;
+	struct list_node       expire_entry;
+};
+
+/*
+ * The destination cache of an endpoint is split into independently locked
+ * shards, each a chained hash table that doubles as it fills.  Records with
+ * a finite lifetime are also kept on the shard's expire_list; since every
+ * lifetime is "now + addr_timeout", appending on each update keeps the list
+ * sorted and expired records are reaped from its head.
+ */
+struct acmp_dest_shard {
+	pthread_mutex_t        lock;
+	struct acmp_dest       **buckets;
+	unsigned int           nbuckets;
+	unsigned int           count;
+	struct list_head       expire_list;
 };
 
 struct acmp_device;
@@ -179,7 +202,7 @@ struct acmp_ep {
 	uint8_t               *recv_bufs;
 	struct list_node      entry;
 	char		      id_string[IBV_SYSFS_NAME_MAX + 11];
-	void                  *dest_map[ACM_ADDRESS_RESERVED - 1];
+	struct acmp_dest_shard dest_cache[ACMP_DEST_SHARDS];
 	struct acmp_dest      mc_dest[MAX_EP_MC];
 	int                   mc_cnt;
 	uint16_t              pkey_index;
@@ -290,9 +313,117 @@ static enum acmp_addr_preload addr_preload;
 
 static int acmp_initialized = 0;
 
-static int acmp_compare_dest(const void *dest1, const void *dest2)
+static uint32_t acmp_dest_hash(uint8_t addr_type, const uint8_t *addr)
+{
+	uint64_t h = addr_type, w;
+	int i;
+
+	for (i = 0; i < ACM_MAX_ADDRESS; i += sizeof(w)) {
+		memcpy(&w, addr + i, sizeof(w));
+		h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+	}
+	return (uint32_t) (h ^ (h >> 32));
+}
+
+static struct acmp_dest_shard *
+acmp_dest_shard(struct acmp_ep *ep, uint32_t hash)
+{
+	return &ep->dest_cache[hash >> 28];
+}
+
+static void acmp_init_dest_cache(struct acmp_ep *ep)
+{
+	int i;
+
+	BUILD_ASSERT(ACMP_DEST_SHARDS == 1 << 4);
+	for (i = 0; i < ACMP_DEST_SHARDS; i++) {
+		pthread_mutex_init(&ep->dest_cache[i].lock, NULL);
+		list_head_init(&ep->dest_cache[i].expire_list);
+	}
+}
+
+/* Caller must hold the shard lock. */
+static struct acmp_dest *
+acmp_dest_lookup(struct acmp_dest_shard *shard, uint32_t hash,
+		 uint8_t addr_type, const uint8_t *addr)
+{
+	struct acmp_dest *dest;
+
+	if (!shard->nbuckets)
+		return NULL;
+
+	for (dest = shard->buckets[hash & (shard->nbuckets - 1)]; dest;
+	     dest = dest->hnext) {
+		if (dest->hash == hash && dest->addr_type == addr_type &&
+		    !memcmp(dest->address, addr, ACM_MAX_ADDRESS))
+			return dest;
+	}
+	return NULL;
+}
+
+/* Caller must hold the shard lock. */
+static int acmp_dest_resize(struct acmp_dest_shard *shard, unsigned int size)
+{
+	struct acmp_dest **buckets, *dest, *next;
+	unsigned int i;
+
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return -1;
+
+	for (i = 0; i < shard->nbuckets; i++) {
+		for (dest = shard->buckets[i]; dest; dest = next) {
+			next = dest->hnext;
+			dest->hnext = buckets[dest->hash & (size - 1)];
+			buckets[dest->hash & (size - 1)] = dest;
+		}
+	}
+
+	free(shard->buckets);
+	shard->buckets = buckets;
+	shard->nbuckets = size;
+	return 0;
+}
+
+/* Caller must hold the shard lock. */
+static int acmp_dest_insert(struct acmp_dest_shard *shard, struct acmp_dest *dest)
+{
+	struct acmp_dest **bucket;
+
+	if (shard->count >= shard->nbuckets &&
+	    acmp_dest_resize(shard, shard->nbuckets ?
+			     shard->nbuckets * 2 : ACMP_DEST_MIN_BUCKETS)) {
+		/* carry on with a fuller table if there is one */
+		if (!shard->nbuckets)
+			return -1;
+	}
+
+	bucket = &shard->buckets[dest->hash & (shard->nbuckets - 1)];
+	dest->hnext = *bucket;
+	*bucket = dest;
+	dest->cached = true;
+	shard->count++;
+	return 0;
+}
+
+/* Caller must hold the shard lock.  Returns false if dest is not cached. */
+static bool acmp_dest_unlink(struct acmp_dest_shard *shard, struct acmp_dest *dest)
 {
-	return memcmp(dest1, dest2, ACM_MAX_ADDRESS);
+	struct acmp_dest **link;
+
+	if (!dest->cached)
+		return false;
+
+	for (link = &shard->buckets[dest->hash & (shard->nbuckets - 1)];
+	     *link != dest; link = &(*link)->hnext)
+		;
+	*link = dest->hnext;
+	dest->hnext = NULL;
+	dest->cached = false;
+	list_del_init(&dest->expire_entry);
+	shard->count--;
+	return true;
 }
 
 static void
@@ -309,6 +440,7 @@ acmp_init_dest(struct acmp_dest *dest, uint8_t addr_type,
 	       const uint8_t *addr, size_t size)
 {
 	list_head_init(&dest->req_queue);
+	list_node_init(&dest->expire_entry);
 	atomic_init(&dest->refcnt);
 	atomic_set(&dest->refcnt, 1);
 	pthread_mutex_init(&dest->lock, NULL);
@@ -333,19 +465,57 @@ acmp_alloc_dest(uint8_t addr_type, const uint8_t *addr)
 	return dest;
 }
 
-/* Caller must hold ep lock. */
+static void
+acmp_put_dest(struct acmp_dest *dest)
+{
+	acm_log(2, "%s\n", dest->name);
+	if (atomic_dec(&dest->refcnt) == 0) {
+		free(dest);
+	}
+}
+
+/* Drop the cache references of an endpoint that is being freed. */
+static void acmp_free_dest_cache(struct acmp_ep *ep)
+{
+	struct acmp_dest_shard *shard;
+	struct acmp_dest *dest, *next;
+	unsigned int i, j;
+
+	for (i = 0; i < ACMP_DEST_SHARDS; i++) {
+		shard = &ep->dest_cache[i];
+		for (j = 0; j < shard->nbuckets; j++) {
+			for (dest = shard->buckets[j]; dest; dest = next) {
+				next = dest->hnext;
+				dest->hnext = NULL;
+				dest->cached = false;
+				list_del_init(&dest->expire_entry);
+				acmp_put_dest(dest);
+			}
+		}
+		free(shard->buckets);
+		shard->buckets = NULL;
+		shard->nbuckets = 0;
+		shard->count = 0;
+		pthread_mutex_destroy(&shard->lock);
+	}
+}
+
 static struct acmp_dest *
 acmp_get_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 {
-	struct acmp_dest *dest, **tdest;
+	uint32_t hash = acmp_dest_hash(addr_type, addr);
+	struct acmp_dest_shard *shard = acmp_dest_shard(ep, hash);
+	struct acmp_dest *dest;
 
-	tdest = tfind(addr, &ep->dest_map[addr_type - 1], acmp_compare_dest);
-	if (tdest) {
-		dest = *tdest;
+	pthread_mutex_lock(&shard->lock);
+	dest = acmp_dest_lookup(shard, hash, addr_type, addr);
+	if (dest)
 		(void) atomic_inc(&dest->refcnt);
+	pthread_mutex_unlock(&shard->lock);
+
+	if (dest) {
 		acm_log(2, "%s\n", dest->name);
 	} else {
-		dest = NULL;
 		acm_format_name(2, log_data, sizeof log_data,
 				addr_type, addr, ACM_MAX_ADDRESS);
 		acm_log(2, "%s not found\n", log_data);
@@ -353,59 +523,148 @@ acmp_get_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 	return dest;
 }
 
+/* Drop the cache reference of dest, if it is still cached. */
 static void
-acmp_put_dest(struct acmp_dest *dest)
+acmp_remove_dest(struct acmp_ep *ep, struct acmp_dest *dest)
 {
+	struct acmp_dest_shard *shard = acmp_dest_shard(ep, dest->hash);
+	bool cached;
+
 	acm_log(2, "%s\n", dest->name);
-	if (atomic_dec(&dest->refcnt) == 0) {
-		free(dest);
+	pthread_mutex_lock(&shard->lock);
+	cached = acmp_dest_unlink(shard, dest);
+	pthread_mutex_unlock(&shard->lock);
+
+	if (cached)
+		acmp_put_dest(dest);
+	else
+		acm_log(0, "ERROR: %s not found!!\n", dest->name);
+}
+
+/*
+ * Set the lifetime of a resolved record.  Records that never expire are
+ * kept off the shard expire list.
+ */
+static void acmp_set_dest_timeout(struct acmp_dest *dest, bool permanent)
+{
+	struct acmp_dest_shard *shard = NULL;
+	uint64_t addr_time, route_time;
+
+	if (permanent) {
+		addr_time = (uint64_t)~0ULL;
+		route_time = (uint64_t)~0ULL;
+	} else {
+		addr_time = time_stamp_min() + (unsigned) addr_timeout;
+		route_time = time_stamp_min() + (unsigned) route_timeout;
 	}
+
+	/* The shard's expire list walker reads addr_timeout */
+	if (dest->ep) {
+		shard = acmp_dest_shard(dest->ep, dest->hash);
+		pthread_mutex_lock(&shard->lock);
+	}
+
+	dest->addr_timeout = addr_time;
+	dest->route_timeout = route_time;
+	if (!shard)
+		return;
+
+	if (dest->cached) {
+		list_del_init(&dest->expire_entry);
+		if (!permanent && addr_timeout >= 0)
+			list_add_tail(&shard->expire_list, &dest->expire_entry);
+	}
+	pthread_mutex_unlock(&shard->lock);
 }
 
-/* Caller must hold ep lock. */
-static void
-acmp_remove_dest(struct acmp_ep *ep, struct acmp_dest *dest)
+/*
+ * Caller must hold the shard lock.  The shard lock nests inside dest->lock,
+ * so the record lock can only be tried here.  Returns 1 if dest is resolved,
+ * 0 if it is not and -1 if it is busy.
+ */
+static int acmp_dest_ready(struct acmp_dest *dest)
 {
-	acm_log(2, "%s\n", dest->name);
-	if (!tdelete(dest->address, &ep->dest_map[dest->addr_type - 1],
-		     acmp_compare_dest))
-		acm_log(0, "ERROR: %s not found!!\n", dest->name);
+	int ready;
 
-	acmp_put_dest(dest);
+	if (pthread_mutex_trylock(&dest->lock))
+		return -1;
+	ready = dest->state == ACMP_READY;
+	pthread_mutex_unlock(&dest->lock);
+	return ready;
+}
+
+/*
+ * Caller must hold the shard lock.  Drop a few resolved records whose
+ * address lifetime has passed; records being resolved again are left in
+ * the table and come back on the list when they get a new lifetime.
+ */
+static void acmp_expire_dests(struct acmp_dest_shard *shard, uint64_t now)
+{
+	struct acmp_dest *dest;
+	int i, ready;
+
+	for (i = 0; i < ACMP_DEST_EXPIRE_BATCH; i++) {
+		dest = list_top(&shard->expire_list, struct acmp_dest,
+				expire_entry);
+		if (!dest || dest->addr_timeout > now)
+			break;
+
+		/* a busy record stays at the head for the next pass */
+		ready = acmp_dest_ready(dest);
+		if (ready < 0)
+			break;
+		if (!ready) {
+			list_del_init(&dest->expire_entry);
+			continue;
+		}
+
+		acm_log(2, "%s expired\n", dest->name);
+		acmp_dest_unlink(shard, dest);
+		acmp_put_dest(dest);
+	}
 }
 
 static struct acmp_dest *
 acmp_acquire_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 {
+	uint32_t hash = acmp_dest_hash(addr_type, addr);
+	struct acmp_dest_shard *shard = acmp_dest_shard(ep, hash);
 	struct acmp_dest *dest;
-	int64_t rec_expr_minutes;
+	uint64_t now = time_stamp_min();
 
 	acm_format_name(2, log_data, sizeof log_data,
 			addr_type, addr, ACM_MAX_ADDRESS);
 	acm_log(2, "%s\n", log_data);
-	pthread_mutex_lock(&ep->lock);
-	dest = acmp_get_dest(ep, addr_type, addr);
-	if (dest && dest->state == ACMP_READY &&
-	    dest->addr_timeout != (uint64_t)~0ULL) {
-		rec_expr_minutes = dest->addr_timeout - time_stamp_min();
-		if (rec_expr_minutes <= 0) {
+	pthread_mutex_lock(&shard->lock);
+	acmp_expire_dests(shard, now);
+	dest = acmp_dest_lookup(shard, hash, addr_type, addr);
+	if (dest && dest->addr_timeout != (uint64_t)~0ULL &&
+	    acmp_dest_ready(dest) > 0) {
+		if (dest->addr_timeout <= now) {
 			acm_log(2, "Record expired\n");
-			acmp_remove_dest(ep, dest);
+			acmp_dest_unlink(shard, dest);
+			acmp_put_dest(dest);
 			dest = NULL;
 		} else {
 			acm_log(2, "Record valid for the next %" PRId64 " minute(s)\n",
-				rec_expr_minutes);
+				(int64_t) (dest->addr_timeout - now));
 		}
 	}
 	if (!dest) {
 		dest = acmp_alloc_dest(addr_type, addr);
 		if (dest) {
 			dest->ep = ep;
-			tsearch(dest, &ep->dest_map[addr_type - 1], acmp_compare_dest);
-			(void) atomic_inc(&dest->refcnt);
+			dest->hash = hash;
+			if (acmp_dest_insert(shard, dest)) {
+				acm_log(0, "ERROR - unable to cache dest\n");
+				acmp_put_dest(dest);
+				dest = NULL;
+			}
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	if (dest)
+		(void) atomic_inc(&dest->refcnt);
+	pthread_mutex_unlock(&shard->lock);
 	return dest;
 }
 
@@ -776,8 +1035,7 @@ acmp_record_acm_route(struct acmp_ep *ep, struct acmp_dest *dest)
 	dest->path = ep->mc_dest[i].path;
 	dest->path.dgid = dest->av.grh.dgid;
 	dest->path.dlid = htobe16(dest->av.dlid);
-	dest->addr_timeout = time_stamp_min() + (unsigned) addr_timeout;
-	dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+	acmp_set_dest_timeout(dest, false);
 	dest->state = ACMP_READY;
 	return ACM_STATUS_SUCCESS;
 }
@@ -1013,8 +1271,7 @@ acmp_dest_sa_resp(struct acm_sa_mad *mad)
 	if (!status) {
 		memcpy(&dest->path, sa_mad->data, sizeof(dest->path));
 		acmp_init_path_av(dest->ep->port, dest);
-		dest->addr_timeout = time_stamp_min() + (unsigned) addr_timeout;
-		dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+		acmp_set_dest_timeout(dest, false);
 		acm_log(2, "timeout addr %" PRIu64 " route %" PRIu64 "\n",
 			dest->addr_timeout, dest->route_timeout);
 		dest->state = ACMP_READY;
@@ -2069,127 +2326,569 @@ err:
 	return -1;
 }
 
-/* Parse "opensm full v1" file to build LID to GUID table */
-static void acmp_parse_osm_fullv1_lid2guid(FILE *f, __be64 *lid2guid)
-{
-	char s[128];
-	char *p, *ptr, *p_guid, *p_lid;
+/*
+ * Route preload: the opensm full v1 file is mapped read-only and indexed
+ * once per process.  The index records, for every "Switch", "Channel
+ * Adapter" or "Router" section header, the node GUID, base LID and the
+ * byte range of the path lines that follow it.  Endpoints then parse only
+ * the section that describes their own port.  The index is built by
+ * several threads, each scanning a slice of the file, and is saved next to
+ * the route file so that a restart can skip the scan.
+ */
+#define ACMP_ROUTE_SCAN_THREADS	8
+#define ACMP_ROUTE_SCAN_MIN	(1 << 20)
+#define ACMP_ROUTE_CACHE_MAGIC	0x41434d52	/* "ACMR" */
+#define ACMP_ROUTE_CACHE_VERSION 1
+
+struct acmp_route_section {
 	uint64_t guid;
+	uint64_t begin;
+	uint64_t end;
 	uint16_t lid;
+	uint8_t  reserved[6];
+};
 
-	while (fgets(s, sizeof s, f)) {
-		if (s[0] == '#')
+struct acmp_route_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t src_size;
+	uint64_t src_ino;
+	int64_t  src_mtime_sec;
+	int64_t  src_mtime_nsec;
+	uint32_t nsections;
+	uint32_t reserved;
+	/* __be64 lid2guid[IB_LID_MCAST_START] */
+	/* struct acmp_route_section sections[nsections] */
+};
+
+struct acmp_route_table {
+	const char *map;
+	size_t size;
+	const __be64 *lid2guid;
+	const struct acmp_route_section *sections;
+	uint32_t nsections;
+	void *cache;
+	size_t cache_size;
+};
+
+/* Section header seen while scanning, valid or not */
+struct acmp_route_mark {
+	uint64_t hdr;
+	uint64_t begin;
+	uint64_t guid;
+	uint16_t lid;
+	bool valid;
+};
+
+struct acmp_route_scan {
+	pthread_t thread;
+	const char *map;
+	size_t size;
+	size_t begin;
+	size_t end;
+	struct acmp_route_mark *marks;
+	uint32_t nmarks;
+	uint32_t max_marks;
+	int ret;
+};
+
+static struct acmp_route_table *route_table;
+static bool route_table_loaded;
+static pthread_mutex_t route_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool acmp_is_osm_node_line(const char *p)
+{
+	return !strncmp(p, "Switch", sizeof("Switch") - 1) ||
+	       !strncmp(p, "Channel", sizeof("Channel") - 1) ||
+	       !strncmp(p, "Router", sizeof("Router") - 1);
+}
+
+/* Parse a "opensm full v1" node line for the node GUID and base LID */
+static int acmp_parse_osm_node(char *s, uint64_t *guid, uint16_t *lid)
+{
+	char *p, *ptr, *p_guid, *p_lid;
+
+	if (!(p = strtok_r(s, " \n", &ptr)))
+		return -1;
+
+	if (!strncmp(p, "Channel", sizeof("Channel") - 1)) {
+		p = strtok_r(NULL, " ", &ptr); /* skip 'Adapter' */
+		if (!p)
+			return -1;
+	}
+
+	p_guid = strtok_r(NULL, ",", &ptr);
+	if (!p_guid)
+		return -1;
+
+	*guid = (uint64_t) strtoull(p_guid, NULL, 16);
+
+	ptr = strstr(ptr, "base LID");
+	if (!ptr)
+		return -1;
+	ptr += sizeof("base LID");
+	p_lid = strtok_r(NULL, ",", &ptr);
+	if (!p_lid)
+		return -1;
+
+	*lid = (uint16_t) strtoul(p_lid, NULL, 0);
+	return 0;
+}
+
+/* Copy one line of the mapped file into s, returns the next line offset */
+static size_t acmp_route_line(const char *map, size_t size, size_t off,
+			      char *s, size_t len)
+{
+	const char *nl;
+	size_t n;
+
+	nl = memchr(map + off, '\n', size - off);
+	n = nl ? nl - (map + off) + 1 : size - off;
+	if (s) {
+		memcpy(s, map + off, min(n, len - 1));
+		s[min(n, len - 1)] = '\0';
+	}
+	return off + n;
+}
+
+static void *acmp_route_scan_thread(void *context)
+{
+	struct acmp_route_scan *scan = context;
+	struct acmp_route_mark *mark;
+	const char *map = scan->map;
+	size_t off = scan->begin, next;
+	char s[128];
+	const char *p;
+
+	/* Lines belong to the slice in which they start */
+	if (off && map[off - 1] != '\n')
+		off = acmp_route_line(map, scan->size, off, NULL, 0);
+
+	for (; off < scan->end; off = next) {
+		for (p = map + off; p < map + scan->size && *p == ' '; p++)
+			;
+		if (p == map + scan->size || (*p != 'S' && *p != 'C' && *p != 'R')) {
+			next = acmp_route_line(map, scan->size, off, NULL, 0);
 			continue;
-		if (!(p = strtok_r(s, " \n", &ptr)))
-			continue;	/* ignore blank lines */
+		}
 
-		if (strncmp(p, "Switch", sizeof("Switch") - 1) &&
-		    strncmp(p, "Channel", sizeof("Channel") - 1) &&
-		    strncmp(p, "Router", sizeof("Router") - 1))
+		next = acmp_route_line(map, scan->size, off, s, sizeof s);
+		if (!acmp_is_osm_node_line(p))
 			continue;
 
-		if (!strncmp(p, "Channel", sizeof("Channel") - 1)) {
-			p = strtok_r(NULL, " ", &ptr); /* skip 'Adapter' */
-			if (!p)
+		if (scan->nmarks == scan->max_marks) {
+			uint32_t max = scan->max_marks ? scan->max_marks * 2 : 256;
+
+			mark = realloc(scan->marks, max * sizeof(*mark));
+			if (!mark) {
+				scan->ret = -1;
+				break;
+			}
+			scan->marks = mark;
+			scan->max_marks = max;
+		}
+		mark = &scan->marks[scan->nmarks++];
+		mark->hdr = off;
+		mark->begin = next;
+		mark->valid = !acmp_parse_osm_node(s, &mark->guid, &mark->lid);
+	}
+	return NULL;
+}
+
+static int acmp_route_section_cmp(const void *a, const void *b)
+{
+	const struct acmp_route_section *sa = a, *sb = b;
+
+	if (sa->guid != sb->guid)
+		return sa->guid < sb->guid ? -1 : 1;
+	if (sa->lid != sb->lid)
+		return sa->lid < sb->lid ? -1 : 1;
+	return 0;
+}
+
+static int acmp_route_section_order(const void *a, const void *b)
+{
+	const struct acmp_route_section *sa = a, *sb = b;
+	int ret;
+
+	ret = acmp_route_section_cmp(a, b);
+	if (ret)
+		return ret;
+	return sa->begin < sb->begin ? -1 : sa->begin > sb->begin;
+}
+
+/* Build the LID to GUID table and the sorted section index from the marks */
+static int acmp_route_merge(struct acmp_route_table *tbl,
+			    struct acmp_route_scan *scan, int nscan)
+{
+	struct acmp_route_section *sections;
+	struct acmp_route_mark *mark, *next;
+	__be64 *lid2guid;
+	uint32_t nmarks = 0, n = 0;
+	int i, j;
+
+	for (i = 0; i < nscan; i++)
+		nmarks += scan[i].nmarks;
+
+	lid2guid = calloc(IB_LID_MCAST_START, sizeof(*lid2guid));
+	sections = calloc(max(nmarks, 1U), sizeof(*sections));
+	if (!lid2guid || !sections) {
+		free(lid2guid);
+		free(sections);
+		return -1;
+	}
+
+	for (i = 0; i < nscan; i++) {
+		for (j = 0; j < scan[i].nmarks; j++) {
+			mark = &scan[i].marks[j];
+			if (!mark->valid)
 				continue;
+
+			if (mark->lid < IB_LID_MCAST_START) {
+				if (lid2guid[mark->lid])
+					acm_log(0, "ERROR - duplicate lid %u\n",
+						mark->lid);
+				else
+					lid2guid[mark->lid] = htobe64(mark->guid);
+			}
+
+			/* A section runs up to the next node line, if any */
+			if (j + 1 < scan[i].nmarks) {
+				next = &scan[i].marks[j + 1];
+			} else {
+				int k;
+
+				for (next = NULL, k = i + 1; k < nscan && !next; k++)
+					if (scan[k].nmarks)
+						next = &scan[k].marks[0];
+			}
+
+			sections[n].guid = mark->guid;
+			sections[n].lid = mark->lid;
+			sections[n].begin = mark->begin;
+			sections[n].end = next ? next->hdr : tbl->size;
+			n++;
 		}
+	}
 
-		p_guid = strtok_r(NULL, ",", &ptr);
-		if (!p_guid)
-			continue;
+	qsort(sections, n, sizeof(*sections), acmp_route_section_order);
+	tbl->lid2guid = lid2guid;
+	tbl->sections = sections;
+	tbl->nsections = n;
+	return 0;
+}
 
-		guid = (uint64_t) strtoull(p_guid, NULL, 16);
+static int acmp_route_index(struct acmp_route_table *tbl)
+{
+	struct acmp_route_scan scan[ACMP_ROUTE_SCAN_THREADS] = {};
+	long ncpu;
+	size_t slice;
+	int i, nscan, ret = 0;
 
-		ptr = strstr(ptr, "base LID");
-		if (!ptr)
-			continue;
-		ptr += sizeof("base LID");
-		p_lid = strtok_r(NULL, ",", &ptr);
-		if (!p_lid)
-			continue;
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nscan = min_t(long, max(ncpu, 1L), ACMP_ROUTE_SCAN_THREADS);
+	nscan = min_t(size_t, nscan, tbl->size / ACMP_ROUTE_SCAN_MIN + 1);
+	slice = tbl->size / nscan;
 
-		lid = (uint16_t) strtoul(p_lid, NULL, 0);
-		if (lid >= IB_LID_MCAST_START)
-			continue;
-		if (lid2guid[lid])
-			acm_log(0, "ERROR - duplicate lid %u\n", lid);
-		else
-			lid2guid[lid] = htobe64(guid);
+	for (i = 0; i < nscan; i++) {
+		scan[i].map = tbl->map;
+		scan[i].size = tbl->size;
+		scan[i].begin = slice * i;
+		scan[i].end = (i == nscan - 1) ? tbl->size : slice * (i + 1);
 	}
+
+	/* The calling thread takes the first slice */
+	for (i = 1; i < nscan; i++) {
+		if (pthread_create(&scan[i].thread, NULL,
+				   acmp_route_scan_thread, &scan[i])) {
+			acm_log(1, "scanning route slice %d inline\n", i);
+			acmp_route_scan_thread(&scan[i]);
+			scan[i].thread = 0;
+		}
+	}
+	acmp_route_scan_thread(&scan[0]);
+	for (i = 1; i < nscan; i++)
+		if (scan[i].thread)
+			pthread_join(scan[i].thread, NULL);
+
+	for (i = 0; i < nscan; i++)
+		ret |= scan[i].ret;
+	if (!ret)
+		ret = acmp_route_merge(tbl, scan, nscan);
+
+	for (i = 0; i < nscan; i++)
+		free(scan[i].marks);
+	return ret;
 }
 
-/* Parse 'opensm full v1' file to populate PR cache */
-static int acmp_parse_osm_fullv1_paths(FILE *f, __be64 *lid2guid, struct acmp_ep *ep)
+static void acmp_route_cache_name(char *name, size_t len)
 {
-	union ibv_gid sgid, dgid;
-	struct ibv_port_attr attr = {};
-	struct acmp_dest *dest;
-	char s[128];
-	char *p, *ptr, *p_guid, *p_lid;
-	uint64_t guid;
-	uint16_t lid, dlid;
-	__be16 net_dlid;
-	int sl, mtu, rate;
-	int ret = 1, i;
-	uint8_t addr[ACM_MAX_ADDRESS];
-	uint8_t addr_type;
+	snprintf(name, len, "%s.cache", route_data_file);
+}
 
-	acm_get_gid((struct acm_port *)ep->port->port, 0, &sgid);
+/*
+ * Sections index the route file, each must stay inside it.  They are sorted
+ * by GUID and LID, not by offset, and the lookup relies on that order.
+ */
+static bool acmp_route_sections_valid(const struct acmp_route_section *sections,
+				      uint32_t nsections, uint64_t src_size)
+{
+	uint32_t i;
 
-	/* Search for endpoint's SLID */
-	while (fgets(s, sizeof s, f)) {
-		if (s[0] == '#')
-			continue;
-		if (!(p = strtok_r(s, " \n", &ptr)))
-			continue;	/* ignore blank lines */
+	for (i = 0; i < nsections; i++) {
+		if (sections[i].begin > sections[i].end ||
+		    sections[i].end > src_size)
+			return false;
+		if (i && acmp_route_section_cmp(&sections[i - 1],
+						&sections[i]) > 0)
+			return false;
+	}
+	return true;
+}
 
-		if (strncmp(p, "Switch", sizeof("Switch") - 1) &&
-		    strncmp(p, "Channel", sizeof("Channel") - 1) &&
-		    strncmp(p, "Router", sizeof("Router") - 1))
-			continue;
+/* Only trust a cache that nobody but us could have written */
+static bool acmp_route_cache_private(const struct stat *st)
+{
+	return S_ISREG(st->st_mode) && st->st_uid == geteuid() &&
+	       !(st->st_mode & 022);
+}
+
+static int acmp_route_cache_load(struct acmp_route_table *tbl,
+				 const struct stat *src)
+{
+	const struct acmp_route_cache_hdr *hdr;
+	const struct acmp_route_section *sections;
+	char name[sizeof(route_data_file) + 8];
+	struct stat st;
+	void *cache;
+	int fd, ret = -1;
+
+	acmp_route_cache_name(name, sizeof name);
+	fd = open(name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return -1;
 
-		if (!strncmp(p, "Channel", sizeof("Channel") - 1)) {
-			p = strtok_r(NULL, " ", &ptr); /* skip 'Adapter' */
-			if (!p)
+	if (fstat(fd, &st))
+		goto close;
+	if (!acmp_route_cache_private(&st)) {
+		acm_log(0, "ignoring route cache %s, it is not owned by us "
+			"or is writable by others\n", name);
+		goto close;
+	}
+	if (st.st_size < sizeof(*hdr) + IB_LID_MCAST_START * sizeof(__be64))
+		goto close;
+
+	cache = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (cache == MAP_FAILED)
+		goto close;
+
+	hdr = cache;
+	if (hdr->magic != ACMP_ROUTE_CACHE_MAGIC ||
+	    hdr->version != ACMP_ROUTE_CACHE_VERSION ||
+	    hdr->src_size != src->st_size || hdr->src_ino != src->st_ino ||
+	    hdr->src_mtime_sec != src->st_mtim.tv_sec ||
+	    hdr->src_mtime_nsec != src->st_mtim.tv_nsec ||
+	    hdr->nsections > (st.st_size - sizeof(*hdr) -
+			      IB_LID_MCAST_START * sizeof(__be64)) /
+			     sizeof(*tbl->sections) ||
+	    st.st_size != sizeof(*hdr) + IB_LID_MCAST_START * sizeof(__be64) +
+			  (size_t)hdr->nsections * sizeof(*tbl->sections)) {
+		acm_log(1, "route cache %s is stale\n", name);
+		goto unmap;
+	}
+
+	sections = (const struct acmp_route_section *)
+		   ((const __be64 *) (hdr + 1) + IB_LID_MCAST_START);
+	if (!acmp_route_sections_valid(sections, hdr->nsections,
+				       src->st_size)) {
+		acm_log(0, "route cache %s is corrupt\n", name);
+		goto unmap;
+	}
+
+	tbl->cache = cache;
+	tbl->cache_size = st.st_size;
+	tbl->lid2guid = (const __be64 *) (hdr + 1);
+	tbl->sections = sections;
+	tbl->nsections = hdr->nsections;
+	ret = 0;
+	goto close;
+unmap:
+	munmap(cache, st.st_size);
+close:
+	close(fd);
+	return ret;
+}
+
+static int acmp_route_write(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
 				continue;
+			return -1;
 		}
+		buf = (const char *) buf + n;
+		len -= n;
+	}
+	return 0;
+}
 
-		p_guid = strtok_r(NULL, ",", &ptr);
-		if (!p_guid)
-			continue;
+static void acmp_route_cache_save(const struct acmp_route_table *tbl,
+				  const struct stat *src)
+{
+	struct acmp_route_cache_hdr hdr = {};
+	char name[sizeof(route_data_file) + 8];
+	char tmp[sizeof(name) + 8];
+	int fd;
 
-		guid = (uint64_t) strtoull(p_guid, NULL, 16);
-		if (guid != be64toh(sgid.global.interface_id))
-			continue;
+	acmp_route_cache_name(name, sizeof name);
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", name);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		acm_log(1, "unable to create route cache %s\n", name);
+		return;
+	}
 
-		ptr = strstr(ptr, "base LID");
-		if (!ptr)
-			continue;
-		ptr += sizeof("base LID");
-		p_lid = strtok_r(NULL, ",", &ptr);
-		if (!p_lid)
-			continue;
+	hdr.magic = ACMP_ROUTE_CACHE_MAGIC;
+	hdr.version = ACMP_ROUTE_CACHE_VERSION;
+	hdr.src_size = src->st_size;
+	hdr.src_ino = src->st_ino;
+	hdr.src_mtime_sec = src->st_mtim.tv_sec;
+	hdr.src_mtime_nsec = src->st_mtim.tv_nsec;
+	hdr.nsections = tbl->nsections;
+
+	if (acmp_route_write(fd, &hdr, sizeof hdr) ||
+	    acmp_route_write(fd, tbl->lid2guid,
+			     IB_LID_MCAST_START * sizeof(*tbl->lid2guid)) ||
+	    acmp_route_write(fd, tbl->sections,
+			     tbl->nsections * sizeof(*tbl->sections)) ||
+	    fchmod(fd, 0644) || rename(tmp, name)) {
+		acm_log(0, "ERROR - unable to write route cache %s\n", name);
+		unlink(tmp);
+	} else {
+		acm_log(1, "saved route cache %s\n", name);
+	}
+	close(fd);
+}
 
-		lid = (uint16_t) strtoul(p_lid, NULL, 0);
-		if (lid != ep->port->lid)
-			continue;
+static struct acmp_route_table *acmp_route_table_load(void)
+{
+	struct acmp_route_table *tbl;
+	struct stat st;
+	int fd;
 
-		ibv_query_port(ep->port->dev->verbs, ep->port->port_num, &attr);
-		ret = 0;
-		break;
+	fd = open(route_data_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		acm_log(0, "ERROR - couldn't open %s\n", route_data_file);
+		return NULL;
 	}
 
-	while (fgets(s, sizeof s, f)) {
+	tbl = calloc(1, sizeof(*tbl));
+	if (!tbl) {
+		acm_log(0, "ERROR - no memory for path record parsing\n");
+		goto close;
+	}
+
+	if (fstat(fd, &st))
+		goto err;
+
+	tbl->size = st.st_size;
+	if (tbl->size) {
+		tbl->map = mmap(NULL, tbl->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (tbl->map == MAP_FAILED) {
+			acm_log(0, "ERROR - couldn't map %s\n", route_data_file);
+			goto err;
+		}
+	}
+
+	if (!acmp_route_cache_load(tbl, &st)) {
+		acm_log(1, "loaded %u route sections from cache\n",
+			tbl->nsections);
+		goto close;
+	}
+
+	if (tbl->size)
+		madvise((void *) tbl->map, tbl->size, MADV_SEQUENTIAL);
+	if (acmp_route_index(tbl)) {
+		acm_log(0, "ERROR - no memory for path record parsing\n");
+		if (tbl->size)
+			munmap((void *) tbl->map, tbl->size);
+		goto err;
+	}
+	if (tbl->size)
+		madvise((void *) tbl->map, tbl->size, MADV_RANDOM);
+
+	acm_log(1, "indexed %u route sections\n", tbl->nsections);
+	acmp_route_cache_save(tbl, &st);
+close:
+	close(fd);
+	return tbl;
+err:
+	free(tbl);
+	tbl = NULL;
+	goto close;
+}
+
+/* The table is loaded by the first endpoint and shared, read-only, by all */
+static const struct acmp_route_table *acmp_get_route_table(void)
+{
+	pthread_mutex_lock(&route_table_lock);
+	if (!route_table_loaded) {
+		route_table = acmp_route_table_load();
+		route_table_loaded = true;
+	}
+	pthread_mutex_unlock(&route_table_lock);
+	return route_table;
+}
+
+static const struct acmp_route_section *
+acmp_find_route_section(const struct acmp_route_table *tbl, uint64_t guid,
+			uint16_t lid)
+{
+	const struct acmp_route_section key = { .guid = guid, .lid = lid };
+	const struct acmp_route_section *sec;
+
+	sec = bsearch(&key, tbl->sections, tbl->nsections, sizeof(*sec),
+		      acmp_route_section_cmp);
+	if (!sec)
+		return NULL;
+
+	/* Use the first matching section in the file, as before */
+	while (sec > tbl->sections && !acmp_route_section_cmp(sec - 1, &key))
+		sec--;
+	return sec;
+}
+
+/* Parse the endpoint's section of the 'opensm full v1' file into the PR cache */
+static void acmp_parse_osm_fullv1_paths(const struct acmp_route_table *tbl,
+					const struct acmp_route_section *sec,
+					union ibv_gid *sgid, struct acmp_ep *ep)
+{
+	union ibv_gid dgid;
+	struct ibv_port_attr attr = {};
+	struct acmp_dest *dest;
+	char s[128];
+	char *p, *ptr;
+	uint16_t dlid;
+	__be16 net_dlid;
+	int sl, mtu, rate;
+	int i;
+	size_t off, next;
+	uint8_t addr[ACM_MAX_ADDRESS];
+	uint8_t addr_type;
+
+	ibv_query_port(ep->port->dev->verbs, ep->port->port_num, &attr);
+
+	for (off = sec->begin; off < sec->end; off = next) {
+		next = acmp_route_line(tbl->map, tbl->size, off, s, sizeof s);
 		if (s[0] == '#')
 			continue;
 		if (!(p = strtok_r(s, " \n", &ptr)))
 			continue;	/* ignore blank lines */
 
-		if (!strncmp(p, "Switch", sizeof("Switch") - 1) ||
-		    !strncmp(p, "Channel", sizeof("Channel") - 1) ||
-		    !strncmp(p, "Router", sizeof("Router") - 1))
-			break;
-
 		dlid = strtoul(p, NULL, 0);
 		net_dlid = htobe16(dlid);
 
@@ -2210,13 +2909,13 @@ static int acmp_parse_osm_fullv1_paths(FILE *f, __be64 *lid2guid, struct acmp_ep
 			continue;
 		rate = atoi(p);
 
-		if (!lid2guid[dlid]) {
+		if (dlid >= IB_LID_MCAST_START || !tbl->lid2guid[dlid]) {
 			acm_log(0, "ERROR - dlid %u not found in lid2guid table\n", dlid);
 			continue;
 		}
 
-		dgid.global.subnet_prefix = sgid.global.subnet_prefix;
-		dgid.global.interface_id = lid2guid[dlid];
+		dgid.global.subnet_prefix = sgid->global.subnet_prefix;
+		dgid.global.interface_id = tbl->lid2guid[dlid];
 
 		for (i = 0; i < 2; i++) {
 			memset(addr, 0, ACM_MAX_ADDRESS);
@@ -2233,7 +2932,7 @@ static int acmp_parse_osm_fullv1_paths(FILE *f, __be64 *lid2guid, struct acmp_ep
 				break;
 			}
 
-			dest->path.sgid = sgid;
+			dest->path.sgid = *sgid;
 			dest->path.slid = htobe16(ep->port->lid);
 			dest->path.dgid = dgid;
 			dest->path.dlid = net_dlid;
@@ -2244,12 +2943,10 @@ static int acmp_parse_osm_fullv1_paths(FILE *f, __be64 *lid2guid, struct acmp_ep
 			dest->path.qosclass_sl = htobe16((uint16_t) sl & 0xF);
 			if (dlid == ep->port->lid) {
 				dest->path.packetlifetime = 0;
-				dest->addr_timeout = (uint64_t)~0ULL;
-				dest->route_timeout = (uint64_t)~0ULL;
+				acmp_set_dest_timeout(dest, true);
 			} else {
 				dest->path.packetlifetime = attr.subnet_timeout;
-				dest->addr_timeout = time_stamp_min() + (unsigned) addr_timeout;
-				dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+				acmp_set_dest_timeout(dest, false);
 			}
 			dest->remote_qpn = 1;
 			dest->state = ACMP_READY;
@@ -2257,33 +2954,28 @@ static int acmp_parse_osm_fullv1_paths(FILE *f, __be64 *lid2guid, struct acmp_ep
 			acm_log(1, "added cached dest %s\n", dest->name);
 		}
 	}
-	return ret;
 }
 
 static int acmp_parse_osm_fullv1(struct acmp_ep *ep)
 {
-	FILE *f;
-	__be64 *lid2guid;
-	int ret = 1;
+	const struct acmp_route_table *tbl;
+	const struct acmp_route_section *sec;
+	union ibv_gid sgid;
 
-	if (!(f = fopen(route_data_file, "r"))) {
-		acm_log(0, "ERROR - couldn't open %s\n", route_data_file);
-		return ret;
-	}
+	tbl = acmp_get_route_table();
+	if (!tbl)
+		return 1;
 
-	lid2guid = calloc(IB_LID_MCAST_START, sizeof(*lid2guid));
-	if (!lid2guid) {
-		acm_log(0, "ERROR - no memory for path record parsing\n");
-		goto err;
-	}
+	acm_get_gid((struct acm_port *)ep->port->port, 0, &sgid);
 
-	acmp_parse_osm_fullv1_lid2guid(f, lid2guid);
-	rewind(f);
-	ret = acmp_parse_osm_fullv1_paths(f, lid2guid, ep);
-	free(lid2guid);
-err:
-	fclose(f);
-	return ret;
+	/* Search for endpoint's SLID */
+	sec = acmp_find_route_section(tbl, be64toh(sgid.global.interface_id),
+				      ep->port->lid);
+	if (!sec)
+		return 1;
+
+	acmp_parse_osm_fullv1_paths(tbl, sec, &sgid, ep);
+	return 0;
 }
 
 static void acmp_parse_hosts_file(struct acmp_ep *ep)
@@ -2349,8 +3041,7 @@ static void acmp_parse_hosts_file(struct acmp_ep *ep)
 		}
 
 		dest->remote_qpn = 1;
-		dest->addr_timeout = time_stamp_min() + (unsigned) addr_timeout;
-		dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+		acmp_set_dest_timeout(dest, false);
 		acmp_put_dest(dest);
 		acm_log(1, "added host %s address type %d IB GID %s\n",
 			addr, addr_type, gid);
@@ -2445,8 +3136,7 @@ static int __acmp_add_addr(const struct acm_address *addr, struct acmp_ep *ep,
 	dest->path.rate = (uint8_t) ep->port->rate;
 
 	dest->remote_qpn = ep->qp->qp_num;
-	dest->addr_timeout = (uint64_t) ~0ULL;
-	dest->route_timeout = (uint64_t) ~0ULL;
+	acmp_set_dest_timeout(dest, true);
 	dest->state = ACMP_READY;
 	acmp_put_dest(dest);
 	*addr_context = addr_ctx;
@@ -2499,9 +3189,8 @@ static void acmp_remove_addr(void *addr_context)
 				dest = acmp_get_dest(ep, address->type, address->addr.info.addr);
 				if (dest) {
 					acm_log(2, "Found a dest addr, deleting it\n");
-					pthread_mutex_lock(&ep->lock);
 					acmp_remove_dest(ep, dest);
-					pthread_mutex_unlock(&ep->lock);
+					acmp_put_dest(dest);
 				}
 				pthread_mutex_lock(&port->lock);
 			}
@@ -2596,10 +3285,12 @@ acmp_alloc_ep(struct acmp_port *port, struct acm_endpoint *endpoint)
 	list_head_init(&ep->active_queue);
 	list_head_init(&ep->wait_queue);
 	pthread_mutex_init(&ep->lock, NULL);
+	acmp_init_dest_cache(ep);
 	sprintf(ep->id_string, "%s-%d-0x%x", port->dev->verbs->device->name,
 		port->port_num, endpoint->pkey);
 
 	if (pthread_rwlock_init(&ep->rwlock, NULL)) {
+		acmp_free_dest_cache(ep);
 		free(ep);
 		return NULL;
 	}
@@ -2713,6 +3404,7 @@ err2:
 err1:
 	ibv_destroy_cq(ep->cq);
 err0:
+	acmp_free_dest_cache(ep);
 	free(ep);
 	return -1;
 }
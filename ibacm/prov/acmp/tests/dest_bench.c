@@ -0,0 +1,292 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Exercise the acmp destination cache outside of ibacm.
+ *
+ * The provider is built in, with the services it imports from ibacm stubbed
+ * out.  A cache of resolved records is filled, checked, expired, including
+ * around a record whose lock is held, and then lookup throughput is measured
+ * with a growing number of threads.
+ */
+#include "../src/acmp.c"
+
+void acm_write(int level, const char *format, ...)
+{
+}
+
+void acm_format_name(int level, char *name, size_t name_size,
+		     uint8_t addr_type, const uint8_t *addr, size_t addr_size)
+{
+	if (name_size)
+		name[0] = '\0';
+}
+
+int ib_any_gid(union ibv_gid *gid)
+{
+	return 0;
+}
+
+uint8_t acm_gid_index(struct acm_port *port, union ibv_gid *gid)
+{
+	return 0;
+}
+
+int acm_get_gid(struct acm_port *port, int index, union ibv_gid *gid)
+{
+	memset(gid, 0, sizeof(*gid));
+	return -1;
+}
+
+__be64 acm_path_comp_mask(struct ibv_path_record *path)
+{
+	return 0;
+}
+
+int acm_resolve_response(uint64_t id, struct acm_msg *msg)
+{
+	return -1;
+}
+
+int acm_query_response(uint64_t id, struct acm_msg *msg)
+{
+	return -1;
+}
+
+enum ibv_rate acm_get_rate(uint8_t width, uint8_t speed)
+{
+	return IBV_RATE_MAX;
+}
+
+enum ibv_mtu acm_convert_mtu(int mtu)
+{
+	return IBV_MTU_2048;
+}
+
+enum ibv_rate acm_convert_rate(int rate)
+{
+	return IBV_RATE_MAX;
+}
+
+struct acm_sa_mad *acm_alloc_sa_mad(const struct acm_endpoint *endpoint,
+				    void *context,
+				    void (*handler)(struct acm_sa_mad *))
+{
+	return NULL;
+}
+
+void acm_free_sa_mad(struct acm_sa_mad *mad)
+{
+}
+
+int acm_send_sa_mad(struct acm_sa_mad *mad)
+{
+	return -1;
+}
+
+const char *acm_get_opts_file(void)
+{
+	return "/dev/null";
+}
+
+void acm_increment_counter(int type)
+{
+}
+
+int acm_if_get_sgid(char *ifname, union ibv_gid *sgid)
+{
+	memset(sgid, 0, sizeof(*sgid));
+	return -1;
+}
+
+struct bench_thread {
+	pthread_t thread;
+	struct acmp_ep *ep;
+	unsigned int seed;
+	unsigned int iters;
+	unsigned int misses;
+};
+
+static unsigned int nr_dests = 100000;
+
+static void bench_addr(uint8_t *addr, unsigned int i)
+{
+	memset(addr, 0, ACM_MAX_ADDRESS);
+	memcpy(addr, &i, sizeof(i));
+}
+
+static unsigned int cached_dests(struct acmp_ep *ep)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < ACMP_DEST_SHARDS; i++) {
+		pthread_mutex_lock(&ep->dest_cache[i].lock);
+		count += ep->dest_cache[i].count;
+		pthread_mutex_unlock(&ep->dest_cache[i].lock);
+	}
+	return count;
+}
+
+static struct acmp_dest *add_dest(struct acmp_ep *ep, unsigned int i)
+{
+	uint8_t addr[ACM_MAX_ADDRESS];
+	struct acmp_dest *dest;
+
+	bench_addr(addr, i);
+	dest = acmp_acquire_dest(ep, ACM_ADDRESS_IP, addr);
+	if (!dest)
+		return NULL;
+	pthread_mutex_lock(&dest->lock);
+	dest->state = ACMP_READY;
+	pthread_mutex_unlock(&dest->lock);
+	acmp_set_dest_timeout(dest, false);
+	acmp_put_dest(dest);
+	return dest;
+}
+
+static bool is_cached(struct acmp_ep *ep, unsigned int i)
+{
+	uint8_t addr[ACM_MAX_ADDRESS];
+	struct acmp_dest *dest;
+
+	bench_addr(addr, i);
+	dest = acmp_get_dest(ep, ACM_ADDRESS_IP, addr);
+	if (dest)
+		acmp_put_dest(dest);
+	return dest;
+}
+
+static int check_cache(struct acmp_ep *ep)
+{
+	struct acmp_dest *busy;
+	unsigned int i, next;
+
+	for (i = 0; i < nr_dests; i++)
+		if (!add_dest(ep, i))
+			return 1;
+	if (cached_dests(ep) != nr_dests)
+		return 2;
+	for (i = 0; i < nr_dests; i++)
+		if (!is_cached(ep, i))
+			return 3;
+	if (is_cached(ep, nr_dests))
+		return 4;
+
+	/* Give every record a lifetime that ends now, holding one busy */
+	addr_timeout = 0;
+	for (i = 0; i < nr_dests; i++)
+		if (!add_dest(ep, i))
+			return 5;
+	busy = add_dest(ep, 0);
+	pthread_mutex_lock(&busy->lock);
+
+	/* New records reap the expired ones, except the busy one's shard */
+	for (next = nr_dests; cached_dests(ep) > nr_dests / 2; next++)
+		if (next > nr_dests * 4 || !add_dest(ep, next))
+			return 6;
+	if (!is_cached(ep, 0))
+		return 7;
+
+	pthread_mutex_unlock(&busy->lock);
+	addr_timeout = -1;
+	for (i = 0; i < nr_dests; i++)
+		if (!is_cached(ep, next + i) && !add_dest(ep, next + i))
+			return 8;
+
+	addr_timeout = 0;
+	for (i = 0; i < nr_dests * 2; i++)
+		add_dest(ep, next + nr_dests + i);
+	if (is_cached(ep, 0))
+		return 9;
+	addr_timeout = 1440;
+	return 0;
+}
+
+static void *lookup_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	uint8_t addr[ACM_MAX_ADDRESS];
+	struct acmp_dest *dest;
+	unsigned int i;
+
+	for (i = 0; i < t->iters; i++) {
+		bench_addr(addr, rand_r(&t->seed) % nr_dests);
+		dest = acmp_get_dest(t->ep, ACM_ADDRESS_IP, addr);
+		if (dest)
+			acmp_put_dest(dest);
+		else
+			t->misses++;
+	}
+	return NULL;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_lookups(struct acmp_ep *ep, unsigned int nr_threads,
+			 unsigned int iters)
+{
+	struct bench_thread *threads;
+	unsigned int i, misses = 0;
+	double start, elapsed;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+
+	start = now_sec();
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].ep = ep;
+		threads[i].seed = i + 1;
+		threads[i].iters = iters;
+		if (pthread_create(&threads[i].thread, NULL, lookup_thread,
+				   &threads[i]))
+			return 1;
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		misses += threads[i].misses;
+	}
+	elapsed = now_sec() - start;
+
+	printf("%2u threads %8.2f Mlookups/s\n", nr_threads,
+	       nr_threads * (double)iters / elapsed / 1e6);
+	free(threads);
+	return misses != 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iters = argc > 1 ? atoi(argv[1]) : 1000000;
+	unsigned int i, nr_threads;
+	struct acmp_ep *ep;
+	int ret;
+
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		return 1;
+	acmp_init_dest_cache(ep);
+
+	ret = check_cache(ep);
+	if (ret) {
+		fprintf(stderr, "dest cache check %d failed\n", ret);
+		return 1;
+	}
+
+	acmp_free_dest_cache(ep);
+	acmp_init_dest_cache(ep);
+	for (i = 0; i < nr_dests; i++)
+		if (!add_dest(ep, i))
+			return 1;
+
+	for (nr_threads = 1; nr_threads <= 8; nr_threads *= 2)
+		if (bench_lookups(ep, nr_threads, iters))
+			return 1;
+
+	acmp_free_dest_cache(ep);
+	free(ep);
+	return 0;
+}
@@ -40,9 +40,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <grp.h>
 #include <infiniband/acm.h>
+#include <infiniband/acm_shm.h>
 #include <infiniband/acm_prov.h>
 #include <infiniband/umad.h>
 #include <infiniband/verbs.h>
@@ -60,6 +63,8 @@
 #include <rdma/rdma_netlink.h>
 #include <rdma/ib_user_sa.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <inttypes.h>
 #include <getopt.h>
 #include <systemd/sd-daemon.h>
@@ -71,6 +76,8 @@
 #define NL_MSG_BUF_SIZE 4096
 #define ACM_PROV_NAME_SIZE 64
 #define NL_CLIENT_INDEX 0
+#define ACM_SEND_TIMEOUT_MS 1000
+#define ACM_MAX_CLIENT_BATCH 16
 
 struct acmc_subnet {
 	struct list_node       entry;
@@ -147,6 +154,28 @@ struct acmc_client {
 	int      sock;
 	int      index;
 	atomic_t refcnt;
+	/* Partially received request.  Only touched by the server thread
+	 * holding the client's (one shot) epoll event.
+	 */
+	unsigned int   rlen;
+	struct acm_msg rmsg;
+	/* Resolve requests awaiting a response, and the key to publish the
+	 * response under in the shared memory cache.  Protected by lock.
+	 */
+	int            shm_pending;
+	uint32_t       shm_generation;
+	uint16_t       shm_key_len;
+	uint8_t        shm_key[ACM_SHM_KEY_LENGTH];
+};
+
+/* Sources registered with the server epoll set, in the upper 32 bits of
+ * the event data; the lower bits hold the client or device index.
+ */
+enum acm_svr_source {
+	ACM_SVR_LISTEN,
+	ACM_SVR_IP_MON,
+	ACM_SVR_CLIENT,
+	ACM_SVR_DEVICE,
 };
 
 union socket_addr {
@@ -184,8 +213,16 @@ static struct acmc_prov *def_provider = NULL;
 static LIST_HEAD(dev_list);
 
 static int listen_socket;
-static int ip_mon_socket;
-static struct acmc_client client_array[FD_SETSIZE - 1];
+static int ip_mon_socket = -1;
+static struct acmc_client *client_array;
+static int epoll_fd = -1;
+/* Requests are served concurrently under the read lock.  Address changes
+ * and device events update endpoint state and take it for write.
+ */
+static pthread_rwlock_t server_lock;
+static struct acm_shm_hdr *shm_cache;
+static size_t shm_cache_len;
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static FILE *flog;
 static pthread_mutex_t log_lock;
@@ -224,6 +261,11 @@ static int server_mode = IBACM_SERVER_MODE_DEFAULT;
 static int acme_plus_kernel_only = IBACM_ACME_PLUS_KERNEL_ONLY_DEFAULT;
 static int support_ips_in_addr_cfg = 0;
 static char prov_lib_path[256] = IBACM_LIB_PATH;
+static int max_clients = 4096;
+static int server_threads = 4;
+static int shm_cache_size = 4096;
+static int shm_cache_timeout = 300;
+static char shm_cache_group[256];
 
 void acm_write(int level, const char *format, ...)
 {
@@ -496,6 +538,226 @@ __be64 acm_path_comp_mask(struct ibv_path_record *path)
 	return comp_mask;
 }
 
+/* Client sockets are non-blocking, wait for room instead of dropping a
+ * response when the socket buffer is full.
+ */
+static int acm_send_msg(int sock, const void *buf, int len)
+{
+	struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+	int done = 0;
+	int ret;
+
+	while (done < len) {
+		ret = send(sock, (const char *) buf + done, len - done, 0);
+		if (ret > 0) {
+			done += ret;
+			continue;
+		}
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+		    poll(&pfd, 1, ACM_SEND_TIMEOUT_MS) > 0)
+			continue;
+		break;
+	}
+	return done;
+}
+
+/*
+ * Shared memory resolve cache, see acm_shm.h.  Entries are only ever written by
+ * the service, under shm_lock; clients map the file read-only.
+ */
+static void acm_shm_retire(const char *path)
+{
+	struct acm_shm_hdr *old;
+	int fd;
+
+	/* Clients may still have a previous instance's cache mapped */
+	fd = open(path, O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return;
+
+	old = mmap(NULL, sizeof(*old), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (old != MAP_FAILED) {
+		__atomic_store_n(&old->closed, 1, __ATOMIC_RELEASE);
+		munmap(old, sizeof(*old));
+	}
+	close(fd);
+	unlink(path);
+}
+
+/* Only root, or the members of shm_cache_group, may read the cache */
+static int acm_shm_set_access(int fd)
+{
+	struct group *grp;
+
+	if (!shm_cache_group[0])
+		return fchmod(fd, 0600);
+
+	grp = getgrnam(shm_cache_group);
+	if (!grp) {
+		acm_log(0, "ERROR - unknown shm_cache_group %s\n",
+			shm_cache_group);
+		return -1;
+	}
+	if (fchown(fd, -1, grp->gr_gid))
+		return -1;
+	return fchmod(fd, 0640);
+}
+
+static void acm_shm_init(void)
+{
+	struct acm_shm_hdr *shm;
+	uint32_t nentries;
+	size_t len;
+	int fd;
+
+	acm_shm_retire(IBACM_SHM_PATH);
+	if (shm_cache_size <= 0)
+		return;
+
+	for (nentries = ACM_SHM_WAYS; nentries < shm_cache_size; nentries <<= 1)
+		;
+	len = sizeof(*shm) + nentries * sizeof(shm->entries[0]);
+
+	fd = open(IBACM_SHM_PATH, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		acm_log(0, "ERROR - unable to create %s\n", IBACM_SHM_PATH);
+		return;
+	}
+
+	if (acm_shm_set_access(fd)) {
+		acm_log(0, "ERROR - unable to set access to %s\n",
+			IBACM_SHM_PATH);
+		goto err;
+	}
+
+	if (ftruncate(fd, len)) {
+		acm_log(0, "ERROR - unable to size %s\n", IBACM_SHM_PATH);
+		goto err;
+	}
+
+	shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED) {
+		acm_log(0, "ERROR - unable to map %s\n", IBACM_SHM_PATH);
+		goto err;
+	}
+	close(fd);
+
+	shm->version = ACM_SHM_VERSION;
+	shm->entry_size = sizeof(shm->entries[0]);
+	shm->nentries = nentries;
+	shm->generation = 1;
+	__atomic_store_n(&shm->magic, ACM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	shm_cache = shm;
+	shm_cache_len = len;
+	acm_log(1, "shared memory cache of %u entries\n", nentries);
+	return;
+err:
+	close(fd);
+	unlink(IBACM_SHM_PATH);
+}
+
+static void acm_shm_fini(void)
+{
+	if (!shm_cache)
+		return;
+
+	__atomic_store_n(&shm_cache->closed, 1, __ATOMIC_RELEASE);
+	munmap(shm_cache, shm_cache_len);
+	shm_cache = NULL;
+	unlink(IBACM_SHM_PATH);
+}
+
+/* Addresses or ports have changed, drop everything published so far */
+static void acm_shm_invalidate(void)
+{
+	if (shm_cache)
+		__atomic_add_fetch(&shm_cache->generation, 1, __ATOMIC_RELEASE);
+}
+
+/* The response is dropped if the cache was invalidated since the request */
+static void acm_shm_publish(const uint8_t *key, uint16_t key_len,
+			    uint32_t generation, const struct acm_msg *msg)
+{
+	struct acm_shm_entry *entry, *victim = NULL;
+	struct timespec now;
+	uint32_t hash, way, seq;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	hash = acm_shm_hash(key, key_len);
+
+	pthread_mutex_lock(&shm_lock);
+	if (generation != __atomic_load_n(&shm_cache->generation,
+					  __ATOMIC_RELAXED))
+		goto unlock;
+
+	for (way = 0; way < ACM_SHM_WAYS; way++) {
+		entry = &shm_cache->entries[(hash + way) &
+					    (shm_cache->nentries - 1)];
+		if (entry->generation != generation ||
+		    entry->expires <= now.tv_sec ||
+		    (entry->hash == hash && entry->key_len == key_len &&
+		     !memcmp(entry->key, key, key_len))) {
+			victim = entry;
+			break;
+		}
+		if (!victim || entry->expires < victim->expires)
+			victim = entry;
+	}
+
+	seq = victim->seq;
+	__atomic_store_n(&victim->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	victim->generation = generation;
+	victim->expires = now.tv_sec + shm_cache_timeout;
+	victim->hash = hash;
+	victim->key_len = key_len;
+	victim->resp_len = msg->hdr.length;
+	memcpy(victim->key, key, key_len);
+	memcpy(victim->resp, msg, msg->hdr.length);
+	((struct acm_hdr *) victim->resp)->tid = 0;
+
+	__atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+unlock:
+	pthread_mutex_unlock(&shm_lock);
+}
+
+/*
+ * Remember the request a client is waiting on, so that its response can be
+ * published.  Only a client with a single resolve outstanding can be
+ * matched to its response; the library clients never pipeline requests.
+ */
+static void acm_shm_track(struct acmc_client *client, struct acm_msg *msg)
+{
+	int i, key_len;
+
+	key_len = msg->hdr.length - ACM_MSG_HDR_LENGTH;
+
+	pthread_mutex_lock(&client->lock);
+	client->shm_key_len = 0;
+	if (client->shm_pending++ || !shm_cache ||
+	    client->index == NL_CLIENT_INDEX ||
+	    key_len <= 0 || key_len > ACM_SHM_KEY_LENGTH ||
+	    key_len % ACM_MSG_EP_LENGTH)
+		goto unlock;
+
+	for (i = 0; i < key_len / ACM_MSG_EP_LENGTH; i++) {
+		if (msg->resolve_data[i].type == ACM_EP_INFO_PATH ||
+		    msg->resolve_data[i].flags & ACM_FLAGS_QUERY_SA)
+			goto unlock;
+	}
+
+	memcpy(client->shm_key, msg->resolve_data, key_len);
+	client->shm_key_len = key_len;
+	client->shm_generation = __atomic_load_n(&shm_cache->generation,
+						 __ATOMIC_ACQUIRE);
+unlock:
+	pthread_mutex_unlock(&client->lock);
+}
+
 int acm_resolve_response(uint64_t id, struct acm_msg *msg)
 {
 	struct acmc_client *client = &client_array[id];
@@ -518,7 +780,7 @@ int acm_resolve_response(uint64_t id, struct acm_msg *msg)
 	if (id == NL_CLIENT_INDEX)
 		ret = acm_nl_send(client->sock, msg);
 	else
-		ret = send(client->sock, (char *) msg, msg->hdr.length, 0);
+		ret = acm_send_msg(client->sock, msg, msg->hdr.length);
 
 	if (ret != msg->hdr.length)
 		acm_log(0, "ERROR - failed to send response\n");
@@ -526,6 +788,14 @@ int acm_resolve_response(uint64_t id, struct acm_msg *msg)
 		ret = 0;
 
 release:
+	if (client->shm_pending) {
+		if (client->shm_pending == 1 && client->shm_key_len && !ret &&
+		    !msg->hdr.status && msg->hdr.length <= ACM_SHM_RESP_LENGTH)
+			acm_shm_publish(client->shm_key, client->shm_key_len,
+					client->shm_generation, msg);
+		client->shm_pending--;
+		client->shm_key_len = 0;
+	}
 	pthread_mutex_unlock(&client->lock);
 	(void) atomic_dec(&client->refcnt);
 	return ret;
@@ -556,7 +826,7 @@ int acm_query_response(uint64_t id, struct acm_msg *msg)
 		goto release;
 	}
 
-	ret = send(client->sock, (char *) msg, msg->hdr.length, 0);
+	ret = acm_send_msg(client->sock, msg, msg->hdr.length);
 	if (ret != msg->hdr.length)
 		acm_log(0, "ERROR - failed to send response\n");
 	else
@@ -576,18 +846,42 @@ static int acmc_query_response(uint64_t id, struct acm_msg *msg, uint8_t status)
 	return acm_query_response(id, msg);
 }
 
-static void acm_init_server(void)
+static int acm_init_server(void)
 {
+	pthread_rwlockattr_t attr;
+	struct rlimit rlim;
 	FILE *f;
 	int i;
 
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
+	client_array = calloc(max_clients, sizeof(*client_array));
+	if (!client_array) {
+		acm_log(0, "ERROR - unable to allocate %d clients\n",
+			max_clients);
+		return ENOMEM;
+	}
+
+	for (i = 0; i < max_clients; i++) {
 		pthread_mutex_init(&client_array[i].lock, NULL);
 		client_array[i].index = i;
 		client_array[i].sock = -1;
 		atomic_init(&client_array[i].refcnt);
 	}
 
+	/* Every client holds a descriptor, make room for them */
+	if (!getrlimit(RLIMIT_NOFILE, &rlim) &&
+	    rlim.rlim_cur < (rlim_t) max_clients + 64) {
+		rlim.rlim_cur = min_t(rlim_t, rlim.rlim_max, max_clients + 64);
+		if (setrlimit(RLIMIT_NOFILE, &rlim))
+			acm_log(0, "notice - unable to raise open file limit\n");
+	}
+
+	/* Do not let a steady flow of requests starve device events */
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+			PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&server_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
 	if (server_mode != IBACM_SERVER_MODE_UNIX) {
 		f = fopen(IBACM_IBACME_PORT_FILE, "w");
 		if (f) {
@@ -607,6 +901,7 @@ static void acm_init_server(void)
 		unlink(IBACM_IBACME_PORT_FILE);
 		unlink(IBACM_PORT_FILE);
 	}
+	return 0;
 }
 
 static int acm_listen(void)
@@ -747,9 +1042,20 @@ static int acm_listen_systemd(void)
 	return 0;
 }
 
+static int acm_svr_watch(int op, int fd, enum acm_svr_source source,
+			 uint32_t index)
+{
+	struct epoll_event event;
+
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.u64 = ((uint64_t) source << 32) | index;
+	return epoll_ctl(epoll_fd, op, fd, &event);
+}
+
 static void acm_disconnect_client(struct acmc_client *client)
 {
 	pthread_mutex_lock(&client->lock);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->sock, NULL);
 	shutdown(client->sock, SHUT_RDWR);
 	close(client->sock);
 	client->sock = -1;
@@ -763,28 +1069,33 @@ static void acm_svr_accept(void)
 	int i;
 
 	acm_log(2, "\n");
-	s = accept(listen_socket, NULL, NULL);
-	if (s == -1) {
-		acm_log(0, "ERROR - failed to accept connection\n");
-		return;
-	}
+	while ((s = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+		for (i = 0; i < max_clients; i++) {
+			if (i == NL_CLIENT_INDEX)
+				continue;
+			if (!atomic_get(&client_array[i].refcnt))
+				break;
+		}
 
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
-		if (i == NL_CLIENT_INDEX)
+		if (i == max_clients) {
+			acm_log(0, "ERROR - all connections busy - rejecting\n");
+			close(s);
 			continue;
-		if (!atomic_get(&client_array[i].refcnt))
-			break;
-	}
+		}
 
-	if (i == FD_SETSIZE - 1) {
-		acm_log(0, "ERROR - all connections busy - rejecting\n");
-		close(s);
-		return;
+		client_array[i].sock = s;
+		client_array[i].rlen = 0;
+		atomic_set(&client_array[i].refcnt, 1);
+		if (acm_svr_watch(EPOLL_CTL_ADD, s, ACM_SVR_CLIENT, i)) {
+			acm_log(0, "ERROR - unable to watch client %d\n", i);
+			acm_disconnect_client(&client_array[i]);
+			continue;
+		}
+		acm_log(2, "assigned client %d\n", i);
 	}
 
-	client_array[i].sock = s;
-	atomic_set(&client_array[i].refcnt, 1);
-	acm_log(2, "assigned client %d\n", i);
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		acm_log(0, "ERROR - failed to accept connection\n");
 }
 
 static int
@@ -1136,9 +1447,11 @@ static int acm_svr_resolve(struct acmc_client *client, struct acm_msg *msg)
 		if (msg->resolve_data[0].flags & ACM_FLAGS_QUERY_SA) {
 			return acm_svr_query_path(client, msg);
 		} else {
+			acm_shm_track(client, msg);
 			return acm_svr_resolve_path(client, msg);
 		}
 	} else {
+		acm_shm_track(client, msg);
 		return acm_svr_resolve_dest(client, msg);
 	}
 }
@@ -1187,7 +1500,9 @@ static int acm_svr_perf_query(struct acmc_client *client, struct acm_msg *msg)
 	}
 	msg->hdr.length = htobe16(len);
 
-	ret = send(client->sock, (char *) msg, len, 0);
+	pthread_mutex_lock(&client->lock);
+	ret = acm_send_msg(client->sock, msg, len);
+	pthread_mutex_unlock(&client->lock);
 	if (ret != len)
 		acm_log(0, "ERROR - failed to send response\n");
 	else
@@ -1272,7 +1587,9 @@ static int acm_svr_ep_query(struct acmc_client *client, struct acm_msg **_msg)
 	msg->hdr.dst_index = 0;
 	msg->hdr.length = htobe16(len);
 
-	ret = send(client->sock, (char *) msg, len, 0);
+	pthread_mutex_lock(&client->lock);
+	ret = acm_send_msg(client->sock, msg, len);
+	pthread_mutex_unlock(&client->lock);
 	if (ret != len)
 		acm_log(0, "ERROR - failed to send response\n");
 	else
@@ -1287,24 +1604,9 @@ static int acm_msg_length(struct acm_msg *msg)
 		msg->hdr.length : be16toh(msg->hdr.length);
 }
 
-static void acm_svr_receive(struct acmc_client *client)
+static int acm_svr_process(struct acmc_client *client, struct acm_msg *msg)
 {
-	struct acm_msg *msg = malloc(sizeof(*msg));
-	int ret;
-
-	if (!msg) {
-		acm_log(0, "ERROR - Unable to alloc acm_msg\n");
-		ret = ENOMEM;
-		goto out;
-	}
-
-	acm_log(2, "client %d\n", client->index);
-	ret = recv(client->sock, (char *)msg, sizeof(*msg), 0);
-	if (ret <= 0 || ret != acm_msg_length(msg)) {
-		acm_log(2, "client disconnected\n");
-		ret = ACM_STATUS_ENOTCONN;
-		goto out;
-	}
+	int ret = ACM_STATUS_EINVAL;
 
 	if (msg->hdr.version != ACM_VERSION) {
 		acm_log(0, "ERROR - unsupported version %d\n", msg->hdr.version);
@@ -1329,8 +1631,67 @@ static void acm_svr_receive(struct acmc_client *client)
 
 out:
 	free(msg);
-	if (ret)
-		acm_disconnect_client(client);
+	return ret;
+}
+
+/*
+ * Read what the client has sent without blocking and serve every complete
+ * request, in order.  Returns false once the client has been disconnected.
+ */
+static bool acm_svr_receive(struct acmc_client *client)
+{
+	struct acm_msg *msg;
+	unsigned int need;
+	int served = 0;
+	int ret;
+
+	acm_log(2, "client %d\n", client->index);
+	while (served < ACM_MAX_CLIENT_BATCH) {
+		if (client->rlen < ACM_MSG_HDR_LENGTH) {
+			need = ACM_MSG_HDR_LENGTH;
+		} else {
+			need = acm_msg_length(&client->rmsg);
+			if (need < ACM_MSG_HDR_LENGTH ||
+			    need > sizeof(client->rmsg)) {
+				acm_log(0, "ERROR - invalid msg length %u\n",
+					need);
+				goto disconnect;
+			}
+		}
+
+		if (client->rlen < need) {
+			ret = recv(client->sock,
+				   (char *) &client->rmsg + client->rlen,
+				   need - client->rlen, 0);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return true;
+			if (ret <= 0) {
+				acm_log(2, "client disconnected\n");
+				goto disconnect;
+			}
+			client->rlen += ret;
+			continue;
+		}
+
+		msg = malloc(sizeof(*msg));
+		if (!msg) {
+			acm_log(0, "ERROR - Unable to alloc acm_msg\n");
+			goto disconnect;
+		}
+		memcpy(msg, &client->rmsg, need);
+		client->rlen = 0;
+		served++;
+
+		if (acm_svr_process(client, msg))
+			goto disconnect;
+	}
+	return true;
+
+disconnect:
+	acm_disconnect_client(client);
+	return false;
 }
 
 static int acm_nl_to_addr_data(struct acm_ep_addr_data *ad,
@@ -1878,14 +2239,117 @@ static int acm_init_nl(void)
 	return 0;
 }
 
-static void acm_server(bool systemd)
+static struct acmc_device *acm_svr_device(uint32_t index)
 {
-	fd_set readfds;
-	int i, n, ret;
 	struct acmc_device *dev;
 
+	list_for_each(&dev_list, dev, entry)
+		if (!index--)
+			return dev;
+	return NULL;
+}
+
+static void acm_svr_event(struct epoll_event *event)
+{
+	enum acm_svr_source source = event->data.u64 >> 32;
+	uint32_t index = (uint32_t) event->data.u64;
+	struct acmc_client *client;
+	struct acmc_device *dev;
+
+	switch (source) {
+	case ACM_SVR_LISTEN:
+		acm_svr_accept();
+		acm_svr_watch(EPOLL_CTL_MOD, listen_socket, source, index);
+		break;
+	case ACM_SVR_IP_MON:
+		pthread_rwlock_wrlock(&server_lock);
+		acm_ipnl_handler();
+		acm_shm_invalidate();
+		pthread_rwlock_unlock(&server_lock);
+		acm_svr_watch(EPOLL_CTL_MOD, ip_mon_socket, source, index);
+		break;
+	case ACM_SVR_DEVICE:
+		dev = acm_svr_device(index);
+		acm_log(2, "handling event from %s\n",
+			dev->device.verbs->device->name);
+		pthread_rwlock_wrlock(&server_lock);
+		acm_event_handler(dev);
+		acm_shm_invalidate();
+		pthread_rwlock_unlock(&server_lock);
+		acm_svr_watch(EPOLL_CTL_MOD, dev->device.verbs->async_fd,
+			      source, index);
+		break;
+	case ACM_SVR_CLIENT:
+		client = &client_array[index];
+		acm_log(2, "receiving from client %d\n", index);
+		pthread_rwlock_rdlock(&server_lock);
+		if (index == NL_CLIENT_INDEX) {
+			acm_nl_receive(client);
+			acm_svr_watch(EPOLL_CTL_MOD, client->sock, source, index);
+		} else if (acm_svr_receive(client)) {
+			/* re-arm only now, keeping the client's requests
+			 * in order */
+			acm_svr_watch(EPOLL_CTL_MOD, client->sock, source, index);
+		}
+		pthread_rwlock_unlock(&server_lock);
+		break;
+	}
+}
+
+static void *acm_svr_worker(void *arg)
+{
+	struct epoll_event event;
+	int ret;
+
+	while (1) {
+		ret = epoll_wait(epoll_fd, &event, 1, -1);
+		if (ret == -1) {
+			if (errno != EINTR)
+				acm_log(0, "ERROR - server epoll error\n");
+			continue;
+		}
+		if (ret == 1)
+			acm_svr_event(&event);
+	}
+
+	return NULL;
+}
+
+static int acm_svr_watch_all(void)
+{
+	struct acmc_device *dev;
+	uint32_t i = 0;
+
+	if (set_fd_nonblock(listen_socket, true) ||
+	    acm_svr_watch(EPOLL_CTL_ADD, listen_socket, ACM_SVR_LISTEN, 0))
+		return -1;
+
+	if (ip_mon_socket != -1 &&
+	    acm_svr_watch(EPOLL_CTL_ADD, ip_mon_socket, ACM_SVR_IP_MON, 0))
+		return -1;
+
+	if (client_array[NL_CLIENT_INDEX].sock != -1 &&
+	    acm_svr_watch(EPOLL_CTL_ADD, client_array[NL_CLIENT_INDEX].sock,
+			  ACM_SVR_CLIENT, NL_CLIENT_INDEX))
+		return -1;
+
+	list_for_each(&dev_list, dev, entry) {
+		if (acm_svr_watch(EPOLL_CTL_ADD, dev->device.verbs->async_fd,
+				  ACM_SVR_DEVICE, i++))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void acm_server(bool systemd)
+{
+	pthread_t thread;
+	int i, ret;
+
 	acm_log(0, "started\n");
-	acm_init_server();
+	if (acm_init_server())
+		return;
 
 	client_array[NL_CLIENT_INDEX].sock = -1;
 	listen_socket = -1;
@@ -1911,59 +2375,31 @@ static void acm_server(bool systemd)
 			acm_log(1, "Warn - Netlink init failed\n");
 	}
 
-	if (systemd)
-		sd_notify(0, "READY=1");
-
-	while (1) {
-		n = (int) listen_socket;
-		FD_ZERO(&readfds);
-		FD_SET(listen_socket, &readfds);
-		n = max(n, (int) ip_mon_socket);
-		FD_SET(ip_mon_socket, &readfds);
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1) {
-				FD_SET(client_array[i].sock, &readfds);
-				n = max(n, (int) client_array[i].sock);
-			}
-		}
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		acm_log(0, "ERROR - unable to create server epoll set\n");
+		return;
+	}
 
-		list_for_each(&dev_list, dev, entry) {
-			FD_SET(dev->device.verbs->async_fd, &readfds);
-			n = max(n, (int) dev->device.verbs->async_fd);
-		}
+	if (acm_svr_watch_all()) {
+		acm_log(0, "ERROR - unable to watch server sockets\n");
+		return;
+	}
 
-		ret = select(n + 1, &readfds, NULL, NULL, NULL);
-		if (ret == -1) {
-			acm_log(0, "ERROR - server select error\n");
-			continue;
+	/* the calling thread is the first worker */
+	for (i = 1; i < server_threads; i++) {
+		if (pthread_create(&thread, NULL, acm_svr_worker, NULL)) {
+			acm_log(0, "notice - started %d of %d server threads\n",
+				i, server_threads);
+			break;
 		}
+		pthread_detach(thread);
+	}
 
-		if (FD_ISSET(listen_socket, &readfds))
-			acm_svr_accept();
-
-		if (FD_ISSET(ip_mon_socket, &readfds))
-			acm_ipnl_handler();
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1 &&
-				FD_ISSET(client_array[i].sock, &readfds)) {
-				acm_log(2, "receiving from client %d\n", i);
-				if (i == NL_CLIENT_INDEX)
-					acm_nl_receive(&client_array[i]);
-				else
-					acm_svr_receive(&client_array[i]);
-			}
-		}
+	if (systemd)
+		sd_notify(0, "READY=1");
 
-		list_for_each(&dev_list, dev, entry) {
-			if (FD_ISSET(dev->device.verbs->async_fd, &readfds)) {
-				acm_log(2, "handling event from %s\n",
-					dev->device.verbs->device->name);
-				acm_event_handler(dev);
-			}
-		}
-	}
+	acm_svr_worker(NULL);
 }
 
 enum ibv_rate acm_get_rate(uint8_t width, uint8_t speed)
@@ -3214,6 +3650,17 @@ static void acm_set_options(void)
 			sa.retries = atoi(value);
 		else if (!strcasecmp("sa_depth", opt))
 			sa.depth = atoi(value);
+		else if (!strcasecmp("server_threads", opt))
+			server_threads = max(atoi(value), 1);
+		else if (!strcasecmp("max_clients", opt))
+			max_clients = max(atoi(value), NL_CLIENT_INDEX + 2);
+		else if (!strcasecmp("shm_cache_size", opt))
+			shm_cache_size = atoi(value);
+		else if (!strcasecmp("shm_cache_timeout", opt))
+			shm_cache_timeout = max(atoi(value), 1);
+		else if (!strcasecmp("shm_cache_group", opt))
+			snprintf(shm_cache_group, sizeof(shm_cache_group),
+				 "%s", value);
 	}
 
 	fclose(f);
@@ -3237,6 +3684,12 @@ static void acm_log_options(void)
 	acm_log(0, "timeout %d ms\n", sa.timeout);
 	acm_log(0, "retries %d\n", sa.retries);
 	acm_log(0, "sa depth %d\n", sa.depth);
+	acm_log(0, "server threads %d\n", server_threads);
+	acm_log(0, "max clients %d\n", max_clients);
+	acm_log(0, "shared memory cache size %d\n", shm_cache_size);
+	acm_log(0, "shared memory cache timeout %d s\n", shm_cache_timeout);
+	acm_log(0, "shared memory cache group %s\n",
+		shm_cache_group[0] ? shm_cache_group : "none");
 	acm_log(0, "options file %s\n", opts_file);
 	acm_log(0, "addr file %s\n", addr_file);
 	acm_log(0, "provider lib path %s\n", prov_lib_path);
@@ -3379,11 +3832,13 @@ int main(int argc, char **argv)
 	}
 
 	acm_activate_devices();
+	acm_shm_init();
 	acm_log(1, "starting server\n");
 	acm_server(systemd);
 
 	acm_log(0, "shutting down\n");
-	if (client_array[NL_CLIENT_INDEX].sock != -1)
+	acm_shm_fini();
+	if (client_array && client_array[NL_CLIENT_INDEX].sock != -1)
 		close(client_array[NL_CLIENT_INDEX].sock);
 	acm_close_providers();
 	acm_stop_sa_handler();
@@ -101,7 +101,8 @@ static void show_usage(char *program)
 	printf("                        s: output data for the endpoint with the\n");
 	printf("                           address specified in -s option\n");
 	printf("   [-S svc_addr]    - address of ACM service, default: local service\n");
-	printf("   [-C repetitions] - repeat count for resolution\n");
+	printf("   [-C repetitions] - repeat count for resolution, reports the\n");
+	printf("                      average latency when greater than 1\n");
 	printf("usage 2: %s\n", program);
 	printf("Generate default ibacm service configuration and option files\n");
 	printf("   -A [addr_file]   - generate local address configuration file\n");
@@ -212,6 +213,38 @@ static void gen_opts_temp(FILE *f)
 #else
 	fprintf(f, "server_mode unix\n");
 #endif
+	fprintf(f, "\n");
+	fprintf(f, "# server_threads:\n");
+	fprintf(f, "# Number of threads serving client requests.  Requests from\n");
+	fprintf(f, "# different clients are handled in parallel, while the requests\n");
+	fprintf(f, "# of a single client are always handled in order.\n");
+	fprintf(f, "\n");
+	fprintf(f, "server_threads 4\n");
+	fprintf(f, "\n");
+	fprintf(f, "# max_clients:\n");
+	fprintf(f, "# Maximum number of simultaneously connected clients.\n");
+	fprintf(f, "\n");
+	fprintf(f, "max_clients 4096\n");
+	fprintf(f, "\n");
+	fprintf(f, "# shm_cache_size:\n");
+	fprintf(f, "# Number of address resolutions that ibacm publishes in a shared\n");
+	fprintf(f, "# memory cache, %s, for local clients to read\n", IBACM_SHM_PATH);
+	fprintf(f, "# without a request to the service.  0 disables the cache.\n");
+	fprintf(f, "\n");
+	fprintf(f, "shm_cache_size 4096\n");
+	fprintf(f, "\n");
+	fprintf(f, "# shm_cache_timeout:\n");
+	fprintf(f, "# Number of seconds that an entry of the shared memory cache is used.\n");
+	fprintf(f, "# The cache is also cleared when addresses or ports change.\n");
+	fprintf(f, "\n");
+	fprintf(f, "shm_cache_timeout 300\n");
+	fprintf(f, "\n");
+	fprintf(f, "# shm_cache_group:\n");
+	fprintf(f, "# Group whose members may read the shared memory cache.  Without\n");
+	fprintf(f, "# it only root can use the cache, other clients always send their\n");
+	fprintf(f, "# requests to the service.\n");
+	fprintf(f, "\n");
+	fprintf(f, "# shm_cache_group ibacm\n");
 	fprintf(f, "\n");
 	fprintf(f, "# acme_plus_kernel_only:\n");
 	fprintf(f, "# If set to 'true', 'yes' or a non-zero number\n");
@@ -307,6 +340,8 @@ static void gen_opts_temp(FILE *f)
 	fprintf(f, "# Specifies the location of the route data file to use when preloading\n");
 	fprintf(f, "# the ACM cache.  This option is only valid if route_preload\n");
 	fprintf(f, "# indicates that routing data should be read from a file.\n");
+	fprintf(f, "# An index of the file is saved alongside it as <route_data_file>.cache\n");
+	fprintf(f, "# and reused until the route data file changes.\n");
 	fprintf(f, "# Default is %s/ibacm_route.data\n", ACM_CONF_DIR);
 	fprintf(f, "# route_data_file %s/ibacm_route.data\n", ACM_CONF_DIR);
 	fprintf(f, "\n");
@@ -729,10 +764,29 @@ static char *get_dest(char *arg, char *format)
 	}
 }
 
+/* Report the resolution latency seen by repeated requests */
+static void show_resolve_stats(struct timespec *start, uint64_t hits,
+			       uint64_t misses)
+{
+	struct timespec end;
+	uint64_t shm_hits, shm_misses;
+	double usec;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ib_acm_shm_stats(&shm_hits, &shm_misses);
+	usec = (end.tv_sec - start->tv_sec) * 1e6 +
+	       (end.tv_nsec - start->tv_nsec) / 1e3;
+	printf("Resolutions: %d, average %.3f usec, shared memory hits %" PRIu64
+	       " misses %" PRIu64 "\n", repetitions, usec / repetitions,
+	       shm_hits - hits, shm_misses - misses);
+}
+
 static int resolve(char *svc)
 {
 	char **dest_list, **src_list;
 	struct ibv_path_record path;
+	struct timespec start;
+	uint64_t hits, misses;
 	int ret = -1, d = 0, s = 0, i;
 	char dest_type;
 
@@ -753,6 +807,8 @@ static int resolve(char *svc)
 			printf("Destination: %s\n", dest_addr);
 			if (src_addr)
 				printf("Source: %s\n", src_addr);
+			ib_acm_shm_stats(&hits, &misses);
+			clock_gettime(CLOCK_MONOTONIC, &start);
 			for (i = 0; i < repetitions; i++) {
 				switch (dest_type) {
 				case 'i':
@@ -773,6 +829,8 @@ static int resolve(char *svc)
 					break;
 				}
 			}
+			if (repetitions > 1)
+				show_resolve_stats(&start, hits, misses);
 
 			if (!ret)
 				show_path(&path);
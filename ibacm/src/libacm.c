@@ -33,11 +33,15 @@
 #include <osd.h>
 #include "libacm.h"
 #include <infiniband/acm.h>
+#include <infiniband/acm_shm.h>
 #include <stdio.h>
 #include <errno.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 
 #include <util/util.h>
@@ -46,6 +50,60 @@ static pthread_mutex_t acm_lock = PTHREAD_MUTEX_INITIALIZER;
 static int sock = -1;
 static short server_port = 6125;
 
+/*
+ * Shared memory cache published by a local ibacm service, see acm_shm.h.  Only
+ * used while connected to the local service.
+ */
+static bool shm_local;
+static const struct acm_shm_hdr *shm;
+static size_t shm_len;
+static uint64_t shm_hits, shm_misses;
+
+static void acm_shm_close(void)
+{
+	if (shm) {
+		munmap((void *) shm, shm_len);
+		shm = NULL;
+	}
+}
+
+static void acm_shm_open(void)
+{
+	acm_shm_close();
+	shm = acm_shm_map(IBACM_SHM_PATH, &shm_len);
+}
+
+/* Returns true if msg now holds the cached response to the request in msg */
+static bool acm_shm_resolve(struct acm_msg *msg)
+{
+	struct timespec now;
+
+	if (!shm)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (acm_shm_lookup(shm, msg->resolve_data,
+			   msg->hdr.length - ACM_MSG_HDR_LENGTH, now.tv_sec, msg)) {
+		shm_hits++;
+		return true;
+	}
+	shm_misses++;
+	return false;
+}
+
+/* Pick up a new cache if the service has restarted */
+static void acm_shm_refresh(void)
+{
+	if (shm_local && (!shm || __atomic_load_n(&shm->closed, __ATOMIC_RELAXED)))
+		acm_shm_open();
+}
+
+void ib_acm_shm_stats(uint64_t *hits, uint64_t *misses)
+{
+	*hits = shm_hits;
+	*misses = shm_misses;
+}
+
 static void acm_set_server_port(void)
 {
 	FILE *f;
@@ -84,8 +142,17 @@ static int ib_acm_connect_open(char *dest)
 	if (ret) {
 		close(sock);
 		sock = -1;
+		goto freeaddr;
 	}
 
+	if (res->ai_family == AF_INET)
+		shm_local = ((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr ==
+			    htobe32(INADDR_LOOPBACK);
+	else if (res->ai_family == AF_INET6)
+		shm_local = IN6_IS_ADDR_LOOPBACK(
+			&((struct sockaddr_in6 *) res->ai_addr)->sin6_addr);
+	acm_shm_refresh();
+
 freeaddr:
 	freeaddrinfo(res);
 	return ret;
@@ -121,6 +188,8 @@ static int ib_acm_connect_unix(char *dest)
 		return ret;
 	}
 
+	shm_local = true;
+	acm_shm_refresh();
 	return 0;
 }
 
@@ -139,6 +208,8 @@ void ib_acm_disconnect(void)
 		close(sock);
 		sock = -1;
 	}
+	acm_shm_close();
+	shm_local = false;
 }
 
 static int acm_format_resp(struct acm_msg *msg,
@@ -277,13 +348,17 @@ static int acm_resolve(uint8_t *src, uint8_t *dest, uint8_t type,
 
 	msg.hdr.length = ACM_MSG_HDR_LENGTH + (cnt * ACM_MSG_EP_LENGTH);
 
-	ret = send(sock, (char *) &msg, msg.hdr.length, 0);
-	if (ret != msg.hdr.length)
-		goto out;
+	if (!acm_shm_resolve(&msg)) {
+		ret = send(sock, (char *) &msg, msg.hdr.length, 0);
+		if (ret != msg.hdr.length)
+			goto out;
 
-	ret = recv(sock, (char *) &msg, sizeof msg, 0);
-	if (ret < ACM_MSG_HDR_LENGTH || ret != msg.hdr.length)
-		goto out;
+		ret = recv(sock, (char *) &msg, sizeof msg, 0);
+		if (ret < ACM_MSG_HDR_LENGTH || ret != msg.hdr.length)
+			goto out;
+
+		acm_shm_refresh();
+	}
 
 	if (msg.hdr.status) {
 		ret = acm_error(msg.hdr.status);
@@ -46,6 +46,7 @@ int ib_acm_resolve_ip(struct sockaddr *src, struct sockaddr *dest,
 	int print);
 int ib_acm_resolve_path(struct ibv_path_record *path, uint32_t flags);
 #define ib_acm_free_paths(paths) free(paths)
+void ib_acm_shm_stats(uint64_t *hits, uint64_t *misses);
 
 int ib_acm_query_perf(int index, uint64_t **counters, int *count);
 int ib_acm_query_perf_ep_addr(uint8_t *src, uint8_t type,
@@ -72,6 +72,8 @@ int ibd_timeout = 0;
 uint32_t ibd_ibnetdisc_flags = IBND_CONFIG_MLX_EPI;
 uint64_t ibd_mkey;
 uint64_t ibd_sakey = 0;
+char *ibd_sa_cache_dir = NULL;
+int ibd_sa_cache_ttl = 60;
 int show_keys = 0;
 char *ibd_nd_format = NULL;
 
@@ -162,6 +164,13 @@ static void read_ibdiag_config(const char *file)
 		} else if (strncmp(name, "sa_key",
 				   strlen("sa_key")) == 0) {
 			ibd_sakey = strtoull(val_str, NULL, 0);
+		} else if (strncmp(name, "sa_cache_dir",
+				   strlen("sa_cache_dir")) == 0) {
+			free(ibd_sa_cache_dir);
+			ibd_sa_cache_dir = strdup(val_str);
+		} else if (strncmp(name, "sa_cache_ttl",
+				   strlen("sa_cache_ttl")) == 0) {
+			ibd_sa_cache_ttl = strtoul(val_str, NULL, 0);
 		} else if (strncmp(name, "nd_format",
 				   strlen("nd_format")) == 0) {
 			if (ibd_nd_format)
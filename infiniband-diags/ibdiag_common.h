@@ -56,6 +56,8 @@ extern int ibd_timeout;
 extern uint32_t ibd_ibnetdisc_flags;
 extern uint64_t ibd_mkey;
 extern uint64_t ibd_sakey;
+extern char *ibd_sa_cache_dir;
+extern int ibd_sa_cache_ttl;
 extern int show_keys;
 extern char *ibd_nd_format;
 
@@ -38,6 +38,15 @@
 
 
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <infiniband/umad.h>
 
 #include "ibdiag_common.h"
@@ -95,14 +104,211 @@ void sa_free_handle(struct sa_handle * h)
 	free(h);
 }
 
+/* On-disk cache of SA GetTable responses.
+ *
+ * The payload of a successful response (as reassembled from RMPP by the
+ * kernel) is written to <sa_cache_dir>/sa-<hash> together with the request
+ * that produced it.  Any tool issuing the identical request through the same
+ * local port to the same SM within sa_cache_ttl seconds is answered from the
+ * file instead of the SM.  Files are replaced atomically with rename(2) so
+ * tools running concurrently never see a partial response.
+ */
+#define SA_CACHE_MAGIC 0x53414331	/* "SAC1" */
+
+struct sa_cache_key {
+	uint64_t hash;
+	uint32_t magic;
+	uint16_t attr;
+	uint16_t sm_lid;
+	uint32_t mod;
+	uint32_t datasz;
+	uint64_t comp_mask;
+};
+
+struct sa_cache_hdr {
+	struct sa_cache_key key;
+	uint32_t len;
+	uint32_t reserved;
+};
+
+static void sa_fill_result(void *mad, int len, struct sa_query_result *result)
+{
+	uint8_t method = (uint8_t) mad_get_field(mad, 0, IB_MAD_METHOD_F);
+	int offset = mad_get_field(mad, 0, IB_SA_ATTROFFS_F);
+
+	result->status = mad_get_field(mad, 0, IB_MAD_STATUS_F);
+	result->p_result_madw = mad;
+	if (result->status != IB_SA_MAD_STATUS_SUCCESS)
+		result->result_cnt = 0;
+	else if (method != IB_MAD_METHOD_GET_TABLE)
+		result->result_cnt = 1;
+	else if (!offset)
+		result->result_cnt = 0;
+	else
+		result->result_cnt = (len - IB_SA_DATA_OFFS) / (offset << 3);
+}
+
+static uint64_t sa_cache_hash(uint64_t hash, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static void sa_cache_make_key(struct sa_handle *h, uint16_t attr,
+			      uint32_t mod, uint64_t comp_mask,
+			      uint64_t sm_key, void *data, size_t datasz,
+			      struct sa_cache_key *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	key->magic = SA_CACHE_MAGIC;
+	key->attr = attr;
+	key->sm_lid = h->dport.lid;
+	key->mod = mod;
+	key->datasz = data ? datasz : 0;
+	key->comp_mask = comp_mask;
+
+	/* The SM_Key changes what a trusted query returns, so it is part
+	 * of the hash but is never written to the file itself. */
+	hash = sa_cache_hash(hash, &key->magic,
+			     sizeof(*key) - offsetof(struct sa_cache_key, magic));
+	if (ibd_ca)
+		hash = sa_cache_hash(hash, ibd_ca, strlen(ibd_ca));
+	hash = sa_cache_hash(hash, &ibd_ca_port, sizeof(ibd_ca_port));
+	hash = sa_cache_hash(hash, &sm_key, sizeof(sm_key));
+	if (key->datasz)
+		hash = sa_cache_hash(hash, data, key->datasz);
+	key->hash = hash ? hash : 1;
+}
+
+static void sa_cache_path(struct sa_cache_key *key, char *path, size_t size)
+{
+	snprintf(path, size, "%s/sa-%016" PRIx64, ibd_sa_cache_dir, key->hash);
+}
+
+/* The cache is only trusted if nobody else could have written to it */
+static bool sa_cache_private(const struct stat *st, mode_t type)
+{
+	return st->st_uid == geteuid() && (st->st_mode & S_IFMT) == type &&
+	       !(st->st_mode & 077);
+}
+
+static bool sa_cache_dir_private(void)
+{
+	struct stat st;
+
+	return !lstat(ibd_sa_cache_dir, &st) && sa_cache_private(&st, S_IFDIR);
+}
+
+static int sa_cache_load(struct sa_cache_key *key, void *data,
+			 struct sa_query_result *result)
+{
+	char path[PATH_MAX];
+	struct sa_cache_hdr hdr;
+	struct stat st;
+	void *umad = NULL, *req = NULL;
+	FILE *f;
+
+	if (!sa_cache_dir_private())
+		return -1;
+
+	sa_cache_path(key, path, sizeof(path));
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	if (fstat(fileno(f), &st) || !sa_cache_private(&st, S_IFREG) ||
+	    time(NULL) - st.st_mtime >= ibd_sa_cache_ttl ||
+	    fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(&hdr.key, key, sizeof(*key)) ||
+	    hdr.len < IB_SA_DATA_OFFS)
+		goto err;
+
+	if (key->datasz) {
+		req = malloc(key->datasz);
+		if (!req || fread(req, key->datasz, 1, f) != 1 ||
+		    memcmp(req, data, key->datasz))
+			goto err;
+	}
+
+	umad = calloc(1, umad_size() + hdr.len);
+	if (!umad || fread(umad_get_mad(umad), hdr.len, 1, f) != 1)
+		goto err;
+
+	free(req);
+	fclose(f);
+
+	if (ibdebug)
+		IBWARN("SA attr 0x%x answered from %s", key->attr, path);
+	sa_fill_result(umad_get_mad(umad), hdr.len, result);
+	return 0;
+
+err:
+	free(umad);
+	free(req);
+	fclose(f);
+	return -1;
+}
+
+static void sa_cache_store(struct sa_cache_key *key, void *data, void *mad,
+			   int len)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 16];
+	struct sa_cache_hdr hdr = { .key = *key, .len = len };
+	FILE *f;
+	int fd;
+
+	/* mkdir() leaves an existing directory as it is, check what is there */
+	if ((mkdir(ibd_sa_cache_dir, 0700) && errno != EEXIST) ||
+	    !sa_cache_dir_private())
+		return;
+
+	sa_cache_path(key, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    (key->datasz && fwrite(data, key->datasz, 1, f) != 1) ||
+	    fwrite(mad, len, 1, f) != 1) {
+		fclose(f);
+		unlink(tmp);
+		return;
+	}
+
+	if (fclose(f) || rename(tmp, path))
+		unlink(tmp);
+}
+
 int sa_query(struct sa_handle * h, uint8_t method,
 		    uint16_t attr, uint32_t mod, uint64_t comp_mask,
 		    uint64_t sm_key, void *data, size_t datasz,
 		    struct sa_query_result *result)
 {
+	struct sa_cache_key key = {};
 	ib_rpc_t rpc;
 	void *umad, *mad;
-	int ret, offset, len = 256;
+	int ret, len = 256;
+
+	/* Only whole-table reads are cached; Set/Delete must reach the SM */
+	if (method == IB_MAD_METHOD_GET_TABLE && ibd_sa_cache_dir) {
+		sa_cache_make_key(h, attr, mod, comp_mask, sm_key, data,
+				  datasz, &key);
+		if (!sa_cache_load(&key, data, result))
+			return 0;
+	}
 
 	memset(&rpc, 0, sizeof(rpc));
 	rpc.mgtclass = IB_SA_CLASS;
@@ -153,18 +359,10 @@ recv_mad:
 	if (ibdebug > 1)
 		xdump(stdout, "SA Response:\n", mad, len);
 
-	method = (uint8_t) mad_get_field(mad, 0, IB_MAD_METHOD_F);
-	offset = mad_get_field(mad, 0, IB_SA_ATTROFFS_F);
-	result->status = mad_get_field(mad, 0, IB_MAD_STATUS_F);
-	result->p_result_madw = mad;
-	if (result->status != IB_SA_MAD_STATUS_SUCCESS)
-		result->result_cnt = 0;
-	else if (method != IB_MAD_METHOD_GET_TABLE)
-		result->result_cnt = 1;
-	else if (!offset)
-		result->result_cnt = 0;
-	else
-		result->result_cnt = (len - IB_SA_DATA_OFFS) / (offset << 3);
+	sa_fill_result(mad, len, result);
+
+	if (key.hash && result->status == IB_SA_MAD_STATUS_SUCCESS)
+		sa_cache_store(&key, data, mad, len);
 
 	return 0;
 }
@@ -183,6 +381,85 @@ void *sa_get_query_rec(void *mad, unsigned i)
 	return (uint8_t *) mad + IB_SA_DATA_OFFS + i * (offset << 3);
 }
 
+static int node_lid_cmp(const void *a, const void *b)
+{
+	const ib_node_record_t *x = *(ib_node_record_t * const *)a;
+	const ib_node_record_t *y = *(ib_node_record_t * const *)b;
+
+	return (int)be16toh(x->lid) - (int)be16toh(y->lid);
+}
+
+static int node_guid_cmp(const void *a, const void *b)
+{
+	const ib_node_record_t *x = *(ib_node_record_t * const *)a;
+	const ib_node_record_t *y = *(ib_node_record_t * const *)b;
+	uint64_t gx = be64toh(x->node_info.port_guid);
+	uint64_t gy = be64toh(y->node_info.port_guid);
+
+	return gx < gy ? -1 : gx > gy;
+}
+
+int sa_node_index_build(struct sa_handle *h, uint64_t sm_key,
+			struct sa_node_index *idx)
+{
+	unsigned i;
+	int ret;
+
+	memset(idx, 0, sizeof(*idx));
+	ret = sa_query(h, IB_MAD_METHOD_GET_TABLE, IB_SA_ATTR_NODERECORD, 0, 0,
+		       sm_key, NULL, 0, &idx->result);
+	if (ret) {
+		fprintf(stderr, "Query SA failed: %s\n", strerror(ret));
+		return ret;
+	}
+	if (idx->result.status != IB_SA_MAD_STATUS_SUCCESS) {
+		sa_report_err(idx->result.status);
+		sa_free_result_mad(&idx->result);
+		return EIO;
+	}
+
+	idx->cnt = idx->result.result_cnt;
+	idx->by_lid = calloc(idx->cnt + 1, sizeof(*idx->by_lid));
+	idx->by_guid = calloc(idx->cnt + 1, sizeof(*idx->by_guid));
+	if (!idx->by_lid || !idx->by_guid)
+		IBPANIC("calloc failed");
+
+	for (i = 0; i < idx->cnt; i++)
+		idx->by_lid[i] = idx->by_guid[i] =
+			sa_get_query_rec(idx->result.p_result_madw, i);
+	qsort(idx->by_lid, idx->cnt, sizeof(*idx->by_lid), node_lid_cmp);
+	qsort(idx->by_guid, idx->cnt, sizeof(*idx->by_guid), node_guid_cmp);
+	return 0;
+}
+
+void sa_node_index_free(struct sa_node_index *idx)
+{
+	free(idx->by_lid);
+	free(idx->by_guid);
+	sa_free_result_mad(&idx->result);
+	memset(idx, 0, sizeof(*idx));
+}
+
+ib_node_record_t *sa_node_index_lid(struct sa_node_index *idx, uint16_t lid)
+{
+	ib_node_record_t key = { .lid = htobe16(lid) }, *k = &key, **r;
+
+	r = bsearch(&k, idx->by_lid, idx->cnt, sizeof(*idx->by_lid),
+		    node_lid_cmp);
+	return r ? *r : NULL;
+}
+
+ib_node_record_t *sa_node_index_port_guid(struct sa_node_index *idx,
+					  __be64 port_guid)
+{
+	ib_node_record_t key, *k = &key, **r;
+
+	key.node_info.port_guid = port_guid;
+	r = bsearch(&k, idx->by_guid, idx->cnt, sizeof(*idx->by_guid),
+		    node_guid_cmp);
+	return r ? *r : NULL;
+}
+
 static const char *ib_sa_error_str[] = {
 	"SA_NO_ERROR",
 	"SA_ERR_NO_RESOURCES",
@@ -69,6 +69,24 @@ void sa_free_result_mad(struct sa_query_result *result);
 void *sa_get_query_rec(void *mad, unsigned i);
 void sa_report_err(int status);
 
+/* NodeRecord table indexed by LID and by port GUID, so tools resolving many
+ * names or GUIDs do a single GetTable and a lookup per record instead of a
+ * walk over the whole table each time.
+ */
+struct sa_node_index {
+	struct sa_query_result result;
+	ib_node_record_t **by_lid;
+	ib_node_record_t **by_guid;
+	unsigned cnt;
+};
+
+int sa_node_index_build(struct sa_handle *h, uint64_t sm_key,
+			struct sa_node_index *idx);
+void sa_node_index_free(struct sa_node_index *idx);
+ib_node_record_t *sa_node_index_lid(struct sa_node_index *idx, uint16_t lid);
+ib_node_record_t *sa_node_index_port_guid(struct sa_node_index *idx,
+					  __be64 port_guid);
+
 /* Macros for setting query values and ComponentMasks */
 static inline uint8_t htobe8(uint8_t val)
 {
@@ -630,8 +630,8 @@ int main(int argc, char **argv)
 		{"filterdownports", 5, 1, "<file>",
 		 "filename of ibnetdiscover cache to filter downports"},
 		{"outstanding_smps", 'o', 1, NULL,
-		 "specify the number of outstanding SMP's which should be "
-		 "issued during the scan"},
+		 "specify the maximum number of outstanding SMP's which "
+		 "should be issued during the scan"},
 		{"switches-only", 6, 0, NULL,
 		 "Output only switches"},
 		{"cas-only", 7, 0, NULL,
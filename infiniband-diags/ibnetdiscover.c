@@ -68,11 +68,13 @@ static FILE *f;
 static char *node_name_map_file = NULL;
 static nn_map_t *node_name_map = NULL;
 static char *cache_file = NULL;
+static unsigned int cache_flags = 0;
 static char *load_cache_file = NULL;
 static char *diff_cache_file = NULL;
 static unsigned diffcheck_flags = DIFF_FLAG_DEFAULT;
 
 static int report_max_hops = 0;
+static ibnd_scan_stats_t scan_stats;
 static int full_info;
 
 /**
@@ -552,10 +554,19 @@ static int dump_topology(int group, ibnd_fabric_t *fabric)
 	struct iter_user_data iter_user_data;
 
 	fprintf(f, "#\n# Topology file: generated on %s#\n", ctime(&t));
-	if (report_max_hops)
+	if (report_max_hops) {
 		fprintf(f, "# Reported max hops discovered: %u\n"
 			"# Total MADs used: %u\n",
 			fabric->maxhops_discovered, fabric->total_mads_used);
+		if (scan_stats.elapsed_us)
+			fprintf(f, "# Discovery time: %" PRIu64 " ms, "
+				"max SMPs on wire: %u, SMP timeouts: %" PRIu64
+				"\n# SMP latency avg/max: %" PRIu64 "/%" PRIu64
+				" us\n",
+				scan_stats.elapsed_us / 1000,
+				scan_stats.max_window, scan_stats.timeouts,
+				scan_stats.avg_rtt_us, scan_stats.max_rtt_us);
+	}
 	fprintf(f, "# Initiated from node %016" PRIx64 " port %016" PRIx64 "\n",
 		fabric->from_node->guid,
 		mad_get_field64(fabric->from_node->info, 0,
@@ -1006,6 +1017,9 @@ static int process_opt(void *context, int ch)
 	case 4:
 		diff_cache_file = strdup(optarg);
 		break;
+	case 6:
+		cache_flags |= IBND_CACHE_FABRIC_FLAG_V1;
+		break;
 	case 5:
 		diffcheck_flags = 0;
 		p = strtok(optarg, ",");
@@ -1084,6 +1098,8 @@ int main(int argc, char **argv)
 		{"node-name-map", 1, 1, "<file>", "node name map file"},
 		{"cache", 2, 1, "<file>",
 		 "filename to cache ibnetdiscover data to"},
+		{"cache-v1", 6, 0, NULL,
+		 "write the cache in the format older releases can load"},
 		{"load-cache", 3, 1, "<file>",
 		 "filename of ibnetdiscover cache to load"},
 		{"diff", 4, 1, "<file>",
@@ -1094,8 +1110,8 @@ int main(int argc, char **argv)
 		{"max_hops", 'm', 0, NULL,
 		 "report max hops discovered by the library"},
 		{"outstanding_smps", 'o', 1, NULL,
-		 "specify the number of outstanding SMP's which should be "
-		 "issued during the scan"},
+		 "specify the maximum number of outstanding SMP's which "
+		 "should be issued during the scan"},
 		{}
 	};
 	char usage_args[] = "[topology-file]";
@@ -1117,6 +1133,7 @@ int main(int argc, char **argv)
 		IBEXIT("can't open file %s for writing", argv[0]);
 
 	config.mkey = ibd_mkey;
+	config.stats = &scan_stats;
 
 	node_name_map = open_node_name_map(node_name_map_file);
 
@@ -1143,7 +1160,7 @@ int main(int argc, char **argv)
 		dump_topology(group, fabric);
 
 	if (cache_file)
-		if (ibnd_cache_fabric(fabric, cache_file, 0) < 0)
+		if (ibnd_cache_fabric(fabric, cache_file, cache_flags) < 0)
 			IBEXIT("caching ibnetdiscover data failed\n");
 
 	ibnd_destroy_fabric(fabric);
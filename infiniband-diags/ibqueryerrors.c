@@ -47,6 +47,7 @@
 #include <errno.h>
 #include <inttypes.h>
 
+#include <ccan/list.h>
 #include <util/node_name_map.h>
 #include <infiniband/ibnetdisc.h>
 #include <infiniband/mad.h>
@@ -55,6 +56,7 @@
 #include "ibdiag_sa.h"
 
 static struct ibmad_port *ibmad_port;
+static struct ibmad_port *pma_srcport;
 static char *node_name_map_file = NULL;
 static nn_map_t *node_name_map = NULL;
 static char *load_cache_file = NULL;
@@ -80,6 +82,12 @@ static unsigned clear_errors, clear_counts, details;
 
 #define DEFAULT_HALF_WORLD_PR_TIMEOUT (3000)
 
+#define DEF_PMA_WINDOW 64
+#define DEF_PMA_PER_LID 4
+static unsigned pma_window = DEF_PMA_WINDOW;
+static unsigned pma_per_lid = DEF_PMA_PER_LID;
+static int stream_output;
+
 static struct {
 	int nodes_checked;
 	int bad_nodes;
@@ -534,82 +542,335 @@ static int print_results(ib_portid_t * portid, char *node_name,
 	return (n);
 }
 
-static int query_cap_mask(ib_portid_t * portid, char *node_name, int portnum,
-			  __be16 * cap_mask, uint32_t * cap_mask2)
+/*
+ * The counters are collected by an asynchronous sweep which keeps many
+ * PerfMgt MADs outstanding across the fabric. A node is printed once all
+ * of its queries have completed, see sweep_nodes().
+ */
+enum pma_stage {
+	PMA_START,
+	PMA_CPI,		/* ClassPortInfo outstanding */
+	PMA_ALL,		/* AllPortSelect counters outstanding */
+	PMA_PORTS,		/* per port counters outstanding */
+	PMA_DONE,
+};
+
+struct pma_node;
+struct pma_port;
+
+struct pma_req {
+	struct pma_node *pn;
+	struct pma_port *pp;
+	uint8_t *buf;
+};
+
+struct pma_port {
+	ib_portid_t portid;
+	int portnum;
+	int failed;
+	uint8_t pc[IB_PC_DATA_SZ];
+	uint8_t pce[IB_PC_DATA_SZ];
+	struct pma_req req[2];
+};
+
+struct pma_node {
+	struct list_node entry;
+	ibnd_node_t *node;
+	char *node_name;
+	int startport;
+	enum pma_stage stage;
+	unsigned pending;
+	__be16 cap_mask;
+	uint32_t cap_mask2;
+	int all_port_sup;
+	struct pma_port cpi;	/* ClassPortInfo is returned in cpi.pc */
+	/* ports[0..numports], ports[numports + 1] is the AllPortSelect port */
+	struct pma_port ports[];
+};
+
+static int exceeds_thresholds(uint8_t *pc, uint8_t *pce, uint32_t cap_mask2)
+{
+	char buf[2048];
+	int i, ext_i, n = 0;
+
+	for (i = IB_PC_ERR_SYM_F, ext_i = IB_PC_EXT_ERR_SYM_F;
+			i <= IB_PC_VL15_DROPPED_F; i++, ext_i++) {
+		if (suppress(i))
+			continue;
+
+		/* this is not a counter, skip it */
+		if (i == IB_PC_COUNTER_SELECT2_F) {
+			ext_i--;
+			continue;
+		}
+
+		if (check_threshold(pc, pce, cap_mask2, i, ext_i, &n, buf,
+				    sizeof(buf)))
+			return 1;
+	}
+
+	return !suppress(IB_PC_XMT_WAIT_F) &&
+	       check_threshold(pc, pce, cap_mask2, IB_PC_XMT_WAIT_F,
+			       IB_PC_EXT_XMT_WAIT_F, &n, buf, sizeof(buf));
+}
+
+static int has_ext_counters(struct pma_node *pn)
+{
+	return !!(pn->cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED |
+				  IB_PM_EXT_WIDTH_NOIETF_SUP));
+}
+
+static void pma_query_failed(struct pma_node *pn, struct pma_port *pp,
+			     unsigned attr_id)
+{
+	const char *attr_name;
+
+	switch (attr_id) {
+	case CLASS_PORT_INFO:
+		attr_name = "classportinfo";
+		break;
+	case IB_GSI_PORT_COUNTERS_EXT:
+		attr_name = "IB_GSI_PORT_COUNTERS_EXT";
+		break;
+	default:
+		attr_name = "IB_GSI_PORT_COUNTERS";
+		break;
+	}
+
+	IBWARN("%s query failed on %s, %s port %d", attr_name,
+	       pn->node_name, portid2str(&pp->portid), pp->portnum);
+	summary.pma_query_failures++;
+	pp->failed = 1;
+}
+
+static void pma_advance(struct mad_rpc_engine *engine, struct pma_node *pn);
+
+static void pma_complete(struct mad_rpc_engine *engine, ib_rpc_t *rpc,
+			 ib_portid_t *dport, int status, uint8_t *mad,
+			 void *cb_data)
+{
+	struct pma_req *req = cb_data;
+	struct pma_node *pn = req->pn;
+
+	if (status || !mad)
+		pma_query_failed(pn, req->pp, rpc->attr.id);
+	else {
+		memcpy(req->buf, mad + IB_PC_DATA_OFFS, IB_PC_DATA_SZ);
+
+		if (rpc->attr.id == IB_GSI_PORT_COUNTERS &&
+		    !(pn->cap_mask & IB_PM_PC_XMIT_WAIT_SUP)) {
+			/* if PortCounters:PortXmitWait not supported clear this counter */
+			uint32_t foo = 0;
+			mad_encode_field(req->buf, IB_PC_XMT_WAIT_F, &foo);
+		}
+	}
+
+	if (--pn->pending == 0)
+		pma_advance(engine, pn);
+}
+
+static void pma_send(struct mad_rpc_engine *engine, struct pma_node *pn,
+		     struct pma_port *pp, struct pma_req *req,
+		     unsigned attr_id, uint8_t *buf)
+{
+	req->pn = pn;
+	req->pp = pp;
+	req->buf = buf;
+
+	pp->portid.sl = lid2sl_table[pp->portid.lid];
+
+	pn->pending++;
+	if (pma_query_async(engine, &pp->portid, pp->portnum, ibd_timeout,
+			    attr_id, pma_complete, req) < 0) {
+		pn->pending--;
+		pma_query_failed(pn, pp, attr_id);
+	}
+}
+
+static void pma_query_port(struct mad_rpc_engine *engine, struct pma_node *pn,
+			   struct pma_port *pp)
+{
+	if (data_counters_only) {
+		if (has_ext_counters(pn))
+			pma_send(engine, pn, pp, &pp->req[1],
+				 IB_GSI_PORT_COUNTERS_EXT, pp->pce);
+		else
+			pma_send(engine, pn, pp, &pp->req[0],
+				 IB_GSI_PORT_COUNTERS, pp->pc);
+		return;
+	}
+
+	pma_send(engine, pn, pp, &pp->req[0], IB_GSI_PORT_COUNTERS, pp->pc);
+	if (has_ext_counters(pn))
+		pma_send(engine, pn, pp, &pp->req[1], IB_GSI_PORT_COUNTERS_EXT,
+			 pp->pce);
+}
+
+static void pma_query_ports(struct mad_rpc_engine *engine, struct pma_node *pn)
+{
+	int p;
+
+	pn->stage = PMA_PORTS;
+	for (p = pn->startport; p <= pn->node->numports; p++)
+		if (pn->node->ports[p])
+			pma_query_port(engine, pn, &pn->ports[p]);
+}
+
+static void pma_decode_cap_mask(struct pma_node *pn)
 {
-	uint8_t pc[1024] = { 0 };
 	__be16 rc_cap_mask;
 	__be32 rc_cap_mask2;
 
-	portid->sl = lid2sl_table[portid->lid];
+	if (pn->cpi.failed)
+		return;
 
-	/* PerfMgt ClassPortInfo is a required attribute */
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout, CLASS_PORT_INFO,
-			   ibmad_port)) {
-		IBWARN("classportinfo query failed on %s, %s port %d",
-		       node_name, portid2str(portid), portnum);
-		summary.pma_query_failures++;
-		return -1;
+	/* ClassPortInfo should be supported as part of libibmad */
+	memcpy(&rc_cap_mask, pn->cpi.pc + 2, sizeof(rc_cap_mask));	/* CapabilityMask */
+	memcpy(&rc_cap_mask2, pn->cpi.pc + 4, sizeof(rc_cap_mask2));	/* CapabilityMask2 */
+
+	pn->cap_mask = rc_cap_mask;
+	pn->cap_mask2 = ntohl(rc_cap_mask2) >> 5;
+	pn->all_port_sup = !!(rc_cap_mask & IB_PM_ALL_PORT_SELECT);
+}
+
+/* Queue the next queries of pn once the previous stage has completed */
+static void pma_advance(struct mad_rpc_engine *engine, struct pma_node *pn)
+{
+	struct pma_port *all = &pn->ports[pn->node->numports + 1];
+
+	while (!pn->pending && pn->stage != PMA_DONE) {
+		/* hold off completion while this stage is being queued */
+		pn->pending++;
+
+		switch (pn->stage) {
+		case PMA_START:
+			/* PerfMgt ClassPortInfo is a required attribute */
+			pn->stage = PMA_CPI;
+			pma_send(engine, pn, &pn->cpi, &pn->cpi.req[0],
+				 CLASS_PORT_INFO, pn->cpi.pc);
+			break;
+		case PMA_CPI:
+			pma_decode_cap_mask(pn);
+			if (pn->all_port_sup && !data_counters_only) {
+				pn->stage = PMA_ALL;
+				pma_query_port(engine, pn, all);
+			} else
+				pma_query_ports(engine, pn);
+			break;
+		case PMA_ALL:
+			/* only look at the ports if the switch reports errors */
+			if (all->failed ||
+			    !exceeds_thresholds(all->pc,
+						has_ext_counters(pn) ? all->pce : NULL,
+						pn->cap_mask2))
+				pn->stage = PMA_DONE;
+			else
+				pma_query_ports(engine, pn);
+			break;
+		default:
+			pn->stage = PMA_DONE;
+			break;
+		}
+
+		pn->pending--;
 	}
+}
 
-	/* ClassPortInfo should be supported as part of libibmad */
-	memcpy(&rc_cap_mask, pc + 2, sizeof(rc_cap_mask));	/* CapabilityMask */
-	memcpy(&rc_cap_mask2, pc + 4, sizeof(rc_cap_mask2));	/* CapabilityMask2 */
+static struct pma_node *pma_node_start(struct mad_rpc_engine *engine,
+				       ibnd_node_t *node)
+{
+	struct pma_node *pn;
+	struct pma_port *pp;
+	int p;
+
+	pn = calloc(1, sizeof(*pn) +
+		       (node->numports + 2) * sizeof(pn->ports[0]));
+	if (!pn)
+		IBEXIT("out of memory");
+
+	pn->node = node;
+	pn->node_name = remap_node_name(node_name_map, node->guid,
+					node->nodedesc);
+	if (node->type == IB_NODE_SWITCH && node->smaenhsp0)
+		pn->startport = 0;
+	else
+		pn->startport = 1;
 
-	*cap_mask = rc_cap_mask;
-	*cap_mask2 = ntohl(rc_cap_mask2) >> 5;
-	return 0;
+	if (node->type == IB_NODE_SWITCH) {
+		ib_portid_set(&pn->cpi.portid, node->smalid, 0, 0);
+		pn->cpi.portnum = 0;
+	} else {
+		for (p = 1; p <= node->numports; p++) {
+			if (node->ports[p]) {
+				ib_portid_set(&pn->cpi.portid,
+					      node->ports[p]->base_lid,
+					      0, 0);
+				pn->cpi.portnum = p;
+				break;
+			}
+		}
+	}
+
+	for (p = 0; p <= node->numports; p++) {
+		pp = &pn->ports[p];
+		pp->portnum = p;
+		if (node->type == IB_NODE_SWITCH)
+			ib_portid_set(&pp->portid, node->smalid, 0, 0);
+		else if (node->ports[p])
+			ib_portid_set(&pp->portid, node->ports[p]->base_lid,
+				      0, 0);
+	}
+	pp = &pn->ports[node->numports + 1];
+	pp->portid = pn->cpi.portid;
+	pp->portnum = 0xFF;
+
+	pma_advance(engine, pn);
+	return pn;
 }
 
-static int print_data_cnts(ib_portid_t * portid, __be16 cap_mask,
-			   char *node_name, ibnd_node_t * node, int portnum,
+static void pma_node_free(struct pma_node *pn)
+{
+	free(pn->node_name);
+	free(pn);
+}
+
+static int print_data_cnts(struct pma_node *pn, struct pma_port *pp,
 			   int *header_printed)
 {
-	uint8_t pc[1024];
+	ibnd_node_t *node = pn->node;
+	uint8_t *pc;
 	int i;
 	int start_field = IB_PC_XMT_BYTES_F;
 	int end_field = IB_PC_RCV_PKTS_F;
 
-	memset(pc, 0, 1024);
-
-	portid->sl = lid2sl_table[portid->lid];
+	/* the query failure has already been reported */
+	if (pp->failed)
+		return (1);
 
-	if (cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
-		if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-				   IB_GSI_PORT_COUNTERS_EXT, ibmad_port)) {
-			IBWARN("IB_GSI_PORT_COUNTERS_EXT query failed on %s, %s port %d",
-			       node_name, portid2str(portid), portnum);
-			summary.pma_query_failures++;
-			return (1);
-		}
+	if (has_ext_counters(pn)) {
+		pc = pp->pce;
 		start_field = IB_PC_EXT_XMT_BYTES_F;
-		if (cap_mask & IB_PM_EXT_WIDTH_SUPPORTED)
+		if (pn->cap_mask & IB_PM_EXT_WIDTH_SUPPORTED)
 			end_field = IB_PC_EXT_RCV_MPKTS_F;
 		else
 			end_field = IB_PC_EXT_RCV_PKTS_F;
 	} else {
-		if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-				   IB_GSI_PORT_COUNTERS, ibmad_port)) {
-			IBWARN("IB_GSI_PORT_COUNTERS query failed on %s, %s port %d",
-			       node_name, portid2str(portid), portnum);
-			summary.pma_query_failures++;
-			return (1);
-		}
+		pc = pp->pc;
 		start_field = IB_PC_XMT_BYTES_F;
 		end_field = IB_PC_RCV_PKTS_F;
 	}
 
 	if (!*header_printed) {
 		printf("Data Counters for 0x%" PRIx64 " \"%s\"\n", node->guid,
-		       node_name);
+		       pn->node_name);
 		*header_printed = 1;
 	}
 
-	if (portnum == 0xFF)
+	if (pp->portnum == 0xFF)
 		printf("   GUID 0x%" PRIx64 " port ALL:", node->guid);
 	else
 		printf("   GUID 0x%" PRIx64 " port %d:",
-		       node->guid, portnum);
+		       node->guid, pp->portnum);
 
 	for (i = start_field; i <= end_field; i++) {
 		uint64_t val64 = 0;
@@ -626,51 +887,23 @@ static int print_data_cnts(ib_portid_t * portid, __be16 cap_mask,
 	}
 	printf("\n");
 
-	if (portnum != 0xFF && port_config)
-		print_port_config(node, portnum);
+	if (pp->portnum != 0xFF && port_config)
+		print_port_config(node, pp->portnum);
 
 	return (0);
 }
 
-static int print_errors(ib_portid_t * portid, __be16 cap_mask, uint32_t cap_mask2,
-			char *node_name, ibnd_node_t * node, int portnum,
+static int print_errors(struct pma_node *pn, struct pma_port *pp,
 			int *header_printed)
 {
-	uint8_t pc[1024];
-	uint8_t pce[1024];
-	uint8_t *pc_ext = NULL;
-
-	memset(pc, 0, 1024);
-	memset(pce, 0, 1024);
-
-	portid->sl = lid2sl_table[portid->lid];
-
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-			   IB_GSI_PORT_COUNTERS, ibmad_port)) {
-		IBWARN("IB_GSI_PORT_COUNTERS query failed on %s, %s port %d",
-		       node_name, portid2str(portid), portnum);
-		summary.pma_query_failures++;
+	/* the query failure has already been reported */
+	if (pp->failed)
 		return (0);
-	}
-
-	if (cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
-		if (!pma_query_via(pce, portid, portnum, ibd_timeout,
-		    IB_GSI_PORT_COUNTERS_EXT, ibmad_port)) {
-			IBWARN("IB_GSI_PORT_COUNTERS_EXT query failed on %s, %s port %d",
-			       node_name, portid2str(portid), portnum);
-			summary.pma_query_failures++;
-			return (0);
-		}
-		pc_ext = pce;
-	}
 
-	if (!(cap_mask & IB_PM_PC_XMIT_WAIT_SUP)) {
-		/* if PortCounters:PortXmitWait not supported clear this counter */
-		uint32_t foo = 0;
-		mad_encode_field(pc, IB_PC_XMT_WAIT_F, &foo);
-	}
-	return (print_results(portid, node_name, node, pc, portnum,
-			      header_printed, pc_ext, cap_mask, cap_mask2));
+	return (print_results(&pp->portid, pn->node_name, pn->node, pp->pc,
+			      pp->portnum, header_printed,
+			      has_ext_counters(pn) ? pp->pce : NULL,
+			      pn->cap_mask, pn->cap_mask2));
 }
 
 static uint8_t *reset_pc_ext(void *rcvbuf, ib_portid_t *dest, int port,
@@ -770,17 +1003,61 @@ static void clear_port(ib_portid_t * portid, __be16 cap_mask, uint32_t cap_mask2
 	}
 }
 
-static void print_node(ibnd_node_t *node, void *user_data)
+static void print_node(struct pma_node *pn)
 {
+	ibnd_node_t *node = pn->node;
+	struct pma_port *pp;
 	int header_printed = 0;
-	int p = 0;
-	int startport = 1;
+	int p;
+
+	if (data_counters_only) {
+		for (p = pn->startport; p <= node->numports; p++) {
+			if (node->ports[p]) {
+				pp = &pn->ports[p];
+				print_data_cnts(pn, pp, &header_printed);
+				summary.ports_checked++;
+				if (!pn->all_port_sup)
+					clear_port(&pp->portid, pn->cap_mask,
+						   pn->cap_mask2, pn->node_name, p);
+			}
+		}
+	} else {
+		if (pn->all_port_sup)
+			if (!print_errors(pn, &pn->ports[node->numports + 1],
+					  &header_printed)) {
+				summary.ports_checked += node->numports;
+				goto clear;
+			}
+
+		for (p = pn->startport; p <= node->numports; p++) {
+			if (node->ports[p]) {
+				pp = &pn->ports[p];
+				print_errors(pn, pp, &header_printed);
+				summary.ports_checked++;
+				if (!pn->all_port_sup)
+					clear_port(&pp->portid, pn->cap_mask,
+						   pn->cap_mask2, pn->node_name, p);
+			}
+		}
+	}
+
+clear:
+	summary.nodes_checked++;
+	if (pn->all_port_sup)
+		clear_port(&pn->cpi.portid, pn->cap_mask, pn->cap_mask2,
+			   pn->node_name, 0xFF);
+}
+
+struct node_list {
+	ibnd_node_t **nodes;
+	unsigned count;
+	unsigned size;
+};
+
+static void add_node(ibnd_node_t *node, void *user_data)
+{
+	struct node_list *list = user_data;
 	int type = 0;
-	int all_port_sup = 0;
-	ib_portid_t portid = { 0 };
-	__be16 cap_mask = 0;
-	uint32_t cap_mask2 = 0;
-	char *node_name = NULL;
 
 	switch (node->type) {
 	case IB_NODE_SWITCH:
@@ -797,76 +1074,64 @@ static void print_node(ibnd_node_t *node, void *user_data)
 	if ((type & node_type_to_print) == 0)
 		return;
 
-	if (node->type == IB_NODE_SWITCH && node->smaenhsp0)
-		startport = 0;
-
-	node_name = remap_node_name(node_name_map, node->guid, node->nodedesc);
-
-	if (node->type == IB_NODE_SWITCH) {
-		ib_portid_set(&portid, node->smalid, 0, 0);
-		p = 0;
-	} else {
-		for (p = 1; p <= node->numports; p++) {
-			if (node->ports[p]) {
-				ib_portid_set(&portid,
-					      node->ports[p]->base_lid,
-					      0, 0);
-				break;
-			}
-		}
+	if (list->count == list->size) {
+		list->size = list->size ? list->size * 2 : 256;
+		list->nodes = realloc(list->nodes,
+				      list->size * sizeof(*list->nodes));
+		if (!list->nodes)
+			IBEXIT("out of memory");
 	}
+	list->nodes[list->count++] = node;
+}
 
-	if ((query_cap_mask(&portid, node_name, p, &cap_mask, &cap_mask2) == 0) &&
-	    (cap_mask & IB_PM_ALL_PORT_SELECT))
-		all_port_sup = 1;
+/*
+ * Query the PMAs of all nodes in list with up to pma_window MADs
+ * outstanding and at most pma_per_lid of them to a single LID, i.e. to a
+ * switch. Nodes are printed in list order unless stream_output is set, in
+ * which case they are printed as soon as their counters arrive.
+ */
+static void sweep_nodes(struct node_list *list)
+{
+	struct mad_rpc_engine *engine;
+	struct pma_node *pn, *next;
+	LIST_HEAD(inflight);
+	unsigned max_inflight = pma_window * 4;
+	unsigned issued = 0, ninflight = 0;
+	int rc;
 
-	if (data_counters_only) {
-		for (p = startport; p <= node->numports; p++) {
-			if (node->ports[p]) {
-				if (node->type == IB_NODE_SWITCH)
-					ib_portid_set(&portid, node->smalid, 0, 0);
-				else
-					ib_portid_set(&portid, node->ports[p]->base_lid,
-						      0, 0);
+	engine = mad_rpc_engine_create(pma_srcport, pma_window);
+	if (!engine)
+		IBEXIT("Failed to create PMA query engine");
+	mad_rpc_engine_set_dest_limit(engine, pma_per_lid);
 
-				print_data_cnts(&portid, cap_mask, node_name, node, p,
-						&header_printed);
-				summary.ports_checked++;
-				if (!all_port_sup)
-					clear_port(&portid, cap_mask, cap_mask2, node_name, p);
-			}
+	while (issued < list->count || !list_empty(&inflight)) {
+		while (issued < list->count && ninflight < max_inflight) {
+			pn = pma_node_start(engine, list->nodes[issued++]);
+			list_add_tail(&inflight, &pn->entry);
+			ninflight++;
 		}
-	} else {
-		if (all_port_sup)
-			if (!print_errors(&portid, cap_mask, cap_mask2, node_name, node,
-					  0xFF, &header_printed)) {
-				summary.ports_checked += node->numports;
-				goto clear;
-			}
-
-		for (p = startport; p <= node->numports; p++) {
-			if (node->ports[p]) {
-				if (node->type == IB_NODE_SWITCH)
-					ib_portid_set(&portid, node->smalid, 0, 0);
-				else
-					ib_portid_set(&portid, node->ports[p]->base_lid,
-						      0, 0);
 
-				print_errors(&portid, cap_mask, cap_mask2, node_name, node, p,
-					     &header_printed);
-				summary.ports_checked++;
-				if (!all_port_sup)
-					clear_port(&portid, cap_mask, cap_mask2, node_name, p);
+		list_for_each_safe(&inflight, pn, next, entry) {
+			if (pn->stage != PMA_DONE) {
+				if (stream_output)
+					continue;
+				break;
 			}
+			list_del(&pn->entry);
+			ninflight--;
+			print_node(pn);
+			pma_node_free(pn);
 		}
-	}
 
-clear:
-	summary.nodes_checked++;
-	if (all_port_sup)
-		clear_port(&portid, cap_mask, cap_mask2, node_name, 0xFF);
+		if (!mad_rpc_engine_outstanding(engine))
+			continue;
+
+		rc = mad_rpc_engine_poll(engine, -1);
+		if (rc < 0)
+			IBEXIT("PMA query receive failed: %s", strerror(-rc));
+	}
 
-	free(node_name);
+	mad_rpc_engine_destroy(engine);
 }
 
 static void add_suppressed(enum MAD_FIELDS field)
@@ -939,6 +1204,17 @@ static int process_opt(void *context, int ch)
 	case 10:
 		obtain_sl = 0;
 		break;
+	case 11:
+		pma_window = strtoul(optarg, NULL, 0);
+		if (!pma_window)
+			pma_window = 1;
+		break;
+	case 12:
+		pma_per_lid = strtoul(optarg, NULL, 0);
+		break;
+	case 13:
+		stream_output = 1;
+		break;
 	case 'G':
 	case 'S':
 		port_guid_str = optarg;
@@ -982,6 +1258,8 @@ int main(int argc, char **argv)
 	int mgmt_classes[4] = { IB_SMI_CLASS, IB_SMI_DIRECT_CLASS, IB_SA_CLASS,
 		IB_PERFORMANCE_CLASS
 	};
+	int pma_classes[1] = { IB_PERFORMANCE_CLASS };
+	struct node_list list = { 0 };
 
 	const struct ibdiag_opt opts[] = {
 		{"suppress", 's', 1, "<err1,err2,...>",
@@ -1015,8 +1293,16 @@ int main(int argc, char **argv)
 		{"load-cache", 7, 1, "<file>",
 		 "filename of ibnetdiscover cache to load"},
 		{"outstanding_smps", 'o', 1, NULL,
-		 "specify the number of outstanding SMP's which should be "
-		 "issued during the scan"},
+		 "specify the maximum number of outstanding SMP's which "
+		 "should be issued during the scan"},
+		{"outstanding_pmas", 11, 1, NULL,
+		 "specify the maximum number of outstanding PerfMgt MAD's "
+		 "during the counter sweep, default: 64"},
+		{"pmas-per-lid", 12, 1, NULL,
+		 "specify the maximum number of outstanding PerfMgt MAD's to "
+		 "a single LID (0 = unlimited), default: 4"},
+		{"stream", 13, 0, NULL,
+		 "print nodes as their counters arrive rather than in fabric order"},
 		{}
 	};
 	char usage_args[] = "";
@@ -1121,10 +1407,26 @@ int main(int argc, char **argv)
 	if (ibd_timeout)
 		mad_rpc_set_timeout(ibmad_port, ibd_timeout);
 
+	/*
+	 * The sweep engine owns receive processing on its port, the detail
+	 * queries and counter resets stay on ibmad_port.
+	 */
+	pma_srcport = mad_rpc_open_port(ibd_ca, ibd_ca_port, pma_classes, 1);
+	if (!pma_srcport) {
+		mad_rpc_close_port(ibmad_port);
+		ibnd_destroy_fabric(fabric);
+		close_node_name_map(node_name_map);
+		IBEXIT("Failed to open PMA port: %s:%d\n",
+			ibd_ca, ibd_ca_port);
+	}
+
+	if (ibd_timeout)
+		mad_rpc_set_timeout(pma_srcport, ibd_timeout);
+
 	if (port_guid_str) {
 		ibnd_port_t *ndport = ibnd_find_port_guid(fabric, port_guid);
 		if (ndport)
-			print_node(ndport->node, NULL);
+			add_node(ndport->node, &list);
 		else
 			fprintf(stderr, "Failed to find node: %s\n",
 				port_guid_str);
@@ -1145,7 +1447,7 @@ int main(int argc, char **argv)
 			if(obtain_sl)
 				if(path_record_query(self_gid,ndport->guid))
 					goto close_port;
-			print_node(ndport->node, NULL);
+			add_node(ndport->node, &list);
 		} else
 			fprintf(stderr, "Failed to find node: %s\n", dr_path);
 	} else {
@@ -1153,14 +1455,18 @@ int main(int argc, char **argv)
 			if(path_record_query(self_gid,0))
 				goto close_port;
 
-		ibnd_iter_nodes(fabric, print_node, NULL);
+		ibnd_iter_nodes(fabric, add_node, &list);
 	}
 
+	sweep_nodes(&list);
+
 	rc = print_summary();
 	if (rc)
 		rc = 1;
 
 close_port:
+	free(list.nodes);
+	mad_rpc_close_port(pma_srcport);
 	mad_rpc_close_port(ibmad_port);
 	ibnd_destroy_fabric(fabric);
 
@@ -37,10 +37,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
 #include <netinet/in.h>
 
 #include <infiniband/umad.h>
 #include <infiniband/mad.h>
+#include <infiniband/ibnetdisc.h>
+#include <util/node_name_map.h>
 
 #include "ibdiag_common.h"
 
@@ -106,6 +113,14 @@ static struct perf_count_ext perf_count_ext = {};
 #define ALL_PORTS 0xFF
 #define MAX_PORTS 255
 
+#define DEF_OUTSTANDING_PMAS 4
+static unsigned outstanding_pmas = DEF_OUTSTANDING_PMAS;
+
+struct port_counters {
+	int failed;
+	uint8_t data[IB_PC_DATA_SZ];
+};
+
 /* Notes: IB semantics is to cap counters if count has exceeded limits.
  * Therefore we must check for overflows and cap the counters if necessary.
  *
@@ -397,16 +412,77 @@ static void output_aggregate_perfcounters_ext(ib_portid_t * portid,
 	       portid2str(portid), ALL_PORTS, ntohs(cap_mask), cap_mask2, buf);
 }
 
+static void port_counters_done(struct mad_rpc_engine *engine, ib_rpc_t *rpc,
+			       ib_portid_t *dport, int status, uint8_t *mad,
+			       void *cb_data)
+{
+	struct port_counters *cnt = cb_data;
+
+	if (status || !mad)
+		cnt->failed = 1;
+	else
+		memcpy(cnt->data, mad + IB_PC_DATA_OFFS, IB_PC_DATA_SZ);
+}
+
+/*
+ * Fetch the counters of several ports with up to outstanding_pmas queries
+ * in flight rather than one round trip per port.
+ */
+static struct port_counters *query_perfcounters(int extended, int timeout,
+						ib_portid_t * portid,
+						int *ports, int nports)
+{
+	struct mad_rpc_engine *engine;
+	struct port_counters *cnt;
+	unsigned attr_id = extended != 1 ? IB_GSI_PORT_COUNTERS :
+					   IB_GSI_PORT_COUNTERS_EXT;
+	int i;
+
+	cnt = calloc(nports, sizeof(*cnt));
+	if (!cnt)
+		IBEXIT("out of memory");
+
+	engine = mad_rpc_engine_create(srcport, outstanding_pmas);
+	if (!engine)
+		IBEXIT("Failed to create PMA query engine");
+
+	for (i = 0; i < nports; i++)
+		if (pma_query_async(engine, portid, ports[i], timeout, attr_id,
+				    port_counters_done, &cnt[i]) < 0)
+			cnt[i].failed = 1;
+
+	if (mad_rpc_engine_wait(engine) < 0)
+		IBEXIT("PMA query receive failed");
+	mad_rpc_engine_destroy(engine);
+
+	return cnt;
+}
+
+/* cnt holds the counters fetched by query_perfcounters() or is NULL */
+static int fetch_perfcounters(struct port_counters *cnt, int timeout,
+			      ib_portid_t * portid, int port,
+			      unsigned attr_id)
+{
+	memset(pc, 0, sizeof(pc));
+	if (!cnt)
+		return pma_query_via(pc, portid, port, timeout, attr_id,
+				     srcport) != NULL;
+	if (cnt->failed)
+		return 0;
+	memcpy(pc, cnt->data, sizeof(cnt->data));
+	return 1;
+}
+
 static void dump_perfcounters(int extended, int timeout, __be16 cap_mask,
 			      uint32_t cap_mask2, ib_portid_t * portid,
-			      int port, int aggregate)
+			      int port, int aggregate,
+			      struct port_counters *cnt)
 {
 	char buf[1536];
 
 	if (extended != 1) {
-		memset(pc, 0, sizeof(pc));
-		if (!pma_query_via(pc, portid, port, timeout,
-				   IB_GSI_PORT_COUNTERS, srcport))
+		if (!fetch_perfcounters(cnt, timeout, portid, port,
+					IB_GSI_PORT_COUNTERS))
 			IBEXIT("perfquery");
 		if (!(cap_mask & IB_PM_PC_XMIT_WAIT_SUP)) {
 			/* if PortCounters:PortXmitWait not supported clear this counter */
@@ -431,9 +507,8 @@ static void dump_perfcounters(int extended, int timeout, __be16 cap_mask,
 			    ("PerfMgt ClassPortInfo CapMask 0x%02X; No extended counter support indicated\n",
 			     ntohs(cap_mask));
 
-		memset(pc, 0, sizeof(pc));
-		if (!pma_query_via(pc, portid, port, timeout,
-				   IB_GSI_PORT_COUNTERS_EXT, srcport))
+		if (!fetch_perfcounters(cnt, timeout, portid, port,
+					IB_GSI_PORT_COUNTERS_EXT))
 			IBEXIT("perfextquery");
 		if (aggregate)
 			aggregate_perfcounters_ext(cap_mask, cap_mask2);
@@ -733,6 +808,425 @@ static void dump_portsamples_control(ib_portid_t *portid, int port)
 	       port, buf);
 }
 
+/*
+ * Sampling mode: read the counters of a set of ports every sample_interval
+ * ms and print deltas and rates in InfluxDB line protocol, one line per
+ * port and interval.
+ */
+enum sample_src {
+	SRC_PC,			/* PortCounters */
+	SRC_PC_WAIT,		/* PortCounters, if PortXmitWait is supported */
+	SRC_PC_DATA,		/* PortCounters, without extended counters */
+	SRC_EXT,		/* PortCountersExtended */
+	SRC_EXT_FULL,		/* PortCountersExtended, full width only */
+};
+
+struct sample_field {
+	const char *name;
+	enum MAD_FIELDS field;
+	int width;		/* in bits, for wraparound */
+	int scale;		/* rate multiplier, data counters are 4 octets */
+	enum sample_src src;
+};
+
+static const struct sample_field sample_fields[] = {
+	{"symbol_errors", IB_PC_ERR_SYM_F, 16, 1, SRC_PC},
+	{"link_recovers", IB_PC_LINK_RECOVERS_F, 8, 1, SRC_PC},
+	{"link_downed", IB_PC_LINK_DOWNED_F, 8, 1, SRC_PC},
+	{"rcv_errors", IB_PC_ERR_RCV_F, 16, 1, SRC_PC},
+	{"rcv_remote_phys_errors", IB_PC_ERR_PHYSRCV_F, 16, 1, SRC_PC},
+	{"rcv_switch_relay_errors", IB_PC_ERR_SWITCH_REL_F, 16, 1, SRC_PC},
+	{"xmit_discards", IB_PC_XMT_DISCARDS_F, 16, 1, SRC_PC},
+	{"xmit_constraint_errors", IB_PC_ERR_XMTCONSTR_F, 8, 1, SRC_PC},
+	{"rcv_constraint_errors", IB_PC_ERR_RCVCONSTR_F, 8, 1, SRC_PC},
+	{"link_integrity_errors", IB_PC_ERR_LOCALINTEG_F, 4, 1, SRC_PC},
+	{"excessive_buffer_overruns", IB_PC_ERR_EXCESS_OVR_F, 4, 1, SRC_PC},
+	{"vl15_dropped", IB_PC_VL15_DROPPED_F, 16, 1, SRC_PC},
+	{"xmit_wait", IB_PC_XMT_WAIT_F, 32, 1, SRC_PC_WAIT},
+	{"xmit_data", IB_PC_XMT_BYTES_F, 32, 4, SRC_PC_DATA},
+	{"rcv_data", IB_PC_RCV_BYTES_F, 32, 4, SRC_PC_DATA},
+	{"xmit_pkts", IB_PC_XMT_PKTS_F, 32, 1, SRC_PC_DATA},
+	{"rcv_pkts", IB_PC_RCV_PKTS_F, 32, 1, SRC_PC_DATA},
+	{"xmit_data", IB_PC_EXT_XMT_BYTES_F, 64, 4, SRC_EXT},
+	{"rcv_data", IB_PC_EXT_RCV_BYTES_F, 64, 4, SRC_EXT},
+	{"xmit_pkts", IB_PC_EXT_XMT_PKTS_F, 64, 1, SRC_EXT},
+	{"rcv_pkts", IB_PC_EXT_RCV_PKTS_F, 64, 1, SRC_EXT},
+	{"unicast_xmit_pkts", IB_PC_EXT_XMT_UPKTS_F, 64, 1, SRC_EXT_FULL},
+	{"unicast_rcv_pkts", IB_PC_EXT_RCV_UPKTS_F, 64, 1, SRC_EXT_FULL},
+	{"multicast_xmit_pkts", IB_PC_EXT_XMT_MPKTS_F, 64, 1, SRC_EXT_FULL},
+	{"multicast_rcv_pkts", IB_PC_EXT_RCV_MPKTS_F, 64, 1, SRC_EXT_FULL},
+};
+
+#define NUM_SAMPLE_FIELDS (sizeof(sample_fields) / sizeof(sample_fields[0]))
+#define DEF_SAMPLE_WINDOW 64
+
+struct sample_port {
+	ib_portid_t portid;
+	int port;
+	uint64_t guid;
+	char *name;
+	int cpi;		/* index of the port whose ClassPortInfo applies */
+	__be16 cap_mask;
+	int cpi_failed;
+	unsigned pending;
+	int round_failed;
+	int failed;
+	int have_prev;
+	struct timespec ts, prev_ts;
+	uint64_t wall_ns;
+	uint64_t val[NUM_SAMPLE_FIELDS];
+	uint64_t prev[NUM_SAMPLE_FIELDS];
+};
+
+static unsigned sample_interval;
+static unsigned sample_count;
+static int sample_fabric;
+static char *node_name_map_file;
+static volatile sig_atomic_t sample_stop;
+
+static int sample_ext(struct sample_port *sp)
+{
+	return !!(sp->cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED |
+				  IB_PM_EXT_WIDTH_NOIETF_SUP));
+}
+
+static int sample_field_valid(struct sample_port *sp,
+			      const struct sample_field *f)
+{
+	switch (f->src) {
+	case SRC_PC:
+		return 1;
+	case SRC_PC_WAIT:
+		return !!(sp->cap_mask & IB_PM_PC_XMIT_WAIT_SUP);
+	case SRC_PC_DATA:
+		return !sample_ext(sp);
+	case SRC_EXT:
+		return sample_ext(sp);
+	case SRC_EXT_FULL:
+		return !!(sp->cap_mask & IB_PM_EXT_WIDTH_SUPPORTED);
+	}
+	return 0;
+}
+
+static uint64_t counter_delta(uint64_t prev, uint64_t cur, int width)
+{
+	if (cur >= prev)
+		return cur - prev;
+	/* some devices let the 32 bit data counters wrap instead of saturate */
+	if (width == 32)
+		return cur + (1ULL << 32) - prev;
+	/* anything else only goes backwards when it has been reset */
+	return cur;
+}
+
+static void sample_done(struct mad_rpc_engine *engine, ib_rpc_t *rpc,
+			ib_portid_t *dport, int status, uint8_t *mad,
+			void *cb_data)
+{
+	struct sample_port *sp = cb_data;
+	const struct sample_field *f;
+	struct timespec now;
+	uint8_t *data;
+	unsigned i;
+
+	if (status || !mad) {
+		sp->round_failed = 1;
+	} else {
+		data = mad + IB_PC_DATA_OFFS;
+		for (i = 0; i < NUM_SAMPLE_FIELDS; i++) {
+			f = &sample_fields[i];
+			if (!sample_field_valid(sp, f) ||
+			    (rpc->attr.id == IB_GSI_PORT_COUNTERS_EXT) !=
+			    (f->src >= SRC_EXT))
+				continue;
+			if (f->width == 64)
+				sp->val[i] = mad_get_field64(data, 0, f->field);
+			else
+				sp->val[i] = mad_get_field(data, 0, f->field);
+		}
+	}
+
+	if (--sp->pending)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &sp->ts);
+	clock_gettime(CLOCK_REALTIME, &now);
+	sp->wall_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void cpi_done(struct mad_rpc_engine *engine, ib_rpc_t *rpc,
+		     ib_portid_t *dport, int status, uint8_t *mad, void *cb_data)
+{
+	struct sample_port *sp = cb_data;
+
+	if (status || !mad)
+		sp->cpi_failed = 1;
+	else
+		/* CapabilityMask */
+		memcpy(&sp->cap_mask, mad + IB_PC_DATA_OFFS + 2,
+		       sizeof(sp->cap_mask));
+}
+
+static void sample_query(struct mad_rpc_engine *engine,
+			 struct sample_port *sp, unsigned attr_id)
+{
+	sp->pending++;
+	if (pma_query_async(engine, &sp->portid, sp->port, ibd_timeout,
+			    attr_id, sample_done, sp) < 0) {
+		sp->pending--;
+		sp->round_failed = 1;
+	}
+}
+
+/* Quote the characters the line protocol treats specially in a tag value */
+static void print_tag(const char *key, const char *val)
+{
+	printf(",%s=", key);
+	for (; *val; val++) {
+		if (*val == ' ' || *val == ',' || *val == '=' || *val == '\\')
+			putchar('\\');
+		putchar(*val);
+	}
+}
+
+static void sample_print(struct sample_port *sp)
+{
+	const struct sample_field *f;
+	const char *sep = " ";
+	uint64_t delta;
+	double dt;
+	unsigned i;
+
+	dt = (sp->ts.tv_sec - sp->prev_ts.tv_sec) +
+	     (sp->ts.tv_nsec - sp->prev_ts.tv_nsec) / 1e9;
+	if (dt <= 0)
+		return;
+
+	printf("perfquery,guid=0x%016" PRIx64 ",port=%d,lid=%u", sp->guid,
+	       sp->port, sp->portid.lid);
+	if (sp->name && *sp->name)
+		print_tag("node", sp->name);
+
+	for (i = 0; i < NUM_SAMPLE_FIELDS; i++) {
+		f = &sample_fields[i];
+		if (!sample_field_valid(sp, f))
+			continue;
+		delta = counter_delta(sp->prev[i], sp->val[i], f->width);
+		printf("%s%s_delta=%" PRIu64 "i,%s_rate=%.3f", sep, f->name,
+		       delta, f->name, delta * f->scale / dt);
+		sep = ",";
+	}
+	printf(" %" PRIu64 "\n", sp->wall_ns);
+}
+
+static void sample_signal(int sig)
+{
+	sample_stop = 1;
+}
+
+static void sample_ports(struct sample_port *sp, int nports)
+{
+	struct mad_rpc_engine *engine;
+	struct sigaction sa = { .sa_handler = sample_signal };
+	struct timespec next, now;
+	unsigned rounds = 0;
+	int i, n;
+
+	engine = mad_rpc_engine_create(srcport, DEF_SAMPLE_WINDOW);
+	if (!engine)
+		IBEXIT("Failed to create PMA query engine");
+	mad_rpc_engine_set_dest_limit(engine, outstanding_pmas);
+
+	/* PerfMgt ClassPortInfo tells which counters each port has */
+	for (i = 0; i < nports; i++)
+		if (sp[i].cpi == i &&
+		    pma_query_async(engine, &sp[i].portid, sp[i].port,
+				    ibd_timeout, CLASS_PORT_INFO, cpi_done,
+				    &sp[i]) < 0)
+			sp[i].cpi_failed = 1;
+	if (mad_rpc_engine_wait(engine) < 0)
+		IBEXIT("PMA query receive failed");
+
+	for (i = 0; i < nports; i++) {
+		sp[i].cap_mask = sp[sp[i].cpi].cap_mask;
+		sp[i].cpi_failed = sp[sp[i].cpi].cpi_failed;
+		if (sp[i].cpi_failed && sp[i].cpi == i)
+			IBWARN("classportinfo query failed on %s; not sampling it",
+			       portid2str(&sp[i].portid));
+	}
+	for (i = 0, n = 0; i < nports; i++) {
+		if (sp[i].cpi_failed)
+			free(sp[i].name);
+		else
+			sp[n++] = sp[i];
+	}
+	nports = n;
+	if (!nports)
+		IBEXIT("no ports to sample");
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!sample_stop) {
+		for (i = 0; i < nports; i++) {
+			sp[i].round_failed = 0;
+			sample_query(engine, &sp[i], IB_GSI_PORT_COUNTERS);
+			if (sample_ext(&sp[i]))
+				sample_query(engine, &sp[i],
+					     IB_GSI_PORT_COUNTERS_EXT);
+		}
+		if (mad_rpc_engine_wait(engine) < 0) {
+			if (sample_stop)
+				break;
+			IBEXIT("PMA query receive failed");
+		}
+
+		for (i = 0; i < nports; i++) {
+			if (sp[i].round_failed) {
+				if (!sp[i].failed)
+					IBWARN("counter query failed on %s port %d",
+					       portid2str(&sp[i].portid),
+					       sp[i].port);
+				sp[i].failed = 1;
+				continue;
+			}
+			sp[i].failed = 0;
+			if (sp[i].have_prev)
+				sample_print(&sp[i]);
+			memcpy(sp[i].prev, sp[i].val, sizeof(sp[i].prev));
+			sp[i].prev_ts = sp[i].ts;
+			sp[i].have_prev = 1;
+		}
+		fflush(stdout);
+
+		/* the first round only provides the base line */
+		if (sample_count && rounds++ == sample_count)
+			break;
+
+		next.tv_sec += sample_interval / 1000;
+		next.tv_nsec += (sample_interval % 1000) * 1000000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		/* skip the intervals a slow round overran */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec ||
+		    (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+			next = now;
+		while (!sample_stop &&
+		       clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+	}
+
+	mad_rpc_engine_destroy(engine);
+	for (i = 0; i < nports; i++)
+		free(sp[i].name);
+}
+
+struct sample_list {
+	struct sample_port *ports;
+	int count;
+	int size;
+	nn_map_t *node_name_map;
+};
+
+static struct sample_port *sample_add(struct sample_list *list)
+{
+	struct sample_port *sp;
+
+	if (list->count == list->size) {
+		list->size = list->size ? list->size * 2 : 256;
+		list->ports = realloc(list->ports,
+				      list->size * sizeof(*list->ports));
+		if (!list->ports)
+			IBEXIT("out of memory");
+	}
+	sp = &list->ports[list->count++];
+	memset(sp, 0, sizeof(*sp));
+	return sp;
+}
+
+static void sample_add_node(ibnd_node_t *node, void *user_data)
+{
+	struct sample_list *list = user_data;
+	struct sample_port *sp;
+	int cpi = -1;
+	ibnd_port_t *port;
+	int p;
+
+	for (p = 1; p <= node->numports; p++) {
+		port = node->ports[p];
+		if (!port || !port->remoteport)
+			continue;
+
+		sp = sample_add(list);
+		if (node->type == IB_NODE_SWITCH)
+			ib_portid_set(&sp->portid, node->smalid, 0, 0);
+		else
+			ib_portid_set(&sp->portid, port->base_lid, 0, 0);
+		sp->port = p;
+		sp->guid = node->guid;
+		sp->name = remap_node_name(list->node_name_map, node->guid,
+					   node->nodedesc);
+		/* all ports of a switch share one PMA, CA ports do not */
+		if (node->type != IB_NODE_SWITCH || cpi < 0)
+			cpi = list->count - 1;
+		sp->cpi = cpi;
+	}
+}
+
+/* Sample every linked port of the fabric, discovered once at start up */
+static void sample_fabric_ports(void)
+{
+	struct ibnd_config config = { 0 };
+	struct sample_list list = { 0 };
+	ibnd_fabric_t *fabric;
+
+	config.flags = ibd_ibnetdisc_flags;
+	config.mkey = ibd_mkey;
+	if (ibd_timeout)
+		config.timeout_ms = ibd_timeout;
+
+	fabric = ibnd_discover_fabric(ibd_ca, ibd_ca_port, NULL, &config);
+	if (!fabric)
+		IBEXIT("discover failed");
+
+	list.node_name_map = open_node_name_map(node_name_map_file);
+	ibnd_iter_nodes(fabric, sample_add_node, &list);
+	close_node_name_map(list.node_name_map);
+	ibnd_destroy_fabric(fabric);
+
+	sample_ports(list.ports, list.count);
+	free(list.ports);
+}
+
+/* Sample the ports of the destination selected on the command line */
+static void sample_dest_ports(ib_portid_t *portid, int *ports, int nports)
+{
+	uint8_t data[IB_SMP_DATA_SIZE] = { 0 };
+	struct sample_port *sp;
+	uint64_t guid = 0;
+	int i;
+
+	if (smp_query_via(data, portid, IB_ATTR_NODE_INFO, 0, 0, srcport))
+		mad_decode_field(data, IB_NODE_GUID_F, &guid);
+
+	sp = calloc(nports, sizeof(*sp));
+	if (!sp)
+		IBEXIT("out of memory");
+
+	for (i = 0; i < nports; i++) {
+		sp[i].portid = *portid;
+		sp[i].port = ports[i];
+		sp[i].guid = guid;
+	}
+
+	sample_ports(sp, nports);
+	free(sp);
+}
 static int process_opt(void *context, int ch)
 {
 	switch (ch) {
@@ -806,6 +1300,25 @@ static int process_opt(void *context, int ch)
 	case 'R':
 		info.reset_only++;
 		break;
+	case 13:
+		outstanding_pmas = strtoul(optarg, NULL, 0);
+		if (!outstanding_pmas)
+			outstanding_pmas = 1;
+		break;
+	case 14:
+		sample_interval = strtoul(optarg, NULL, 0);
+		if (!sample_interval)
+			sample_interval = 1;
+		break;
+	case 15:
+		sample_count = strtoul(optarg, NULL, 0);
+		break;
+	case 16:
+		sample_fabric = 1;
+		break;
+	case 17:
+		node_name_map_file = strdup(optarg);
+		break;
 	default:
 		return -1;
 	}
@@ -826,6 +1339,9 @@ int main(int argc, char **argv)
 	uint8_t data[IB_SMP_DATA_SIZE] = { 0 };
 	int start_port = 1;
 	int enhancedport0;
+	struct port_counters *cnt;
+	int ports[MAX_PORTS + 1];
+	int nports = 0, aggregate = 0;
 	char *tmpstr;
 	int i;
 
@@ -853,6 +1369,16 @@ int main(int argc, char **argv)
 		{"loop_ports", 'l', 0, NULL, "iterate through each port"},
 		{"reset_after_read", 'r', 0, NULL, "reset counters after read"},
 		{"Reset_only", 'R', 0, NULL, "only reset counters"},
+		{"outstanding_pmas", 13, 1, NULL,
+		 "specify the maximum number of outstanding PerfMgt MAD's "
+		 "to a single lid, default: 4"},
+		{"sample", 14, 1, "<ms>",
+		 "sample the counters every <ms> and print rates in line protocol"},
+		{"samples", 15, 1, "<n>",
+		 "stop sampling after <n> intervals, default: run until interrupted"},
+		{"fabric", 16, 0, NULL,
+		 "sample all linked ports of the fabric"},
+		{"node-name-map", 17, 1, "<file>", "node name map file"},
 		{}
 	};
 	char usage_args[] = " [<lid|guid> [[port(s)] [reset_mask]]]";
@@ -872,6 +1398,8 @@ int main(int argc, char **argv)
 		"-l 32 1-10\t# read performance counters from lid 32, port 1-10, output each port",
 		"-a 32 1,4,8\t# read performance counters from lid 32, port 1, 4, and 8, aggregate output",
 		"-l 32 1,4,8\t# read performance counters from lid 32, port 1, 4, and 8, output each port",
+		"--sample 1000 -l 32 1-10\t# print rates of lid 32, port 1-10 every second",
+		"--sample 10000 --fabric\t# print rates of all fabric ports every 10 seconds",
 		NULL,
 	};
 
@@ -922,6 +1450,13 @@ int main(int argc, char **argv)
 
 	smp_mkey_set(srcport, ibd_mkey);
 
+	if (sample_fabric) {
+		if (!sample_interval)
+			IBEXIT("--fabric requires --sample");
+		sample_fabric_ports();
+		goto done;
+	}
+
 	if (argc) {
 		if (resolve_portid_str(ibd_ca, ibd_ca_port, &portid, argv[0],
 				       ibd_dest_type, ibd_sm_id, srcport) < 0)
@@ -1063,29 +1598,37 @@ int main(int argc, char **argv)
 			    ("Emulating AllPortSelect by iterating through all ports");
 	}
 
-	if (info.reset_only)
-		goto do_reset;
-
 	if (all_ports_loop ||
 	    (info.loop_ports && (info.all_ports || info.port == ALL_PORTS))) {
 		for (i = start_port; i <= num_ports; i++)
-			dump_perfcounters(info.extended, ibd_timeout, cap_mask,
-					  cap_mask2, &portid, i,
-					  (all_ports_loop && !info.loop_ports));
-		if (all_ports_loop && !info.loop_ports) {
-			if (info.extended != 1)
-				output_aggregate_perfcounters(&portid,
-							      cap_mask);
-			else
-				output_aggregate_perfcounters_ext(&portid,
-								  cap_mask, cap_mask2);
-		}
+			ports[nports++] = i;
+		aggregate = all_ports_loop && !info.loop_ports;
 	} else if (info.ports_count > 1) {
 		for (i = 0; i < info.ports_count; i++)
+			ports[nports++] = info.ports[i];
+		aggregate = info.all_ports && !info.loop_ports;
+	}
+
+	if (sample_interval) {
+		if (nports)
+			sample_dest_ports(&portid, ports, nports);
+		else
+			sample_dest_ports(&portid, &info.port, 1);
+		goto done;
+	}
+
+	if (info.reset_only)
+		goto do_reset;
+
+	if (nports) {
+		cnt = query_perfcounters(info.extended, ibd_timeout, &portid,
+					 ports, nports);
+		for (i = 0; i < nports; i++)
 			dump_perfcounters(info.extended, ibd_timeout, cap_mask,
-					  cap_mask2, &portid, info.ports[i],
-					  (info.all_ports && !info.loop_ports));
-		if (info.all_ports && !info.loop_ports) {
+					  cap_mask2, &portid, ports[i],
+					  aggregate, &cnt[i]);
+		free(cnt);
+		if (aggregate) {
 			if (info.extended != 1)
 				output_aggregate_perfcounters(&portid,
 							      cap_mask);
@@ -1095,7 +1638,7 @@ int main(int argc, char **argv)
 		}
 	} else
 		dump_perfcounters(info.extended, ibd_timeout, cap_mask,
-				  cap_mask2, &portid, info.port, 0);
+				  cap_mask2, &portid, info.port, 0, NULL);
 
 	if (!info.reset)
 		goto done;
@@ -111,6 +111,7 @@ static uint16_t requested_lid;
 static int requested_lid_flag;
 static uint64_t requested_guid;
 static int requested_guid_flag;
+static int no_sa_cache;
 
 static unsigned valid_gid(ibmad_gid_t * gid)
 {
@@ -351,31 +352,27 @@ static void dump_multicast_group_record(void *data, struct query_params *p)
 }
 
 static void dump_multicast_member_record(ib_member_rec_t *p_mcmr,
-					 struct sa_query_result *nr_result,
+					 struct sa_node_index *nodes,
 					 struct query_params *params)
 {
 	char gid_str[INET6_ADDRSTRLEN];
 	char gid_str2[INET6_ADDRSTRLEN];
 	uint16_t mlid = be16toh(p_mcmr->mlid);
-	unsigned i = 0;
-	char *node_name = strdup("<unknown>");
+	char *node_name;
+	ib_node_record_t *nr;
 
-	/* go through the node records searching for a port guid which matches
-	 * this port gid interface id.
+	/* look up the node record whose port guid matches this port gid
+	 * interface id.
 	 * This gives us a node name to print, if available.
 	 */
-	for (i = 0; i < nr_result->result_cnt; i++) {
-		ib_node_record_t *nr = sa_get_query_rec(nr_result->p_result_madw, i);
-		if (nr->node_info.port_guid ==
-		    p_mcmr->port_gid.unicast.interface_id) {
-			if(node_name != NULL)
-				free(node_name);
-			node_name = remap_node_name(node_name_map,
-						be64toh(nr->node_info.node_guid),
-						(char *)nr->node_desc.description);
-			break;
-		}
-	}
+	nr = sa_node_index_port_guid(nodes,
+				     p_mcmr->port_gid.unicast.interface_id);
+	if (nr)
+		node_name = remap_node_name(node_name_map,
+					    be64toh(nr->node_info.node_guid),
+					    (char *)nr->node_desc.description);
+	else
+		node_name = strdup("<unknown>");
 
 	if (requested_name) {
 		if (strtol(requested_name, NULL, 0) == mlid)
@@ -854,34 +851,58 @@ static int get_and_dump_all_records(struct sa_handle * h, uint16_t attr_id,
 	return ret;
 }
 
+/**
+ * NodeRecords are needed by several lookups in a single invocation (names
+ * given for src and dst, member names for MCMemberRecords, ...); fetch the
+ * table once and index it.
+ */
+static struct sa_node_index node_index;
+static int node_index_valid;
+
+static struct sa_node_index *get_node_index(struct sa_handle * h, int *ret)
+{
+	if (!node_index_valid) {
+		*ret = sa_node_index_build(h, ibd_sakey, &node_index);
+		if (*ret)
+			return NULL;
+		node_index_valid = 1;
+	}
+	*ret = 0;
+	return &node_index;
+}
+
+static void free_node_index(void)
+{
+	if (node_index_valid)
+		sa_node_index_free(&node_index);
+	node_index_valid = 0;
+}
+
 /**
  * return the lid from the node descriptor (name) supplied
  */
 static int get_lid_from_name(struct sa_handle * h, const char *name, uint16_t * lid)
 {
-	ib_node_record_t *node_record = NULL;
+	struct sa_node_index *nodes;
+	ib_node_record_t *node_record;
 	unsigned i;
 	int ret;
-	struct sa_query_result result;
 
-	ret = get_all_records(h, IB_SA_ATTR_NODERECORD, &result);
-	if (ret)
+	nodes = get_node_index(h, &ret);
+	if (!nodes)
 		return ret;
 
-	ret = ENONET;
-	for (i = 0; i < result.result_cnt; i++) {
-		node_record = sa_get_query_rec(result.p_result_madw, i);
+	for (i = 0; i < nodes->cnt; i++) {
+		node_record = sa_get_query_rec(nodes->result.p_result_madw, i);
 		if (name
 		    && strncmp(name, (char *)node_record->node_desc.description,
 			       sizeof(node_record->node_desc.description)) ==
 		    0) {
 			*lid = be16toh(node_record->lid);
-			ret = 0;
-			break;
+			return 0;
 		}
 	}
-	sa_free_result_mad(&result);
-	return ret;
+	return ENONET;
 }
 
 static uint16_t get_lid(struct sa_handle * h, const char *name)
@@ -978,31 +999,38 @@ static int get_issm_records(struct sa_handle * h, __be32 capability_mask,
 
 static int print_node_records(struct sa_handle * h, struct query_params *p)
 {
+	struct sa_node_index *nodes;
+	ib_node_record_t *node_record;
+	struct sa_query_result *result;
 	unsigned i;
 	int ret;
-	struct sa_query_result result;
 
-	ret = get_all_records(h, IB_SA_ATTR_NODERECORD, &result);
-	if (ret)
+	nodes = get_node_index(h, &ret);
+	if (!nodes)
 		return ret;
+	result = &nodes->result;
+
+	if (node_print_desc == NAME_OF_LID) {
+		node_record = sa_node_index_lid(nodes, requested_lid);
+		if (node_record)
+			print_node_record(node_record);
+		return 0;
+	} else if (node_print_desc == NAME_OF_GUID) {
+		node_record = sa_node_index_port_guid(nodes,
+						      htobe64(requested_guid));
+		if (node_record)
+			print_node_record(node_record);
+		return 0;
+	}
 
 	if (node_print_desc == ALL_DESC) {
 		printf("   LID \"name\"\n");
 		printf("================\n");
 	}
-	for (i = 0; i < result.result_cnt; i++) {
-		ib_node_record_t *node_record;
-		node_record = sa_get_query_rec(result.p_result_madw, i);
+	for (i = 0; i < result->result_cnt; i++) {
+		node_record = sa_get_query_rec(result->p_result_madw, i);
 		if (node_print_desc == ALL_DESC) {
 			print_node_desc(node_record);
-		} else if (node_print_desc == NAME_OF_LID) {
-			if (requested_lid == be16toh(node_record->lid))
-				print_node_record(node_record);
-		} else if (node_print_desc == NAME_OF_GUID) {
-			ib_node_info_t *p_ni = &(node_record->node_info);
-
-			if (requested_guid == be64toh(p_ni->port_guid))
-				print_node_record(node_record);
 		} else {
 			ib_node_info_t *p_ni = &(node_record->node_info);
 			ib_node_desc_t *p_nd = &(node_record->node_desc);
@@ -1023,7 +1051,7 @@ static int print_node_records(struct sa_handle * h, struct query_params *p)
 					    node_desc.description)) == 0)) {
 				print_node_record(node_record);
 				if (node_print_desc == UNIQUE_LID_ONLY) {
-					sa_free_result_mad(&result);
+					free_node_index();
 					exit(0);
 				}
 			}
@@ -1031,7 +1059,6 @@ static int print_node_records(struct sa_handle * h, struct query_params *p)
 			free(name);
 		}
 	}
-	sa_free_result_mad(&result);
 	return ret;
 }
 
@@ -1105,7 +1132,7 @@ static int print_multicast_member_records(struct sa_handle * h,
 					struct query_params *params)
 {
 	struct sa_query_result mc_group_result;
-	struct sa_query_result nr_result;
+	struct sa_node_index *nodes;
 	int ret;
 	unsigned i;
 
@@ -1113,19 +1140,17 @@ static int print_multicast_member_records(struct sa_handle * h,
 	if (ret)
 		return ret;
 
-	ret = get_all_records(h, IB_SA_ATTR_NODERECORD, &nr_result);
-	if (ret)
+	nodes = get_node_index(h, &ret);
+	if (!nodes)
 		goto return_mc;
 
 	for (i = 0; i < mc_group_result.result_cnt; i++) {
 		ib_member_rec_t *rec = (ib_member_rec_t *)
 				sa_get_query_rec(mc_group_result.p_result_madw,
 					      i);
-		dump_multicast_member_record(rec, &nr_result, params);
+		dump_multicast_member_record(rec, nodes, params);
 	}
 
-	sa_free_result_mad(&nr_result);
-
 return_mc:
 	sa_free_result_mad(&mc_group_result);
 
@@ -1695,6 +1720,9 @@ static int process_opt(void *context, int ch)
 	case 22:
 		p->service_id = strtoull(optarg, NULL, 0);
 		break;
+	case 23:
+		no_sa_cache = 1;
+		break;
 	default:
 		return -1;
 	}
@@ -1779,6 +1807,8 @@ int main(int argc, char **argv)
 		{"join_state", 'J', 1, NULL, "Join state (MCMemberRecord)"},
 		{"proxy_join", 'X', 1, NULL, "Proxy join (MCMemberRecord)"},
 		{"service_id", 22, 1, NULL, "ServiceID (PathRecord)"},
+		{"no-sa-cache", 23, 0, NULL,
+		 "always query the SM, ignoring sa_cache_dir in ibdiag.conf"},
 		{}
 	};
 
@@ -1809,6 +1839,11 @@ int main(int argc, char **argv)
 	ibdiag_process_opts(argc, argv, &params, "DGLsy", opts, process_opt,
 			    usage_args, NULL);
 
+	if (no_sa_cache) {
+		free(ibd_sa_cache_dir);
+		ibd_sa_cache_dir = NULL;
+	}
+
 	argc -= optind;
 	argv += optind;
 
@@ -1910,6 +1945,7 @@ int main(int argc, char **argv)
 error:
 	if (src_lid)
 		free(src_lid);
+	free_node_index();
 	sa_free_handle(h);
 	umad_done();
 	close_node_name_map(node_name_map);
@@ -76,6 +76,7 @@
 #define IWARP_PM_REQ_ACK    4
 
 #define IWARP_PM_RECV_PAYLOAD 4096
+#define IWARP_PM_NL_BATCH     32 /* netlink messages per recvmmsg/sendmmsg */
 #define IWARP_PM_MAX_CLIENTS  64
 #define IWPM_MAP_REQ_TIMEOUT  10 /* sec */
 #define IWPM_SEND_MSG_RETRIES 3
@@ -133,8 +134,29 @@ typedef union sockaddr_union {
 	struct sockaddr_nl nl_sockaddr;
 } sockaddr_union;
 
+/* chained hash table, doubles in size as it fills */
+struct iwpm_hash_node {
+	struct list_node	entry;
+	__u32			key;
+};
+
+struct iwpm_hash {
+	struct list_head       *buckets;
+	unsigned int		size;
+	unsigned int		count;
+};
+
+/* mapped port indexes */
+enum {
+	IWPM_LOCAL_INDEX,
+	IWPM_MAPPED_INDEX,
+	IWPM_NUM_INDEXES
+};
+
 typedef struct iwpm_mapped_port {
 	struct list_node	    entry;
+	struct iwpm_hash_node	    addr_node[IWPM_NUM_INDEXES]; /* by address */
+	struct iwpm_hash_node	    port_node[IWPM_NUM_INDEXES]; /* by tcp port */
 	int			    owner_client;
 	int			    sd;
 	struct sockaddr_storage	    local_addr;
@@ -165,6 +187,7 @@ typedef struct iwpm_send_msg {
 
 typedef struct iwpm_mapping_request {
 	struct list_node		entry;
+	struct iwpm_hash_node		assoc_node;	/* by assochandle */
 	struct sockaddr_storage		src_addr;
 	struct sockaddr_storage		remote_addr;
 	__u16 				nlmsg_type;     /* Message content */
@@ -224,6 +247,10 @@ void form_iwpm_reject(iwpm_wire_msg *, iwpm_msg_parms *);
 
 int send_iwpm_nlmsg(int, struct nl_msg *, int);
 
+void start_iwpm_nlmsg_batch(void);
+
+int flush_iwpm_nlmsg_batch(int);
+
 struct nl_msg *create_iwpm_nlmsg(__u16, int);
 
 void print_iwpm_sockaddr(struct sockaddr_storage *, const char *, __u32);
@@ -274,6 +301,8 @@ int check_same_sockaddr(struct sockaddr_storage *, struct sockaddr_storage *);
 
 void free_iwpm_mapped_ports(void);
 
+int init_iwpm_indexes(void);
+
 extern struct list_head pending_messages;
 extern struct list_head mapping_reqs;
 
@@ -31,6 +31,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include "iwarp_pm.h"
 #include <endian.h>
 
@@ -319,11 +320,95 @@ parse_nlmsg_error:
 	return ret;
 }
 
+/*
+ * Netlink messages queued for sending with a single sendmmsg,
+ * used only by the main iwarp port mapper thread
+ */
+static struct {
+	int			active;
+	unsigned int		count;
+	struct mmsghdr		msgs[IWARP_PM_NL_BATCH];
+	struct iovec		iov[IWARP_PM_NL_BATCH];
+	struct sockaddr_nl	dest_addr[IWARP_PM_NL_BATCH];
+} nlmsg_batch;
+
+/**
+ * start_iwpm_nlmsg_batch - Queue netlink messages until the batch is flushed
+ *
+ * The messages passed to send_iwpm_nlmsg() are copied and sent by
+ * flush_iwpm_nlmsg_batch(), or when the batch fills up
+ */
+void start_iwpm_nlmsg_batch(void)
+{
+	nlmsg_batch.active = 1;
+}
+
+/**
+ * flush_iwpm_nlmsg_batch - Send the queued netlink messages and stop queueing
+ * @nl_sock: netlink socket to use for sending the messages
+ *
+ * Returns 0 if all messages were sent, otherwise the error of the first failure
+ */
+int flush_iwpm_nlmsg_batch(int nl_sock)
+{
+	unsigned int i, sent = 0;
+	int len, ret = 0;
+
+	while (sent < nlmsg_batch.count) {
+		len = sendmmsg(nl_sock, &nlmsg_batch.msgs[sent],
+			       nlmsg_batch.count - sent, 0);
+		if (len <= 0) {
+			/* skip the message which can't be sent */
+			if (!ret)
+				ret = -errno;
+			syslog(LOG_WARNING, "flush_iwpm_nlmsg_batch: Unable to send "
+				"nlmsg to pid = %u (%s).\n",
+				nlmsg_batch.dest_addr[sent].nl_pid, strerror(errno));
+			len = 1;
+		}
+		sent += len;
+	}
+	for (i = 0; i < nlmsg_batch.count; i++)
+		free(nlmsg_batch.iov[i].iov_base);
+	nlmsg_batch.count = 0;
+	nlmsg_batch.active = 0;
+	return ret;
+}
+
+static int queue_iwpm_nlmsg(int nl_sock, struct nlmsghdr *nlh,
+				struct sockaddr_nl *dest_addr)
+{
+	unsigned int i;
+	void *data;
+
+	if (nlmsg_batch.count == IWARP_PM_NL_BATCH) {
+		flush_iwpm_nlmsg_batch(nl_sock);
+		nlmsg_batch.active = 1;
+	}
+	data = malloc(nlh->nlmsg_len);
+	if (!data)
+		return -ENOMEM;
+	memcpy(data, nlh, nlh->nlmsg_len);
+
+	i = nlmsg_batch.count++;
+	nlmsg_batch.iov[i].iov_base = data;
+	nlmsg_batch.iov[i].iov_len = nlh->nlmsg_len;
+	nlmsg_batch.dest_addr[i] = *dest_addr;
+	memset(&nlmsg_batch.msgs[i], 0, sizeof(nlmsg_batch.msgs[i]));
+	nlmsg_batch.msgs[i].msg_hdr.msg_name = &nlmsg_batch.dest_addr[i];
+	nlmsg_batch.msgs[i].msg_hdr.msg_namelen = sizeof(nlmsg_batch.dest_addr[i]);
+	nlmsg_batch.msgs[i].msg_hdr.msg_iov = &nlmsg_batch.iov[i];
+	nlmsg_batch.msgs[i].msg_hdr.msg_iovlen = 1;
+	return 0;
+}
+
 /**
  * send_iwpm_nlmsg - Send a netlink message
  * @nl_sock:  netlink socket to use for sending the message
  * @nlmsg:    netlink message to send
  * @dest_pid: pid of the destination of the nlmsg
+ *
+ * If a batch is started, the message is only queued for sending
  */
 int send_iwpm_nlmsg(int nl_sock, struct nl_msg *nlmsg, int dest_pid)
 {
@@ -338,6 +423,9 @@ int send_iwpm_nlmsg(int nl_sock, struct nl_msg *nlmsg, int dest_pid)
 	dest_addr.nl_family = AF_NETLINK;
 	dest_addr.nl_pid = dest_pid;
 
+	if (nlmsg_batch.active)
+		return queue_iwpm_nlmsg(nl_sock, nlh, &dest_addr);
+
 	/* send response to the client */
 	len = sendto(nl_sock, (char *)nlh, nlmsg_len, 0,
 		     	(struct sockaddr *)&dest_addr, sizeof(dest_addr));
@@ -34,6 +34,142 @@
 #include "iwarp_pm.h"
 
 static LIST_HEAD(mapped_ports);		/* list of mapped ports */
+/* mapped ports hashed by local/mapped address and by local/mapped tcp port */
+static struct iwpm_hash addr_index[IWPM_NUM_INDEXES];
+static struct iwpm_hash port_index[IWPM_NUM_INDEXES];
+/* mapping requests hashed by assochandle, protected by map_req_mutex */
+static struct iwpm_hash map_req_index;
+
+#define IWPM_HASH_MIN_SIZE 64
+
+static __u32 iwpm_hash_bytes(__u32 hash, const void *data, size_t len)
+{
+	const __u8 *p = data;
+
+	/* FNV-1a */
+	while (len--)
+		hash = (hash ^ *p++) * 16777619;
+	return hash;
+}
+
+static __u32 iwpm_addr_key(struct sockaddr_storage *sockaddr)
+{
+	__u32 hash = iwpm_hash_bytes(2166136261u, &sockaddr->ss_family,
+				     sizeof(sockaddr->ss_family));
+	__be16 port;
+
+	switch (sockaddr->ss_family) {
+	case AF_INET: {
+		struct sockaddr_in *in4addr = (struct sockaddr_in *)sockaddr;
+
+		hash = iwpm_hash_bytes(hash, &in4addr->sin_addr, sizeof(in4addr->sin_addr));
+		break;
+	}
+	case AF_INET6: {
+		struct sockaddr_in6 *in6addr = (struct sockaddr_in6 *)sockaddr;
+
+		hash = iwpm_hash_bytes(hash, &in6addr->sin6_addr, sizeof(in6addr->sin6_addr));
+		break;
+	}
+	default:
+		break;
+	}
+	port = get_sockaddr_port(sockaddr);
+	return iwpm_hash_bytes(hash, &port, sizeof(port));
+}
+
+static __u32 iwpm_port_key(struct sockaddr_storage *sockaddr)
+{
+	__be16 port = get_sockaddr_port(sockaddr);
+
+	return iwpm_hash_bytes(2166136261u, &port, sizeof(port));
+}
+
+static struct list_head *iwpm_hash_bucket(struct iwpm_hash *hash, __u32 key)
+{
+	return &hash->buckets[key & (hash->size - 1)];
+}
+
+static int iwpm_hash_resize(struct iwpm_hash *hash, unsigned int size)
+{
+	struct list_head *buckets, *old = hash->buckets;
+	struct iwpm_hash_node *node;
+	unsigned int i, old_size = hash->size;
+
+	buckets = malloc(size * sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
+	for (i = 0; i < size; i++)
+		list_head_init(&buckets[i]);
+	hash->buckets = buckets;
+	hash->size = size;
+
+	/* keep the order of the nodes within a bucket */
+	for (i = 0; i < old_size; i++)
+		while ((node = list_pop(&old[i], struct iwpm_hash_node, entry)))
+			list_add_tail(iwpm_hash_bucket(hash, node->key), &node->entry);
+	free(old);
+	return 0;
+}
+
+/**
+ * iwpm_hash_add - Insert a node ahead of the nodes with the same key
+ * @hash: hash table
+ * @node: node to insert
+ * @key: hash key of the node
+ *
+ * Grow the table when it gets twice as many nodes as buckets,
+ * if that fails keep the longer chains.
+ */
+static void iwpm_hash_add(struct iwpm_hash *hash, struct iwpm_hash_node *node, __u32 key)
+{
+	if (hash->count >= 2 * hash->size)
+		iwpm_hash_resize(hash, 2 * hash->size);
+	node->key = key;
+	list_add(iwpm_hash_bucket(hash, key), &node->entry);
+	hash->count++;
+}
+
+static void iwpm_hash_del(struct iwpm_hash *hash, struct iwpm_hash_node *node)
+{
+	list_del(&node->entry);
+	hash->count--;
+}
+
+static void iwpm_hash_free(struct iwpm_hash *hash)
+{
+	free(hash->buckets);
+	memset(hash, 0, sizeof(*hash));
+}
+
+static __u32 iwpm_assoc_key(__u64 assochandle)
+{
+	return iwpm_hash_bytes(2166136261u, &assochandle, sizeof(assochandle));
+}
+
+/**
+ * init_iwpm_indexes - Allocate the mapped port and mapping request indexes
+ */
+int init_iwpm_indexes(void)
+{
+	int i;
+
+	for (i = 0; i < IWPM_NUM_INDEXES; i++) {
+		if (iwpm_hash_resize(&addr_index[i], IWPM_HASH_MIN_SIZE) ||
+		    iwpm_hash_resize(&port_index[i], IWPM_HASH_MIN_SIZE))
+			goto init_indexes_error;
+	}
+	if (iwpm_hash_resize(&map_req_index, IWPM_HASH_MIN_SIZE))
+		goto init_indexes_error;
+	return 0;
+
+init_indexes_error:
+	for (i = 0; i < IWPM_NUM_INDEXES; i++) {
+		iwpm_hash_free(&addr_index[i]);
+		iwpm_hash_free(&port_index[i]);
+	}
+	return -ENOMEM;
+}
 
 /**
  * create_iwpm_map_request - Create a new map request tracking object
@@ -89,6 +225,8 @@ void add_iwpm_map_request(iwpm_mapping_request *iwpm_map_req)
 {
 	pthread_mutex_lock(&map_req_mutex);
 	list_add(&mapping_reqs, &iwpm_map_req->entry);
+	iwpm_hash_add(&map_req_index, &iwpm_map_req->assoc_node,
+		      iwpm_assoc_key(iwpm_map_req->assochandle));
 	/* if not wake, signal the thread that a new request has been posted */
 	if (!wake)
 		pthread_cond_signal(&cond_req_complete);
@@ -109,6 +247,7 @@ void remove_iwpm_map_request(iwpm_mapping_request *iwpm_map_req)
 			iwpm_map_req->msg_type, iwpm_map_req->nlmsg_pid);
 	}
 	list_del(&iwpm_map_req->entry);
+	iwpm_hash_del(&map_req_index, &iwpm_map_req->assoc_node);
 	if (iwpm_map_req->send_msg)
 		free(iwpm_map_req->send_msg);
 	free(iwpm_map_req);
@@ -126,11 +265,14 @@ int update_iwpm_map_request(__u64 assochandle, struct sockaddr_storage *src_addr
 				int msg_type, iwpm_mapping_request *iwpm_copy_req, int update)
 {
 	iwpm_mapping_request *iwpm_map_req;
+	struct iwpm_hash_node *node;
+	__u32 key = iwpm_assoc_key(assochandle);
 	int ret = -EINVAL;
 
 	pthread_mutex_lock(&map_req_mutex);
-	/* look for a matching entry in the list */
-	list_for_each(&mapping_reqs, iwpm_map_req, entry) {
+	/* look for a matching entry in the assochandle bucket */
+	list_for_each(iwpm_hash_bucket(&map_req_index, key), node, entry) {
+		iwpm_map_req = container_of(node, iwpm_mapping_request, assoc_node);
 		if (assochandle == iwpm_map_req->assochandle &&
 				(msg_type & iwpm_map_req->msg_type) &&
 				check_same_sockaddr(src_addr, &iwpm_map_req->src_addr)) {
@@ -426,6 +568,25 @@ void add_iwpm_mapped_port(iwpm_mapped_port *iwpm_port)
 		return;
 	iwpm_debug(IWARP_PM_ALL_DBG, "add_iwpm_mapped_port: Adding a new mapping #%d\n", dbg_idx++);
 	list_add(&mapped_ports, &iwpm_port->entry);
+
+	iwpm_hash_add(&addr_index[IWPM_LOCAL_INDEX], &iwpm_port->addr_node[IWPM_LOCAL_INDEX],
+		      iwpm_addr_key(&iwpm_port->local_addr));
+	iwpm_hash_add(&addr_index[IWPM_MAPPED_INDEX], &iwpm_port->addr_node[IWPM_MAPPED_INDEX],
+		      iwpm_addr_key(&iwpm_port->mapped_addr));
+	iwpm_hash_add(&port_index[IWPM_LOCAL_INDEX], &iwpm_port->port_node[IWPM_LOCAL_INDEX],
+		      iwpm_port_key(&iwpm_port->local_addr));
+	iwpm_hash_add(&port_index[IWPM_MAPPED_INDEX], &iwpm_port->port_node[IWPM_MAPPED_INDEX],
+		      iwpm_port_key(&iwpm_port->mapped_addr));
+}
+
+static void del_iwpm_mapped_port_indexes(iwpm_mapped_port *iwpm_port)
+{
+	int i;
+
+	for (i = 0; i < IWPM_NUM_INDEXES; i++) {
+		iwpm_hash_del(&addr_index[i], &iwpm_port->addr_node[i]);
+		iwpm_hash_del(&port_index[i], &iwpm_port->port_node[i]);
+	}
 }
 
 /**
@@ -469,57 +630,69 @@ int check_same_sockaddr(struct sockaddr_storage *sockaddr_a, struct sockaddr_sto
 
 /**
  * find_iwpm_mapping - Find saved mapped port object
- * @search_addr: IP address and port to search for in the list
+ * @search_addr: IP address and port to search for
  * @not_mapped: if set, compare local addresses, otherwise compare mapped addresses
  *
- * Compares the search_sockaddr to the addresses in the list,
- * to find a saved port object with the sockaddr or
- * a wild card address with the same tcp port
+ * Look up a saved port object with the search_addr sockaddr and
+ * failing that, a wild card address with the same tcp port
+ * (or any address with the same tcp port if search_addr is a wild card)
  */
 iwpm_mapped_port *find_iwpm_mapping(struct sockaddr_storage *search_addr,
 		int not_mapped)
 {
-	iwpm_mapped_port *iwpm_port, *saved_iwpm_port = NULL;
+	int idx = (not_mapped) ? IWPM_LOCAL_INDEX : IWPM_MAPPED_INDEX;
+	__be16 search_port = get_sockaddr_port(search_addr);
+	iwpm_mapped_port *iwpm_port;
 	struct sockaddr_storage *current_addr;
-
-	list_for_each(&mapped_ports, iwpm_port, entry) {
-		current_addr = (not_mapped)? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
-
-		if (get_sockaddr_port(search_addr) == get_sockaddr_port(current_addr)) {
-			if (check_same_sockaddr(search_addr, current_addr) ||
-					iwpm_port->wcard || is_wcard_ipaddr(search_addr)) {
-				saved_iwpm_port = iwpm_port;
-				goto find_mapping_exit;
-			}
-		}
+	struct iwpm_hash_node *node;
+	__u32 key;
+	int wcard_search;
+
+	iwpm_port = find_iwpm_same_mapping(search_addr, not_mapped);
+	if (iwpm_port)
+		return iwpm_port;
+
+	wcard_search = is_wcard_ipaddr(search_addr);
+	key = iwpm_port_key(search_addr);
+	list_for_each(iwpm_hash_bucket(&port_index[idx], key), node, entry) {
+		if (node->key != key)
+			continue;
+		iwpm_port = container_of(node - idx, iwpm_mapped_port, port_node[0]);
+		current_addr = (not_mapped) ? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
+
+		if (search_port == get_sockaddr_port(current_addr) &&
+				(iwpm_port->wcard || wcard_search))
+			return iwpm_port;
 	}
-find_mapping_exit:
-	return saved_iwpm_port;
+	return NULL;
 }
 
 /**
  * find_iwpm_same_mapping - Find saved mapped port object
- * @search_addr: IP address and port to search for in the list
+ * @search_addr: IP address and port to search for
  * @not_mapped: if set, compare local addresses, otherwise compare mapped addresses
  *
- * Compares the search_sockaddr to the addresses in the list,
- * to find a saved port object with the same sockaddr
+ * Look up a saved port object with the same sockaddr as search_addr
  */
 iwpm_mapped_port *find_iwpm_same_mapping(struct sockaddr_storage *search_addr,
 		int not_mapped)
 {
-	iwpm_mapped_port *iwpm_port, *saved_iwpm_port = NULL;
+	int idx = (not_mapped) ? IWPM_LOCAL_INDEX : IWPM_MAPPED_INDEX;
+	iwpm_mapped_port *iwpm_port;
 	struct sockaddr_storage *current_addr;
+	struct iwpm_hash_node *node;
+	__u32 key = iwpm_addr_key(search_addr);
 
-	list_for_each(&mapped_ports, iwpm_port, entry) {
-		current_addr = (not_mapped)? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
-		if (check_same_sockaddr(search_addr, current_addr)) {
-			saved_iwpm_port = iwpm_port;
-			goto find_same_mapping_exit;
-		}
+	list_for_each(iwpm_hash_bucket(&addr_index[idx], key), node, entry) {
+		if (node->key != key)
+			continue;
+		iwpm_port = container_of(node - idx, iwpm_mapped_port, addr_node[0]);
+		current_addr = (not_mapped) ? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
+
+		if (check_same_sockaddr(search_addr, current_addr))
+			return iwpm_port;
 	}
-find_same_mapping_exit:
-	return saved_iwpm_port;
+	return NULL;
 }
 
 /**
@@ -545,6 +718,7 @@ void remove_iwpm_mapped_port(iwpm_mapped_port *iwpm_port)
 	iwpm_debug(IWARP_PM_ALL_DBG, "remove_iwpm_mapped_port: index = %d\n", dbg_idx++);
 
 	list_del(&iwpm_port->entry);
+	del_iwpm_mapped_port_indexes(iwpm_port);
 }
 
 void print_iwpm_mapped_ports(void)
@@ -594,12 +768,27 @@ int add_iwpm_pending_msg(iwpm_send_msg *send_msg)
 }
 
 /**
- * free_iwpm_mapped_ports - Free all iwpm mapped port objects
+ * free_iwpm_mapped_ports - Free all iwpm mapped port and map request objects
  */
 void free_iwpm_mapped_ports(void)
 {
 	iwpm_mapped_port *iwpm_port;
+	iwpm_mapping_request *iwpm_map_req;
+
+	int i;
 
-	while ((iwpm_port = list_pop(&mapped_ports, iwpm_mapped_port, entry)))
+	while ((iwpm_port = list_pop(&mapped_ports, iwpm_mapped_port, entry))) {
+		del_iwpm_mapped_port_indexes(iwpm_port);
 		free_iwpm_port(iwpm_port);
+	}
+	for (i = 0; i < IWPM_NUM_INDEXES; i++) {
+		iwpm_hash_free(&addr_index[i]);
+		iwpm_hash_free(&port_index[i]);
+	}
+
+	pthread_mutex_lock(&map_req_mutex);
+	while ((iwpm_map_req = list_top(&mapping_reqs, iwpm_mapping_request, entry)))
+		remove_iwpm_map_request(iwpm_map_req);
+	iwpm_hash_free(&map_req_index);
+	pthread_mutex_unlock(&map_req_mutex);
 }
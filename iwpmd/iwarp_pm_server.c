@@ -31,6 +31,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include "config.h"
 #include <systemd/sd-daemon.h>
 #include <getopt.h>
@@ -60,32 +61,27 @@ pthread_cond_t cond_pending_msg;
 pthread_mutex_t pending_msg_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void iwpm_cleanup(void);
-static int print_mappings = 0;
+static volatile sig_atomic_t print_mappings = 0;
+static volatile sig_atomic_t exit_signal = 0;
 static int send_iwpm_mapinfo_request(int nl_sock, int client);
 
 /**
  * iwpm_signal_handler - Handle signals which iwarp port mapper receives
  * @signum: the number of the caught signal
+ *
+ * Only sets a flag, iwarp_port_mapper() acts on it outside of signal context
  */
 static void iwpm_signal_handler(int signum)
 {
 	switch(signum) {
 		case SIGHUP:
-			syslog(LOG_WARNING, "iwpm_signal_handler: Received SIGHUP signal\n");
-			iwpm_cleanup();
-			exit(signum);
-			break;
 		case SIGTERM:
-			syslog(LOG_WARNING, "iwpm_signal_handler: Received SIGTERM signal\n");
-			iwpm_cleanup();
-			exit(EXIT_SUCCESS);
+			exit_signal = signum;
 			break;
 		case SIGUSR1:
-			syslog(LOG_WARNING, "iwpm_signal_handler: Received SIGUSR1 signal\n");
 			print_mappings = 1;
 			break;
 		default:
-			syslog(LOG_WARNING, "iwpm_signal_handler: Unhandled signal %d\n", signum);
 			break;
 	}
 }
@@ -1125,42 +1121,21 @@ hello_error:
 }
 
 /**
- * process_iwpm_netlink_msg - Dispatch received netlink messages
- * @nl_sock: netlink socket to read the messages from
+ * dispatch_iwpm_nlmsg - Dispatch the netlink messages of a received datagram
+ * @nlh: the first netlink message in the datagram
+ * @len: length of the datagram
+ * @nl_sock: netlink socket to send responses to
  */
-static int process_iwpm_netlink_msg(int nl_sock)
+static int dispatch_iwpm_nlmsg(struct nlmsghdr *nlh, int len, int nl_sock)
 {
-	char *recv_buffer = NULL;
-	struct nlmsghdr *nlh;
-	struct sockaddr_nl src_addr;
-	int len, type, client_idx, op;
-	socklen_t src_addr_len;
+	int type, client_idx, op;
 	const char *str_err = "";
 	int ret = 0;
 
-	recv_buffer = malloc(NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD));
-	if (!recv_buffer) {
-		ret = -ENOMEM;
-		str_err = "Unable to allocate receive socket buffer";
-		goto process_netlink_msg_exit;
-	}
-	/* receive a new message */
-	nlh = (struct nlmsghdr *)recv_buffer;
-	memset(nlh, 0, NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD));
-	memset(&src_addr, 0, sizeof(src_addr));
-
-	src_addr_len = sizeof(src_addr);
-	len = recvfrom(nl_sock, (void *)nlh, NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD), 0,
-			(struct sockaddr *)&src_addr, &src_addr_len);
-	if (len <= 0) {
-		ret = -errno;
-		str_err = "Unable to receive data from netlink socket";
-		goto process_netlink_msg_exit;
-	}
 	/* loop for multiple netlink messages packed together */
 	while (NLMSG_OK(nlh, len) != 0) {
 		if (nlh->nlmsg_type == NLMSG_DONE) {
-			goto process_netlink_msg_exit;
+			goto dispatch_nlmsg_exit;
 		}
 
 		type = nlh->nlmsg_type;
@@ -1174,7 +1149,7 @@ static int process_iwpm_netlink_msg(int nl_sock)
 				iwpm_debug(IWARP_PM_NETLINK_DBG, "process_netlink_msg: "
 					"Netlink error message seq = %u\n", nlh->nlmsg_seq);
 			}
-			goto process_netlink_msg_exit;
+			goto dispatch_nlmsg_exit;
 		}
 		op = RDMA_NL_GET_OP(type);
 		iwpm_debug(IWARP_PM_NETLINK_DBG, "process_netlink_msg: Received a new message: "
@@ -1185,7 +1160,7 @@ static int process_iwpm_netlink_msg(int nl_sock)
 		if (client_idx >= IWARP_PM_MAX_CLIENTS) {
 			ret = -EINVAL;
 			str_err = "Invalid client index";
-			goto process_netlink_msg_exit;
+			goto dispatch_nlmsg_exit;
 		}
 		switch (op) {
 		case RDMA_NL_IWPM_REG_PID:
@@ -1196,7 +1171,7 @@ static int process_iwpm_netlink_msg(int nl_sock)
 			str_err = "Add Mapping request";
 			if (!client_list[client_idx].valid) {
 				ret = -EINVAL;
-				goto process_netlink_msg_exit;
+				goto dispatch_nlmsg_exit;
 			}
 			ret = process_iwpm_add_mapping(nlh, client_idx, nl_sock);
 			break;
@@ -1204,7 +1179,7 @@ static int process_iwpm_netlink_msg(int nl_sock)
 			str_err = "Query Mapping request";
 			if (!client_list[client_idx].valid) {
 				ret = -EINVAL;
-				goto process_netlink_msg_exit;
+				goto dispatch_nlmsg_exit;
 			}
 			ret = process_iwpm_query_mapping(nlh, client_idx, nl_sock);
 			break;
@@ -1228,17 +1203,80 @@ static int process_iwpm_netlink_msg(int nl_sock)
 		}
 		nlh = NLMSG_NEXT(nlh, len);
 		if (ret)
-			goto process_netlink_msg_exit;
+			goto dispatch_nlmsg_exit;
 	}
 
-process_netlink_msg_exit:
-	if (recv_buffer)
-		free(recv_buffer);
+dispatch_nlmsg_exit:
 	if (ret)
 		syslog(LOG_WARNING, "process_netlink_msg: %s error (ret = %d).\n", str_err, ret);
 	return ret;
 }
 
+/* receive buffers for a batch of netlink datagrams */
+static char *nl_recv_buffer;
+
+/**
+ * process_iwpm_netlink_msg - Dispatch received netlink messages
+ * @nl_sock: netlink socket to read the messages from
+ *
+ * Receive up to IWARP_PM_NL_BATCH datagrams with a single recvmmsg
+ * and send all responses to them with a single sendmmsg
+ */
+static int process_iwpm_netlink_msg(int nl_sock)
+{
+	struct mmsghdr msgs[IWARP_PM_NL_BATCH];
+	struct iovec iov[IWARP_PM_NL_BATCH];
+	struct sockaddr_nl src_addr[IWARP_PM_NL_BATCH];
+	const size_t buf_size = NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD);
+	const char *str_err = "";
+	int i, num_msgs, ret = 0;
+
+	if (!nl_recv_buffer) {
+		nl_recv_buffer = malloc(IWARP_PM_NL_BATCH * buf_size);
+		if (!nl_recv_buffer) {
+			ret = -ENOMEM;
+			str_err = "Unable to allocate receive socket buffer";
+			goto process_netlink_msg_exit;
+		}
+	}
+	memset(msgs, 0, sizeof(msgs));
+	memset(src_addr, 0, sizeof(src_addr));
+	for (i = 0; i < IWARP_PM_NL_BATCH; i++) {
+		iov[i].iov_base = nl_recv_buffer + i * buf_size;
+		iov[i].iov_len = buf_size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &src_addr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(src_addr[i]);
+	}
+
+	/* receive the new messages, select() found at least one */
+	num_msgs = recvmmsg(nl_sock, msgs, IWARP_PM_NL_BATCH, MSG_DONTWAIT, NULL);
+	if (num_msgs <= 0) {
+		if (num_msgs < 0 && errno == EAGAIN)
+			goto process_netlink_msg_exit;
+		ret = -errno;
+		str_err = "Unable to receive data from netlink socket";
+		goto process_netlink_msg_exit;
+	}
+
+	start_iwpm_nlmsg_batch();
+	for (i = 0; i < num_msgs; i++) {
+		if (!msgs[i].msg_len)
+			continue;
+		/* keep going with the rest of the batch */
+		if (dispatch_iwpm_nlmsg((struct nlmsghdr *)iov[i].iov_base,
+					msgs[i].msg_len, nl_sock))
+			ret = -EINVAL;
+	}
+	flush_iwpm_nlmsg_batch(nl_sock);
+	return ret;
+
+process_netlink_msg_exit:
+	syslog(LOG_WARNING, "process_netlink_msg: %s error (ret = %d).\n", str_err, ret);
+	return ret;
+}
+
 /**
  * process_iwpm_msg - Dispatch iwpm wire messages, sent by the remote peer
  * @pm_sock: socket handle to read the messages from
@@ -1408,7 +1446,13 @@ static int iwarp_port_mapper(void)
 	/* poll a set of sockets */
 	do {
 		do {
+			if (exit_signal) {
+				syslog(LOG_WARNING, "iwarp_port_mapper: Received %s signal\n",
+					exit_signal == SIGHUP ? "SIGHUP" : "SIGTERM");
+				goto iwarp_port_mapper_exit;
+			}
 			if (print_mappings) {
+				syslog(LOG_WARNING, "iwarp_port_mapper: Received SIGUSR1 signal\n");
 				print_iwpm_mapped_ports();
 				print_mappings = 0;
 			}
@@ -1479,6 +1523,7 @@ static void daemonize_iwpm_server(void)
 int main(int argc, char *argv[])
 {
 	FILE *fp;
+	sigset_t sigset;
 	int c;
 	int ret = EXIT_FAILURE;
 	bool systemd = false;
@@ -1516,6 +1561,9 @@ int main(int argc, char *argv[])
 	}
 	memset(client_list, 0, sizeof(client_list));
 
+	if (init_iwpm_indexes())
+		goto error_exit_v4;
+
 	pmv4_sock = create_iwpm_socket_v4(IWARP_PM_PORT);
 	if (pmv4_sock < 0)
 		goto error_exit_v4;
@@ -1543,11 +1591,17 @@ int main(int argc, char *argv[])
 	pthread_cond_init(&cond_req_complete, NULL);
 	pthread_cond_init(&cond_pending_msg, NULL);
 
-	ret = pthread_create(&map_req_thread, NULL, iwpm_mapping_reqs_handler, NULL);
-	if (ret)
-		goto error_exit;
+	/* the signals interrupt select() in the main thread, not the workers */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGHUP);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
 
-	ret = pthread_create(&pending_msg_thread, NULL, iwpm_pending_msgs_handler, NULL);
+	ret = pthread_create(&map_req_thread, NULL, iwpm_mapping_reqs_handler, NULL);
+	if (!ret)
+		ret = pthread_create(&pending_msg_thread, NULL, iwpm_pending_msgs_handler, NULL);
+	pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
 	if (ret)
 		goto error_exit;
 
@@ -1560,6 +1614,11 @@ int main(int argc, char *argv[])
 
 	iwarp_port_mapper(); /* start iwarp port mapper process */
 
+	if (exit_signal) {
+		iwpm_cleanup();
+		return exit_signal == SIGHUP ? SIGHUP : EXIT_SUCCESS;
+	}
+
 	free_iwpm_mapped_ports();
 	closelog();
 
@@ -0,0 +1,274 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Stress the iwpmd mapping tables the way a connect storm does.
+ *
+ * Synthetic clients map, look up and release ports, including wild card
+ * listeners, and every answer of the indexed lookups is compared with a
+ * linear walk of the mapped ports.  Meanwhile several threads post, match
+ * and retire mapping requests, as the wire message handlers and the timeout
+ * thread do.  The kernel netlink clients cannot be driven from here, so the
+ * tables are called directly.
+ */
+#include "../iwarp_pm_common.c"
+#include "../iwarp_pm_helper.c"
+
+#include <time.h>
+
+/* Normally provided by iwarp_pm_server.c */
+LIST_HEAD(mapping_reqs);
+LIST_HEAD(pending_messages);
+iwpm_client client_list[IWARP_PM_MAX_CLIENTS];
+pthread_cond_t cond_req_complete = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t map_req_mutex = PTHREAD_MUTEX_INITIALIZER;
+int wake = 1;
+pthread_cond_t cond_pending_msg = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t pending_msg_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define NR_PORTS	20000
+#define NR_LOOKUPS	200000
+#define NR_REQ_THREADS	4
+#define NR_REQS		50000
+
+static iwpm_mapped_port *ports[NR_PORTS];
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_addr(struct sockaddr_storage *s, int v6, __u32 ip, __u16 port)
+{
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)s;
+	struct sockaddr_in *sin = (struct sockaddr_in *)s;
+
+	memset(s, 0, sizeof(*s));
+	if (v6) {
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr.s6_addr[12], &ip, sizeof(ip));
+		sin6->sin6_port = htobe16(port);
+	} else {
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = ip;
+		sin->sin_port = htobe16(port);
+	}
+}
+
+static void random_addr(struct sockaddr_storage *s, unsigned int *seed,
+			__u16 port_base, __u16 port_range)
+{
+	__u32 ip = rand_r(seed) % 10 ? htobe32(0x0a000000 + rand_r(seed) % 50) : 0;
+
+	make_addr(s, rand_r(seed) & 1, ip, port_base + rand_r(seed) % port_range);
+}
+
+/* The lookup rules of find_iwpm_mapping(), as a walk of the mapped ports */
+static iwpm_mapped_port *linear_find(struct sockaddr_storage *search,
+				     int not_mapped, int exact)
+{
+	struct sockaddr_storage *addr;
+	iwpm_mapped_port *port;
+
+	list_for_each(&mapped_ports, port, entry) {
+		addr = not_mapped ? &port->local_addr : &port->mapped_addr;
+		if (check_same_sockaddr(search, addr))
+			return port;
+	}
+	if (exact)
+		return NULL;
+	list_for_each(&mapped_ports, port, entry) {
+		addr = not_mapped ? &port->local_addr : &port->mapped_addr;
+		if (get_sockaddr_port(search) == get_sockaddr_port(addr) &&
+		    (port->wcard || is_wcard_ipaddr(search)))
+			return port;
+	}
+	return NULL;
+}
+
+static bool same_match(iwpm_mapped_port *a, iwpm_mapped_port *b,
+		       struct sockaddr_storage *search, int not_mapped)
+{
+	if (a == b)
+		return true;
+	/* any of several wild card matches will do */
+	return a && b && !check_same_sockaddr(search, not_mapped ?
+					      &b->local_addr : &b->mapped_addr);
+}
+
+static int stress_mappings(void)
+{
+	struct sockaddr_storage local, mapped, search;
+	iwpm_mapped_port *found;
+	unsigned int seed = 1;
+	double start;
+	int i, not_mapped, bad = 0;
+
+	start = now_sec();
+	for (i = 0; i < NR_PORTS; i++) {
+		random_addr(&local, &seed, 1000, 5000);
+		mapped = local;
+		if (local.ss_family == AF_INET)
+			((struct sockaddr_in *)&mapped)->sin_port = htobe16(20000 + i);
+		else
+			((struct sockaddr_in6 *)&mapped)->sin6_port = htobe16(20000 + i);
+		ports[i] = get_iwpm_port(i % IWARP_PM_MAX_CLIENTS, &local, &mapped, -1);
+		if (!ports[i])
+			return 1;
+		add_iwpm_mapped_port(ports[i]);
+	}
+	printf("add %d mappings      %8.1f ns/op\n", NR_PORTS,
+	       (now_sec() - start) * 1e9 / NR_PORTS);
+
+	/* Clients go away and leave holes in the tables */
+	for (i = 0; i < NR_PORTS; i += 3) {
+		remove_iwpm_mapped_port(ports[i]);
+		free_iwpm_port(ports[i]);
+		ports[i] = NULL;
+	}
+
+	for (i = 0; i < NR_LOOKUPS / 100; i++) {
+		not_mapped = rand_r(&seed) & 1;
+		if (not_mapped)
+			random_addr(&search, &seed, 1000, 5000);
+		else
+			random_addr(&search, &seed, 20000, NR_PORTS);
+
+		found = find_iwpm_mapping(&search, not_mapped);
+		if (!same_match(found, linear_find(&search, not_mapped, 0),
+				&search, not_mapped))
+			bad++;
+		if (find_iwpm_same_mapping(&search, not_mapped) !=
+		    linear_find(&search, not_mapped, 1))
+			bad++;
+	}
+	if (bad) {
+		fprintf(stderr, "%d lookups differ from a linear walk\n", bad);
+		return 1;
+	}
+
+	start = now_sec();
+	for (i = 0; i < NR_LOOKUPS; i++) {
+		not_mapped = i & 1;
+		if (not_mapped)
+			random_addr(&search, &seed, 1000, 5000);
+		else
+			random_addr(&search, &seed, 20000, NR_PORTS);
+		find_iwpm_mapping(&search, not_mapped);
+	}
+	printf("look up %d mappings %8.1f ns/op\n", NR_LOOKUPS,
+	       (now_sec() - start) * 1e9 / NR_LOOKUPS);
+	return 0;
+}
+
+struct req_thread {
+	pthread_t thread;
+	unsigned int id;
+	int bad;
+};
+
+static void *req_client(void *arg)
+{
+	struct sockaddr_storage src, remote;
+	struct req_thread *t = arg;
+	iwpm_mapping_request *req, copy;
+	__u64 assochandle;
+	int i;
+
+	make_addr(&remote, 0, htobe32(0x0a010000 + t->id), 3260);
+	for (i = 0; i < NR_REQS; i++) {
+		assochandle = (__u64)(t->id + 1) << 32 | i;
+		make_addr(&src, i & 1, htobe32(0x0a000000 + t->id), 1000 + i % 5000);
+
+		req = create_iwpm_map_request(NULL, &src, &remote, assochandle,
+					      IWARP_PM_REQ_QUERY, NULL);
+		if (!req)
+			return NULL;
+		add_iwpm_map_request(req);
+
+		/* the accept from the peer finds and completes it */
+		if (update_iwpm_map_request(assochandle, &src, IWARP_PM_REQ_QUERY,
+					    &copy, 1) ||
+		    copy.assochandle != assochandle)
+			t->bad++;
+		/* a stale duplicate from another address does not */
+		make_addr(&src, 0, htobe32(0x0b000000), 1);
+		if (!update_iwpm_map_request(assochandle, &src,
+					     IWARP_PM_REQ_QUERY, &copy, 0))
+			t->bad++;
+	}
+	return NULL;
+}
+
+/* Retire completed requests, as iwpm_mapping_reqs_handler() does */
+static void *req_reaper(void *arg)
+{
+	iwpm_mapping_request *req, *next;
+	bool *done = arg;
+	bool last;
+
+	do {
+		last = __atomic_load_n(done, __ATOMIC_ACQUIRE);
+		pthread_mutex_lock(&map_req_mutex);
+		list_for_each_safe(&mapping_reqs, req, next, entry)
+			if (req->complete)
+				remove_iwpm_map_request(req);
+		pthread_mutex_unlock(&map_req_mutex);
+		usleep(100);
+	} while (!last);
+	return NULL;
+}
+
+static int stress_requests(void)
+{
+	struct req_thread threads[NR_REQ_THREADS] = {};
+	pthread_t reaper;
+	bool done = false;
+	double start;
+	int i, bad = 0;
+
+	start = now_sec();
+	if (pthread_create(&reaper, NULL, req_reaper, &done))
+		return 1;
+	for (i = 0; i < NR_REQ_THREADS; i++) {
+		threads[i].id = i;
+		if (pthread_create(&threads[i].thread, NULL, req_client,
+				   &threads[i]))
+			return 1;
+	}
+	for (i = 0; i < NR_REQ_THREADS; i++) {
+		pthread_join(threads[i].thread, NULL);
+		bad += threads[i].bad;
+	}
+	__atomic_store_n(&done, true, __ATOMIC_RELEASE);
+	pthread_join(reaper, NULL);
+
+	printf("%d threads x %d map requests %8.1f ns/op\n", NR_REQ_THREADS,
+	       NR_REQS, (now_sec() - start) * 1e9 / (NR_REQ_THREADS * NR_REQS));
+	if (bad) {
+		fprintf(stderr, "%d map requests were not matched correctly\n",
+			bad);
+		return 1;
+	}
+	if (!list_empty(&mapping_reqs)) {
+		fprintf(stderr, "completed map requests were left behind\n");
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	int ret;
+
+	if (init_iwpm_indexes())
+		return 1;
+
+	ret = stress_mappings();
+	if (!ret)
+		ret = stress_requests();
+
+	free_iwpm_mapped_ports();
+	return ret;
+}
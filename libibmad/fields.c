@@ -35,9 +35,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #include <infiniband/mad.h>
+#include <ccan/array_size.h>
 
 /*
  * BITSOFFS and BE_OFFS are required due the fact that the bit offsets are inconsistently
@@ -1015,6 +1017,103 @@ static const ib_field_t ib_mad_f[] = {
 	{}			/* IB_FIELD_LAST_ */
 };
 
+/*
+ * Precomputed field codec.
+ *
+ * Every field that fits in a single 32 bit big endian word is reduced to a
+ * (byte offset, shift, mask) triple so it can be extracted with one word
+ * load instead of the byte by byte walk done by _get_field(). The table is
+ * derived from ib_mad_f when the library is loaded, so ib_mad_f stays the
+ * only place the field layout is described. Fields that do not qualify
+ * (arrays, 64 bit fields, fields straddling a word) keep using the generic
+ * helpers below.
+ */
+enum field_codec_kind {
+	FIELD_CODEC_GENERIC,	/* must be 0 so an unset entry is always safe */
+	FIELD_CODEC_WORD,
+	FIELD_CODEC_QWORD,
+};
+
+struct field_codec {
+	uint16_t offs;		/* byte offset of the containing word */
+	uint8_t shift;
+	uint8_t kind;
+	uint32_t mask;
+};
+
+static struct field_codec ib_mad_codec[IB_FIELD_LAST_];
+
+static void __attribute__((constructor)) ib_mad_codec_init(void)
+{
+	const ib_field_t *f;
+	int i;
+
+	for (i = IB_NO_FIELD + 1; i < IB_FIELD_LAST_; i++) {
+		f = ib_mad_f + i;
+
+		if (f->bitlen <= 0)
+			continue;
+
+		if (f->bitlen <= 32 && (f->bitoffs & 31) + f->bitlen <= 32) {
+			ib_mad_codec[i].offs = (f->bitoffs / 32) * 4;
+			ib_mad_codec[i].shift = f->bitoffs & 31;
+			ib_mad_codec[i].mask = f->bitlen == 32 ?
+				0xffffffff : (1u << f->bitlen) - 1;
+			ib_mad_codec[i].kind = FIELD_CODEC_WORD;
+		} else if (f->bitlen == 64 && !(f->bitoffs & 7)) {
+			ib_mad_codec[i].offs = f->bitoffs / 8;
+			ib_mad_codec[i].kind = FIELD_CODEC_QWORD;
+		}
+	}
+}
+
+/*
+ * The word fast path is only equivalent to _get_field()/_set_field() when
+ * base_offs keeps the 32 bit words aligned with the attribute, which is the
+ * case for every IB_*_DATA_OFFS and for base_offs 0.
+ */
+static inline const struct field_codec *word_codec(int base_offs,
+						   enum MAD_FIELDS field)
+{
+	const struct field_codec *c = ib_mad_codec + field;
+
+	if (c->kind != FIELD_CODEC_WORD || (base_offs & 3))
+		return NULL;
+	return c;
+}
+
+static inline uint32_t codec_get_word(const void *buf, int base_offs,
+				      const struct field_codec *c)
+{
+	uint32_t w;
+
+	memcpy(&w, (const uint8_t *)buf + base_offs + c->offs, sizeof(w));
+	return (ntohl(w) >> c->shift) & c->mask;
+}
+
+static inline void codec_set_word(void *buf, int base_offs,
+				  const struct field_codec *c, uint32_t val)
+{
+	uint8_t *p = (uint8_t *)buf + base_offs + c->offs;
+	uint32_t w;
+
+	memcpy(&w, p, sizeof(w));
+	w = ntohl(w);
+	w &= ~(c->mask << c->shift);
+	w |= (val & c->mask) << c->shift;
+	w = htonl(w);
+	memcpy(p, &w, sizeof(w));
+}
+
+static inline uint64_t codec_get_qword(const void *buf, int base_offs,
+				       const struct field_codec *c)
+{
+	uint64_t v;
+
+	memcpy(&v, (const uint8_t *)buf + base_offs + c->offs, sizeof(v));
+	return ntohll(v);
+}
+
 static void _set_field64(void *buf, int base_offs, const ib_field_t * f,
 			 uint64_t val)
 {
@@ -1118,12 +1217,22 @@ static void _get_array(void *buf, int base_offs, const ib_field_t * f,
 
 uint32_t mad_get_field(void *buf, int base_offs, enum MAD_FIELDS field)
 {
+	const struct field_codec *c = word_codec(base_offs, field);
+
+	if (c)
+		return codec_get_word(buf, base_offs, c);
 	return _get_field(buf, base_offs, ib_mad_f + field);
 }
 
 void mad_set_field(void *buf, int base_offs, enum MAD_FIELDS field,
 		   uint32_t val)
 {
+	const struct field_codec *c = word_codec(base_offs, field);
+
+	if (c) {
+		codec_set_word(buf, base_offs, c, val);
+		return;
+	}
 	_set_field(buf, base_offs, ib_mad_f + field, val);
 }
 
@@ -1157,7 +1266,7 @@ void mad_decode_field(uint8_t * buf, enum MAD_FIELDS field, void *val)
 		return;
 	}
 	if (f->bitlen <= 32) {
-		*(uint32_t *) val = _get_field(buf, 0, f);
+		*(uint32_t *) val = mad_get_field(buf, 0, field);
 		return;
 	}
 	if (f->bitlen == 64) {
@@ -1176,7 +1285,7 @@ void mad_encode_field(uint8_t * buf, enum MAD_FIELDS field, void *val)
 		return;
 	}
 	if (f->bitlen <= 32) {
-		_set_field(buf, 0, f, *(uint32_t *) val);
+		mad_set_field(buf, 0, field, *(uint32_t *) val);
 		return;
 	}
 	if (f->bitlen == 64) {
@@ -1186,6 +1295,201 @@ void mad_encode_field(uint8_t * buf, enum MAD_FIELDS field, void *val)
 	_set_array(buf, 0, f, val);
 }
 
+/*
+ * Bulk attribute decoders
+ */
+struct field_slot {
+	enum MAD_FIELDS field;
+	unsigned short offs;	/* offset of the destination struct member */
+	unsigned short size;
+};
+
+#define FIELD_SLOT(f, type, member) \
+	{f, offsetof(type, member), sizeof(((type *)0)->member)}
+
+static const struct field_slot portinfo_slots[] = {
+	FIELD_SLOT(IB_PORT_MKEY_F, struct mad_portinfo, mkey),
+	FIELD_SLOT(IB_PORT_GID_PREFIX_F, struct mad_portinfo, gid_prefix),
+	FIELD_SLOT(IB_PORT_LID_F, struct mad_portinfo, lid),
+	FIELD_SLOT(IB_PORT_SMLID_F, struct mad_portinfo, smlid),
+	FIELD_SLOT(IB_PORT_CAPMASK_F, struct mad_portinfo, capmask),
+	FIELD_SLOT(IB_PORT_DIAG_F, struct mad_portinfo, diag_code),
+	FIELD_SLOT(IB_PORT_MKEY_LEASE_F, struct mad_portinfo, mkey_lease_period),
+	FIELD_SLOT(IB_PORT_LOCAL_PORT_F, struct mad_portinfo, local_port),
+	FIELD_SLOT(IB_PORT_LINK_WIDTH_ENABLED_F, struct mad_portinfo,
+		   link_width_enabled),
+	FIELD_SLOT(IB_PORT_LINK_WIDTH_SUPPORTED_F, struct mad_portinfo,
+		   link_width_supported),
+	FIELD_SLOT(IB_PORT_LINK_WIDTH_ACTIVE_F, struct mad_portinfo,
+		   link_width_active),
+	FIELD_SLOT(IB_PORT_LINK_SPEED_SUPPORTED_F, struct mad_portinfo,
+		   link_speed_supported),
+	FIELD_SLOT(IB_PORT_STATE_F, struct mad_portinfo, state),
+	FIELD_SLOT(IB_PORT_PHYS_STATE_F, struct mad_portinfo, phys_state),
+	FIELD_SLOT(IB_PORT_LINK_DOWN_DEF_F, struct mad_portinfo,
+		   link_down_def_state),
+	FIELD_SLOT(IB_PORT_MKEY_PROT_BITS_F, struct mad_portinfo,
+		   mkey_prot_bits),
+	FIELD_SLOT(IB_PORT_LMC_F, struct mad_portinfo, lmc),
+	FIELD_SLOT(IB_PORT_LINK_SPEED_ACTIVE_F, struct mad_portinfo,
+		   link_speed_active),
+	FIELD_SLOT(IB_PORT_LINK_SPEED_ENABLED_F, struct mad_portinfo,
+		   link_speed_enabled),
+	FIELD_SLOT(IB_PORT_NEIGHBOR_MTU_F, struct mad_portinfo, neighbor_mtu),
+	FIELD_SLOT(IB_PORT_SMSL_F, struct mad_portinfo, smsl),
+	FIELD_SLOT(IB_PORT_VL_CAP_F, struct mad_portinfo, vl_cap),
+	FIELD_SLOT(IB_PORT_INIT_TYPE_F, struct mad_portinfo, init_type),
+	FIELD_SLOT(IB_PORT_VL_HIGH_LIMIT_F, struct mad_portinfo,
+		   vl_high_limit),
+	FIELD_SLOT(IB_PORT_VL_ARBITRATION_HIGH_CAP_F, struct mad_portinfo,
+		   vl_arb_high_cap),
+	FIELD_SLOT(IB_PORT_VL_ARBITRATION_LOW_CAP_F, struct mad_portinfo,
+		   vl_arb_low_cap),
+	FIELD_SLOT(IB_PORT_INIT_TYPE_REPLY_F, struct mad_portinfo,
+		   init_type_reply),
+	FIELD_SLOT(IB_PORT_MTU_CAP_F, struct mad_portinfo, mtu_cap),
+	FIELD_SLOT(IB_PORT_VL_STALL_COUNT_F, struct mad_portinfo,
+		   vl_stall_count),
+	FIELD_SLOT(IB_PORT_HOQ_LIFE_F, struct mad_portinfo, hoq_life),
+	FIELD_SLOT(IB_PORT_OPER_VLS_F, struct mad_portinfo, oper_vls),
+	FIELD_SLOT(IB_PORT_PART_EN_INB_F, struct mad_portinfo,
+		   part_enforce_inb),
+	FIELD_SLOT(IB_PORT_PART_EN_OUTB_F, struct mad_portinfo,
+		   part_enforce_outb),
+	FIELD_SLOT(IB_PORT_FILTER_RAW_INB_F, struct mad_portinfo,
+		   filter_raw_inb),
+	FIELD_SLOT(IB_PORT_FILTER_RAW_OUTB_F, struct mad_portinfo,
+		   filter_raw_outb),
+	FIELD_SLOT(IB_PORT_MKEY_VIOL_F, struct mad_portinfo, mkey_violations),
+	FIELD_SLOT(IB_PORT_PKEY_VIOL_F, struct mad_portinfo, pkey_violations),
+	FIELD_SLOT(IB_PORT_QKEY_VIOL_F, struct mad_portinfo, qkey_violations),
+	FIELD_SLOT(IB_PORT_GUID_CAP_F, struct mad_portinfo, guid_cap),
+	FIELD_SLOT(IB_PORT_CLIENT_REREG_F, struct mad_portinfo,
+		   client_reregister),
+	FIELD_SLOT(IB_PORT_MCAST_PKEY_SUPR_ENAB_F, struct mad_portinfo,
+		   mcast_pkey_trap_suppr),
+	FIELD_SLOT(IB_PORT_SUBN_TIMEOUT_F, struct mad_portinfo,
+		   subnet_timeout),
+	FIELD_SLOT(IB_PORT_RESP_TIME_VAL_F, struct mad_portinfo,
+		   resp_time_val),
+	FIELD_SLOT(IB_PORT_LOCAL_PHYS_ERR_F, struct mad_portinfo,
+		   local_phys_err),
+	FIELD_SLOT(IB_PORT_OVERRUN_ERR_F, struct mad_portinfo, overrun_err),
+	FIELD_SLOT(IB_PORT_MAX_CREDIT_HINT_F, struct mad_portinfo,
+		   max_credit_hint),
+	FIELD_SLOT(IB_PORT_LINK_ROUND_TRIP_F, struct mad_portinfo,
+		   link_round_trip),
+};
+
+static const struct field_slot perfcounters_slots[] = {
+	FIELD_SLOT(IB_PC_PORT_SELECT_F, struct mad_perfcounters, port_select),
+	FIELD_SLOT(IB_PC_COUNTER_SELECT_F, struct mad_perfcounters,
+		   counter_select),
+	FIELD_SLOT(IB_PC_ERR_SYM_F, struct mad_perfcounters, symbol_err),
+	FIELD_SLOT(IB_PC_LINK_RECOVERS_F, struct mad_perfcounters,
+		   link_recovers),
+	FIELD_SLOT(IB_PC_LINK_DOWNED_F, struct mad_perfcounters, link_downed),
+	FIELD_SLOT(IB_PC_ERR_RCV_F, struct mad_perfcounters, rcv_err),
+	FIELD_SLOT(IB_PC_ERR_PHYSRCV_F, struct mad_perfcounters,
+		   rcv_rem_phys_err),
+	FIELD_SLOT(IB_PC_ERR_SWITCH_REL_F, struct mad_perfcounters,
+		   rcv_sw_relay_err),
+	FIELD_SLOT(IB_PC_XMT_DISCARDS_F, struct mad_perfcounters,
+		   xmt_discards),
+	FIELD_SLOT(IB_PC_ERR_XMTCONSTR_F, struct mad_perfcounters,
+		   xmt_constraint_err),
+	FIELD_SLOT(IB_PC_ERR_RCVCONSTR_F, struct mad_perfcounters,
+		   rcv_constraint_err),
+	FIELD_SLOT(IB_PC_COUNTER_SELECT2_F, struct mad_perfcounters,
+		   counter_select2),
+	FIELD_SLOT(IB_PC_ERR_LOCALINTEG_F, struct mad_perfcounters,
+		   link_integrity_err),
+	FIELD_SLOT(IB_PC_ERR_EXCESS_OVR_F, struct mad_perfcounters,
+		   excessive_buf_overrun_err),
+	FIELD_SLOT(IB_PC_QP1_DROP_F, struct mad_perfcounters, qp1_dropped),
+	FIELD_SLOT(IB_PC_VL15_DROPPED_F, struct mad_perfcounters,
+		   vl15_dropped),
+	FIELD_SLOT(IB_PC_XMT_BYTES_F, struct mad_perfcounters, xmt_data),
+	FIELD_SLOT(IB_PC_RCV_BYTES_F, struct mad_perfcounters, rcv_data),
+	FIELD_SLOT(IB_PC_XMT_PKTS_F, struct mad_perfcounters, xmt_pkts),
+	FIELD_SLOT(IB_PC_RCV_PKTS_F, struct mad_perfcounters, rcv_pkts),
+	FIELD_SLOT(IB_PC_XMT_WAIT_F, struct mad_perfcounters, xmt_wait),
+};
+
+static const struct field_slot perfcounters_ext_slots[] = {
+	FIELD_SLOT(IB_PC_EXT_PORT_SELECT_F, struct mad_perfcounters_ext,
+		   port_select),
+	FIELD_SLOT(IB_PC_EXT_COUNTER_SELECT_F, struct mad_perfcounters_ext,
+		   counter_select),
+	FIELD_SLOT(IB_PC_EXT_XMT_BYTES_F, struct mad_perfcounters_ext,
+		   xmt_data),
+	FIELD_SLOT(IB_PC_EXT_RCV_BYTES_F, struct mad_perfcounters_ext,
+		   rcv_data),
+	FIELD_SLOT(IB_PC_EXT_XMT_PKTS_F, struct mad_perfcounters_ext,
+		   xmt_pkts),
+	FIELD_SLOT(IB_PC_EXT_RCV_PKTS_F, struct mad_perfcounters_ext,
+		   rcv_pkts),
+	FIELD_SLOT(IB_PC_EXT_XMT_UPKTS_F, struct mad_perfcounters_ext,
+		   xmt_upkts),
+	FIELD_SLOT(IB_PC_EXT_RCV_UPKTS_F, struct mad_perfcounters_ext,
+		   rcv_upkts),
+	FIELD_SLOT(IB_PC_EXT_XMT_MPKTS_F, struct mad_perfcounters_ext,
+		   xmt_mpkts),
+	FIELD_SLOT(IB_PC_EXT_RCV_MPKTS_F, struct mad_perfcounters_ext,
+		   rcv_mpkts),
+};
+
+static void decode_slots(void *buf, int base_offs,
+			 const struct field_slot *slots, int nslots, void *out)
+{
+	const struct field_codec *c;
+	uint8_t *dst = out;
+	uint64_t v64;
+	uint32_t v;
+	int i;
+
+	for (i = 0; i < nslots; i++) {
+		c = ib_mad_codec + slots[i].field;
+
+		if (slots[i].size == sizeof(uint64_t)) {
+			if (c->kind == FIELD_CODEC_QWORD)
+				v64 = codec_get_qword(buf, base_offs, c);
+			else
+				v64 = _get_field64(buf, base_offs,
+						   ib_mad_f + slots[i].field);
+			memcpy(dst + slots[i].offs, &v64, sizeof(v64));
+			continue;
+		}
+
+		if (c->kind == FIELD_CODEC_WORD && !(base_offs & 3))
+			v = codec_get_word(buf, base_offs, c);
+		else
+			v = _get_field(buf, base_offs,
+				       ib_mad_f + slots[i].field);
+		memcpy(dst + slots[i].offs, &v, sizeof(v));
+	}
+}
+
+void mad_decode_portinfo(void *buf, int base_offs, struct mad_portinfo *pi)
+{
+	decode_slots(buf, base_offs, portinfo_slots,
+		     ARRAY_SIZE(portinfo_slots), pi);
+}
+
+void mad_decode_perfcounters(void *buf, int base_offs,
+			     struct mad_perfcounters *pc)
+{
+	decode_slots(buf, base_offs, perfcounters_slots,
+		     ARRAY_SIZE(perfcounters_slots), pc);
+}
+
+void mad_decode_perfcounters_ext(void *buf, int base_offs,
+				 struct mad_perfcounters_ext *pc)
+{
+	decode_slots(buf, base_offs, perfcounters_ext_slots,
+		     ARRAY_SIZE(perfcounters_ext_slots), pc);
+}
+
 /************************/
 
 static char *_mad_dump_val(const ib_field_t * f, char *buf, int bufsz,
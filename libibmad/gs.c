@@ -80,6 +80,40 @@ uint8_t *pma_query_via(void *rcvbuf, ib_portid_t * dest, int port,
 	return p_ret;
 }
 
+int pma_query_async(struct mad_rpc_engine *engine, ib_portid_t * dest,
+		    int port, unsigned timeout, unsigned id, mad_rpc_cb_fn * cb,
+		    void *cb_data)
+{
+	ib_rpc_t rpc = { 0 };
+	uint8_t data[IB_PC_DATA_SZ] = { 0 };
+
+	DEBUG("lid %u port %d attr 0x%x", dest->lid, port, id);
+
+	if (dest->lid == -1) {
+		IBWARN("only lid routed is supported");
+		errno = EINVAL;
+		return -1;
+	}
+
+	rpc.mgtclass = IB_PERFORMANCE_CLASS;
+	rpc.method = IB_MAD_METHOD_GET;
+	rpc.attr.id = id;
+
+	/* Same for attribute IDs */
+	mad_set_field(data, 0, IB_PC_PORT_SELECT_F, port);
+	rpc.attr.mod = 0;
+	rpc.timeout = timeout;
+	rpc.datasz = IB_PC_DATA_SZ;
+	rpc.dataoffs = IB_PC_DATA_OFFS;
+
+	if (!dest->qp)
+		dest->qp = 1;
+	if (!dest->qkey)
+		dest->qkey = IB_DEFAULT_QP1_QKEY;
+
+	return mad_rpc_async(engine, &rpc, dest, data, cb, cb_data);
+}
+
 uint8_t *performance_reset_via(void *rcvbuf, ib_portid_t * dest,
 			       int port, unsigned mask, unsigned timeout,
 			       unsigned id, const struct ibmad_port * srcport)
@@ -1456,6 +1456,103 @@ char *mad_dump_field(enum MAD_FIELDS field, char *buf, int bufsz, void *val);
 char *mad_dump_val(enum MAD_FIELDS field, char *buf, int bufsz, void *val);
 const char *mad_field_name(enum MAD_FIELDS field);
 
+/*
+ * Bulk attribute decoders: extract a whole attribute into host order in one
+ * call. buf/base_offs have the same meaning as for mad_get_field().
+ */
+struct mad_portinfo {
+	uint64_t mkey;
+	uint64_t gid_prefix;
+	uint32_t lid;
+	uint32_t smlid;
+	uint32_t capmask;
+	uint32_t diag_code;
+	uint32_t mkey_lease_period;
+	uint32_t local_port;
+	uint32_t link_width_enabled;
+	uint32_t link_width_supported;
+	uint32_t link_width_active;
+	uint32_t link_speed_supported;
+	uint32_t state;
+	uint32_t phys_state;
+	uint32_t link_down_def_state;
+	uint32_t mkey_prot_bits;
+	uint32_t lmc;
+	uint32_t link_speed_active;
+	uint32_t link_speed_enabled;
+	uint32_t neighbor_mtu;
+	uint32_t smsl;
+	uint32_t vl_cap;
+	uint32_t init_type;
+	uint32_t vl_high_limit;
+	uint32_t vl_arb_high_cap;
+	uint32_t vl_arb_low_cap;
+	uint32_t init_type_reply;
+	uint32_t mtu_cap;
+	uint32_t vl_stall_count;
+	uint32_t hoq_life;
+	uint32_t oper_vls;
+	uint32_t part_enforce_inb;
+	uint32_t part_enforce_outb;
+	uint32_t filter_raw_inb;
+	uint32_t filter_raw_outb;
+	uint32_t mkey_violations;
+	uint32_t pkey_violations;
+	uint32_t qkey_violations;
+	uint32_t guid_cap;
+	uint32_t client_reregister;
+	uint32_t mcast_pkey_trap_suppr;
+	uint32_t subnet_timeout;
+	uint32_t resp_time_val;
+	uint32_t local_phys_err;
+	uint32_t overrun_err;
+	uint32_t max_credit_hint;
+	uint32_t link_round_trip;
+};
+
+struct mad_perfcounters {
+	uint32_t port_select;
+	uint32_t counter_select;
+	uint32_t symbol_err;
+	uint32_t link_recovers;
+	uint32_t link_downed;
+	uint32_t rcv_err;
+	uint32_t rcv_rem_phys_err;
+	uint32_t rcv_sw_relay_err;
+	uint32_t xmt_discards;
+	uint32_t xmt_constraint_err;
+	uint32_t rcv_constraint_err;
+	uint32_t counter_select2;
+	uint32_t link_integrity_err;
+	uint32_t excessive_buf_overrun_err;
+	uint32_t qp1_dropped;
+	uint32_t vl15_dropped;
+	uint32_t xmt_data;
+	uint32_t rcv_data;
+	uint32_t xmt_pkts;
+	uint32_t rcv_pkts;
+	uint32_t xmt_wait;
+};
+
+struct mad_perfcounters_ext {
+	uint32_t port_select;
+	uint32_t counter_select;
+	uint64_t xmt_data;
+	uint64_t rcv_data;
+	uint64_t xmt_pkts;
+	uint64_t rcv_pkts;
+	uint64_t xmt_upkts;
+	uint64_t rcv_upkts;
+	uint64_t xmt_mpkts;
+	uint64_t rcv_mpkts;
+};
+
+void mad_decode_portinfo(void *buf, int base_offs, struct mad_portinfo *pi);
+void mad_decode_perfcounters(void *buf, int base_offs,
+			     struct mad_perfcounters *pc);
+void mad_decode_perfcounters_ext(void *buf, int base_offs,
+				 struct mad_perfcounters_ext *pc);
+
 /* mad.c */
 void *mad_encode(void *buf, ib_rpc_t *rpc, ib_dr_path_t *drpath, void *data);
 uint64_t mad_trid(void);
@@ -1488,6 +1585,61 @@ int mad_rpc_class_agent(struct ibmad_port *srcport, int cls);
 int mad_get_timeout(const struct ibmad_port *srcport, int override_ms);
 int mad_get_retries(const struct ibmad_port *srcport);
 
+/* rpc_async.c */
+struct mad_rpc_engine;
+
+/*
+ * Completion callback of an asynchronous RPC. rpc and dport are the
+ * engine's copies of the request (dport reflects any redirection). status
+ * is 0 on success, EIO if the MAD completed with a non zero MAD status
+ * (rpc->rstatus holds it) or the errno of a transport failure such as
+ * ETIMEDOUT. mad is the response MAD, or NULL if none was received.
+ */
+typedef void (mad_rpc_cb_fn)(struct mad_rpc_engine *engine, ib_rpc_t *rpc,
+			     ib_portid_t *dport, int status, uint8_t *mad,
+			     void *cb_data);
+
+/*
+ * The engine owns receive processing of srcport while it has requests
+ * outstanding; do not mix it with mad_rpc() on the same port.
+ */
+struct mad_rpc_engine *mad_rpc_engine_create(const struct ibmad_port *srcport,
+					     unsigned max_on_wire);
+void mad_rpc_engine_destroy(struct mad_rpc_engine *engine);
+void mad_rpc_engine_set_window(struct mad_rpc_engine *engine,
+			       unsigned max_on_wire);
+unsigned mad_rpc_engine_get_window(const struct mad_rpc_engine *engine);
+void mad_rpc_engine_set_dest_limit(struct mad_rpc_engine *engine,
+				   unsigned max_per_dest);
+unsigned mad_rpc_engine_outstanding(const struct mad_rpc_engine *engine);
+uint64_t mad_rpc_engine_total_sent(const struct mad_rpc_engine *engine);
+
+/*
+ * Let the window adapt between min_window and max_window: it grows while
+ * responses arrive before the MAD timeout and is halved on a timeout.
+ * mad_rpc_engine_set_window() switches back to a fixed window.
+ */
+void mad_rpc_engine_set_adaptive(struct mad_rpc_engine *engine,
+				 unsigned min_window, unsigned max_window);
+
+struct mad_rpc_stats {
+	uint64_t sent;		/* MADs put on the wire, redirects included */
+	uint64_t completed;
+	uint64_t timeouts;
+	uint64_t errors;	/* transport or MAD status errors */
+	uint64_t rtt_total_us;	/* sum over responses received */
+	uint64_t rtt_max_us;
+	unsigned window;	/* current window */
+	unsigned max_window;	/* largest window used */
+};
+void mad_rpc_engine_get_stats(const struct mad_rpc_engine *engine,
+			      struct mad_rpc_stats *stats);
+int mad_rpc_async(struct mad_rpc_engine *engine, ib_rpc_t *rpc,
+		  ib_portid_t *dport, void *payload, mad_rpc_cb_fn *cb,
+		  void *cb_data);
+int mad_rpc_engine_poll(struct mad_rpc_engine *engine, int timeout_ms);
+int mad_rpc_engine_wait(struct mad_rpc_engine *engine);
+
 /* register.c */
 int mad_register_port_client(int port_id, int mgmt, uint8_t rmpp_version);
 int mad_register_client(int mgmt, uint8_t rmpp_version)
@@ -1622,6 +1774,13 @@ uint8_t *pma_query_via(void *rcvbuf, ib_portid_t *dest, int port,
 uint8_t *performance_reset_via(void *rcvbuf, ib_portid_t *dest, int port,
 			       unsigned mask, unsigned timeout, unsigned id,
 			       const struct ibmad_port *srcport);
+/*
+ * Queue a PerfMgt Get of attribute id on engine. The attribute data of
+ * the response starts at mad + IB_PC_DATA_OFFS in the callback.
+ */
+int pma_query_async(struct mad_rpc_engine *engine, ib_portid_t *dest,
+		    int port, unsigned timeout, unsigned id, mad_rpc_cb_fn *cb,
+		    void *cb_data);
 
 /* bm.c */
 uint8_t *bm_call_via(void *data, ib_portid_t *portid, ib_bm_call_t *call,
@@ -47,4 +47,6 @@ extern struct ibmad_port *ibmp;
 extern int madrpc_timeout;
 extern int madrpc_retries;
 
+int redirect_port(ib_portid_t *port, uint8_t *mad);
+
 #endif /* _MAD_INTERNAL_H_ */
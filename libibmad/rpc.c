@@ -188,7 +188,7 @@ _do_madrpc(int port_id, void *sndbuf, void *rcvbuf, int agentid, int len,
 	return -1;
 }
 
-static int redirect_port(ib_portid_t * port, uint8_t * mad)
+int redirect_port(ib_portid_t * port, uint8_t * mad)
 {
 	port->lid = mad_get_field(mad, 64, IB_CPI_REDIRECT_LID_F);
 	if (!port->lid) {
@@ -0,0 +1,616 @@
+/* SPDX-License-Identifier: GPL-2.0 OR Linux-OpenIB */
+/*
+ * Asynchronous, windowed MAD RPC engine.
+ *
+ * mad_rpc() keeps exactly one MAD on the wire and sleeps in umad_recv()
+ * for every query. The engine below lets a caller queue any number of
+ * requests; up to max_on_wire of them are sent at once (and at most
+ * max_per_dest to any single destination), responses are matched back to
+ * their request by TID and handed to a per request completion callback.
+ *
+ * Requests wait in a queue per destination, and the destinations that may
+ * send are kept on a ready list served round robin, so filling the window
+ * never walks requests that cannot be sent yet.
+ *
+ * Timeouts and retries are left to the kernel MAD layer (umad_send()
+ * timeout/retries), so a lost MAD comes back through umad_recv() with a
+ * non zero umad_status() just like a response does.
+ *
+ * The window can optionally adapt between a minimum and a maximum in the
+ * spirit of TCP congestion control: it grows by one per response (slow
+ * start) up to a threshold and then by one per window of responses, as
+ * long as responses come back before the first kernel resend; a timeout
+ * halves it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <infiniband/umad.h>
+#include <infiniband/mad.h>
+#include <ccan/list.h>
+#include <ccan/container_of.h>
+#include <util/cl_qmap.h>
+
+#include "mad_internal.h"
+
+#undef DEBUG
+#define DEBUG	if (ibdebug)	IBWARN
+
+#define MAD_RPC_DEF_ON_WIRE	16
+/* a redirect normally points straight at the service, don't follow loops */
+#define MAD_RPC_MAX_REDIRECTS	4
+
+struct mad_rpc_dest {
+	cl_map_item_t item;
+	struct list_head pending;	/* requests not sent yet, in order */
+	struct list_node ready;		/* on the engine ready list */
+	int is_ready;
+	unsigned on_wire;
+};
+
+struct mad_rpc_req {
+	cl_map_item_t on_wire;		/* keyed by the low 32 bits of the TID */
+	struct list_node entry;		/* dest pending list */
+	struct mad_rpc_dest *dest;
+	union {
+		ib_rpc_t rpc;
+		ib_rpc_v1_t rpcv1;
+		ib_rpc_cc_t rpccc;
+	};
+	ib_portid_t dport;
+	mad_rpc_cb_fn *cb;
+	void *cb_data;
+	int has_payload;
+	int error;
+	unsigned redirects;
+	uint64_t seq;			/* send sequence number */
+	uint64_t sent_us;
+	uint8_t payload[IB_MAD_SIZE];
+};
+
+struct mad_rpc_engine {
+	const struct ibmad_port *port;
+	unsigned max_on_wire;		/* current window */
+	unsigned min_window;
+	unsigned max_window;		/* == min_window - fixed window */
+	unsigned ssthresh;
+	unsigned credit;
+	uint64_t backoff_seq;		/* last seq sent before a backoff */
+	unsigned max_per_dest;		/* 0 - no per destination limit */
+	unsigned pending;
+	struct list_head ready;		/* dests that have a request to send */
+	cl_qmap_t wire;
+	cl_qmap_t dests;
+	struct mad_rpc_stats stats;
+	uint8_t umad[1024];
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void window_grow(struct mad_rpc_engine *engine)
+{
+	if (engine->max_on_wire >= engine->max_window)
+		return;
+
+	if (engine->max_on_wire < engine->ssthresh) {
+		engine->max_on_wire++;
+	} else if (++engine->credit >= engine->max_on_wire) {
+		engine->credit = 0;
+		engine->max_on_wire++;
+	}
+	if (engine->max_on_wire > engine->stats.max_window)
+		engine->stats.max_window = engine->max_on_wire;
+}
+
+static void window_backoff(struct mad_rpc_engine *engine,
+			   struct mad_rpc_req *req)
+{
+	/* one backoff per window: ignore losses of MADs sent before it */
+	if (req->seq <= engine->backoff_seq)
+		return;
+	engine->backoff_seq = engine->stats.sent;
+
+	engine->ssthresh = engine->max_on_wire / 2;
+	if (engine->ssthresh < engine->min_window)
+		engine->ssthresh = engine->min_window;
+	engine->max_on_wire = engine->ssthresh;
+	engine->credit = 0;
+}
+
+/*
+ * A response that arrived after the MAD timeout means the kernel had to
+ * resend it, which is treated like a loss.
+ */
+static void window_update(struct mad_rpc_engine *engine,
+			  struct mad_rpc_req *req, int status)
+{
+	uint64_t rtt = now_us() - req->sent_us;
+	uint64_t timeout_us;
+
+	if (status == ETIMEDOUT) {
+		engine->stats.timeouts++;
+		if (engine->max_window > engine->min_window)
+			window_backoff(engine, req);
+		return;
+	}
+
+	engine->stats.rtt_total_us += rtt;
+	if (rtt > engine->stats.rtt_max_us)
+		engine->stats.rtt_max_us = rtt;
+
+	if (engine->max_window <= engine->min_window)
+		return;
+
+	timeout_us = (uint64_t)mad_get_timeout(engine->port,
+					       req->rpc.timeout) * 1000;
+	if (rtt < timeout_us)
+		window_grow(engine);
+	else
+		window_backoff(engine, req);
+}
+
+static size_t rpc_size(const ib_rpc_t *rpc)
+{
+	if ((rpc->mgtclass & 0xff) == IB_CC_CLASS)
+		return sizeof(ib_rpc_cc_t);
+	if ((rpc->mgtclass & IB_MAD_RPC_VERSION_MASK) == IB_MAD_RPC_VERSION1)
+		return sizeof(ib_rpc_v1_t);
+	return sizeof(ib_rpc_t);
+}
+
+/*
+ * LID routed MADs are limited per DLID; directed route MADs per path so
+ * that a sweep through one switch does not starve the others.
+ */
+static uint64_t dest_key(const ib_rpc_t *rpc, const ib_portid_t *dport)
+{
+	uint64_t key = 0;
+	int i;
+
+	if ((rpc->mgtclass & 0xff) != IB_SMI_DIRECT_CLASS)
+		return (uint64_t)dport->lid;
+
+	for (i = 1; i <= dport->drpath.cnt; i++)
+		key = key * 131 + dport->drpath.p[i];
+	return key | (1ULL << 63);
+}
+
+static struct mad_rpc_dest *get_dest(struct mad_rpc_engine *engine,
+				     uint64_t key)
+{
+	struct mad_rpc_dest *dest;
+	cl_map_item_t *item;
+
+	item = cl_qmap_get(&engine->dests, key);
+	if (item != cl_qmap_end(&engine->dests))
+		return container_of(item, struct mad_rpc_dest, item);
+
+	dest = calloc(1, sizeof(*dest));
+	if (!dest)
+		return NULL;
+	list_head_init(&dest->pending);
+	cl_qmap_insert(&engine->dests, key, &dest->item);
+	return dest;
+}
+
+/*
+ * Put dest on the ready list if it has a request it may send, take it off
+ * otherwise, and free it once it has nothing queued or on the wire.
+ */
+static void update_dest(struct mad_rpc_engine *engine,
+			struct mad_rpc_dest *dest)
+{
+	if (!list_empty(&dest->pending) &&
+	    (!engine->max_per_dest || dest->on_wire < engine->max_per_dest)) {
+		if (!dest->is_ready) {
+			list_add_tail(&engine->ready, &dest->ready);
+			dest->is_ready = 1;
+		}
+		return;
+	}
+
+	if (dest->is_ready) {
+		list_del(&dest->ready);
+		dest->is_ready = 0;
+	}
+	if (!dest->on_wire && list_empty(&dest->pending)) {
+		cl_qmap_remove_item(&engine->dests, &dest->item);
+		free(dest);
+	}
+}
+
+static void put_dest(struct mad_rpc_engine *engine, struct mad_rpc_dest *dest)
+{
+	dest->on_wire--;
+	update_dest(engine, dest);
+}
+
+static void queue_req(struct mad_rpc_engine *engine, struct mad_rpc_req *req,
+		      struct mad_rpc_dest *dest, int at_head)
+{
+	req->dest = dest;
+	if (at_head)
+		list_add(&dest->pending, &req->entry);
+	else
+		list_add_tail(&dest->pending, &req->entry);
+	engine->pending++;
+	update_dest(engine, dest);
+}
+
+static int send_req(struct mad_rpc_engine *engine, struct mad_rpc_req *req)
+{
+	const struct ibmad_port *port = engine->port;
+	int agent, len, retries;
+	cl_map_item_t *item;
+
+	agent = port->class_agents[req->rpc.mgtclass & 0xff];
+	if (agent < 0) {
+		IBWARN("class 0x%x is not registered on this port",
+		       req->rpc.mgtclass & 0xff);
+		return -EINVAL;
+	}
+
+	/* a fresh TID per send so a redirected request is not confused */
+	do {
+		req->rpc.trid = mad_trid();
+		item = cl_qmap_get(&engine->wire, (uint32_t)req->rpc.trid);
+	} while (item != cl_qmap_end(&engine->wire));
+
+	memset(engine->umad, 0, umad_size() + IB_MAD_SIZE);
+	len = mad_build_pkt(engine->umad, &req->rpc, &req->dport, NULL,
+			    req->has_payload ? req->payload : NULL);
+	if (len < 0)
+		return -EINVAL;
+
+	/* port retries count attempts, the kernel counts resends */
+	retries = mad_get_retries(port) - 1;
+	if (umad_send(port->port_id, agent, engine->umad, len,
+		      mad_get_timeout(port, req->rpc.timeout),
+		      retries > 0 ? retries : 0) < 0) {
+		IBWARN("send failed; %s", strerror(errno));
+		return -errno;
+	}
+
+	cl_qmap_insert(&engine->wire, (uint32_t)req->rpc.trid, &req->on_wire);
+	req->dest->on_wire++;
+	req->seq = ++engine->stats.sent;
+	req->sent_us = now_us();
+	return 0;
+}
+
+static void complete_req(struct mad_rpc_engine *engine,
+			 struct mad_rpc_req *req, int status, uint8_t *mad)
+{
+	if (status != ECANCELED)
+		engine->stats.completed++;
+	if (req->cb)
+		req->cb(engine, &req->rpc, &req->dport, status, mad,
+			req->cb_data);
+	free(req);
+}
+
+/*
+ * Move queued requests onto the wire until the window is full, taking one
+ * request from each ready destination in turn.
+ */
+static void fill_window(struct mad_rpc_engine *engine)
+{
+	struct mad_rpc_req *req, *next;
+	struct mad_rpc_dest *dest;
+	LIST_HEAD(failed);
+	int rc;
+
+	while (cl_qmap_count(&engine->wire) < engine->max_on_wire) {
+		dest = list_pop(&engine->ready, struct mad_rpc_dest, ready);
+		if (!dest)
+			break;
+		dest->is_ready = 0;
+
+		req = list_pop(&dest->pending, struct mad_rpc_req, entry);
+		engine->pending--;
+
+		rc = send_req(engine, req);
+		if (rc) {
+			req->dest = NULL;
+			req->error = -rc;
+			list_add_tail(&failed, &req->entry);
+		}
+		/* back to the tail of the ready list, or freed if idle */
+		update_dest(engine, dest);
+	}
+
+	/* callbacks may queue new requests, so run them outside the walk */
+	list_for_each_safe(&failed, req, next, entry) {
+		list_del(&req->entry);
+		complete_req(engine, req, req->error, NULL);
+	}
+}
+
+struct mad_rpc_engine *mad_rpc_engine_create(const struct ibmad_port *srcport,
+					     unsigned max_on_wire)
+{
+	struct mad_rpc_engine *engine;
+
+	if (!srcport) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	engine = calloc(1, sizeof(*engine));
+	if (!engine) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	engine->port = srcport;
+	mad_rpc_engine_set_window(engine, max_on_wire);
+	list_head_init(&engine->ready);
+	cl_qmap_init(&engine->wire);
+	cl_qmap_init(&engine->dests);
+	return engine;
+}
+
+void mad_rpc_engine_destroy(struct mad_rpc_engine *engine)
+{
+	struct mad_rpc_req *req, *next;
+	struct mad_rpc_dest *dest;
+	cl_map_item_t *item, *next_item;
+	LIST_HEAD(canceled);
+
+	if (!engine)
+		return;
+
+	for (item = cl_qmap_head(&engine->dests);
+	     item != cl_qmap_end(&engine->dests); item = next_item) {
+		next_item = cl_qmap_next(item);
+		dest = container_of(item, struct mad_rpc_dest, item);
+		list_append_list(&canceled, &dest->pending);
+		update_dest(engine, dest);
+	}
+	engine->pending = 0;
+
+	/* late responses for these are dropped as unknown TIDs */
+	while ((item = cl_qmap_head(&engine->wire)) !=
+	       cl_qmap_end(&engine->wire)) {
+		req = container_of(item, struct mad_rpc_req, on_wire);
+		cl_qmap_remove_item(&engine->wire, item);
+		put_dest(engine, req->dest);
+		list_add_tail(&canceled, &req->entry);
+	}
+
+	list_for_each_safe(&canceled, req, next, entry) {
+		list_del(&req->entry);
+		complete_req(engine, req, ECANCELED, NULL);
+	}
+
+	free(engine);
+}
+
+void mad_rpc_engine_set_window(struct mad_rpc_engine *engine,
+			       unsigned max_on_wire)
+{
+	engine->max_on_wire = max_on_wire ? max_on_wire : MAD_RPC_DEF_ON_WIRE;
+	engine->min_window = engine->max_on_wire;
+	engine->max_window = engine->max_on_wire;
+	engine->ssthresh = engine->max_on_wire;
+	engine->credit = 0;
+	engine->stats.max_window = engine->max_on_wire;
+}
+
+void mad_rpc_engine_set_adaptive(struct mad_rpc_engine *engine,
+				 unsigned min_window, unsigned max_window)
+{
+	if (!min_window)
+		min_window = 1;
+	if (max_window < min_window)
+		max_window = min_window;
+
+	engine->min_window = min_window;
+	engine->max_window = max_window;
+	engine->max_on_wire = min_window;
+	engine->ssthresh = max_window;
+	engine->credit = 0;
+	engine->stats.max_window = min_window;
+}
+
+unsigned mad_rpc_engine_get_window(const struct mad_rpc_engine *engine)
+{
+	return engine->max_on_wire;
+}
+
+void mad_rpc_engine_set_dest_limit(struct mad_rpc_engine *engine,
+				   unsigned max_per_dest)
+{
+	cl_map_item_t *item, *next_item;
+
+	engine->max_per_dest = max_per_dest;
+	for (item = cl_qmap_head(&engine->dests);
+	     item != cl_qmap_end(&engine->dests); item = next_item) {
+		next_item = cl_qmap_next(item);
+		update_dest(engine,
+			    container_of(item, struct mad_rpc_dest, item));
+	}
+}
+
+unsigned mad_rpc_engine_outstanding(const struct mad_rpc_engine *engine)
+{
+	return engine->pending + cl_qmap_count(&engine->wire);
+}
+
+uint64_t mad_rpc_engine_total_sent(const struct mad_rpc_engine *engine)
+{
+	return engine->stats.sent;
+}
+
+void mad_rpc_engine_get_stats(const struct mad_rpc_engine *engine,
+			      struct mad_rpc_stats *stats)
+{
+	*stats = engine->stats;
+	stats->window = engine->max_on_wire;
+}
+
+/*
+ * Returns 0 once the request is queued, its callback then runs exactly once,
+ * possibly before this returns. On -1 nothing was queued.
+ */
+int mad_rpc_async(struct mad_rpc_engine *engine, ib_rpc_t *rpc,
+		  ib_portid_t *dport, void *payload, mad_rpc_cb_fn *cb,
+		  void *cb_data)
+{
+	struct mad_rpc_dest *dest;
+	struct mad_rpc_req *req;
+
+	if (!engine || !rpc || !dport) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	req = calloc(1, sizeof(*req));
+	if (!req) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memcpy(&req->rpc, rpc, rpc_size(rpc));
+	req->dport = *dport;
+	req->cb = cb;
+	req->cb_data = cb_data;
+	if (payload && rpc->datasz > 0) {
+		if (rpc->dataoffs + rpc->datasz > IB_MAD_SIZE) {
+			free(req);
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(req->payload, payload, rpc->datasz);
+		req->has_payload = 1;
+	}
+
+	dest = get_dest(engine, dest_key(&req->rpc, &req->dport));
+	if (!dest) {
+		free(req);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	queue_req(engine, req, dest, 0);
+	fill_window(engine);
+	return 0;
+}
+
+static int process_one(struct mad_rpc_engine *engine, int length)
+{
+	struct mad_rpc_dest *dest;
+	struct mad_rpc_req *req;
+	cl_map_item_t *item;
+	uint8_t *mad;
+	uint32_t trid;
+	int status;
+
+	mad = umad_get_mad(engine->umad);
+	trid = (uint32_t)mad_get_field64(mad, 0, IB_MAD_TRID_F);
+
+	item = cl_qmap_remove(&engine->wire, trid);
+	if (item == cl_qmap_end(&engine->wire)) {
+		DEBUG("dropping MAD with unknown trid 0x%x", trid);
+		return 0;
+	}
+	req = container_of(item, struct mad_rpc_req, on_wire);
+	put_dest(engine, req->dest);
+	req->dest = NULL;
+
+	if (ibdebug > 1) {
+		IBWARN("rcv buf:");
+		xdump(stderr, "rcv buf\n", mad, IB_MAD_SIZE);
+	}
+
+	status = umad_status(engine->umad);
+	window_update(engine, req, status);
+	if (status && status != ENOMEM) {
+		DEBUG("MAD to %s failed: %s", portid2str(&req->dport),
+		      strerror(status));
+		engine->stats.errors++;
+		complete_req(engine, req, status, NULL);
+		return 1;
+	}
+
+	status = mad_get_field(mad, 0, IB_DRSMP_STATUS_F);
+	if (status == IB_MAD_STS_REDIRECT &&
+	    req->redirects < MAD_RPC_MAX_REDIRECTS &&
+	    !redirect_port(&req->dport, mad)) {
+		dest = get_dest(engine, dest_key(&req->rpc, &req->dport));
+		if (!dest) {
+			engine->stats.errors++;
+			complete_req(engine, req, ENOMEM, NULL);
+			return 1;
+		}
+		/* resend to the redirection target ahead of its queue */
+		req->redirects++;
+		queue_req(engine, req, dest, 1);
+		return 0;
+	}
+
+	req->rpc.rstatus = status;
+	if (status) {
+		DEBUG("MAD completed with error status 0x%x; dport (%s)",
+		      status, portid2str(&req->dport));
+		engine->stats.errors++;
+		complete_req(engine, req, EIO, mad);
+		return 1;
+	}
+
+	complete_req(engine, req, 0, mad);
+	return 1;
+}
+
+int mad_rpc_engine_poll(struct mad_rpc_engine *engine, int timeout_ms)
+{
+	int fd = engine->port->port_id;
+	int done = 0, length, rc;
+
+	fill_window(engine);
+
+	while (!cl_is_qmap_empty(&engine->wire)) {
+		/* after the first completion only pick up what is queued */
+		rc = umad_poll(fd, done ? 0 : timeout_ms);
+		if (rc == -ETIMEDOUT)
+			break;
+		if (rc < 0)
+			return rc;
+
+		length = IB_MAD_SIZE;
+		rc = umad_recv(fd, engine->umad, &length, 0);
+		if (rc < 0) {
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				continue;
+			IBWARN("recv failed: %s", strerror(errno));
+			return -errno;
+		}
+
+		done += process_one(engine, length);
+		fill_window(engine);
+	}
+
+	return done;
+}
+
+int mad_rpc_engine_wait(struct mad_rpc_engine *engine)
+{
+	int rc;
+
+	while (mad_rpc_engine_outstanding(engine)) {
+		rc = mad_rpc_engine_poll(engine, -1);
+		if (rc < 0)
+			return rc;
+	}
+	return 0;
+}
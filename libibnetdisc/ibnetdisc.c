@@ -42,6 +42,7 @@
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <assert.h>
 
 #include <infiniband/umad.h>
 #include <infiniband/mad.h>
@@ -52,8 +53,10 @@
 #include "internal.h"
 #include "chassis.h"
 
-#define container_of(ptr, type, member)                                        \
-	((type *)((uint8_t *)(ptr)-offsetof(type, member)))
+/* Fields added to ibnd_config must come out of pad, never change its size */
+static_assert(offsetof(ibnd_config_t, pad) + sizeof(((ibnd_config_t *)0)->pad) ==
+	      offsetof(ibnd_config_t, mkey) + sizeof(uint64_t) + 44,
+	      "ibnd_config_t layout changed");
 
 /* forward declarations */
 struct ni_cbdata
@@ -233,7 +236,7 @@ int mlnx_ext_port_info_err(smp_engine_t * engine, ibnd_smp_t * smp,
 	ibnd_port_t *port;
 	uint8_t port_num, local_port;
 
-	port_num = (uint8_t) mad_get_field(mad, 0, IB_MAD_ATTRMOD_F);
+	port_num = (uint8_t) smp->rpc.attr.mod;
 	port = node->ports[port_num];
 	if (!port) {
 		IBND_ERROR("Failed to find 0x%" PRIx64 " port %u\n",
@@ -374,7 +377,7 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 		port->lmc = node->smalmc;
 	}
 
-	int rc1 = add_to_portguid_hash(port, f_int->fabric.portstbl);
+	int rc1 = add_to_portguid_hash(port, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -484,7 +487,7 @@ static ibnd_node_t *create_node(smp_engine_t * engine, ib_portid_t * path,
 	rc->path_portid = *path;
 	memcpy(rc->info, node_info, sizeof(rc->info));
 
-	int rc1 = add_to_nodeguid_hash(rc, f_int->fabric.nodestbl);
+	int rc1 = add_to_nodeguid_hash(rc, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -493,6 +496,7 @@ static ibnd_node_t *create_node(smp_engine_t * engine, ib_portid_t * path,
 	/* add this to the all nodes list */
 	rc->next = f_int->fabric.nodes;
 	f_int->fabric.nodes = rc;
+	((ibnd_scan_t *) engine->user_data)->nodes++;
 
 	add_to_type_list(rc, f_int);
 
@@ -614,36 +618,108 @@ static int query_node_info(smp_engine_t * engine, ib_portid_t * portid,
 			 recv_node_info, (void *)cbdata);
 }
 
-ibnd_node_t *ibnd_find_node_guid(ibnd_fabric_t * fabric, uint64_t guid)
+static inline unsigned guid_hash(uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_node_t *node;
+	/* GUIDs share a vendor prefix and are often sequential, mix all bits */
+	guid ^= guid >> 33;
+	guid *= 0xff51afd7ed558ccdULL;
+	guid ^= guid >> 33;
+	return (unsigned)guid;
+}
+
+static struct guid_slot *guid_tbl_slot(struct guid_slot *slots, unsigned size,
+				       uint64_t guid)
+{
+	unsigned mask = size - 1;
+	unsigned i = guid_hash(guid) & mask;
+
+	while (slots[i].head && slots[i].guid != guid)
+		i = (i + 1) & mask;
+	return &slots[i];
+}
+
+static void *guid_tbl_find(struct guid_tbl *tbl, uint64_t guid)
+{
+	if (!tbl->size)
+		return NULL;
+	return guid_tbl_slot(tbl->slots, tbl->size, guid)->head;
+}
+
+static int guid_tbl_resize(struct guid_tbl *tbl, unsigned size)
+{
+	struct guid_slot *slots;
+	unsigned i;
+
+	slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return -1;
+
+	for (i = 0; i < tbl->size; i++)
+		if (tbl->slots[i].head)
+			*guid_tbl_slot(slots, size, tbl->slots[i].guid) =
+			    tbl->slots[i];
+
+	free(tbl->slots);
+	tbl->slots = slots;
+	tbl->size = size;
+	return 0;
+}
+
+static int guid_tbl_reserve(struct guid_tbl *tbl, unsigned count)
+{
+	unsigned size = tbl->size ? tbl->size : 256;
+
+	while (size < 2 * count)
+		size *= 2;
+	if (size == tbl->size)
+		return 0;
+	return guid_tbl_resize(tbl, size);
+}
+
+/* Return the slot for guid, claiming a free one if it is not indexed yet */
+static struct guid_slot *guid_tbl_insert(struct guid_tbl *tbl, uint64_t guid)
+{
+	struct guid_slot *slot;
+
+	if (guid_tbl_reserve(tbl, tbl->used + 1))
+		return NULL;
 
+	slot = guid_tbl_slot(tbl->slots, tbl->size, guid);
+	if (!slot->head) {
+		slot->guid = guid;
+		tbl->used++;
+	}
+	return slot;
+}
+
+ibnd_node_t *ibnd_find_node_guid(ibnd_fabric_t * fabric, uint64_t guid)
+{
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return NULL;
 	}
 
-	for (node = fabric->nodestbl[hash]; node; node = node->htnext)
-		if (node->guid == guid)
-			return node;
-
-	return NULL;
+	return guid_tbl_find(&((f_internal_t *)fabric)->node_guids, guid);
 }
 
 ibnd_node_t *ibnd_find_node_dr(ibnd_fabric_t * fabric, char *dr_str)
 {
 	ibnd_port_t *rc = ibnd_find_port_dr(fabric, dr_str);
-	return rc->node;
+	return rc ? rc->node : NULL;
 }
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[])
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int)
 {
-	int rc = 0;
+	struct guid_slot *slot;
 	ibnd_node_t *tblnode;
-	int hash_idx = HASHGUID(node->guid) % HTSZ;
 
-	for (tblnode = hash[hash_idx]; tblnode; tblnode = tblnode->htnext) {
+	slot = guid_tbl_insert(&f_int->node_guids, node->guid);
+	if (!slot) {
+		IBND_ERROR("OOM: failed to grow the node guid index\n");
+		return 1;
+	}
+
+	for (tblnode = slot->head; tblnode; tblnode = tblnode->htnext) {
 		if (tblnode == node) {
 			IBND_ERROR("Duplicate Node: Node with guid 0x%016"
 				   PRIx64 " already exists in nodes DB\n",
@@ -651,18 +727,23 @@ int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[])
 			return 1;
 		}
 	}
-	node->htnext = hash[hash_idx];
-	hash[hash_idx] = node;
-	return rc;
+	node->htnext = slot->head;
+	slot->head = node;
+	return 0;
 }
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[])
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int)
 {
-	int rc = 0;
+	struct guid_slot *slot;
 	ibnd_port_t *tblport;
-	int hash_idx = HASHGUID(port->guid) % HTSZ;
 
-	for (tblport = hash[hash_idx]; tblport; tblport = tblport->htnext) {
+	slot = guid_tbl_insert(&f_int->port_guids, port->guid);
+	if (!slot) {
+		IBND_ERROR("OOM: failed to grow the port guid index\n");
+		return 1;
+	}
+
+	for (tblport = slot->head; tblport; tblport = tblport->htnext) {
 		if (tblport == port) {
 			IBND_ERROR("Duplicate Port: Port with guid 0x%016"
 				   PRIx64 " already exists in ports DB\n",
@@ -670,52 +751,53 @@ int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[])
 			return 1;
 		}
 	}
-	port->htnext = hash[hash_idx];
-	hash[hash_idx] = port;
-	return rc;
+	port->htnext = slot->head;
+	slot->head = port;
+	return 0;
 }
 
-struct lid2guid_item {
-	cl_map_item_t cl_map;
-	ibnd_port_t *port;
-};
-
-void create_lid2guid(f_internal_t *f_int)
+int reserve_fabric_index(f_internal_t *f_int, unsigned nodes, unsigned ports)
 {
-	cl_qmap_init(&f_int->lid2guid);
+	if (guid_tbl_reserve(&f_int->node_guids, nodes) ||
+	    guid_tbl_reserve(&f_int->port_guids, ports))
+		return -1;
+	return 0;
 }
 
-void destroy_lid2guid(f_internal_t *f_int)
+void destroy_fabric_index(f_internal_t *f_int)
 {
-	cl_map_item_t *item;
-
-	for (item = cl_qmap_head(&f_int->lid2guid); item != cl_qmap_end(&f_int->lid2guid);
-	     item = cl_qmap_head(&f_int->lid2guid)) {
-		cl_qmap_remove_item(&f_int->lid2guid, item);
-		free(container_of(item, struct lid2guid_item, cl_map));
-	}
+	free(f_int->node_guids.slots);
+	free(f_int->port_guids.slots);
+	free(f_int->lid2port);
 }
 
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int)
 {
-	uint16_t base_lid = port->base_lid;
-	uint16_t lid_mask = ((1 << port->lmc) -1);
-	uint16_t lid = 0;
+	unsigned base_lid = port->base_lid;
+	unsigned lid_mask = ((1 << port->lmc) -1);
+	unsigned lid;
+
 	/* 0 < valid lid <= 0xbfff */
-	if (base_lid > 0 && base_lid <= 0xbfff) {
-		/* We add the port for all lids
-		 * so it is easier to find any "random" lid specified */
-		for (lid = base_lid; lid <= (base_lid + lid_mask); lid++) {
-			struct lid2guid_item *item;
-
-			item = malloc(sizeof(*item));
-			if (item) {
-				item->port = port;
-				cl_qmap_insert(&f_int->lid2guid, lid,
-					       &item->cl_map);
-			}
+	if (base_lid == 0 || base_lid > MAX_UNICAST_LID)
+		return;
+
+	if (!f_int->lid2port) {
+		f_int->lid2port = calloc(MAX_UNICAST_LID + 1,
+					 sizeof(*f_int->lid2port));
+		if (!f_int->lid2port) {
+			IBND_ERROR("OOM: failed to allocate the lid index\n");
+			return;
 		}
 	}
+
+	/* We add the port for all lids
+	 * so it is easier to find any "random" lid specified.
+	 * The first port reported for a lid keeps it.
+	 */
+	for (lid = base_lid;
+	     lid <= base_lid + lid_mask && lid <= MAX_UNICAST_LID; lid++)
+		if (!f_int->lid2port[lid])
+			f_int->lid2port[lid] = port;
 }
 
 void add_to_type_list(ibnd_node_t * node, f_internal_t * f_int)
@@ -747,6 +829,12 @@ static int set_config(struct ibnd_config *config, struct ibnd_config *cfg)
 
 	if (!config->max_smps)
 		config->max_smps = DEFAULT_MAX_SMP_ON_WIRE;
+	if (!config->min_smps)
+		config->min_smps = DEFAULT_MIN_SMP_ON_WIRE;
+	if (config->min_smps > config->max_smps)
+		config->min_smps = config->max_smps;
+	if (!config->max_smps_per_node)
+		config->max_smps_per_node = DEFAULT_MAX_SMP_PER_NODE;
 	if (!config->timeout_ms)
 		config->timeout_ms = DEFAULT_TIMEOUT;
 	if (!config->retries)
@@ -757,11 +845,7 @@ static int set_config(struct ibnd_config *config, struct ibnd_config *cfg)
 
 f_internal_t *allocate_fabric_internal(void)
 {
-	f_internal_t *f = calloc(1, sizeof(*f));
-	if (f)
-		create_lid2guid(f);
-
-	return (f);
+	return calloc(1, sizeof(f_internal_t));
 }
 
 ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
@@ -792,7 +876,7 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 		return NULL;
 	}
 
-	memset(&scan.selfportid, 0, sizeof(scan.selfportid));
+	memset(&scan, 0, sizeof(scan));
 	scan.f_int = f_int;
 	scan.cfg = &config;
 	scan.initial_hops = from->drpath.cnt;
@@ -828,6 +912,9 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 	f_int->fabric.total_mads_used = engine.total_smps;
 	f_int->fabric.maxhops_discovered += scan.initial_hops;
 
+	if (config.stats)
+		smp_engine_stats(&engine, config.stats);
+
 	if (group_nodes(&f_int->fabric))
 		goto error;
 
@@ -853,6 +940,7 @@ void destroy_node(ibnd_node_t * node)
 
 void ibnd_destroy_fabric(ibnd_fabric_t * fabric)
 {
+	f_internal_t *f = (f_internal_t *)fabric;
 	ibnd_node_t *node = NULL;
 	ibnd_node_t *next = NULL;
 	ibnd_chassis_t *ch, *ch_next;
@@ -866,13 +954,19 @@ void ibnd_destroy_fabric(ibnd_fabric_t * fabric)
 		free(ch);
 		ch = ch_next;
 	}
-	node = fabric->nodes;
-	while (node) {
-		next = node->next;
-		destroy_node(node);
-		node = next;
+	if (f->node_pool) {
+		free(f->node_pool);
+		free(f->port_pool);
+		free(f->port_array_pool);
+	} else {
+		node = fabric->nodes;
+		while (node) {
+			next = node->next;
+			destroy_node(node);
+			node = next;
+		}
 	}
-	destroy_lid2guid((f_internal_t *)fabric);
+	destroy_fabric_index(f);
 	free(fabric);
 }
 
@@ -935,26 +1029,25 @@ ibnd_port_t *ibnd_find_port_lid(ibnd_fabric_t * fabric,
 {
 	f_internal_t *f = (f_internal_t *)fabric;
 
-	return container_of(cl_qmap_get(&f->lid2guid, lid),
-			    struct lid2guid_item, cl_map)
-		->port;
+	if (!fabric) {
+		IBND_DEBUG("fabric parameter NULL\n");
+		return NULL;
+	}
+
+	if (!lid || lid > MAX_UNICAST_LID || !f->lid2port)
+		return NULL;
+
+	return f->lid2port[lid];
 }
 
 ibnd_port_t *ibnd_find_port_guid(ibnd_fabric_t * fabric, uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_port_t *port;
-
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return NULL;
 	}
 
-	for (port = fabric->portstbl[hash]; port; port = port->htnext)
-		if (port->guid == guid)
-			return port;
-
-	return NULL;
+	return guid_tbl_find(&((f_internal_t *)fabric)->port_guids, guid);
 }
 
 ibnd_port_t *ibnd_find_port_dr(ibnd_fabric_t * fabric, char *dr_str)
@@ -983,7 +1076,9 @@ ibnd_port_t *ibnd_find_port_dr(ibnd_fabric_t * fabric, char *dr_str)
 		ibnd_port_t *remote_port = NULL;
 		if (path.p[i] == 0)
 			continue;
-		if (!cur_node->ports)
+		if (!cur_node || !cur_node->ports ||
+		    path.p[i] > cur_node->numports ||
+		    !cur_node->ports[path.p[i]])
 			return NULL;
 
 		remote_port = cur_node->ports[path.p[i]]->remoteport;
@@ -1000,7 +1095,8 @@ ibnd_port_t *ibnd_find_port_dr(ibnd_fabric_t * fabric, char *dr_str)
 void ibnd_iter_ports(ibnd_fabric_t * fabric, ibnd_iter_port_func_t func,
 			void *user_data)
 {
-	int i = 0;
+	f_internal_t *f = (f_internal_t *)fabric;
+	unsigned i = 0;
 	ibnd_port_t *cur = NULL;
 
 	if (!fabric) {
@@ -1013,7 +1109,7 @@ void ibnd_iter_ports(ibnd_fabric_t * fabric, ibnd_iter_port_func_t func,
 		return;
 	}
 
-	for (i = 0; i<HTSZ; i++)
-		for (cur = fabric->portstbl[i]; cur; cur = cur->htnext)
+	for (i = 0; i < f->port_guids.size; i++)
+		for (cur = f->port_guids.slots[i].head; cur; cur = cur->htnext)
 			func(cur, user_data);
 }
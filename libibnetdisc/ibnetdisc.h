@@ -142,7 +142,22 @@ typedef struct ibnd_chassis {
 /* define config flags */
 #define IBND_CONFIG_MLX_EPI (1 << 0)
 
+/* discovery statistics, see ibnd_config.stats */
+typedef struct ibnd_scan_stats {
+	uint64_t smps_sent;
+	uint64_t smps_completed;
+	uint64_t timeouts;
+	uint64_t errors;
+	uint64_t avg_rtt_us;
+	uint64_t max_rtt_us;
+	uint64_t elapsed_us;
+	unsigned nodes;
+	unsigned max_window;	/* largest number of SMPs on the wire */
+} ibnd_scan_stats_t;
+
 typedef struct ibnd_config {
+	/* upper bound of the SMP window, default 2; above min_smps the
+	 * window grows while responses arrive in time */
 	unsigned max_smps;
 	unsigned show_progress;
 	unsigned max_hops;
@@ -151,7 +166,14 @@ typedef struct ibnd_config {
 	unsigned retries;
 	uint32_t flags;
 	uint64_t mkey;
-	uint8_t pad[44];
+	unsigned max_smps_per_node;	/* default 2 */
+	unsigned min_smps;	/* initial and minimum SMP window, default 2 */
+	/* optional, kept up to date while ibnd_discover_fabric() runs */
+	union {
+		ibnd_scan_stats_t *stats;
+		uint64_t stats_slot;	/* same size on every ABI */
+	};
+	uint8_t pad[28];
 } ibnd_config_t;
 
 /** =========================================================================
@@ -173,7 +195,8 @@ typedef struct ibnd_fabric {
 	unsigned maxhops_discovered;
 	unsigned total_mads_used;
 
-	/* internal use only */
+	/* internal use only; the GUID tables are no longer populated and are
+	 * kept for ABI compatibility, use ibnd_find_*() and ibnd_iter_*() */
 	ibnd_node_t *nodestbl[HTSZ];
 	ibnd_port_t *portstbl[HTSZ];
 	ibnd_node_t *switches;
@@ -204,6 +227,8 @@ int ibnd_cache_fabric(ibnd_fabric_t *fabric, const char *file,
 
 #define IBND_CACHE_FABRIC_FLAG_DEFAULT      0x0000
 #define IBND_CACHE_FABRIC_FLAG_NO_OVERWRITE 0x0001
+/* write the version 1 format that older releases can load */
+#define IBND_CACHE_FABRIC_FLAG_V1           0x0002
 
 /** =========================================================================
  * Node operations
@@ -38,20 +38,40 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <endian.h>
 
 #include <infiniband/ibnetdisc.h>
+#include <ccan/build_assert.h>
 
 #include "internal.h"
 #include "chassis.h"
 
 /* For this caching lib, we always cache little endian */
 
-/* Cache format
+/* Snapshot format (version 2), written by ibnd_cache_fabric()
+ *
+ * Every record has a fixed size and 8 byte aligned offset, so the loader
+ * can index the arrays straight out of the mapped file.  They are still
+ * copied into the pointer based ibnd_node_t/ibnd_port_t, the mapping is not
+ * kept.  Links between records are array indexes, IBND_SNAP_NONE when
+ * absent.
+ *
+ * header (struct ibnd_snap_header)
+ * nodes - node_count struct ibnd_snap_node
+ * ports - port_count struct ibnd_snap_port.  Each node owns numports + 1
+ *         consecutive records starting at first_port and indexed by port
+ *         number; a record for a port that was not discovered has
+ *         node == IBND_SNAP_NONE
+ * lids  - lid_count 32 bit port indexes, the port owning each LID
+ *
+ * Version 1 cache format, still accepted by ibnd_load_fabric() and written
+ * by ibnd_cache_fabric() with IBND_CACHE_FABRIC_FLAG_V1 for older readers
  *
  * Bytes 1-4 - magic number
  * Bytes 5-8 - version number
@@ -142,6 +162,51 @@ typedef struct ibnd_fabric_cache {
 #define IBND_PORT_CACHE_KEY_LEN        (8 + 1)
 #define IBND_PORT_CACHE_LEN            (31 + IB_SMP_DATA_SIZE)
 
+#define IBND_FABRIC_SNAP_VERSION  0x00000002
+#define IBND_SNAP_NONE            0xFFFFFFFF
+
+struct ibnd_snap_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t node_count;
+	uint32_t port_count;
+	uint32_t lid_count;
+	uint32_t from_node;
+	uint32_t maxhops_discovered;
+	uint32_t reserved;
+	uint64_t node_offset;
+	uint64_t port_offset;
+	uint64_t lid_offset;
+	uint64_t size;
+};
+
+struct ibnd_snap_node {
+	uint64_t guid;
+	uint32_t first_port;
+	uint16_t smalid;
+	uint8_t smalmc;
+	uint8_t smaenhsp0;
+	uint8_t type;
+	uint8_t numports;
+	uint8_t reserved[6];
+	uint8_t switchinfo[IB_SMP_DATA_SIZE];
+	uint8_t info[IB_SMP_DATA_SIZE];
+	uint8_t nodedesc[IB_SMP_DATA_SIZE];
+};
+
+struct ibnd_snap_port {
+	uint64_t guid;
+	uint32_t node;
+	uint32_t remoteport;
+	uint16_t base_lid;
+	uint8_t portnum;
+	uint8_t ext_portnum;
+	uint8_t lmc;
+	uint8_t reserved[3];
+	uint8_t info[IB_SMP_DATA_SIZE];
+	uint8_t ext_info[IB_SMP_DATA_SIZE];
+};
+
 static ssize_t ibnd_read(int fd, void *buf, size_t count)
 {
 	size_t count_done = 0;
@@ -511,8 +576,7 @@ static int _fill_port(ibnd_fabric_cache_t * fabric_cache, ibnd_node_t * node,
 	/* achu: needed if user wishes to re-cache a loaded fabric.
 	 * Otherwise, mostly unnecessary to do this.
 	 */
-	int rc = add_to_portguid_hash(port_cache->port,
-				      fabric_cache->f_int->fabric.portstbl);
+	int rc = add_to_portguid_hash(port_cache->port, fabric_cache->f_int);
 	if (rc) {
 		IBND_DEBUG("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -541,9 +605,7 @@ static int _rebuild_nodes(ibnd_fabric_cache_t * fabric_cache)
 		fabric_cache->f_int->fabric.nodes = node;
 
 		int rc = add_to_nodeguid_hash(node_cache->node,
-					      fabric_cache->
-					      f_int->
-					      fabric.nodestbl);
+					      fabric_cache->f_int);
 		if (rc) {
 			IBND_DEBUG("Error Occurred when trying"
 				   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -617,26 +679,15 @@ static int _rebuild_ports(ibnd_fabric_cache_t * fabric_cache)
 	return 0;
 }
 
-ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
+static ibnd_fabric_t *_load_fabric_v1(int fd)
 {
 	unsigned int node_count = 0;
 	unsigned int port_count = 0;
 	ibnd_fabric_cache_t *fabric_cache = NULL;
 	f_internal_t *f_int = NULL;
 	ibnd_node_cache_t *node_cache = NULL;
-	int fd = -1;
 	unsigned int i;
 
-	if (!file) {
-		IBND_DEBUG("file parameter NULL\n");
-		return NULL;
-	}
-
-	if ((fd = open(file, O_RDONLY)) < 0) {
-		IBND_DEBUG("open: %s\n", strerror(errno));
-		return NULL;
-	}
-
 	fabric_cache =
 	    (ibnd_fabric_cache_t *) malloc(sizeof(ibnd_fabric_cache_t));
 	if (!fabric_cache) {
@@ -684,16 +735,284 @@ ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
 		goto cleanup;
 
 	_destroy_ibnd_fabric_cache(fabric_cache);
-	close(fd);
 	return (ibnd_fabric_t *)&f_int->fabric;
 
 cleanup:
 	ibnd_destroy_fabric((ibnd_fabric_t *)f_int);
 	_destroy_ibnd_fabric_cache(fabric_cache);
-	close(fd);
 	return NULL;
 }
 
+static int _snap_array_valid(size_t size, uint64_t offset, uint32_t count,
+			     size_t rec_size)
+{
+	if (offset % 8 || offset > size)
+		return 0;
+	return (size - offset) / rec_size >= count;
+}
+
+static int _load_snap_nodes(f_internal_t * f_int,
+			    const struct ibnd_snap_node *snodes,
+			    uint32_t node_count, uint32_t port_count)
+{
+	uint32_t first_port = 0;
+	uint32_t i;
+
+	/* ports must be laid out node after node */
+	for (i = 0; i < node_count; i++) {
+		if (le32toh(snodes[i].first_port) != first_port)
+			return -1;
+		first_port += snodes[i].numports + 1;
+		if (first_port > port_count)
+			return -1;
+	}
+	if (first_port != port_count)
+		return -1;
+
+	/* walk backwards so the lists keep the order of the snapshot */
+	for (i = node_count; i-- > 0;) {
+		const struct ibnd_snap_node *snode = &snodes[i];
+		ibnd_node_t *node = &f_int->node_pool[i];
+
+		node->guid = le64toh(snode->guid);
+		node->smalid = le16toh(snode->smalid);
+		node->smalmc = snode->smalmc;
+		node->smaenhsp0 = snode->smaenhsp0;
+		node->type = snode->type;
+		node->numports = snode->numports;
+		memcpy(node->switchinfo, snode->switchinfo,
+		       sizeof(node->switchinfo));
+		memcpy(node->info, snode->info, sizeof(node->info));
+		memcpy(node->nodedesc, snode->nodedesc, sizeof(node->nodedesc));
+		node->nodedesc[sizeof(node->nodedesc) - 1] = '\0';
+		node->ports =
+		    &f_int->port_array_pool[le32toh(snode->first_port)];
+
+		node->next = f_int->fabric.nodes;
+		f_int->fabric.nodes = node;
+
+		if (add_to_nodeguid_hash(node, f_int))
+			IBND_DEBUG("Error Occurred when trying"
+				   " to insert new node guid 0x%016" PRIx64
+				   " to DB\n", node->guid);
+
+		add_to_type_list(node, f_int);
+	}
+
+	return 0;
+}
+
+static int _load_snap_ports(f_internal_t * f_int,
+			    const struct ibnd_snap_port *sports,
+			    uint32_t node_count, uint32_t port_count)
+{
+	uint32_t i;
+
+	for (i = 0; i < port_count; i++) {
+		const struct ibnd_snap_port *sport = &sports[i];
+		uint32_t node_idx = le32toh(sport->node);
+		uint32_t remote_idx = le32toh(sport->remoteport);
+		ibnd_port_t *port = &f_int->port_pool[i];
+		ibnd_node_t *node;
+
+		if (node_idx == IBND_SNAP_NONE)
+			continue;
+		if (node_idx >= node_count)
+			return -1;
+
+		node = &f_int->node_pool[node_idx];
+		if (sport->portnum > node->numports ||
+		    &node->ports[sport->portnum] != &f_int->port_array_pool[i])
+			return -1;
+
+		port->guid = le64toh(sport->guid);
+		port->portnum = sport->portnum;
+		port->ext_portnum = sport->ext_portnum;
+		port->base_lid = le16toh(sport->base_lid);
+		port->lmc = sport->lmc;
+		memcpy(port->info, sport->info, sizeof(port->info));
+		memcpy(port->ext_info, sport->ext_info, sizeof(port->ext_info));
+		port->node = node;
+
+		if (remote_idx != IBND_SNAP_NONE) {
+			if (remote_idx >= port_count ||
+			    le32toh(sports[remote_idx].node) == IBND_SNAP_NONE)
+				return -1;
+			port->remoteport = &f_int->port_pool[remote_idx];
+		}
+
+		node->ports[port->portnum] = port;
+
+		if (add_to_portguid_hash(port, f_int))
+			IBND_DEBUG("Error Occurred when trying"
+				   " to insert new port guid 0x%016" PRIx64
+				   " to DB\n", port->guid);
+	}
+
+	return 0;
+}
+
+static int _load_snap_lids(f_internal_t * f_int, const uint32_t *slids,
+			   uint32_t lid_count, uint32_t port_count)
+{
+	uint32_t lid;
+
+	if (!lid_count)
+		return 0;
+
+	f_int->lid2port = calloc(MAX_UNICAST_LID + 1, sizeof(*f_int->lid2port));
+	if (!f_int->lid2port) {
+		IBND_DEBUG("OOM: lid index\n");
+		return -1;
+	}
+
+	for (lid = 1; lid < lid_count; lid++) {
+		uint32_t idx = le32toh(slids[lid]);
+
+		if (idx == IBND_SNAP_NONE)
+			continue;
+		if (idx >= port_count || !f_int->port_pool[idx].node)
+			return -1;
+		f_int->lid2port[lid] = &f_int->port_pool[idx];
+	}
+
+	return 0;
+}
+
+static ibnd_fabric_t *_load_snapshot(const uint8_t * map, size_t size)
+{
+	const struct ibnd_snap_header *hdr = (const void *)map;
+	uint32_t node_count, port_count, lid_count, from_node;
+	uint64_t node_offset, port_offset, lid_offset;
+	f_internal_t *f_int;
+
+	if (size < sizeof(*hdr) || le64toh(hdr->size) != size) {
+		IBND_DEBUG("Cache invalid: truncated snapshot\n");
+		return NULL;
+	}
+
+	node_count = le32toh(hdr->node_count);
+	port_count = le32toh(hdr->port_count);
+	lid_count = le32toh(hdr->lid_count);
+	from_node = le32toh(hdr->from_node);
+	node_offset = le64toh(hdr->node_offset);
+	port_offset = le64toh(hdr->port_offset);
+	lid_offset = le64toh(hdr->lid_offset);
+
+	if (!_snap_array_valid(size, node_offset, node_count,
+			       sizeof(struct ibnd_snap_node)) ||
+	    !_snap_array_valid(size, port_offset, port_count,
+			       sizeof(struct ibnd_snap_port)) ||
+	    !_snap_array_valid(size, lid_offset, lid_count, sizeof(uint32_t)) ||
+	    lid_count > MAX_UNICAST_LID + 1 || from_node >= node_count) {
+		IBND_DEBUG("Cache invalid: bad snapshot layout\n");
+		return NULL;
+	}
+
+	f_int = allocate_fabric_internal();
+	if (!f_int) {
+		IBND_DEBUG("OOM: fabric\n");
+		return NULL;
+	}
+
+	f_int->node_pool = calloc(node_count, sizeof(*f_int->node_pool));
+	f_int->port_pool = calloc(port_count ? port_count : 1,
+				  sizeof(*f_int->port_pool));
+	f_int->port_array_pool = calloc(port_count ? port_count : 1,
+					sizeof(*f_int->port_array_pool));
+	if (!f_int->node_pool || !f_int->port_pool ||
+	    !f_int->port_array_pool ||
+	    reserve_fabric_index(f_int, node_count, port_count)) {
+		IBND_DEBUG("OOM: fabric snapshot\n");
+		goto cleanup;
+	}
+
+	if (_load_snap_nodes(f_int, (const void *)(map + node_offset),
+			     node_count, port_count) < 0 ||
+	    _load_snap_ports(f_int, (const void *)(map + port_offset),
+			     node_count, port_count) < 0 ||
+	    _load_snap_lids(f_int, (const void *)(map + lid_offset),
+			    lid_count, port_count) < 0) {
+		IBND_DEBUG("Cache invalid: inconsistent snapshot\n");
+		goto cleanup;
+	}
+
+	f_int->fabric.from_node = &f_int->node_pool[from_node];
+	f_int->fabric.maxhops_discovered = le32toh(hdr->maxhops_discovered);
+
+	if (group_nodes(&f_int->fabric))
+		goto cleanup;
+
+	return (ibnd_fabric_t *)&f_int->fabric;
+
+cleanup:
+	ibnd_destroy_fabric((ibnd_fabric_t *)f_int);
+	return NULL;
+}
+
+ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
+{
+	ibnd_fabric_t *fabric = NULL;
+	struct stat statbuf;
+	uint8_t buf[8];
+	uint32_t magic, version;
+	void *map;
+	int fd;
+
+	if (!file) {
+		IBND_DEBUG("file parameter NULL\n");
+		return NULL;
+	}
+
+	if ((fd = open(file, O_RDONLY)) < 0) {
+		IBND_DEBUG("open: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	if (ibnd_read(fd, buf, sizeof(buf)) < 0)
+		goto out;
+
+	_unmarshall32(buf, &magic);
+	_unmarshall32(buf + 4, &version);
+
+	if (magic != IBND_FABRIC_CACHE_MAGIC) {
+		IBND_DEBUG("invalid fabric cache file\n");
+		goto out;
+	}
+
+	if (version == IBND_FABRIC_CACHE_VERSION) {
+		if (lseek(fd, 0, SEEK_SET) < 0) {
+			IBND_DEBUG("lseek: %s\n", strerror(errno));
+			goto out;
+		}
+		fabric = _load_fabric_v1(fd);
+		goto out;
+	}
+
+	if (version != IBND_FABRIC_SNAP_VERSION) {
+		IBND_DEBUG("invalid fabric cache version\n");
+		goto out;
+	}
+
+	if (fstat(fd, &statbuf) < 0) {
+		IBND_DEBUG("fstat: %s\n", strerror(errno));
+		goto out;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		IBND_DEBUG("mmap: %s\n", strerror(errno));
+		goto out;
+	}
+	madvise(map, statbuf.st_size, MADV_SEQUENTIAL);
+
+	fabric = _load_snapshot(map, statbuf.st_size);
+	munmap(map, statbuf.st_size);
+out:
+	close(fd);
+	return fabric;
+}
+
 static ssize_t ibnd_write(int fd, const void *buf, size_t count)
 {
 	size_t count_done = 0;
@@ -875,18 +1194,220 @@ static int _cache_port(int fd, ibnd_port_t * port)
 	return 0;
 }
 
+static int _cache_fabric_v1(int fd, ibnd_fabric_t * fabric)
+{
+	ibnd_node_t *node;
+	unsigned int node_count = 0;
+	unsigned int port_count = 0;
+	int i;
+
+	if (_cache_header_info(fd, fabric) < 0)
+		return -1;
+
+	for (node = fabric->nodes; node; node = node->next) {
+		if (_cache_node(fd, node) < 0)
+			return -1;
+		node_count++;
+	}
+
+	/* every port a node stored a key for, in any order */
+	for (node = fabric->nodes; node; node = node->next)
+		for (i = 0; i <= node->numports; i++) {
+			if (!node->ports[i])
+				continue;
+			if (_cache_port(fd, node->ports[i]) < 0)
+				return -1;
+			port_count++;
+		}
+
+	return _cache_header_counts(fd, node_count, port_count);
+}
+
+struct snap_node_ref {
+	const ibnd_node_t *node;
+	uint32_t idx;
+	uint32_t first_port;
+};
+
+static int _snap_node_ref_cmp(const void *a, const void *b)
+{
+	const struct snap_node_ref *ra = a;
+	const struct snap_node_ref *rb = b;
+
+	if (ra->node == rb->node)
+		return 0;
+	return (uintptr_t) ra->node < (uintptr_t) rb->node ? -1 : 1;
+}
+
+static const struct snap_node_ref *_snap_find_node(const struct snap_node_ref
+						   *refs, uint32_t node_count,
+						   const ibnd_node_t * node)
+{
+	struct snap_node_ref key = {.node = node };
+
+	return bsearch(&key, refs, node_count, sizeof(*refs),
+		       _snap_node_ref_cmp);
+}
+
+static uint32_t _snap_port_idx(const struct snap_node_ref *refs,
+			       uint32_t node_count, const ibnd_port_t * port)
+{
+	const struct snap_node_ref *ref;
+
+	ref = _snap_find_node(refs, node_count, port->node);
+	if (!ref || port->portnum < 0 || port->portnum > port->node->numports)
+		return IBND_SNAP_NONE;
+	return ref->first_port + port->portnum;
+}
+
+static void _snap_node(struct ibnd_snap_node *snode, const ibnd_node_t * node,
+		       uint32_t first_port)
+{
+	snode->guid = htole64(node->guid);
+	snode->first_port = htole32(first_port);
+	snode->smalid = htole16(node->smalid);
+	snode->smalmc = node->smalmc;
+	snode->smaenhsp0 = (uint8_t) node->smaenhsp0;
+	snode->type = (uint8_t) node->type;
+	snode->numports = (uint8_t) node->numports;
+	memcpy(snode->switchinfo, node->switchinfo, sizeof(snode->switchinfo));
+	memcpy(snode->info, node->info, sizeof(snode->info));
+	memcpy(snode->nodedesc, node->nodedesc, sizeof(snode->nodedesc));
+}
+
+static void _snap_port(struct ibnd_snap_port *sport, const ibnd_port_t * port,
+		       uint32_t node_idx, uint32_t remote_idx)
+{
+	sport->guid = htole64(port->guid);
+	sport->node = htole32(node_idx);
+	sport->remoteport = htole32(remote_idx);
+	sport->base_lid = htole16(port->base_lid);
+	sport->portnum = (uint8_t) port->portnum;
+	sport->ext_portnum = (uint8_t) port->ext_portnum;
+	sport->lmc = port->lmc;
+	memcpy(sport->info, port->info, sizeof(sport->info));
+	memcpy(sport->ext_info, port->ext_info, sizeof(sport->ext_info));
+}
+
+/* Build the whole snapshot in memory so it is written with a single write */
+static uint8_t *_build_snapshot(f_internal_t * f_int, size_t *len)
+{
+	ibnd_fabric_t *fabric = &f_int->fabric;
+	struct ibnd_snap_header *hdr;
+	struct ibnd_snap_node *snodes;
+	struct ibnd_snap_port *sports;
+	struct snap_node_ref *refs;
+	const struct snap_node_ref *from;
+	uint32_t node_count = 0, port_count = 0, lid_count = 0;
+	uint32_t *slids;
+	ibnd_node_t *node;
+	uint8_t *image = NULL;
+	size_t size;
+	uint32_t i, lid;
+	int p;
+
+	BUILD_ASSERT(sizeof(struct ibnd_snap_header) == 64);
+	BUILD_ASSERT(sizeof(struct ibnd_snap_node) == 24 + 3 * IB_SMP_DATA_SIZE);
+	BUILD_ASSERT(sizeof(struct ibnd_snap_port) == 24 + 2 * IB_SMP_DATA_SIZE);
+
+	for (node = fabric->nodes; node; node = node->next)
+		node_count++;
+
+	refs = calloc(node_count ? node_count : 1, sizeof(*refs));
+	if (!refs) {
+		IBND_DEBUG("OOM: snapshot node refs\n");
+		return NULL;
+	}
+
+	for (i = 0, node = fabric->nodes; node; node = node->next, i++) {
+		refs[i].node = node;
+		refs[i].idx = i;
+		refs[i].first_port = port_count;
+		port_count += node->numports + 1;
+	}
+	qsort(refs, node_count, sizeof(*refs), _snap_node_ref_cmp);
+
+	from = _snap_find_node(refs, node_count, fabric->from_node);
+	if (!from) {
+		IBND_DEBUG("from node not in fabric\n");
+		goto out;
+	}
+
+	if (f_int->lid2port)
+		for (lid = MAX_UNICAST_LID; lid > 0; lid--)
+			if (f_int->lid2port[lid]) {
+				lid_count = lid + 1;
+				break;
+			}
+
+	size = sizeof(*hdr) + node_count * sizeof(*snodes) +
+	    (size_t)port_count * sizeof(*sports) + lid_count * sizeof(*slids);
+	size = (size + 7) & ~(size_t)7;
+	image = calloc(1, size);
+	if (!image) {
+		IBND_DEBUG("OOM: snapshot\n");
+		goto out;
+	}
+
+	hdr = (struct ibnd_snap_header *)image;
+	snodes = (struct ibnd_snap_node *)(hdr + 1);
+	sports = (struct ibnd_snap_port *)(snodes + node_count);
+	slids = (uint32_t *)(sports + port_count);
+
+	hdr->magic = htole32(IBND_FABRIC_CACHE_MAGIC);
+	hdr->version = htole32(IBND_FABRIC_SNAP_VERSION);
+	hdr->node_count = htole32(node_count);
+	hdr->port_count = htole32(port_count);
+	hdr->lid_count = htole32(lid_count);
+	hdr->from_node = htole32(from->idx);
+	hdr->maxhops_discovered = htole32(fabric->maxhops_discovered);
+	hdr->node_offset = htole64((uint8_t *)snodes - image);
+	hdr->port_offset = htole64((uint8_t *)sports - image);
+	hdr->lid_offset = htole64((uint8_t *)slids - image);
+	hdr->size = htole64(size);
+
+	for (i = 0; i < node_count; i++) {
+		const struct snap_node_ref *ref = &refs[i];
+
+		node = (ibnd_node_t *)ref->node;
+		_snap_node(&snodes[ref->idx], node, ref->first_port);
+
+		for (p = 0; p <= node->numports; p++) {
+			ibnd_port_t *port = node->ports[p];
+			struct ibnd_snap_port *sport =
+			    &sports[ref->first_port + p];
+
+			if (!port) {
+				sport->node = htole32(IBND_SNAP_NONE);
+				sport->remoteport = htole32(IBND_SNAP_NONE);
+				continue;
+			}
+			_snap_port(sport, port, ref->idx,
+				   port->remoteport ?
+				   _snap_port_idx(refs, node_count,
+						  port->remoteport) :
+				   IBND_SNAP_NONE);
+		}
+	}
+
+	for (lid = 0; lid < lid_count; lid++)
+		slids[lid] = htole32(f_int->lid2port[lid] ?
+				     _snap_port_idx(refs, node_count,
+						    f_int->lid2port[lid]) :
+				     IBND_SNAP_NONE);
+
+	*len = size;
+out:
+	free(refs);
+	return image;
+}
 int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 		      unsigned int flags)
 {
 	struct stat statbuf;
-	ibnd_node_t *node = NULL;
-	ibnd_node_t *node_next = NULL;
-	unsigned int node_count = 0;
-	ibnd_port_t *port = NULL;
-	ibnd_port_t *port_next = NULL;
-	unsigned int port_count = 0;
+	uint8_t *image;
+	size_t len = 0;
 	int fd;
-	int i;
 
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
@@ -914,49 +1435,42 @@ int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 		}
 	}
 
-	if ((fd = open(file, O_CREAT | O_EXCL | O_WRONLY, 0644)) < 0) {
-		IBND_DEBUG("open: %s\n", strerror(errno));
-		return -1;
-	}
-
-	if (_cache_header_info(fd, fabric) < 0)
-		goto cleanup;
-
-	node = fabric->nodes;
-	while (node) {
-		node_next = node->next;
-
-		if (_cache_node(fd, node) < 0)
+	if (flags & IBND_CACHE_FABRIC_FLAG_V1) {
+		if ((fd = open(file, O_CREAT | O_EXCL | O_WRONLY, 0644)) < 0) {
+			IBND_DEBUG("open: %s\n", strerror(errno));
+			return -1;
+		}
+		image = NULL;
+		if (_cache_fabric_v1(fd, fabric) < 0)
 			goto cleanup;
-
-		node_count++;
-		node = node_next;
+		goto done;
 	}
 
-	for (i = 0; i < HTSZ; i++) {
-		port = fabric->portstbl[i];
-		while (port) {
-			port_next = port->htnext;
-
-			if (_cache_port(fd, port) < 0)
-				goto cleanup;
+	image = _build_snapshot((f_internal_t *)fabric, &len);
+	if (!image)
+		return -1;
 
-			port_count++;
-			port = port_next;
-		}
+	if ((fd = open(file, O_CREAT | O_EXCL | O_WRONLY, 0644)) < 0) {
+		IBND_DEBUG("open: %s\n", strerror(errno));
+		free(image);
+		return -1;
 	}
 
-	if (_cache_header_counts(fd, node_count, port_count) < 0)
+	if (ibnd_write(fd, image, len) < 0)
 		goto cleanup;
 
+	free(image);
+done:
 	if (close(fd) < 0) {
 		IBND_DEBUG("close: %s\n", strerror(errno));
-		goto cleanup;
+		unlink(file);
+		return -1;
 	}
 
 	return 0;
 
 cleanup:
+	free(image);
 	unlink(file);
 	close(fd);
 	return -1;
@@ -39,7 +39,6 @@
 #define _INTERNAL_H_
 
 #include <infiniband/ibnetdisc.h>
-#include <util/cl_qmap.h>
 
 #define	IBND_DEBUG(fmt, ...) \
 	if (ibdebug) { \
@@ -53,17 +52,44 @@
 
 #define MAXHOPS         63
 
+/* a larger max_smps opts in to the adaptive window */
 #define DEFAULT_MAX_SMP_ON_WIRE 2
+#define DEFAULT_MIN_SMP_ON_WIRE 2
+#define DEFAULT_MAX_SMP_PER_NODE 2
 #define DEFAULT_TIMEOUT 1000
 #define DEFAULT_RETRIES 3
 
+#define MAX_UNICAST_LID 0xbfff
+
+/* Open addressed GUID index.  Each used slot heads the htnext list of the
+ * objects sharing that GUID (e.g. all the ports of a switch), most recently
+ * added first.  The table is kept at most half full.
+ */
+struct guid_slot {
+	uint64_t guid;
+	void *head;
+};
+
+struct guid_tbl {
+	struct guid_slot *slots;
+	unsigned size;		/* 0 or a power of 2 */
+	unsigned used;
+};
+
 typedef struct f_internal {
 	ibnd_fabric_t fabric;
-	cl_qmap_t lid2guid;
+	struct guid_tbl node_guids;
+	struct guid_tbl port_guids;
+	ibnd_port_t **lid2port;	/* MAX_UNICAST_LID + 1 entries, lazily allocated */
+	/* set when the nodes and ports were bulk allocated from a snapshot,
+	 * in which case they are not freed individually */
+	ibnd_node_t *node_pool;
+	ibnd_port_t *port_pool;
+	ibnd_port_t **port_array_pool;
 } f_internal_t;
 f_internal_t *allocate_fabric_internal(void);
-void create_lid2guid(f_internal_t *f_int);
-void destroy_lid2guid(f_internal_t *f_int);
+int reserve_fabric_index(f_internal_t *f_int, unsigned nodes, unsigned ports);
+void destroy_fabric_index(f_internal_t *f_int);
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int);
 
 typedef struct ibnd_scan {
@@ -71,6 +97,7 @@ typedef struct ibnd_scan {
 	f_internal_t *f_int;
 	struct ibnd_config *cfg;
 	unsigned initial_hops;
+	unsigned nodes;
 } ibnd_scan_t;
 
 typedef struct ibnd_smp ibnd_smp_t;
@@ -78,8 +105,7 @@ typedef struct smp_engine smp_engine_t;
 typedef int (*smp_comp_cb_t) (smp_engine_t * engine, ibnd_smp_t * smp,
 			      uint8_t * mad_resp, void *cb_data);
 struct ibnd_smp {
-	cl_map_item_t on_wire;
-	struct ibnd_smp *qnext;
+	smp_engine_t *engine;
 	smp_comp_cb_t cb;
 	void *cb_data;
 	ib_portid_t path;
@@ -87,15 +113,13 @@ struct ibnd_smp {
 };
 
 struct smp_engine {
-	int umad_fd;
-	int smi_agent;
-	int smi_dir_agent;
-	ibnd_smp_t *smp_queue_head;
-	ibnd_smp_t *smp_queue_tail;
+	struct ibmad_port *srcport;
+	struct mad_rpc_engine *rpc_engine;
 	void *user_data;
-	cl_qmap_t smps_on_wire;
 	struct ibnd_config *cfg;
 	unsigned total_smps;
+	uint64_t start_us;
+	int error;		/* first error returned by a completion */
 };
 
 int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
@@ -103,11 +127,12 @@ int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
 int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	      unsigned attrid, unsigned mod, smp_comp_cb_t cb, void *cb_data);
 int process_mads(smp_engine_t * engine);
+void smp_engine_stats(smp_engine_t * engine, ibnd_scan_stats_t * stats);
 void smp_engine_destroy(smp_engine_t * engine);
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[]);
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int);
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[]);
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int);
 
 void add_to_type_list(ibnd_node_t * node, f_internal_t * fabric);
 
@@ -33,87 +33,56 @@
  */
 
 #include <errno.h>
+#include <time.h>
 #include <infiniband/ibnetdisc.h>
 #include <infiniband/umad.h>
 #include "internal.h"
 
-static void queue_smp(smp_engine_t * engine, ibnd_smp_t * smp)
+static uint64_t now_us(void)
 {
-	smp->qnext = NULL;
-	if (!engine->smp_queue_head) {
-		engine->smp_queue_head = smp;
-		engine->smp_queue_tail = smp;
-	} else {
-		engine->smp_queue_tail->qnext = smp;
-		engine->smp_queue_tail = smp;
-	}
-}
+	struct timespec ts;
 
-static ibnd_smp_t *get_smp(smp_engine_t * engine)
-{
-	ibnd_smp_t *head = engine->smp_queue_head;
-	ibnd_smp_t *tail = engine->smp_queue_tail;
-	ibnd_smp_t *rc = head;
-	if (head) {
-		if (tail == head)
-			engine->smp_queue_tail = NULL;
-		engine->smp_queue_head = head->qnext;
-	}
-	return rc;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-static int send_smp(ibnd_smp_t * smp, smp_engine_t * engine)
+static void smp_complete(struct mad_rpc_engine *rpc_engine, ib_rpc_t *rpc,
+			 ib_portid_t *dport, int status, uint8_t *mad,
+			 void *cb_data)
 {
+	ibnd_smp_t *smp = cb_data;
+	smp_engine_t *engine = smp->engine;
 	int rc = 0;
-	uint8_t umad[1024];
-	ib_rpc_t *rpc = &smp->rpc;
-	int agent = 0;
-
-	memset(umad, 0, umad_size() + IB_MAD_SIZE);
 
-	if (rpc->mgtclass == IB_SMI_CLASS) {
-		agent = engine->smi_agent;
-	} else if (rpc->mgtclass == IB_SMI_DIRECT_CLASS) {
-		agent = engine->smi_dir_agent;
-	} else {
-		IBND_ERROR("Invalid class for RPC\n");
-		return (-EIO);
-	}
-
-	if ((rc = mad_build_pkt(umad, &smp->rpc, &smp->path, NULL, NULL))
-	    < 0) {
-		IBND_ERROR("mad_build_pkt failed; %d\n", rc);
-		return rc;
-	}
-
-	if ((rc = umad_send(engine->umad_fd, agent, umad, IB_MAD_SIZE,
-			    engine->cfg->timeout_ms, engine->cfg->retries)) < 0) {
-		IBND_ERROR("send failed; %d\n", rc);
-		return rc;
+	/* the engine is being torn down, nothing may be queued any more */
+	if (status == ECANCELED) {
+		free(smp);
+		return;
 	}
 
-	return 0;
-}
+	smp->rpc = *rpc;
+	smp->path = *dport;
 
-static int process_smp_queue(smp_engine_t * engine)
-{
-	int rc = 0;
-	ibnd_smp_t *smp;
-	while (cl_qmap_count(&engine->smps_on_wire)
-	       < engine->cfg->max_smps) {
-		smp = get_smp(engine);
-		if (!smp)
-			return 0;
+	if (!mad) {
+		IBND_ERROR("umad (%s Attr 0x%x:%u) bad status %d; %s\n",
+			   portid2str(&smp->path), smp->rpc.attr.id,
+			   smp->rpc.attr.mod, status, strerror(status));
+		if (smp->rpc.attr.id == IB_ATTR_MLNX_EXT_PORT_INFO)
+			rc = mlnx_ext_port_info_err(engine, smp, mad,
+						    smp->cb_data);
+	} else if (status) {
+		IBND_ERROR("mad (%s Attr 0x%x:%u) bad status 0x%x\n",
+			   portid2str(&smp->path), smp->rpc.attr.id,
+			   smp->rpc.attr.mod, smp->rpc.rstatus);
+		if (smp->rpc.attr.id == IB_ATTR_MLNX_EXT_PORT_INFO)
+			rc = mlnx_ext_port_info_err(engine, smp, mad,
+						    smp->cb_data);
+	} else
+		rc = smp->cb(engine, smp, mad, smp->cb_data);
 
-		if ((rc = send_smp(smp, engine)) != 0) {
-			free(smp);
-			return rc;
-		}
-		cl_qmap_insert(&engine->smps_on_wire, (uint32_t) smp->rpc.trid,
-			       (cl_map_item_t *) smp);
-		engine->total_smps++;
-	}
-	return 0;
+	if (rc && !engine->error)
+		engine->error = rc;
+	free(smp);
 }
 
 int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
@@ -125,6 +94,7 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 		return -ENOMEM;
 	}
 
+	smp->engine = engine;
 	smp->cb = cb;
 	smp->cb_data = cb_data;
 	smp->path = *portid;
@@ -134,7 +104,6 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	smp->rpc.timeout = engine->cfg->timeout_ms;
 	smp->rpc.datasz = IB_SMP_DATA_SIZE;
 	smp->rpc.dataoffs = IB_SMP_DATA_OFFS;
-	smp->rpc.trid = mad_trid();
 	smp->rpc.mkey = engine->cfg->mkey;
 
 	if (portid->lid <= 0 || portid->drpath.drslid == 0xffff ||
@@ -145,135 +114,100 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 
 	portid->sl = 0;
 	portid->qp = 0;
+	smp->path.sl = 0;
+	smp->path.qp = 0;
 
-	queue_smp(engine, smp);
-	return process_smp_queue(engine);
-}
-
-static int process_one_recv(smp_engine_t * engine)
-{
-	int rc = 0;
-	int status = 0;
-	ibnd_smp_t *smp;
-	uint8_t *mad;
-	uint32_t trid;
-	uint8_t umad[sizeof(struct ib_user_mad) + IB_MAD_SIZE];
-	int length = umad_size() + IB_MAD_SIZE;
-
-	memset(umad, 0, sizeof(umad));
-
-	/* wait for the next message */
-	if ((rc = umad_recv(engine->umad_fd, umad, &length,
-			    -1)) < 0) {
-		IBND_ERROR("umad_recv failed: %d\n", rc);
-		return -1;
-	}
-
-	mad = umad_get_mad(umad);
-	trid = (uint32_t) mad_get_field64(mad, 0, IB_MAD_TRID_F);
-
-	smp = (ibnd_smp_t *) cl_qmap_remove(&engine->smps_on_wire, trid);
-	if ((cl_map_item_t *) smp == cl_qmap_end(&engine->smps_on_wire)) {
-		IBND_ERROR("Failed to find matching smp for trid (%x)\n", trid);
-		return -1;
+	if (mad_rpc_async(engine->rpc_engine, &smp->rpc, &smp->path, NULL,
+			  smp_complete, smp)) {
+		IBND_ERROR("failed to queue SMP; %s\n", strerror(errno));
+		free(smp);
+		return -errno;
 	}
-
-	rc = process_smp_queue(engine);
-	if (rc)
-		goto error;
-
-	if ((status = umad_status(umad))) {
-		IBND_ERROR("umad (%s Attr 0x%x:%u) bad status %d; %s\n",
-			   portid2str(&smp->path), smp->rpc.attr.id,
-			   smp->rpc.attr.mod, status, strerror(status));
-		if (smp->rpc.attr.id == IB_ATTR_MLNX_EXT_PORT_INFO)
-			rc = mlnx_ext_port_info_err(engine, smp, mad,
-						    smp->cb_data);
-	} else if ((status = mad_get_field(mad, 0, IB_DRSMP_STATUS_F))) {
-		IBND_ERROR("mad (%s Attr 0x%x:%u) bad status 0x%x\n",
-			   portid2str(&smp->path), smp->rpc.attr.id,
-			   smp->rpc.attr.mod, status);
-		if (smp->rpc.attr.id == IB_ATTR_MLNX_EXT_PORT_INFO)
-			rc = mlnx_ext_port_info_err(engine, smp, mad,
-						    smp->cb_data);
-	} else
-		rc = smp->cb(engine, smp, mad, smp->cb_data);
-
-error:
-	free(smp);
-	return rc;
+	engine->total_smps++;
+	return 0;
 }
 
 int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
 		    void *user_data, ibnd_config_t *cfg)
 {
-	memset(engine, 0, sizeof(*engine));
+	int mc[2] = { IB_SMI_CLASS, IB_SMI_DIRECT_CLASS };
 
-	if (umad_init() < 0) {
-		IBND_ERROR("umad_init failed\n");
-		return -EIO;
-	}
+	memset(engine, 0, sizeof(*engine));
 
-	engine->umad_fd = umad_open_port(ca_name, ca_port);
-	if (engine->umad_fd < 0) {
+	engine->srcport = mad_rpc_open_port(ca_name, ca_port, mc, 2);
+	if (!engine->srcport) {
 		IBND_ERROR("can't open UMAD port (%s:%d)\n", ca_name, ca_port);
 		return -EIO;
 	}
-
-	if ((engine->smi_agent = umad_register(engine->umad_fd,
-	     IB_SMI_CLASS, 1, 0, NULL)) < 0) {
-		IBND_ERROR("Failed to register SMI agent on (%s:%d)\n",
-			   ca_name, ca_port);
-		goto eio_close;
-	}
-
-	if ((engine->smi_dir_agent = umad_register(engine->umad_fd,
-	     IB_SMI_DIRECT_CLASS, 1, 0, NULL)) < 0) {
-		IBND_ERROR("Failed to register SMI_DIRECT agent on (%s:%d)\n",
-			   ca_name, ca_port);
-		goto eio_close;
+	/* ibnd retries are kernel resends, the port counts attempts */
+	mad_rpc_set_timeout(engine->srcport, cfg->timeout_ms);
+	mad_rpc_set_retries(engine->srcport, cfg->retries + 1);
+
+	engine->rpc_engine = mad_rpc_engine_create(engine->srcport,
+						   cfg->max_smps);
+	if (!engine->rpc_engine) {
+		IBND_ERROR("can't create MAD RPC engine\n");
+		mad_rpc_close_port(engine->srcport);
+		return -ENOMEM;
 	}
+	/*
+	 * Start small and let the window grow while the SMAs keep up; the
+	 * per node limit keeps a switch with many ports from filling the
+	 * whole window and lets the BFS frontier progress in parallel.
+	 */
+	if (cfg->min_smps < cfg->max_smps)
+		mad_rpc_engine_set_adaptive(engine->rpc_engine, cfg->min_smps,
+					    cfg->max_smps);
+	mad_rpc_engine_set_dest_limit(engine->rpc_engine,
+				      cfg->max_smps_per_node);
 
 	engine->user_data = user_data;
-	cl_qmap_init(&engine->smps_on_wire);
 	engine->cfg = cfg;
+	engine->start_us = now_us();
 	return (0);
-
-eio_close:
-	umad_close_port(engine->umad_fd);
-	return (-EIO);
 }
 
 void smp_engine_destroy(smp_engine_t * engine)
 {
-	cl_map_item_t *item;
-	ibnd_smp_t *smp;
-
-	/* remove queued smps */
-	smp = get_smp(engine);
-	if (smp)
+	if (mad_rpc_engine_outstanding(engine->rpc_engine))
 		IBND_ERROR("outstanding SMP's\n");
-	for ( /* */ ; smp; smp = get_smp(engine))
-		free(smp);
 
-	/* remove smps from the wire queue */
-	item = cl_qmap_head(&engine->smps_on_wire);
-	if (item != cl_qmap_end(&engine->smps_on_wire))
-		IBND_ERROR("outstanding SMP's on wire\n");
-	for ( /* */ ; item != cl_qmap_end(&engine->smps_on_wire);
-	     item = cl_qmap_head(&engine->smps_on_wire)) {
-		cl_qmap_remove_item(&engine->smps_on_wire, item);
-		free(item);
-	}
+	mad_rpc_engine_destroy(engine->rpc_engine);
+	mad_rpc_close_port(engine->srcport);
+}
 
-	umad_close_port(engine->umad_fd);
+void smp_engine_stats(smp_engine_t * engine, ibnd_scan_stats_t * stats)
+{
+	struct mad_rpc_stats rs;
+	uint64_t responses;
+
+	mad_rpc_engine_get_stats(engine->rpc_engine, &rs);
+	stats->smps_sent = rs.sent;
+	stats->smps_completed = rs.completed;
+	stats->timeouts = rs.timeouts;
+	stats->errors = rs.errors;
+	responses = rs.completed - rs.timeouts;
+	stats->avg_rtt_us = responses ? rs.rtt_total_us / responses : 0;
+	stats->max_rtt_us = rs.rtt_max_us;
+	stats->max_window = rs.max_window;
+	stats->nodes = ((ibnd_scan_t *) engine->user_data)->nodes;
+	stats->elapsed_us = now_us() - engine->start_us;
 }
 
 int process_mads(smp_engine_t * engine)
 {
 	int rc;
-	while (!cl_is_qmap_empty(&engine->smps_on_wire))
-		if ((rc = process_one_recv(engine)) != 0)
+
+	while (mad_rpc_engine_outstanding(engine->rpc_engine)) {
+		rc = mad_rpc_engine_poll(engine->rpc_engine, -1);
+		if (rc < 0) {
+			IBND_ERROR("MAD receive failed: %d\n", rc);
 			return rc;
+		}
+		if (engine->error)
+			return engine->error;
+		if (engine->cfg->stats)
+			smp_engine_stats(engine, engine->cfg->stats);
+	}
 	return 0;
 }
@@ -995,6 +995,199 @@ int umad_poll(int fd, int timeout_ms)
 	return dev_poll(fd, timeout_ms);
 }
 
+int umad_send_batch(int fd, int agentid, void *umads[], int lengths[],
+		    int count, int timeout_ms, int retries)
+{
+	int i, ret;
+
+	TRACE("fd %d agentid %d count %d timeout %u",
+	      fd, agentid, count, timeout_ms);
+
+	if (!umads || !lengths || count <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	/* The kernel takes a single MAD per write() */
+	for (i = 0; i < count; i++) {
+		ret = umad_send(fd, agentid, umads[i], lengths[i], timeout_ms,
+				retries);
+		if (ret < 0)
+			return i ? i : ret;
+	}
+	return count;
+}
+
+/*
+ * Read up to count MADs which are already queued on fd, the kernel returns a
+ * single MAD per read().  Returns the number of MADs read or, if none could
+ * be read, a negative error as umad_recv() does.
+ */
+static int dev_read_batch(int fd, void *umads[], int lengths[], int count)
+{
+	struct ib_user_mad *mad;
+	int i, n;
+
+	for (i = 0; i < count; i++) {
+		mad = umads[i];
+		errno = 0;
+		n = read(fd, mad, umad_size() + lengths[i]);
+
+		VALGRIND_MAKE_MEM_DEFINED(mad, umad_size() + lengths[i]);
+
+		if ((n >= 0) && (n <= umad_size() + lengths[i])) {
+			DEBUG("mad received by agent %d length %d",
+			      mad->agent_id, n);
+			if (n > umad_size())
+				lengths[i] = n - umad_size();
+			else
+				lengths[i] = 0;
+			continue;
+		}
+
+		/* the MAD which doesn't fit is left queued for the next call */
+		if (i)
+			return i;
+
+		if (errno == EWOULDBLOCK)
+			return -EWOULDBLOCK;
+
+		DEBUG("read returned %zu > sizeof umad %zu + length %d (%m)",
+		      mad->length - umad_size(), umad_size(), lengths[i]);
+
+		lengths[i] = mad->length - umad_size();
+		if (!errno)
+			errno = EIO;
+		return -errno;
+	}
+	return count;
+}
+
+int umad_recv_batch(int fd, void *umads[], int lengths[], int count,
+		    int timeout_ms)
+{
+	int n;
+
+	errno = 0;
+	TRACE("fd %d count %d timeout %u", fd, count, timeout_ms);
+
+	if (!umads || !lengths || count <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (timeout_ms && (n = dev_poll(fd, timeout_ms)) < 0) {
+		if (!errno)
+			errno = -n;
+		return n;
+	}
+
+	return dev_read_batch(fd, umads, lengths, count);
+}
+
+struct umad_ring {
+	int fd;
+	int count;
+	int length;		/* data length of each buffer */
+	size_t buf_size;
+	char *pool;
+	void **free_bufs;	/* stack of the buffers not handed out */
+	int nfree;
+};
+
+struct umad_ring *umad_ring_create(int fd, int count, int length)
+{
+	struct umad_ring *ring;
+	int i;
+
+	TRACE("fd %d count %d length %d", fd, count, length);
+
+	if (count <= 0 || length < 256) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->fd = fd;
+	ring->length = length;
+	ring->count = count;
+	/* keep every umad header 8 byte aligned */
+	ring->buf_size = (umad_size() + length + 7) & ~(size_t)7;
+	ring->pool = calloc(count, ring->buf_size);
+	ring->free_bufs = calloc(count, sizeof(*ring->free_bufs));
+	if (!ring->pool || !ring->free_bufs) {
+		free(ring->free_bufs);
+		free(ring->pool);
+		free(ring);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for (i = count - 1; i >= 0; i--)
+		ring->free_bufs[ring->nfree++] = ring->pool + i * ring->buf_size;
+
+	return ring;
+}
+
+void umad_ring_destroy(struct umad_ring *ring)
+{
+	TRACE("ring %p", ring);
+
+	if (!ring)
+		return;
+	free(ring->free_bufs);
+	free(ring->pool);
+	free(ring);
+}
+
+int umad_ring_recv(struct umad_ring *ring, void *umads[], int lengths[],
+		   int count, int timeout_ms)
+{
+	int i, n;
+
+	errno = 0;
+	TRACE("ring %p count %d timeout %u", ring, count, timeout_ms);
+
+	if (!ring || !umads || !lengths || count <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (!ring->nfree) {
+		errno = ENOBUFS;
+		return -ENOBUFS;
+	}
+
+	if (timeout_ms && (n = dev_poll(ring->fd, timeout_ms)) < 0) {
+		if (!errno)
+			errno = -n;
+		return n;
+	}
+
+	if (count > ring->nfree)
+		count = ring->nfree;
+	for (i = 0; i < count; i++) {
+		umads[i] = ring->free_bufs[ring->nfree - 1 - i];
+		lengths[i] = ring->length;
+	}
+
+	n = dev_read_batch(ring->fd, umads, lengths, count);
+	if (n > 0)
+		ring->nfree -= n;
+	return n;
+}
+
+void umad_ring_release(struct umad_ring *ring, void *umad)
+{
+	TRACE("ring %p umad %p", ring, umad);
+
+	if (ring->nfree < ring->count)
+		ring->free_bufs[ring->nfree++] = umad;
+}
+
 int umad_get_fd(int fd)
 {
 	TRACE("fd %d", fd);
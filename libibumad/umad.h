@@ -208,6 +208,18 @@ int umad_recv(int portid, void *umad, int *length, int timeout_ms);
 int umad_poll(int portid, int timeout_ms);
 int umad_get_fd(int portid);
 
+int umad_send_batch(int portid, int agentid, void *umads[], int lengths[],
+		    int count, int timeout_ms, int retries);
+int umad_recv_batch(int portid, void *umads[], int lengths[], int count,
+		    int timeout_ms);
+
+struct umad_ring;
+struct umad_ring *umad_ring_create(int portid, int count, int length);
+void umad_ring_destroy(struct umad_ring *ring);
+int umad_ring_recv(struct umad_ring *ring, void *umads[], int lengths[],
+		   int count, int timeout_ms);
+void umad_ring_release(struct umad_ring *ring, void *umad);
+
 int umad_register(int portid, int mgmt_class, int mgmt_version,
 		  uint8_t rmpp_version, long method_mask[16 / sizeof(long)]);
 int umad_register_oui(int portid, int mgmt_class, uint8_t rmpp_version,
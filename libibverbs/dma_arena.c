@@ -0,0 +1,322 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <ccan/bitmap.h>
+#include <ccan/minmax.h>
+#include <infiniband/driver.h>
+#include <util/util.h>
+
+#define DMA_ARENA_CHUNK_SIZE		(2UL * 1024 * 1024)
+/* A THP size this large (512M with 64K pages) is no use as a chunk */
+#define DMA_ARENA_MAX_CHUNK_SIZE	(32UL * 1024 * 1024)
+#define DMA_ARENA_MAX_NUMA_NODE		1024
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+struct dma_arena_chunk {
+	struct list_node entry;
+	uint8_t *addr;
+	unsigned long npages;
+	unsigned long nused;
+	bitmap used[];
+};
+
+static size_t dma_arena_thp_size(void)
+{
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	fd = open("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size",
+		  O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+
+	buf[len] = 0;
+	return strtoul(buf, NULL, 0);
+}
+
+static int dma_arena_numa_node(struct ibv_device *device)
+{
+	struct verbs_device *vdev;
+	char buf[16];
+
+	if (!device)
+		return -1;
+
+	vdev = verbs_get_device(device);
+	if (!vdev->sysfs ||
+	    ibv_read_ibdev_sysfs_file(buf, sizeof(buf), vdev->sysfs,
+				      "device/numa_node") <= 0)
+		return -1;
+
+	return atoi(buf);
+}
+
+/*
+ * Only a preference, the memory still comes from another node when the
+ * device's one is exhausted. Failures (no NUMA, seccomp) are not fatal.
+ */
+static void dma_arena_bind(struct dma_arena *arena, void *addr, size_t size)
+{
+#ifdef SYS_mbind
+	unsigned long mask[DMA_ARENA_MAX_NUMA_NODE / (8 * sizeof(long))] = {};
+	int node = arena->numa_node;
+
+	if (node < 0 || node >= DMA_ARENA_MAX_NUMA_NODE)
+		return;
+
+	mask[node / (8 * sizeof(long))] = 1UL << (node % (8 * sizeof(long)));
+	syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask,
+		DMA_ARENA_MAX_NUMA_NODE + 1, 0);
+#endif
+}
+
+static void *dma_arena_map_huge(struct dma_arena *arena, size_t size)
+{
+	uint8_t *addr, *aligned;
+
+	if (arena->mode == DMA_ARENA_MODE_HUGETLB && size == arena->chunk_size) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED)
+			return addr;
+	}
+
+	/* THP only backs huge page aligned ranges, trim the mapping to one */
+	addr = mmap(NULL, size + arena->chunk_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	aligned = (uint8_t *)align((uintptr_t)addr, arena->chunk_size);
+	if (aligned != addr)
+		munmap(addr, aligned - addr);
+	munmap(aligned + size, addr + arena->chunk_size - aligned);
+
+	madvise(aligned, size, MADV_HUGEPAGE);
+	return aligned;
+}
+
+static void *dma_arena_map(struct dma_arena *arena, size_t size, bool huge)
+{
+	void *addr;
+	int ret;
+
+	if (huge) {
+		addr = dma_arena_map_huge(arena, size);
+		if (!addr)
+			return NULL;
+	} else {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED)
+			return NULL;
+	}
+
+	dma_arena_bind(arena, addr, size);
+
+	ret = ibv_dontfork_range(addr, size);
+	if (ret) {
+		munmap(addr, size);
+		errno = ret;
+		return NULL;
+	}
+
+	return addr;
+}
+
+static void dma_arena_unmap(void *addr, size_t size)
+{
+	ibv_dofork_range(addr, size);
+	munmap(addr, size);
+}
+
+static bool dma_arena_shared(struct dma_arena *arena, size_t size)
+{
+	return arena->mode != DMA_ARENA_MODE_OFF &&
+	       size <= arena->chunk_size / 2;
+}
+
+static struct dma_arena_chunk *dma_arena_add_chunk(struct dma_arena *arena)
+{
+	unsigned long npages = arena->chunk_size / arena->page_size;
+	struct dma_arena_chunk *chunk;
+
+	chunk = calloc(1, sizeof(*chunk) + bitmap_sizeof(npages));
+	if (!chunk)
+		return NULL;
+
+	chunk->addr = dma_arena_map(arena, arena->chunk_size, true);
+	if (!chunk->addr) {
+		free(chunk);
+		return NULL;
+	}
+
+	chunk->npages = npages;
+	list_add_tail(&arena->chunks, &chunk->entry);
+	return chunk;
+}
+
+static void dma_arena_del_chunk(struct dma_arena *arena,
+				struct dma_arena_chunk *chunk)
+{
+	list_del(&chunk->entry);
+	dma_arena_unmap(chunk->addr, arena->chunk_size);
+	free(chunk);
+}
+
+/* First fit, the chunks are a few hundred pages */
+static long dma_arena_chunk_find(struct dma_arena_chunk *chunk,
+				 unsigned long npages)
+{
+	unsigned long start = 0, used;
+
+	if (chunk->npages - chunk->nused < npages)
+		return -1;
+
+	while (start + npages <= chunk->npages) {
+		used = bitmap_ffs(chunk->used, start, start + npages);
+		if (used == start + npages)
+			return start;
+		start = used + 1;
+	}
+
+	return -1;
+}
+
+void *dma_arena_alloc(struct dma_arena *arena, size_t size)
+{
+	struct dma_arena_chunk *chunk;
+	unsigned long npages;
+	uint8_t *addr = NULL;
+	long start;
+
+	size = align(size, arena->page_size);
+	if (!dma_arena_shared(arena, size))
+		return dma_arena_map(arena, size,
+				     arena->mode != DMA_ARENA_MODE_OFF &&
+				     size >= arena->chunk_size);
+
+	npages = size / arena->page_size;
+
+	pthread_mutex_lock(&arena->mutex);
+	list_for_each(&arena->chunks, chunk, entry) {
+		start = dma_arena_chunk_find(chunk, npages);
+		if (start >= 0)
+			goto found;
+	}
+
+	chunk = dma_arena_add_chunk(arena);
+	if (!chunk)
+		goto out;
+	start = 0;
+
+found:
+	bitmap_fill_range(chunk->used, start, start + npages);
+	chunk->nused += npages;
+	addr = chunk->addr + start * arena->page_size;
+out:
+	pthread_mutex_unlock(&arena->mutex);
+	return addr;
+}
+
+static struct dma_arena_chunk *dma_arena_find_chunk(struct dma_arena *arena,
+						    void *addr)
+{
+	struct dma_arena_chunk *chunk;
+
+	list_for_each(&arena->chunks, chunk, entry) {
+		if ((uint8_t *)addr >= chunk->addr &&
+		    (uint8_t *)addr < chunk->addr + arena->chunk_size)
+			return chunk;
+	}
+
+	return NULL;
+}
+
+void dma_arena_free(struct dma_arena *arena, void *addr, size_t size)
+{
+	struct dma_arena_chunk *chunk;
+	unsigned long start, npages;
+
+	size = align(size, arena->page_size);
+	if (!dma_arena_shared(arena, size)) {
+		dma_arena_unmap(addr, size);
+		return;
+	}
+
+	npages = size / arena->page_size;
+
+	pthread_mutex_lock(&arena->mutex);
+	chunk = dma_arena_find_chunk(arena, addr);
+	if (!chunk)
+		goto out;
+
+	/* The next user expects zeroed memory, like from a fresh mmap */
+	memset(addr, 0, size);
+	start = ((uint8_t *)addr - chunk->addr) / arena->page_size;
+	bitmap_zero_range(chunk->used, start, start + npages);
+	chunk->nused -= npages;
+
+	/* Keep one chunk so create/destroy loops don't map and unmap it */
+	if (!chunk->nused &&
+	    list_top(&arena->chunks, struct dma_arena_chunk, entry) !=
+	    list_tail(&arena->chunks, struct dma_arena_chunk, entry))
+		dma_arena_del_chunk(arena, chunk);
+out:
+	pthread_mutex_unlock(&arena->mutex);
+}
+
+int dma_arena_init(struct dma_arena *arena, struct ibv_device *device,
+		   size_t page_size)
+{
+	size_t chunk_size;
+	char *env;
+
+	arena->mode = DMA_ARENA_MODE_THP;
+	env = getenv("RDMAV_DMA_ARENA");
+	if (env) {
+		if (!strcasecmp(env, "off"))
+			arena->mode = DMA_ARENA_MODE_OFF;
+		else if (!strcasecmp(env, "hugetlb"))
+			arena->mode = DMA_ARENA_MODE_HUGETLB;
+	}
+
+	arena->page_size = max_t(size_t, page_size, sysconf(_SC_PAGESIZE));
+
+	chunk_size = dma_arena_thp_size();
+	if (!chunk_size || chunk_size > DMA_ARENA_MAX_CHUNK_SIZE)
+		chunk_size = DMA_ARENA_CHUNK_SIZE;
+	arena->chunk_size = max_t(size_t, chunk_size, 16 * arena->page_size);
+
+	arena->numa_node = dma_arena_numa_node(device);
+	list_head_init(&arena->chunks);
+	return pthread_mutex_init(&arena->mutex, NULL);
+}
+
+void dma_arena_cleanup(struct dma_arena *arena)
+{
+	struct dma_arena_chunk *chunk, *tmp;
+
+	list_for_each_safe(&arena->chunks, chunk, tmp, entry)
+		dma_arena_del_chunk(arena, chunk);
+	pthread_mutex_destroy(&arena->mutex);
+}
@@ -628,6 +628,44 @@ int ibv_cmd_read_counters(struct verbs_counters *vcounters,
 			  struct ibv_command_buffer *link);
 int ibv_dontfork_range(void *base, size_t size);
 int ibv_dofork_range(void *base, size_t size);
+
+enum dma_arena_mode {
+	/* One private mapping per buffer, no huge pages */
+	DMA_ARENA_MODE_OFF,
+	/* Sub allocate from transparent huge pages */
+	DMA_ARENA_MODE_THP,
+	/* Sub allocate from hugetlbfs pages, THP when none are reserved */
+	DMA_ARENA_MODE_HUGETLB,
+};
+
+/*
+ * Allocator for the queue, CQ and doorbell buffers a provider shares with its
+ * device. Small buffers are carved out of huge page sized chunks, so many
+ * queues end up in one huge page instead of each taking its own mapping, and
+ * all memory prefers the NUMA node of the device. Buffers are page aligned,
+ * zeroed and excluded from fork like the ones the providers used to mmap
+ * themselves.
+ *
+ * The RDMAV_DMA_ARENA environment variable selects the mode: "off", "thp"
+ * (the default) or "hugetlb".
+ */
+struct dma_arena {
+	pthread_mutex_t mutex;
+	struct list_head chunks;
+	size_t page_size;
+	size_t chunk_size;
+	int numa_node;
+	enum dma_arena_mode mode;
+};
+
+int dma_arena_init(struct dma_arena *arena, struct ibv_device *device,
+		   size_t page_size);
+void dma_arena_cleanup(struct dma_arena *arena);
+
+/* size is rounded up to the arena page size, free must be given the same */
+void *dma_arena_alloc(struct dma_arena *arena, size_t size);
+void dma_arena_free(struct dma_arena *arena, void *addr, size_t size);
+
 int ibv_cmd_alloc_dm(struct ibv_context *ctx,
 		     const struct ibv_alloc_dm_attr *dm_attr,
 		     struct verbs_dm *dm,
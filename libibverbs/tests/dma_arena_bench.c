@@ -0,0 +1,272 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Exercise the DMA arena the providers allocate queue buffers from.
+ *
+ * A random mix of small and large allocations and frees checks that every
+ * buffer is page aligned, zeroed when handed out and not shared with any
+ * other live buffer.  A buffer of an arena bound to node 0 must carry a
+ * preferred node 0 memory policy.  Then the buffers of a few thousand QPs,
+ * a send queue, a receive queue and a CQ each, are allocated, touched and
+ * freed, in every arena mode, which is where the huge page chunks pay off
+ * in creation time, resident memory and mappings.  Pass "fork" to run it all
+ * after ibv_fork_init().
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <infiniband/driver.h>
+#include <ccan/array_size.h>
+
+#define PAGE_SIZE	4096
+#define NUM_BUFS	3000
+#define NUM_OPS		50000
+#define NUM_QPS		4000
+#define NUM_ACCESSES	2000000
+#define SQ_SIZE		16384
+#define RQ_SIZE		8192
+#define CQ_SIZE		16384
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED	1
+#endif
+#ifndef MPOL_F_ADDR
+#define MPOL_F_ADDR	(1 << 1)
+#endif
+
+struct qp_bufs {
+	void *sq;
+	void *rq;
+	void *cq;
+};
+
+static const char * const modes[] = {"off", "thp", "hugetlb"};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A field of /proc/self/status or smaps_rollup, in kB, -1 if missing */
+static long proc_kb(const char *path, const char *field)
+{
+	size_t len = strlen(field);
+	char line[256];
+	long val = -1;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, field, len)) {
+			val = atol(line + len);
+			break;
+		}
+	fclose(f);
+	return val;
+}
+
+static long num_mappings(void)
+{
+	long n = 0;
+	FILE *f;
+	int c;
+
+	f = fopen("/proc/self/maps", "r");
+	if (!f)
+		return -1;
+	while ((c = fgetc(f)) != EOF)
+		n += c == '\n';
+	fclose(f);
+	return n;
+}
+
+static size_t random_size(unsigned int *seed)
+{
+	/* Mostly queue sized buffers, some larger than a huge page */
+	if (rand_r(seed) % 100 < 90)
+		return (1 + rand_r(seed) % 64) * 1024;
+	return (1 + rand_r(seed) % 4096) * 1024;
+}
+
+static int check_stress(void)
+{
+	static uint8_t *bufs[NUM_BUFS];
+	static size_t sizes[NUM_BUFS];
+	struct dma_arena arena;
+	unsigned int seed = 1;
+	int i, k, bad = 0;
+	size_t off;
+
+	if (dma_arena_init(&arena, NULL, PAGE_SIZE))
+		return 1;
+
+	for (i = 0; i < NUM_OPS; i++) {
+		k = rand_r(&seed) % NUM_BUFS;
+		if (bufs[k]) {
+			/* Nobody else may have written to it */
+			for (off = 0; off < sizes[k]; off += 512)
+				if (bufs[k][off] != (uint8_t)k)
+					bad++;
+			dma_arena_free(&arena, bufs[k], sizes[k]);
+			bufs[k] = NULL;
+			continue;
+		}
+
+		sizes[k] = random_size(&seed);
+		bufs[k] = dma_arena_alloc(&arena, sizes[k]);
+		if (!bufs[k] || (uintptr_t)bufs[k] % PAGE_SIZE) {
+			fprintf(stderr, "allocation of %zu bytes failed or is unaligned\n",
+				sizes[k]);
+			bufs[k] = NULL;
+			bad++;
+			continue;
+		}
+		for (off = 0; off < sizes[k]; off++)
+			if (bufs[k][off]) {
+				fprintf(stderr, "%zu byte buffer not zeroed\n",
+					sizes[k]);
+				bad++;
+				break;
+			}
+		memset(bufs[k], (uint8_t)k, sizes[k]);
+	}
+
+	for (i = 0; i < NUM_BUFS; i++)
+		if (bufs[i])
+			dma_arena_free(&arena, bufs[i], sizes[i]);
+	dma_arena_cleanup(&arena);
+	return bad;
+}
+
+static int check_numa_policy(void)
+{
+	unsigned long mask[1024 / (8 * sizeof(long))] = {};
+	struct dma_arena arena;
+	int mode = -1, ret = 0;
+	void *buf;
+
+	if (dma_arena_init(&arena, NULL, PAGE_SIZE))
+		return 1;
+	arena.numa_node = 0;
+
+	buf = dma_arena_alloc(&arena, PAGE_SIZE);
+	if (!buf) {
+		ret = 1;
+		goto out;
+	}
+	if (syscall(SYS_get_mempolicy, &mode, mask, 8 * sizeof(mask), buf,
+		    MPOL_F_ADDR)) {
+		printf("NUMA policy: not supported\n");
+	} else if (mode != MPOL_PREFERRED || mask[0] != 1) {
+		fprintf(stderr, "buffer has policy %d nodes 0x%lx\n", mode,
+			mask[0]);
+		ret = 1;
+	}
+	dma_arena_free(&arena, buf, PAGE_SIZE);
+out:
+	dma_arena_cleanup(&arena);
+	return ret;
+}
+
+/* Allocate and touch the buffers of many QPs the way a provider does */
+static int bench_qps(const char *mode)
+{
+	static struct qp_bufs qps[NUM_QPS];
+	long rss, maps, huge;
+	struct dma_arena arena;
+	volatile uint64_t sum = 0;
+	double t0, t1, t2, t3;
+	unsigned int seed = 7;
+	struct qp_bufs *qp;
+	int i, ret = 0;
+
+	setenv("RDMAV_DMA_ARENA", mode, 1);
+	if (dma_arena_init(&arena, NULL, PAGE_SIZE))
+		return 1;
+
+	rss = proc_kb("/proc/self/status", "VmRSS:");
+	huge = proc_kb("/proc/self/smaps_rollup", "AnonHugePages:");
+	maps = num_mappings();
+	t0 = now_sec();
+	for (i = 0; i < NUM_QPS; i++) {
+		qp = &qps[i];
+		qp->sq = dma_arena_alloc(&arena, SQ_SIZE);
+		qp->rq = dma_arena_alloc(&arena, RQ_SIZE);
+		qp->cq = dma_arena_alloc(&arena, CQ_SIZE);
+		if (!qp->sq || !qp->rq || !qp->cq) {
+			ret = 1;
+			break;
+		}
+		memset(qp->sq, 0, SQ_SIZE);
+		memset(qp->rq, 0, RQ_SIZE);
+		memset(qp->cq, 0xff, CQ_SIZE);
+	}
+	t1 = now_sec();
+	rss = proc_kb("/proc/self/status", "VmRSS:") - rss;
+	maps = num_mappings() - maps;
+	huge = proc_kb("/proc/self/smaps_rollup", "AnonHugePages:") - huge;
+
+	/* One WQE and one CQE of a random QP at a time */
+	t2 = now_sec();
+	for (i = 0; !ret && i < NUM_ACCESSES; i++) {
+		qp = &qps[rand_r(&seed) % NUM_QPS];
+		sum += ((uint64_t *)qp->sq)[(i * 8) % (SQ_SIZE / 8)];
+		sum += ((uint64_t *)qp->cq)[(i * 8) % (CQ_SIZE / 8)];
+	}
+	t2 = now_sec() - t2;
+
+	t3 = now_sec();
+	for (i = 0; i < NUM_QPS; i++) {
+		qp = &qps[i];
+		if (qp->sq)
+			dma_arena_free(&arena, qp->sq, SQ_SIZE);
+		if (qp->rq)
+			dma_arena_free(&arena, qp->rq, RQ_SIZE);
+		if (qp->cq)
+			dma_arena_free(&arena, qp->cq, CQ_SIZE);
+		memset(qp, 0, sizeof(*qp));
+	}
+	t3 = now_sec() - t3;
+	dma_arena_cleanup(&arena);
+
+	if (ret) {
+		fprintf(stderr, "%s: QP buffer allocation failed\n", mode);
+		return ret;
+	}
+	printf("%-8s %7.2f %8.2f %9ld %6ld %9ld %7.1f\n", mode,
+	       (t1 - t0) / NUM_QPS * 1e6, t3 / NUM_QPS * 1e6, rss, maps, huge,
+	       t2 / (2.0 * NUM_ACCESSES) * 1e9);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int ret = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "fork"))
+		ibv_fork_init();
+
+	if (check_stress() || check_numa_policy())
+		return 1;
+
+	printf("%-8s %7s %8s %9s %6s %9s %7s\n", "mode", "create", "destroy",
+	       "rss KB", "maps", "huge KB", "access");
+	printf("%-8s %7s %8s %9s %6s %9s %7s\n", "", "us/qp", "us/qp", "", "",
+	       "", "ns");
+	for (i = 0; i < ARRAY_SIZE(modes); i++)
+		if (bench_qps(modes[i]))
+			ret = 1;
+	return ret;
+}
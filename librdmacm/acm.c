@@ -33,15 +33,20 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <inttypes.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cma.h"
 #include "acm.h"
+#include "acm_shm.h"
 #include <rdma/rdma_cma.h>
 #include <infiniband/ib.h>
 #include <infiniband/sa.h>
@@ -49,6 +54,8 @@
 static pthread_mutex_t acm_lock = PTHREAD_MUTEX_INITIALIZER;
 static int sock = -1;
 static uint16_t server_port;
+static const struct acm_shm_hdr *shm;
+static size_t shm_len;
 
 static int ucma_set_server_port(void)
 {
@@ -64,6 +71,30 @@ static int ucma_set_server_port(void)
 	return server_port;
 }
 
+/* Map the resolve cache published by ibacm, see acm_shm.h */
+static void ucma_shm_open(void)
+{
+	if (shm) {
+		munmap((void *) shm, shm_len);
+		shm = NULL;
+	}
+
+	shm = acm_shm_map(IBACM_SHM_PATH, &shm_len);
+}
+
+static bool ucma_shm_resolve(struct acm_msg *msg)
+{
+	struct timespec now;
+
+	if (!shm)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return acm_shm_lookup(shm, msg->resolve_data,
+			      msg->hdr.length - ACM_MSG_HDR_LENGTH,
+			      now.tv_sec, msg) != 0;
+}
+
 void ucma_ib_init(void)
 {
 	union {
@@ -111,6 +142,8 @@ void ucma_ib_init(void)
 			sock = -1;
 		}
 	}
+	if (sock >= 0)
+		ucma_shm_open();
 out:
 	init = 1;
 unlock:
@@ -123,6 +156,10 @@ void ucma_ib_cleanup(void)
 		shutdown(sock, SHUT_RDWR);
 		close(sock);
 	}
+	if (shm) {
+		munmap((void *) shm, shm_len);
+		shm = NULL;
+	}
 }
 
 static int ucma_ib_set_addr(struct rdma_addrinfo *ib_rai,
@@ -381,6 +418,12 @@ void ucma_ib_resolve(struct rdma_addrinfo **rai,
 	}
 
 	pthread_mutex_lock(&acm_lock);
+	if (ucma_shm_resolve(&msg)) {
+		pthread_mutex_unlock(&acm_lock);
+		ret = msg.hdr.length;
+		goto resp;
+	}
+
 	ret = send(sock, (char *) &msg, msg.hdr.length, 0);
 	if (ret != msg.hdr.length) {
 		pthread_mutex_unlock(&acm_lock);
@@ -388,7 +431,11 @@ void ucma_ib_resolve(struct rdma_addrinfo **rai,
 	}
 
 	ret = recv(sock, (char *) &msg, sizeof msg, 0);
+	/* Pick up a new cache if ibacm has restarted */
+	if (!shm || __atomic_load_n(&shm->closed, __ATOMIC_RELAXED))
+		ucma_shm_open();
 	pthread_mutex_unlock(&acm_lock);
+resp:
 	if (ret < ACM_MSG_HDR_LENGTH || ret != msg.hdr.length || msg.hdr.status)
 		return;
 
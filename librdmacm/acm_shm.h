@@ -0,0 +1,159 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef ACM_SHM_H
+#define ACM_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <infiniband/acm.h>
+
+/*
+ * Shared memory resolve cache.  The ibacm service publishes the responses to
+ * successful address resolutions in a read-only mapping, so that local
+ * clients can repeat a resolution without a round trip to the service.  An
+ * entry is keyed by the resolve_data of the request, exactly as the client
+ * sent it, and holds the response message.  Entries are written under a
+ * sequence count which is odd while an update is in progress; a reader that
+ * sees the count change while copying an entry must treat it as a miss.
+ *
+ * This is private to ibacm and the clients shipped with it, the layout is
+ * only versioned against them and is not installed.
+ */
+#define ACM_SHM_MAGIC           0x41434d53	/* "ACMS" */
+#define ACM_SHM_VERSION         1
+#define ACM_SHM_KEY_LENGTH      (ACM_MSG_EP_LENGTH * 2)
+#define ACM_SHM_RESP_LENGTH     (ACM_MSG_HDR_LENGTH + ACM_MSG_EP_LENGTH * 3)
+#define ACM_SHM_WAYS            2
+
+struct acm_shm_entry {
+	uint32_t                seq;
+	uint32_t                generation;
+	uint64_t                expires;	/* CLOCK_MONOTONIC seconds */
+	uint32_t                hash;
+	uint16_t                key_len;
+	uint16_t                resp_len;
+	uint8_t                 key[ACM_SHM_KEY_LENGTH];
+	uint8_t                 resp[ACM_SHM_RESP_LENGTH];
+};
+
+struct acm_shm_hdr {
+	uint32_t                magic;
+	uint16_t                version;
+	uint16_t                entry_size;
+	uint32_t                nentries;	/* power of 2 */
+	uint32_t                generation;	/* older entries are stale */
+	uint32_t                closed;		/* the service has gone away */
+	uint32_t                reserved[11];
+	struct acm_shm_entry    entries[];
+};
+
+/* Keys are whole acm_ep_addr_data entries, so a multiple of 8 bytes */
+static inline uint32_t acm_shm_hash(const void *key, uint16_t len)
+{
+	const uint8_t *p = key;
+	uint64_t hash = 0xcbf29ce484222325ULL, word;
+
+	for (; len >= sizeof(word); len -= sizeof(word), p += sizeof(word)) {
+		memcpy(&word, p, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ULL;
+		hash ^= hash >> 29;
+	}
+	return (uint32_t) (hash ^ (hash >> 32));
+}
+
+/*
+ * Map the cache at path read-only.  The file is only trusted if it was
+ * created by root or by our own user and nobody else can write to it.
+ * Returns NULL if there is no usable cache, otherwise the mapping, which is
+ * *len bytes long.
+ */
+static inline const struct acm_shm_hdr *acm_shm_map(const char *path,
+						    size_t *len)
+{
+	const struct acm_shm_hdr *hdr = NULL;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+	    (st.st_uid && st.st_uid != geteuid()) || (st.st_mode & 022) ||
+	    st.st_size < sizeof(*hdr))
+		goto out;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto out;
+
+	hdr = map;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != ACM_SHM_MAGIC ||
+	    hdr->version != ACM_SHM_VERSION ||
+	    hdr->entry_size != sizeof(hdr->entries[0]) ||
+	    !hdr->nentries || (hdr->nentries & (hdr->nentries - 1)) ||
+	    st.st_size < sizeof(*hdr) +
+			 (size_t) hdr->nentries * sizeof(hdr->entries[0])) {
+		munmap(map, st.st_size);
+		hdr = NULL;
+		goto out;
+	}
+	*len = st.st_size;
+out:
+	close(fd);
+	return hdr;
+}
+
+/*
+ * Look up a resolve request in the shared memory cache.  Returns the length
+ * of the response copied into resp, or 0 if the request is not cached.  resp
+ * is only written on a hit, so it may be the buffer holding the request.
+ */
+static inline int acm_shm_lookup(const struct acm_shm_hdr *shm,
+				 const void *key, uint16_t key_len,
+				 uint64_t now, struct acm_msg *resp)
+{
+	const struct acm_shm_entry *entry;
+	uint32_t hash, generation, seq, way;
+	uint8_t copy[ACM_SHM_RESP_LENGTH];
+	uint16_t resp_len;
+
+	if (!key_len || key_len > ACM_SHM_KEY_LENGTH ||
+	    __atomic_load_n(&shm->closed, __ATOMIC_RELAXED))
+		return 0;
+
+	generation = __atomic_load_n(&shm->generation, __ATOMIC_ACQUIRE);
+	hash = acm_shm_hash(key, key_len);
+	for (way = 0; way < ACM_SHM_WAYS; way++) {
+		entry = &shm->entries[(hash + way) & (shm->nentries - 1)];
+
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		if (entry->hash != hash || entry->key_len != key_len ||
+		    entry->generation != generation || entry->expires <= now)
+			continue;
+
+		resp_len = entry->resp_len;
+		if (resp_len < ACM_MSG_HDR_LENGTH ||
+		    resp_len > ACM_SHM_RESP_LENGTH ||
+		    memcmp(entry->key, key, key_len))
+			continue;
+		memcpy(copy, entry->resp, resp_len);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq)
+			return 0;
+
+		memcpy(resp, copy, resp_len);
+		return resp_len;
+	}
+	return 0;
+}
+
+#endif /* ACM_SHM_H */
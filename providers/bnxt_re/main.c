@@ -167,10 +167,16 @@ static struct verbs_context *bnxt_re_alloc_context(struct ibv_device *vdev,
 	}
 	pthread_mutex_init(&cntx->shlock, NULL);
 
+	if (dma_arena_init(&cntx->dma_arena, vdev, dev->pg_size))
+		goto arena_err;
+
 	verbs_set_ops(&cntx->ibvctx, &bnxt_re_cntx_ops);
 
 	return &cntx->ibvctx;
 
+arena_err:
+	pthread_mutex_destroy(&cntx->shlock);
+	munmap(cntx->shpg, dev->pg_size);
 failed:
 	verbs_uninit_context(&cntx->ibvctx);
 	free(cntx);
@@ -187,6 +193,7 @@ static void bnxt_re_free_context(struct ibv_context *ibvctx)
 	if (cntx->shpg)
 		munmap(cntx->shpg, dev->pg_size);
 	pthread_spin_destroy(&cntx->fqlock);
+	dma_arena_cleanup(&cntx->dma_arena);
 
 	/* Un-map DPI only for the first PD that was
 	 * allocated in this context.
@@ -173,6 +173,7 @@ struct bnxt_re_context {
 	void *shpg;
 	pthread_mutex_t shlock;
 	pthread_spinlock_t fqlock;
+	struct dma_arena dma_arena;
 };
 
 /* Chip context related functions */
@@ -37,40 +37,34 @@
  *              buffers.
  */
 
+#include <errno.h>
 #include <string.h>
-#include <sys/mman.h>
 
 #include "main.h"
 
-int bnxt_re_alloc_aligned(struct bnxt_re_queue *que, uint32_t pg_size)
+int bnxt_re_alloc_aligned(struct bnxt_re_context *cntx,
+			  struct bnxt_re_queue *que, uint32_t pg_size)
 {
-	int ret, bytes;
+	int bytes;
 
 	bytes = (que->depth * que->stride);
 	que->bytes = get_aligned(bytes, pg_size);
-	que->va = mmap(NULL, que->bytes, PROT_READ | PROT_WRITE,
-		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (que->va == MAP_FAILED) {
+	que->va = dma_arena_alloc(&cntx->dma_arena, que->bytes);
+	if (!que->va) {
 		que->bytes = 0;
 		return errno;
 	}
 	/* Touch pages before proceeding. */
 	memset(que->va, 0, que->bytes);
 
-	ret = ibv_dontfork_range(que->va, que->bytes);
-	if (ret) {
-		munmap(que->va, que->bytes);
-		que->bytes = 0;
-	}
-
-	return ret;
+	return 0;
 }
 
-void bnxt_re_free_aligned(struct bnxt_re_queue *que)
+void bnxt_re_free_aligned(struct bnxt_re_context *cntx,
+			  struct bnxt_re_queue *que)
 {
 	if (que->bytes) {
-		ibv_dofork_range(que->va, que->bytes);
-		munmap(que->va, que->bytes);
+		dma_arena_free(&cntx->dma_arena, que->va, que->bytes);
 		que->bytes = 0;
 	}
 }
@@ -42,6 +42,8 @@
 
 #include <pthread.h>
 
+struct bnxt_re_context;
+
 struct bnxt_re_queue {
 	void *va;
 	uint32_t bytes; /* for munmap */
@@ -78,8 +80,10 @@ static inline unsigned long roundup_pow_of_two(unsigned long val)
 	return roundup;
 }
 
-int bnxt_re_alloc_aligned(struct bnxt_re_queue *que, uint32_t pg_size);
-void bnxt_re_free_aligned(struct bnxt_re_queue *que);
+int bnxt_re_alloc_aligned(struct bnxt_re_context *cntx,
+			  struct bnxt_re_queue *que, uint32_t pg_size);
+void bnxt_re_free_aligned(struct bnxt_re_context *cntx,
+			  struct bnxt_re_queue *que);
 
 /* Basic queue operation */
 static inline uint32_t bnxt_re_is_que_full(struct bnxt_re_queue *que)
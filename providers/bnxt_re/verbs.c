@@ -184,7 +184,7 @@ struct ibv_cq *bnxt_re_create_cq(struct ibv_context *ibvctx, int ncqe,
 	if (cq->cqq.depth > dev->max_cq_depth + 1)
 		cq->cqq.depth = dev->max_cq_depth + 1;
 	cq->cqq.stride = dev->cqe_size;
-	if (bnxt_re_alloc_aligned(&cq->cqq, dev->pg_size))
+	if (bnxt_re_alloc_aligned(cntx, &cq->cqq, dev->pg_size))
 		goto fail;
 
 	pthread_spin_init(&cq->cqq.qlock, PTHREAD_PROCESS_PRIVATE);
@@ -209,7 +209,7 @@ struct ibv_cq *bnxt_re_create_cq(struct ibv_context *ibvctx, int ncqe,
 
 	return &cq->ibvcq;
 cmdfail:
-	bnxt_re_free_aligned(&cq->cqq);
+	bnxt_re_free_aligned(cntx, &cq->cqq);
 fail:
 	free(cq);
 	return NULL;
@@ -224,7 +224,7 @@ int bnxt_re_destroy_cq(struct ibv_cq *ibvcq)
 	if (status)
 		return status;
 
-	bnxt_re_free_aligned(&cq->cqq);
+	bnxt_re_free_aligned(to_bnxt_re_context(ibvcq->context), &cq->cqq);
 	free(cq);
 
 	return 0;
@@ -815,22 +815,24 @@ static int bnxt_re_alloc_queue_ptr(struct bnxt_re_qp *qp,
 	return 0;
 }
 
-static void bnxt_re_free_queues(struct bnxt_re_qp *qp)
+static void bnxt_re_free_queues(struct bnxt_re_context *cntx,
+				struct bnxt_re_qp *qp)
 {
 	if (qp->rqq) {
 		if (qp->rwrid)
 			free(qp->rwrid);
 		pthread_spin_destroy(&qp->rqq->qlock);
-		bnxt_re_free_aligned(qp->rqq);
+		bnxt_re_free_aligned(cntx, qp->rqq);
 	}
 
 	if (qp->swrid)
 		free(qp->swrid);
 	pthread_spin_destroy(&qp->sqq->qlock);
-	bnxt_re_free_aligned(qp->sqq);
+	bnxt_re_free_aligned(cntx, qp->sqq);
 }
 
-static int bnxt_re_alloc_queues(struct bnxt_re_qp *qp,
+static int bnxt_re_alloc_queues(struct bnxt_re_context *cntx,
+				struct bnxt_re_qp *qp,
 				struct ibv_qp_init_attr *attr,
 				uint32_t pg_size) {
 	struct bnxt_re_psns_ext *psns_ext;
@@ -860,7 +862,7 @@ static int bnxt_re_alloc_queues(struct bnxt_re_qp *qp,
 	 * is UD-qp. UD-qp use this memory to maintain WC-opcode.
 	 * See definition of bnxt_re_fill_psns() for the use case.
 	 */
-	ret = bnxt_re_alloc_aligned(qp->sqq, pg_size);
+	ret = bnxt_re_alloc_aligned(cntx, qp->sqq, pg_size);
 	if (ret)
 		return ret;
 	/* exclude psns depth*/
@@ -891,7 +893,7 @@ static int bnxt_re_alloc_queues(struct bnxt_re_qp *qp,
 		que->stride = bnxt_re_get_rqe_sz();
 		que->depth = roundup_pow_of_two(attr->cap.max_recv_wr + 1);
 		que->diff = que->depth - attr->cap.max_recv_wr;
-		ret = bnxt_re_alloc_aligned(qp->rqq, pg_size);
+		ret = bnxt_re_alloc_aligned(cntx, qp->rqq, pg_size);
 		if (ret)
 			goto fail;
 		pthread_spin_init(&que->qlock, PTHREAD_PROCESS_PRIVATE);
@@ -906,7 +908,7 @@ static int bnxt_re_alloc_queues(struct bnxt_re_qp *qp,
 
 	return 0;
 fail:
-	bnxt_re_free_queues(qp);
+	bnxt_re_free_queues(cntx, qp);
 	return ret;
 }
 
@@ -932,7 +934,7 @@ struct ibv_qp *bnxt_re_create_qp(struct ibv_pd *ibvpd,
 		goto fail;
 	/* alloc queues */
 	qp->cctx = &cntx->cctx;
-	if (bnxt_re_alloc_queues(qp, attr, dev->pg_size))
+	if (bnxt_re_alloc_queues(cntx, qp, attr, dev->pg_size))
 		goto failq;
 	/* Fill ibv_cmd */
 	cap = &qp->cap;
@@ -963,7 +965,7 @@ struct ibv_qp *bnxt_re_create_qp(struct ibv_pd *ibvpd,
 
 	return &qp->ibvqp;
 failcmd:
-	bnxt_re_free_queues(qp);
+	bnxt_re_free_queues(cntx, qp);
 failq:
 	bnxt_re_free_queue_ptr(qp);
 fail:
@@ -1029,7 +1031,7 @@ int bnxt_re_destroy_qp(struct ibv_qp *ibvqp)
 
 	bnxt_re_cleanup_cq(qp, qp->rcq);
 	bnxt_re_cleanup_cq(qp, qp->scq);
-	bnxt_re_free_queues(qp);
+	bnxt_re_free_queues(to_bnxt_re_context(ibvqp->context), qp);
 	bnxt_re_free_queue_ptr(qp);
 	free(qp);
 
@@ -1453,14 +1455,16 @@ static struct bnxt_re_srq *bnxt_re_srq_alloc_queue_ptr(void)
 	return srq;
 }
 
-static void bnxt_re_srq_free_queue(struct bnxt_re_srq *srq)
+static void bnxt_re_srq_free_queue(struct bnxt_re_context *cntx,
+				   struct bnxt_re_srq *srq)
 {
 	free(srq->srwrid);
 	pthread_spin_destroy(&srq->srqq->qlock);
-	bnxt_re_free_aligned(srq->srqq);
+	bnxt_re_free_aligned(cntx, srq->srqq);
 }
 
-static int bnxt_re_srq_alloc_queue(struct bnxt_re_srq *srq,
+static int bnxt_re_srq_alloc_queue(struct bnxt_re_context *cntx,
+				   struct bnxt_re_srq *srq,
 				   struct ibv_srq_init_attr *attr,
 				   uint32_t pg_size)
 {
@@ -1471,7 +1475,7 @@ static int bnxt_re_srq_alloc_queue(struct bnxt_re_srq *srq,
 	que->depth = roundup_pow_of_two(attr->attr.max_wr + 1);
 	que->diff = que->depth - attr->attr.max_wr;
 	que->stride = bnxt_re_get_srqe_sz();
-	ret = bnxt_re_alloc_aligned(que, pg_size);
+	ret = bnxt_re_alloc_aligned(cntx, que, pg_size);
 	if (ret)
 		goto bail;
 	pthread_spin_init(&que->qlock, PTHREAD_PROCESS_PRIVATE);
@@ -1491,7 +1495,7 @@ static int bnxt_re_srq_alloc_queue(struct bnxt_re_srq *srq,
 	/*TODO: update actual max depth. */
 	return 0;
 bail:
-	bnxt_re_srq_free_queue(srq);
+	bnxt_re_srq_free_queue(cntx, srq);
 	return ret;
 }
 
@@ -1510,7 +1514,7 @@ struct ibv_srq *bnxt_re_create_srq(struct ibv_pd *ibvpd,
 	if (!srq)
 		goto fail;
 
-	if (bnxt_re_srq_alloc_queue(srq, attr, dev->pg_size))
+	if (bnxt_re_srq_alloc_queue(cntx, srq, attr, dev->pg_size))
 		goto fail;
 
 	req.srqva = (uintptr_t)srq->srqq->va;
@@ -1559,7 +1563,7 @@ int bnxt_re_destroy_srq(struct ibv_srq *ibvsrq)
 	ret = ibv_cmd_destroy_srq(ibvsrq);
 	if (ret)
 		return ret;
-	bnxt_re_srq_free_queue(srq);
+	bnxt_re_srq_free_queue(to_bnxt_re_context(ibvsrq->context), srq);
 	bnxt_re_srq_free_queue_ptr(srq);
 
 	return 0;
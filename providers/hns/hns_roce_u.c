@@ -154,6 +154,9 @@ static struct verbs_context *hns_roce_alloc_context(struct ibv_device *ibdev,
 	context->max_sge = dev_attrs.max_sge;
 	context->max_cqe = dev_attrs.max_cqe;
 
+	if (dma_arena_init(&context->dma_arena, ibdev, hr_dev->page_size))
+		goto tptr_free;
+
 	return &context->ibv_ctx;
 
 tptr_free:
@@ -182,6 +185,7 @@ static void hns_roce_free_context(struct ibv_context *ibctx)
 	if (hr_dev->hw_version == HNS_ROCE_HW_VER1)
 		munmap(context->cq_tptr_base, HNS_ROCE_CQ_DB_BUF_SIZE);
 
+	dma_arena_cleanup(&context->dma_arena);
 	verbs_uninit_context(&context->ibv_ctx);
 	free(context);
 }
@@ -159,6 +159,8 @@ struct hns_roce_context {
 	struct hns_roce_db_page		*db_list[HNS_ROCE_DB_TYPE_NUM];
 	pthread_mutex_t			db_list_mutex;
 
+	struct dma_arena		dma_arena;
+
 	unsigned int			max_qp_wr;
 	unsigned int			max_sge;
 	int				max_cqe;
@@ -354,9 +356,9 @@ struct ibv_qp *hns_roce_u_create_qp(struct ibv_pd *pd,
 int hns_roce_u_query_qp(struct ibv_qp *ibqp, struct ibv_qp_attr *attr,
 			int attr_mask, struct ibv_qp_init_attr *init_attr);
 
-int hns_roce_alloc_buf(struct hns_roce_buf *buf, unsigned int size,
-		       int page_size);
-void hns_roce_free_buf(struct hns_roce_buf *buf);
+int hns_roce_alloc_buf(struct hns_roce_context *ctx, struct hns_roce_buf *buf,
+		       unsigned int size, int page_size);
+void hns_roce_free_buf(struct hns_roce_context *ctx, struct hns_roce_buf *buf);
 
 void hns_roce_init_qp_indices(struct hns_roce_qp *qp);
 
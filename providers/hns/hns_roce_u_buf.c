@@ -31,32 +31,22 @@
  */
 
 #include <errno.h>
-#include <sys/mman.h>
 #include <util/util.h>
 
 #include "hns_roce_u.h"
 
-int hns_roce_alloc_buf(struct hns_roce_buf *buf, unsigned int size,
-		       int page_size)
+int hns_roce_alloc_buf(struct hns_roce_context *ctx, struct hns_roce_buf *buf,
+		       unsigned int size, int page_size)
 {
-	int ret;
-
 	buf->length = align(size, page_size);
-	buf->buf = mmap(NULL, buf->length, PROT_READ | PROT_WRITE,
-			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (buf->buf == MAP_FAILED)
+	buf->buf = dma_arena_alloc(&ctx->dma_arena, buf->length);
+	if (!buf->buf)
 		return errno;
 
-	ret = ibv_dontfork_range(buf->buf, buf->length);
-	if (ret)
-		munmap(buf->buf, buf->length);
-
-	return ret;
+	return 0;
 }
 
-void hns_roce_free_buf(struct hns_roce_buf *buf)
+void hns_roce_free_buf(struct hns_roce_context *ctx, struct hns_roce_buf *buf)
 {
-	ibv_dofork_range(buf->buf, buf->length);
-
-	munmap(buf->buf, buf->length);
+	dma_arena_free(&ctx->dma_arena, buf->buf, buf->length);
 }
@@ -62,7 +62,7 @@ static struct hns_roce_db_page *hns_roce_add_db_page(
 	if (!page->bitmap)
 		goto err_map;
 
-	if (hns_roce_alloc_buf(&(page->buf), page_size, page_size))
+	if (hns_roce_alloc_buf(ctx, &(page->buf), page_size, page_size))
 		goto err;
 
 	/* add the set ctx->db_list */
@@ -83,12 +83,13 @@ err_page:
 	return NULL;
 }
 
-static void hns_roce_clear_db_page(struct hns_roce_db_page *page)
+static void hns_roce_clear_db_page(struct hns_roce_context *ctx,
+				   struct hns_roce_db_page *page)
 {
 	assert(page);
 
 	free(page->bitmap);
-	hns_roce_free_buf(&(page->buf));
+	hns_roce_free_buf(ctx, &(page->buf));
 }
 
 void *hns_roce_alloc_db(struct hns_roce_context *ctx,
@@ -149,7 +150,7 @@ found:
 		if (page->next)
 			page->next->prev = page->prev;
 
-		hns_roce_clear_db_page(page);
+		hns_roce_clear_db_page(ctx, page);
 		free(page);
 
 		goto out;
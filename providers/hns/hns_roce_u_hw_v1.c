@@ -720,7 +720,7 @@ static int hns_roce_u_v1_destroy_qp(struct ibv_qp *ibqp)
 	if (qp->rq.wqe_cnt)
 		free(qp->rq.wrid);
 
-	hns_roce_free_buf(&qp->buf);
+	hns_roce_free_buf(to_hr_ctx(ibqp->context), &qp->buf);
 	free(qp);
 
 	return ret;
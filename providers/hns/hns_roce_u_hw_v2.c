@@ -1295,7 +1295,7 @@ static int hns_roce_u_v2_destroy_qp(struct ibv_qp *ibqp)
 		hns_roce_free_db(to_hr_ctx(ibqp->context), qp->sdb,
 				 HNS_ROCE_QP_TYPE_DB);
 
-	hns_roce_free_buf(&qp->buf);
+	hns_roce_free_buf(to_hr_ctx(ibqp->context), &qp->buf);
 	if (qp->rq_rinl_buf.wqe_list) {
 		if (qp->rq_rinl_buf.wqe_list[0].sg_list) {
 			free(qp->rq_rinl_buf.wqe_list[0].sg_list);
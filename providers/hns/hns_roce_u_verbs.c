@@ -275,11 +275,12 @@ static int hns_roce_verify_cq(int *cqe, struct hns_roce_context *context)
 	return 0;
 }
 
-static int hns_roce_alloc_cq_buf(struct hns_roce_cq *cq, int nent)
+static int hns_roce_alloc_cq_buf(struct hns_roce_context *ctx,
+				 struct hns_roce_cq *cq, int nent)
 {
 	int buf_size = hr_hw_page_align(nent * cq->cqe_size);
 
-	if (hns_roce_alloc_buf(&cq->buf, buf_size, HNS_HW_PAGE_SIZE))
+	if (hns_roce_alloc_buf(ctx, &cq->buf, buf_size, HNS_HW_PAGE_SIZE))
 		return ENOMEM;
 
 	return 0;
@@ -316,7 +317,7 @@ struct ibv_cq *hns_roce_u_create_cq(struct ibv_context *context, int cqe,
 	else
 		cqe = align_queue_size(cqe);
 
-	if (hns_roce_alloc_cq_buf(cq, cqe))
+	if (hns_roce_alloc_cq_buf(hr_ctx, cq, cqe))
 		goto err;
 
 	cmd.buf_addr = (uintptr_t) cq->buf.buf;
@@ -356,7 +357,7 @@ err_db:
 				 HNS_ROCE_CQ_TYPE_DB);
 
 err_buf:
-	hns_roce_free_buf(&cq->buf);
+	hns_roce_free_buf(hr_ctx, &cq->buf);
 
 err:
 	free(cq);
@@ -387,13 +388,14 @@ int hns_roce_u_destroy_cq(struct ibv_cq *cq)
 	if (to_hr_dev(cq->context->device)->hw_version != HNS_ROCE_HW_VER1)
 		hns_roce_free_db(to_hr_ctx(cq->context),
 				 to_hr_cq(cq)->set_ci_db, HNS_ROCE_CQ_TYPE_DB);
-	hns_roce_free_buf(&to_hr_cq(cq)->buf);
+	hns_roce_free_buf(to_hr_ctx(cq->context), &to_hr_cq(cq)->buf);
 	free(to_hr_cq(cq));
 
 	return ret;
 }
 
-static int hns_roce_create_idx_que(struct hns_roce_srq *srq)
+static int hns_roce_create_idx_que(struct hns_roce_context *ctx,
+				   struct hns_roce_srq *srq)
 {
 	struct hns_roce_idx_que	*idx_que = &srq->idx_que;
 	unsigned int buf_size;
@@ -407,7 +409,8 @@ static int hns_roce_create_idx_que(struct hns_roce_srq *srq)
 		return ENOMEM;
 
 	buf_size = to_hr_hem_entries_size(srq->wqe_cnt, idx_que->entry_shift);
-	if (hns_roce_alloc_buf(&idx_que->buf, buf_size, HNS_HW_PAGE_SIZE)) {
+	if (hns_roce_alloc_buf(ctx, &idx_que->buf, buf_size,
+			       HNS_HW_PAGE_SIZE)) {
 		free(idx_que->bitmap);
 		idx_que->bitmap = NULL;
 		return ENOMEM;
@@ -420,7 +423,8 @@ static int hns_roce_create_idx_que(struct hns_roce_srq *srq)
 	return 0;
 }
 
-static int hns_roce_alloc_srq_buf(struct hns_roce_srq *srq)
+static int hns_roce_alloc_srq_buf(struct hns_roce_context *ctx,
+				  struct hns_roce_srq *srq)
 {
 	int srq_buf_size;
 
@@ -433,7 +437,8 @@ static int hns_roce_alloc_srq_buf(struct hns_roce_srq *srq)
 	srq_buf_size = to_hr_hem_entries_size(srq->wqe_cnt, srq->wqe_shift);
 
 	/* allocate srq wqe buf */
-	if (hns_roce_alloc_buf(&srq->buf, srq_buf_size, HNS_HW_PAGE_SIZE)) {
+	if (hns_roce_alloc_buf(ctx, &srq->buf, srq_buf_size,
+			       HNS_HW_PAGE_SIZE)) {
 		free(srq->wrid);
 		return ENOMEM;
 	}
@@ -466,11 +471,11 @@ struct ibv_srq *hns_roce_u_create_srq(struct ibv_pd *pd,
 	srq->wqe_cnt = roundup_pow_of_two(init_attr->attr.max_wr + 1);
 	srq->max_gs = init_attr->attr.max_sge;
 
-	ret = hns_roce_create_idx_que(srq);
+	ret = hns_roce_create_idx_que(to_hr_ctx(pd->context), srq);
 	if (ret)
 		goto out;
 
-	ret = hns_roce_alloc_srq_buf(srq);
+	ret = hns_roce_alloc_srq_buf(to_hr_ctx(pd->context), srq);
 	if (ret)
 		goto err_idx_que;
 
@@ -498,11 +503,11 @@ err_srq_db:
 
 err_srq_buf:
 	free(srq->wrid);
-	hns_roce_free_buf(&srq->buf);
+	hns_roce_free_buf(to_hr_ctx(pd->context), &srq->buf);
 
 err_idx_que:
 	free(srq->idx_que.bitmap);
-	hns_roce_free_buf(&srq->idx_que.buf);
+	hns_roce_free_buf(to_hr_ctx(pd->context), &srq->idx_que.buf);
 out:
 	free(srq);
 	return NULL;
@@ -534,9 +539,10 @@ int hns_roce_u_destroy_srq(struct ibv_srq *srq)
 
 	hns_roce_free_db(to_hr_ctx(srq->context), to_hr_srq(srq)->db,
 			 HNS_ROCE_QP_TYPE_DB);
-	hns_roce_free_buf(&to_hr_srq(srq)->buf);
+	hns_roce_free_buf(to_hr_ctx(srq->context), &to_hr_srq(srq)->buf);
 	free(to_hr_srq(srq)->wrid);
-	hns_roce_free_buf(&to_hr_srq(srq)->idx_que.buf);
+	hns_roce_free_buf(to_hr_ctx(srq->context),
+			  &to_hr_srq(srq)->idx_que.buf);
 	free(to_hr_srq(srq)->idx_que.bitmap);
 	free(to_hr_srq(srq));
 
@@ -674,7 +680,8 @@ static int hns_roce_alloc_qp_buf(struct ibv_pd *pd, struct ibv_qp_cap *cap,
 			goto err_alloc;
 	}
 
-	if (hns_roce_alloc_buf(&qp->buf, qp->buf_size, HNS_HW_PAGE_SIZE))
+	if (hns_roce_alloc_buf(to_hr_ctx(pd->context), &qp->buf, qp->buf_size,
+			       HNS_HW_PAGE_SIZE))
 		goto err_alloc;
 
 	return 0;
@@ -900,7 +907,7 @@ err_free:
 	free(qp->sq.wrid);
 	if (qp->rq.wqe_cnt)
 		free(qp->rq.wrid);
-	hns_roce_free_buf(&qp->buf);
+	hns_roce_free_buf(context, &qp->buf);
 
 err_buf:
 	free(qp);
@@ -34,7 +34,6 @@
 
 #include <stdlib.h>
 #include <errno.h>
-#include <sys/mman.h>
 
 #include "mlx4.h"
 
@@ -72,22 +71,15 @@ static bool mlx4_is_extern_alloc(struct mlx4_context *context)
 int mlx4_alloc_buf(struct mlx4_context *ctx, struct mlx4_buf *buf,
 		   size_t size, int page_size)
 {
-	int ret;
-
 	if (mlx4_is_extern_alloc(ctx))
 		return mlx4_alloc_buf_extern(ctx, buf, size);
 
 	buf->length = align(size, page_size);
-	buf->buf = mmap(NULL, buf->length, PROT_READ | PROT_WRITE,
-			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (buf->buf == MAP_FAILED)
+	buf->buf = dma_arena_alloc(&ctx->dma_arena, buf->length);
+	if (!buf->buf)
 		return errno;
 
-	ret = ibv_dontfork_range(buf->buf, size);
-	if (ret)
-		munmap(buf->buf, buf->length);
-
-	return ret;
+	return 0;
 }
 
 void mlx4_free_buf(struct mlx4_context *context, struct mlx4_buf *buf)
@@ -95,8 +87,6 @@ void mlx4_free_buf(struct mlx4_context *context, struct mlx4_buf *buf)
 	if (mlx4_is_extern_alloc(context))
 		return mlx4_free_buf_extern(context, buf);
 
-	if (buf->length) {
-		ibv_dofork_range(buf->buf, buf->length);
-		munmap(buf->buf, buf->length);
-	}
+	if (buf->length)
+		dma_arena_free(&context->dma_arena, buf->buf, buf->length);
 }
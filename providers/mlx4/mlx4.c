@@ -252,8 +252,18 @@ static struct verbs_context *mlx4_alloc_context(struct ibv_device *ibdev,
 			mlx4_map_internal_clock(dev, &verbs_ctx->context);
 	}
 
+	if (dma_arena_init(&context->dma_arena, ibdev, dev->page_size))
+		goto arena_err;
+
 	return verbs_ctx;
 
+arena_err:
+	munmap(context->uar, dev->page_size);
+	if (context->bf_page)
+		munmap(context->bf_page, dev->page_size);
+	if (context->hca_core_clock)
+		munmap(context->hca_core_clock - context->core_clock.offset,
+		       dev->page_size);
 failed:
 	verbs_uninit_context(&context->ibv_ctx);
 	free(context);
@@ -272,6 +282,7 @@ static void mlx4_free_context(struct ibv_context *ibv_ctx)
 		munmap(context->hca_core_clock - context->core_clock.offset,
 		       mdev->page_size);
 
+	dma_arena_cleanup(&context->dma_arena);
 	verbs_uninit_context(&context->ibv_ctx);
 	free(context);
 }
@@ -123,6 +123,7 @@ struct mlx4_context {
 
 	struct mlx4_db_page	       *db_list[MLX4_NUM_DB_TYPE];
 	pthread_mutex_t			db_list_mutex;
+	struct dma_arena		dma_arena;
 	int				cqe_size;
 	struct mlx4_xsrq_table		xsrq_table;
 	struct {
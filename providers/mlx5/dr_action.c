@@ -970,6 +970,16 @@ mlx5dv_dr_action_create_packet_reformat(struct mlx5dv_dr_domain *dmn,
 	if (ret)
 		goto dec_ref;
 
+	/* Encap needs a device reformat context */
+	if (dr_domain_is_emu(dmn) &&
+	    ((flags & MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL) ||
+	     reformat_type == MLX5DV_FLOW_ACTION_PACKET_REFORMAT_TYPE_L2_TO_L2_TUNNEL ||
+	     reformat_type == MLX5DV_FLOW_ACTION_PACKET_REFORMAT_TYPE_L2_TO_L3_TUNNEL)) {
+		dr_dbg(dmn, "Reformat type is not supported on emulated domain\n");
+		errno = EOPNOTSUPP;
+		goto dec_ref;
+	}
+
 	action_type = dr_action_reformat_to_action_type(reformat_type);
 	action = dr_action_create_generic(action_type);
 	if (!action)
@@ -1534,8 +1544,10 @@ mlx5dv_dr_action_create_modify_header(struct mlx5dv_dr_domain *dmn,
 		goto dec_ref;
 	}
 
-	if (!dmn->info.supp_sw_steering &&
-	    !(flags & MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL)) {
+	if ((!dmn->info.supp_sw_steering &&
+	     !(flags & MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL)) ||
+	    (dr_domain_is_emu(dmn) &&
+	     (flags & MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL))) {
 		dr_dbg(dmn, "Only root actions are supported on current domain\n");
 		errno = EOPNOTSUPP;
 		goto dec_ref;
@@ -1601,7 +1613,7 @@ mlx5dv_dr_action_create_flow_meter(struct mlx5dv_dr_flow_meter_attr *attr)
 	struct mlx5dv_dr_action *action;
 	int ret;
 
-	if (!dmn->info.supp_sw_steering) {
+	if (!dmn->info.supp_sw_steering || dr_domain_is_emu(dmn)) {
 		dr_dbg(dmn, "Meter action is not supported on current domain\n");
 		errno = EOPNOTSUPP;
 		return NULL;
@@ -2033,8 +2045,9 @@ mlx5dv_dr_action_create_flow_sampler(struct mlx5dv_dr_flow_sampler_attr *attr)
 		return NULL;
 	}
 
-	if (dmn->type != MLX5DV_DR_DOMAIN_TYPE_NIC_RX &&
-	    dmn->type != MLX5DV_DR_DOMAIN_TYPE_FDB) {
+	if ((dmn->type != MLX5DV_DR_DOMAIN_TYPE_NIC_RX &&
+	     dmn->type != MLX5DV_DR_DOMAIN_TYPE_FDB) ||
+	    dr_domain_is_emu(dmn)) {
 		errno = EOPNOTSUPP;
 		return NULL;
 	}
@@ -2239,6 +2252,11 @@ mlx5dv_dr_action_create_dest_array(struct mlx5dv_dr_domain *dmn,
 		return NULL;
 	}
 
+	if (dr_domain_is_emu(dmn)) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
 	atomic_fetch_add(&dmn->refcount, 1);
 
 	action = dr_action_create_generic(DR_ACTION_TYP_DEST_ARRAY);
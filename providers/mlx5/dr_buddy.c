@@ -37,20 +37,76 @@
 #include <ccan/bitmap.h>
 #include "mlx5dv_dr.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 struct dr_icm_pool;
 struct dr_icm_buddy_mem;
 
-static int dr_find_first_bit(const bitmap *set_addr,
-			     const bitmap *addr,
-			     unsigned int size)
+/* Index of the first non zero word of bmap in [start, end) or end */
+static unsigned long dr_find_first_word(const bitmap *bmap,
+					unsigned long start,
+					unsigned long end)
 {
-	unsigned int set_size = (size - 1) / BITS_PER_LONG + 1;
-	unsigned long set_idx;
+#if defined(__SSE2__)
+	/* Words per 16 byte load, 2 or 4 depending on the size of a long */
+	const unsigned long step = sizeof(__m128i) / sizeof(*bmap);
+	const __m128i zero = _mm_setzero_si128();
+
+	/* Skip empty words two loads at a time, the first level of the
+	 * smallest order of a 4M entries buddy is 1K words.
+	 */
+	while (start + 2 * step <= end) {
+		const __m128i *p = (const __m128i *)&bmap[start];
+		__m128i cmp;
+
+		cmp = _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+		cmp = _mm_cmpeq_epi8(cmp, zero);
+
+		if (_mm_movemask_epi8(cmp) != 0xffff)
+			break;
+		start += 2 * step;
+	}
+#endif
+	while (start < end && !bmap[start].w)
+		start++;
+
+	return start;
+}
 
-	/* find the first free in the first level */
-	set_idx =  bitmap_ffs(set_addr, 0, set_size);
+static int dr_find_first_bit(struct dr_icm_buddy_mem *buddy, int order)
+{
+	unsigned int size = 1 << (buddy->max_order - order);
+	unsigned int set_size = (size - 1) / BITS_PER_LONG + 1;
+	unsigned long set_words = BITS_TO_LONGS(set_size);
+	unsigned long set_word, set_idx;
+
+	/* find the first free in the first level, none is below the hint */
+	set_word = dr_find_first_word(buddy->set_bit[order],
+				      buddy->set_bit_hint[order], set_words);
+	if (set_word == set_words)
+		return size;
+
+	buddy->set_bit_hint[order] = set_word;
+	set_idx = bitmap_ffs(buddy->set_bit[order], set_word * BITS_PER_LONG,
+			     min_t(unsigned long, set_size,
+				   (set_word + 1) * BITS_PER_LONG));
 	/* find the next level */
-	return bitmap_ffs(addr, set_idx * BITS_PER_LONG, size);
+	return bitmap_ffs(buddy->bits[order], set_idx * BITS_PER_LONG, size);
+}
+
+/* Mark seg of the given order free in both layers of the bitmaps */
+static void dr_buddy_set_seg(struct dr_icm_buddy_mem *buddy,
+			     uint32_t seg, int order)
+{
+	uint32_t set_idx = seg / BITS_PER_LONG;
+
+	bitmap_set_bit(buddy->bits[order], seg);
+	bitmap_set_bit(buddy->set_bit[order], set_idx);
+	buddy->set_bit_hint[order] = min_t(uint32_t,
+					   buddy->set_bit_hint[order],
+					   set_idx / BITS_PER_LONG);
 }
 
 int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order)
@@ -77,6 +133,11 @@ int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order)
 	if (!buddy->set_bit)
 		goto err_out_free_num_free;
 
+	buddy->set_bit_hint = calloc(buddy->max_order + 1,
+				     sizeof(*buddy->set_bit_hint));
+	if (!buddy->set_bit_hint)
+		goto err_out_free_set_bit;
+
 	/* Allocating max_order bitmaps, one for each order.
 	 * only the bitmap for the maximum size will be available for use and
 	 * the first bit there will be set.
@@ -95,8 +156,7 @@ int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order)
 			goto err_out_free_set;
 	}
 
-	bitmap_set_bit(buddy->bits[buddy->max_order], 0);
-	bitmap_set_bit(buddy->set_bit[buddy->max_order], 0);
+	dr_buddy_set_seg(buddy, 0, buddy->max_order);
 
 	buddy->num_free[buddy->max_order] = 1;
 
@@ -107,11 +167,14 @@ err_out_free_set:
 		free(buddy->set_bit[i]);
 
 err_out_free_each_bit_per_order:
-	free(buddy->set_bit);
-
 	for (i = 0; i <= buddy->max_order; ++i)
 		free(buddy->bits[i]);
 
+	free(buddy->set_bit_hint);
+
+err_out_free_set_bit:
+	free(buddy->set_bit);
+
 err_out_free_num_free:
 	free(buddy->num_free);
 
@@ -132,6 +195,7 @@ void dr_buddy_cleanup(struct dr_icm_buddy_mem *buddy)
 		free(buddy->set_bit[i]);
 	}
 
+	free(buddy->set_bit_hint);
 	free(buddy->set_bit);
 	free(buddy->num_free);
 	free(buddy->bits);
@@ -182,7 +246,7 @@ int dr_buddy_alloc_mem(struct dr_icm_buddy_mem *buddy, int order)
 	for (o = order; o <= buddy->max_order; ++o)
 		if (buddy->num_free[o]) {
 			m = 1 << (buddy->max_order - o);
-			seg = dr_find_first_bit(buddy->set_bit[o], buddy->bits[o], m);
+			seg = dr_find_first_bit(buddy, o);
 			if (m <= seg) {
 				/* not found free mem, but there are free mem */
 				assert(false);
@@ -205,8 +269,7 @@ found:
 	while (o > order) {
 		--o;
 		seg <<= 1;
-		bitmap_set_bit(buddy->bits[o], seg ^ 1);
-		bitmap_set_bit(buddy->set_bit[o], (seg ^ 1) / BITS_PER_LONG);
+		dr_buddy_set_seg(buddy, seg ^ 1, o);
 
 		++buddy->num_free[o];
 	}
@@ -229,8 +292,7 @@ dr_buddy_free_mem(struct dr_icm_buddy_mem *buddy, uint32_t seg, int order)
 		seg >>= 1;
 		++order;
 	}
-	bitmap_set_bit(buddy->bits[order], seg);
-	bitmap_set_bit(buddy->set_bit[order], seg / BITS_PER_LONG);
+	dr_buddy_set_seg(buddy, seg, order);
 
 	++buddy->num_free[order];
 }
@@ -56,16 +56,29 @@
 #include <string.h>
 #include "mlx5dv_dr.h"
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && !defined(__AARCH64EB__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
 #define DR_STE_CRC_POLY		0xEDB88320L
 
 static uint32_t dr_ste_crc_tab32[8][256];
 
+static uint32_t dr_crc32_tag_calc_sw(const uint8_t *tag);
+static uint32_t (*dr_crc32_tag_calc_fn)(const uint8_t *tag) = dr_crc32_tag_calc_sw;
+
 static void dr_crc32_calc_lookup_entry(uint32_t (*tbl)[256], uint8_t i,
 				       uint8_t j)
 {
 	tbl[i][j] = (tbl[i-1][j] >> 8) ^ tbl[0][tbl[i-1][j] & 0xff];
 }
 
+static void dr_crc32_select_tag_calc(void);
+
 void dr_crc32_init_table(void)
 {
 	uint32_t crc, i, j;
@@ -91,6 +104,8 @@ void dr_crc32_init_table(void)
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 6, i);
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 7, i);
 	}
+
+	dr_crc32_select_tag_calc();
 }
 
 /* Compute CRC32 (Slicing-by-8 algorithm) */
@@ -129,3 +144,86 @@ uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length)
 	return ((crc>>24) & 0xff) | ((crc<<8) & 0xff0000) |
 		((crc>>8) & 0xff00) | ((crc<<24) & 0xff000000);
 }
+
+static uint32_t dr_crc32_tag_calc_sw(const uint8_t *tag)
+{
+	return dr_crc32_slice8_calc(tag, DR_STE_SIZE_TAG);
+}
+
+#if defined(__x86_64__)
+/*
+ * The SSE4.2 crc32 instruction implements CRC32C, the tag CRC uses the
+ * IEEE polynomial. Fold the 128 bit tag to 64 and then 32 bits with
+ * carry-less multiplications and finish with a Barrett reduction, the
+ * constants are the bit reflected ones of Intel's "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction".
+ */
+static uint32_t __attribute__((target("pclmul,sse4.1")))
+dr_crc32_tag_calc_pclmul(const uint8_t *tag)
+{
+	const __m128i k4k3 = _mm_set_epi64x(0x00ccaa009eULL, 0x01751997d0ULL);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124ULL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641ULL, 0x01db710641ULL);
+	const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+	__m128i crc, tmp;
+
+	crc = _mm_loadu_si128((const __m128i *)tag);
+
+	/* 128 to 64 bits, also appends the 32 zero bits of the CRC */
+	tmp = _mm_clmulepi64_si128(k4k3, crc, 0x01);
+	crc = _mm_xor_si128(_mm_srli_si128(crc, 8), tmp);
+
+	/* 64 to 32 bits */
+	tmp = _mm_srli_si128(crc, 4);
+	crc = _mm_clmulepi64_si128(_mm_and_si128(crc, mask32), k5, 0x00);
+	crc = _mm_xor_si128(crc, tmp);
+
+	/* Barrett reduction */
+	tmp = crc;
+	crc = _mm_clmulepi64_si128(_mm_and_si128(crc, mask32), poly, 0x10);
+	crc = _mm_clmulepi64_si128(_mm_and_si128(crc, mask32), poly, 0x00);
+	crc = _mm_xor_si128(crc, tmp);
+
+	return __builtin_bswap32(_mm_extract_epi32(crc, 1));
+}
+
+static void dr_crc32_select_tag_calc(void)
+{
+	unsigned int ax, bx, cx, dx;
+
+	if (__get_cpuid(1, &ax, &bx, &cx, &dx) &&
+	    (cx & bit_PCLMUL) && (cx & bit_SSE4_1))
+		dr_crc32_tag_calc_fn = dr_crc32_tag_calc_pclmul;
+}
+#elif defined(__aarch64__) && !defined(__AARCH64EB__)
+/* ARMv8 crc32 instructions use the IEEE polynomial, optional before 8.1 */
+static uint32_t __attribute__((target("+crc")))
+dr_crc32_tag_calc_armv8(const uint8_t *tag)
+{
+	uint64_t low, high;
+	uint32_t crc;
+
+	memcpy(&low, tag, sizeof(low));
+	memcpy(&high, tag + sizeof(low), sizeof(high));
+	crc = __crc32d(0, low);
+	crc = __crc32d(crc, high);
+
+	return __builtin_bswap32(crc);
+}
+
+static void dr_crc32_select_tag_calc(void)
+{
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		dr_crc32_tag_calc_fn = dr_crc32_tag_calc_armv8;
+}
+#else
+static void dr_crc32_select_tag_calc(void)
+{
+}
+#endif
+
+/* CRC32 of an STE tag, same result as dr_crc32_slice8_calc() */
+uint32_t dr_crc32_tag_calc(const uint8_t *tag)
+{
+	return dr_crc32_tag_calc_fn(tag);
+}
@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include "mlx5dv_dr.h"
+#include "dr_stats_dump.h"
 
 #define BUFF_SIZE	1024
 
@@ -709,7 +710,7 @@ static int dr_dump_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
 	enum mlx5dv_dr_domain_type dmn_type = dmn->type;
 	char *dev_name = dmn->ctx->device->dev_name;
 	uint64_t domain_id;
-	int ret;
+	int i, ret;
 
 	domain_id = dr_domain_id_calc(dmn_type);
 
@@ -728,8 +729,12 @@ static int dr_dump_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
 	if (ret < 0)
 		return ret;
 
-	if (dmn->info.supp_sw_steering) {
-		ret = dr_dump_send_ring(f, dmn->send_ring, domain_id);
+	for (i = 0; dmn->info.supp_sw_steering && i < dmn->num_send_rings; i++) {
+		/* Emulated domains have no QP to report */
+		if (!dmn->send_ring[i]->qp)
+			break;
+
+		ret = dr_dump_send_ring(f, dmn->send_ring[i], domain_id);
 		if (ret < 0)
 			return ret;
 	}
@@ -771,3 +776,128 @@ int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *dmn)
 	return ret;
 }
 
+static int dr_dump_stats_rec(FILE *f, enum dr_stats_dump_rec_type type,
+			     uint64_t *vals, uint16_t num_vals)
+{
+	struct dr_stats_dump_rec rec = {
+		.type = htole16(type),
+		.num_vals = htole16(num_vals),
+	};
+	int i;
+
+	for (i = 0; i < num_vals; i++)
+		vals[i] = htole64(vals[i]);
+
+	if (fwrite(&rec, sizeof(rec), 1, f) != 1 ||
+	    fwrite(vals, sizeof(*vals), num_vals, f) != num_vals)
+		return -EIO;
+
+	return 0;
+}
+
+static int dr_dump_stats_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
+{
+	uint64_t vals[DR_STATS_DUMP_DOMAIN_NUM_VALS];
+	struct mlx5dv_dr_domain_stats stats;
+	int ret, i;
+
+	ret = mlx5dv_dr_domain_query_stats(dmn, &stats);
+	if (ret)
+		return -ret;
+
+	vals[DR_STATS_DUMP_DOMAIN_ID] = dr_domain_id_calc(dmn->type);
+	vals[DR_STATS_DUMP_DOMAIN_TYPE] = dmn->type;
+	vals[DR_STATS_DUMP_DOMAIN_STE_ICM_TOTAL] = stats.ste_icm_total_bytes;
+	vals[DR_STATS_DUMP_DOMAIN_ACTION_ICM] = stats.action_icm_bytes;
+	vals[DR_STATS_DUMP_DOMAIN_ACTION_ICM_TOTAL] = stats.action_icm_total_bytes;
+	vals[DR_STATS_DUMP_DOMAIN_SEND_STALLS] = stats.num_send_stalls;
+	vals[DR_STATS_DUMP_DOMAIN_SEND_STALL_NS] = stats.send_stall_time_ns;
+	for (i = 0; i < MLX5DV_DR_ICM_CHUNK_SIZES; i++)
+		vals[DR_STATS_DUMP_DOMAIN_STE_ICM + i] = stats.ste_icm_bytes[i];
+
+	return dr_dump_stats_rec(f, DR_STATS_DUMP_REC_DOMAIN, vals,
+				 DR_STATS_DUMP_DOMAIN_NUM_VALS);
+}
+
+static int dr_dump_stats_matcher(FILE *f, struct mlx5dv_dr_matcher *matcher)
+{
+	uint64_t vals[DR_STATS_DUMP_MATCHER_NUM_VALS];
+	struct mlx5dv_dr_matcher_stats stats;
+	int i;
+
+	dr_matcher_query_stats(matcher, &stats);
+
+	vals[DR_STATS_DUMP_MATCHER_ID] = (uint64_t) (uintptr_t) matcher;
+	vals[DR_STATS_DUMP_MATCHER_TABLE_ID] = (uint64_t) (uintptr_t) matcher->tbl;
+	vals[DR_STATS_DUMP_MATCHER_PRIO] = matcher->prio;
+	vals[DR_STATS_DUMP_MATCHER_NUM_RULES] = stats.num_rules;
+	vals[DR_STATS_DUMP_MATCHER_LOG_HTBL_SIZE] = stats.log_htbl_size;
+	vals[DR_STATS_DUMP_MATCHER_HTBL_VALID_ENTRIES] = stats.htbl_valid_entries;
+	vals[DR_STATS_DUMP_MATCHER_HTBL_COLLISIONS] = stats.htbl_collisions;
+	vals[DR_STATS_DUMP_MATCHER_NUM_COLLISIONS] = stats.num_collisions;
+	vals[DR_STATS_DUMP_MATCHER_MAX_MISS_LIST_LEN] = stats.max_miss_list_len;
+	vals[DR_STATS_DUMP_MATCHER_NUM_REHASH] = stats.num_rehash;
+	vals[DR_STATS_DUMP_MATCHER_REHASH_NS] = stats.rehash_time_ns;
+	vals[DR_STATS_DUMP_MATCHER_MAX_REHASH_NS] = stats.max_rehash_time_ns;
+	for (i = 0; i < MLX5DV_DR_MISS_LIST_LEN_HIST; i++)
+		vals[DR_STATS_DUMP_MATCHER_MISS_LIST_LEN + i] =
+			stats.miss_list_len[i];
+
+	return dr_dump_stats_rec(f, DR_STATS_DUMP_REC_MATCHER, vals,
+				 DR_STATS_DUMP_MATCHER_NUM_VALS);
+}
+
+static int dr_dump_stats_all(FILE *f, struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_stats_dump_hdr hdr = {
+		.magic = htole32(DR_STATS_DUMP_MAGIC),
+		.version = htole32(DR_STATS_DUMP_VERSION),
+	};
+	uint64_t vals[DR_STATS_DUMP_TABLE_NUM_VALS];
+	struct mlx5dv_dr_matcher *matcher;
+	struct mlx5dv_dr_table *tbl;
+	int ret;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		return -EIO;
+
+	ret = dr_dump_stats_domain(f, dmn);
+	if (ret)
+		return ret;
+
+	list_for_each(&dmn->tbl_list, tbl, tbl_list) {
+		vals[DR_STATS_DUMP_TABLE_ID] = (uint64_t) (uintptr_t) tbl;
+		vals[DR_STATS_DUMP_TABLE_LEVEL] = tbl->level;
+		ret = dr_dump_stats_rec(f, DR_STATS_DUMP_REC_TABLE, vals,
+					DR_STATS_DUMP_TABLE_NUM_VALS);
+		if (ret)
+			return ret;
+
+		if (dr_is_root_table(tbl))
+			continue;
+
+		list_for_each(&tbl->matcher_list, matcher, matcher_list) {
+			ret = dr_dump_stats_matcher(f, matcher);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+int mlx5dv_dump_dr_domain_stats(FILE *fout, struct mlx5dv_dr_domain *dmn)
+{
+	int ret;
+
+	if (!fout || !dmn)
+		return -EINVAL;
+
+	dr_domain_lock(dmn);
+
+	ret = dr_dump_stats_all(fout, dmn);
+
+	dr_domain_unlock(dmn);
+
+	return ret;
+}
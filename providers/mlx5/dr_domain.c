@@ -51,6 +51,10 @@ static int dr_domain_init_resources(struct mlx5dv_dr_domain *dmn)
 		return errno;
 	}
 
+	/* Emulated ICM needs neither a PD nor a UAR for the send ring */
+	if (dr_domain_is_emu(dmn))
+		goto alloc_pools;
+
 	dmn->pd = ibv_alloc_pd(dmn->ctx);
 	if (!dmn->pd) {
 		dr_dbg(dmn, "Couldn't allocate PD\n");
@@ -69,6 +73,7 @@ static int dr_domain_init_resources(struct mlx5dv_dr_domain *dmn)
 		goto clean_pd;
 	}
 
+alloc_pools:
 	dmn->ste_icm_pool = dr_icm_pool_create(dmn, DR_ICM_TYPE_STE);
 	if (!dmn->ste_icm_pool) {
 		dr_dbg(dmn, "Couldn't get icm memory for %s\n",
@@ -97,20 +102,27 @@ free_action_icm_pool:
 free_ste_icm_pool:
 	dr_icm_pool_destroy(dmn->ste_icm_pool);
 clean_uar:
-	mlx5dv_devx_free_uar(dmn->uar);
+	if (dmn->uar)
+		mlx5dv_devx_free_uar(dmn->uar);
 clean_pd:
-	ibv_dealloc_pd(dmn->pd);
+	if (dmn->pd)
+		ibv_dealloc_pd(dmn->pd);
 
 	return ret;
 }
 
 static void dr_free_resources(struct mlx5dv_dr_domain *dmn)
 {
-	dr_send_ring_free(dmn->send_ring);
+	int i;
+
+	for (i = 0; i < dmn->num_send_rings; i++)
+		dr_send_ring_free(dmn->send_ring[i]);
 	dr_icm_pool_destroy(dmn->action_icm_pool);
 	dr_icm_pool_destroy(dmn->ste_icm_pool);
-	mlx5dv_devx_free_uar(dmn->uar);
-	ibv_dealloc_pd(dmn->pd);
+	if (dmn->uar)
+		mlx5dv_devx_free_uar(dmn->uar);
+	if (dmn->pd)
+		ibv_dealloc_pd(dmn->pd);
 }
 
 static int dr_query_vport_cap(struct ibv_context *ctx, uint16_t vport_number,
@@ -327,8 +339,8 @@ mlx5dv_dr_domain_create(struct ibv_context *ctx,
 	dmn->type = type;
 	atomic_init(&dmn->refcount, 1);
 	list_head_init(&dmn->tbl_list);
-	pthread_mutex_init(&dmn->info.rx.mutex, NULL);
-	pthread_mutex_init(&dmn->info.tx.mutex, NULL);
+	dr_domain_nic_lock_init(&dmn->info.rx);
+	dr_domain_nic_lock_init(&dmn->info.tx);
 
 	if (dr_domain_caps_init(ctx, dmn)) {
 		dr_dbg(dmn, "Failed init domain, no caps\n");
@@ -360,6 +372,64 @@ free_domain:
 	return NULL;
 }
 
+/*
+ * Create a domain whose ICM is emulated in host memory. Rules are inserted
+ * by the regular SW steering code and can be matched against packets with
+ * mlx5dv_dr_table_emu_match(), no device is involved.
+ */
+struct mlx5dv_dr_domain *
+mlx5dv_dr_domain_create_emu(enum mlx5dv_dr_domain_type type, uint32_t flags)
+{
+	struct mlx5dv_dr_domain *dmn;
+	int ret;
+
+	if (type > MLX5DV_DR_DOMAIN_TYPE_FDB ||
+	    !check_comp_mask(flags, MLX5DV_DR_DOMAIN_EMU_FLAGS_STE_V1)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	dmn = calloc(1, sizeof(*dmn));
+	if (!dmn) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	dmn->emu = dr_emu_create(flags);
+	if (!dmn->emu)
+		goto free_domain;
+
+	dmn->ctx = dr_emu_get_ctx(dmn->emu);
+	dmn->type = type;
+	atomic_init(&dmn->refcount, 1);
+	list_head_init(&dmn->tbl_list);
+	dr_domain_nic_lock_init(&dmn->info.rx);
+	dr_domain_nic_lock_init(&dmn->info.tx);
+
+	if (dr_emu_caps_init(dmn->emu, dmn))
+		goto uninit_caps;
+
+	if (dr_domain_check_icm_memory_caps(dmn))
+		goto uninit_caps;
+
+	ret = dr_domain_init_resources(dmn);
+	if (ret) {
+		dr_dbg(dmn, "Failed init emulated domain resources\n");
+		goto uninit_caps;
+	}
+
+	dr_crc32_init_table();
+
+	return dmn;
+
+uninit_caps:
+	dr_domain_caps_uninit(dmn);
+	dr_emu_destroy(dmn->emu);
+free_domain:
+	free(dmn);
+	return NULL;
+}
+
 /*
  * Assure synchronization of the device steering tables with updates made by SW
  * insertion.
@@ -380,7 +450,7 @@ int mlx5dv_dr_domain_sync(struct mlx5dv_dr_domain *dmn, uint32_t flags)
 			return ret;
 	}
 
-	if (flags & MLX5DV_DR_DOMAIN_SYNC_FLAGS_HW) {
+	if ((flags & MLX5DV_DR_DOMAIN_SYNC_FLAGS_HW) && !dr_domain_is_emu(dmn)) {
 		ret = dr_devx_sync_steering(dmn->ctx);
 		if (ret)
 			return ret;
@@ -400,6 +470,46 @@ int mlx5dv_dr_domain_sync(struct mlx5dv_dr_domain *dmn, uint32_t flags)
 	return ret;
 }
 
+int mlx5dv_dr_domain_query_stats(struct mlx5dv_dr_domain *dmn,
+				 struct mlx5dv_dr_domain_stats *stats)
+{
+	struct dr_icm_pool_stats pool_stats;
+	uint64_t num_stalls, stall_time_ns;
+	int i;
+
+	static_assert(MLX5DV_DR_ICM_CHUNK_SIZES == DR_CHUNK_SIZE_MAX,
+		      "ICM chunk sizes mismatch");
+
+	if (!dmn->info.supp_sw_steering) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	dr_icm_pool_query(dmn->ste_icm_pool, &pool_stats);
+	stats->ste_icm_total_bytes = pool_stats.total_bytes;
+	for (i = 0; i < DR_CHUNK_SIZE_MAX; i++)
+		stats->ste_icm_bytes[i] = pool_stats.num_chunks[i] *
+			dr_icm_pool_chunk_size_to_byte(i, DR_ICM_TYPE_STE);
+
+	dr_icm_pool_query(dmn->action_icm_pool, &pool_stats);
+	stats->action_icm_total_bytes = pool_stats.total_bytes;
+	for (i = 0; i < DR_CHUNK_SIZE_MAX; i++)
+		stats->action_icm_bytes += pool_stats.num_chunks[i] *
+			dr_icm_pool_chunk_size_to_byte(i, DR_ICM_TYPE_MODIFY_ACTION);
+
+	/* Rings are only ever added */
+	for (i = 0; i < dmn->num_send_rings; i++) {
+		dr_send_ring_query(dmn->send_ring[i], &num_stalls,
+				   &stall_time_ns);
+		stats->num_send_stalls += num_stalls;
+		stats->send_stall_time_ns += stall_time_ns;
+	}
+
+	return 0;
+}
+
 void mlx5dv_dr_domain_set_reclaim_device_memory(struct mlx5dv_dr_domain *dmn,
 						bool enable)
 {
@@ -418,11 +528,14 @@ int mlx5dv_dr_domain_destroy(struct mlx5dv_dr_domain *dmn)
 
 	if (dmn->info.supp_sw_steering) {
 		/* make sure resources are not used by the hardware */
-		dr_devx_sync_steering(dmn->ctx);
+		if (!dr_domain_is_emu(dmn))
+			dr_devx_sync_steering(dmn->ctx);
 		dr_free_resources(dmn);
 	}
 
 	dr_domain_caps_uninit(dmn);
+	if (dr_domain_is_emu(dmn))
+		dr_emu_destroy(dmn->emu);
 
 	free(dmn);
 	return 0;
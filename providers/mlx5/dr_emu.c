@@ -0,0 +1,698 @@
+/* SPDX-License-Identifier: GPL-2.0 OR Linux-OpenIB */
+/*
+ * Host memory emulation of the steering ICM.
+ *
+ * An emulated domain runs the regular SW steering code, but every ICM
+ * buddy is backed by host memory and the writes that would be posted on
+ * the domain's RC QP are copied straight into it. On top of that a
+ * software walker follows the STE chains the way the device does:
+ * hash with the previous STE's next lookup type and byte mask, compare
+ * the tag under the STE mask, then continue on the hit or miss address
+ * until an address outside the emulated ICM is reached.
+ *
+ * This lets rule insertion rate, collision behaviour, memory usage and
+ * matching results be measured without a device.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dr_ste.h"
+
+#define DR_EMU_MAX_REGIONS	1024
+#define DR_EMU_ICM_BASE		(1ULL << 32)
+#define DR_EMU_ICM_LIMIT	(1ULL << 38)
+#define DR_EMU_MAX_LOOKUPS	(1 << 16)
+
+/* Terminal addresses, all of them below the emulated ICM range */
+enum {
+	DR_EMU_NIC_RX_DROP_ADDR		= 0x1000,
+	DR_EMU_NIC_TX_DROP_ADDR		= 0x2000,
+	DR_EMU_NIC_TX_ALLOW_ADDR	= 0x3000,
+	DR_EMU_ESW_RX_DROP_ADDR		= 0x4000,
+	DR_EMU_ESW_TX_DROP_ADDR		= 0x5000,
+	DR_EMU_VPORT_RX_ADDR		= 0x6000,
+	DR_EMU_VPORT_TX_ADDR		= 0x7000,
+	DR_EMU_UPLINK_RX_ADDR		= 0x8000,
+	DR_EMU_UPLINK_TX_ADDR		= 0x9000,
+};
+
+enum dr_emu_builder {
+	DR_EMU_SB_ETH_L2_SRC_DST,
+	DR_EMU_SB_ETH_L3_IPV6_DST,
+	DR_EMU_SB_ETH_L3_IPV6_SRC,
+	DR_EMU_SB_ETH_L3_IPV4_5_TUPLE,
+	DR_EMU_SB_ETH_L2_SRC,
+	DR_EMU_SB_ETH_L2_DST,
+	DR_EMU_SB_ETH_L2_TNL,
+	DR_EMU_SB_ETH_L3_IPV4_MISC,
+	DR_EMU_SB_ETH_IPV6_L3_L4,
+	DR_EMU_SB_MPLS,
+	DR_EMU_SB_TNL_GRE,
+	DR_EMU_SB_TNL_MPLS,
+	DR_EMU_SB_ICMP,
+	DR_EMU_SB_GENERAL_PURPOSE,
+	DR_EMU_SB_ETH_L4_MISC,
+	DR_EMU_SB_TNL_VXLAN_GPE,
+	DR_EMU_SB_TNL_GENEVE,
+	DR_EMU_SB_TNL_GTPU,
+	DR_EMU_SB_REGISTER_0,
+	DR_EMU_SB_REGISTER_1,
+	DR_EMU_SB_SRC_GVMI_QPN,
+	DR_EMU_SB_MAX,
+};
+
+struct dr_emu_region {
+	uint8_t			*buf;
+	uint64_t		icm_addr;
+	size_t			size;
+	/* STE owning each entry, only for STE regions */
+	struct dr_ste		**ste_map;
+};
+
+struct dr_emu {
+	/* Only what dr_dbg() and the dump code look at is filled in */
+	struct mlx5_context	mctx;
+	struct ibv_device	ibdev;
+	uint32_t		flags;
+	/* protect regions, stats and the builders */
+	pthread_mutex_t		mutex;
+	struct dr_emu_region	regions[DR_EMU_MAX_REGIONS];
+	uint32_t		num_regions;
+	uint64_t		next_icm_addr;
+	struct mlx5dv_dr_domain_emu_stats stats;
+	/* One builder per lookup type layout, all fields masked */
+	struct dr_ste_build	*sb_arr;
+	uint32_t		num_sb;
+};
+
+struct dr_emu *dr_emu_create(uint32_t flags)
+{
+	struct dr_emu *emu;
+
+	emu = calloc(1, sizeof(*emu));
+	if (!emu) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	emu->flags = flags;
+	emu->next_icm_addr = DR_EMU_ICM_BASE;
+	emu->mctx.dbg_fp = stderr;
+	strcpy(emu->ibdev.name, "mlx5_emu");
+	strcpy(emu->ibdev.dev_name, "mlx5_emu");
+	emu->mctx.ibv_ctx.context.device = &emu->ibdev;
+	pthread_mutex_init(&emu->mutex, NULL);
+
+	return emu;
+}
+
+void dr_emu_destroy(struct dr_emu *emu)
+{
+	uint32_t i;
+
+	for (i = 0; i < emu->num_regions; i++) {
+		free(emu->regions[i].ste_map);
+		free(emu->regions[i].buf);
+	}
+
+	pthread_mutex_destroy(&emu->mutex);
+	free(emu->sb_arr);
+	free(emu);
+}
+
+struct ibv_context *dr_emu_get_ctx(struct dr_emu *emu)
+{
+	return &emu->mctx.ibv_ctx.context;
+}
+
+int dr_emu_caps_init(struct dr_emu *emu, struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_devx_caps *caps = &dmn->info.caps;
+
+	if (emu->flags & MLX5DV_DR_DOMAIN_EMU_FLAGS_STE_V1)
+		caps->sw_format_ver = MLX5_HW_CONNECTX_6DX;
+	else
+		caps->sw_format_ver = MLX5_HW_CONNECTX_5;
+
+	caps->flex_protocols = MLX5_FLEX_PARSER_ICMP_V4_ENABLED |
+			       MLX5_FLEX_PARSER_ICMP_V6_ENABLED |
+			       MLX5_FLEX_PARSER_VXLAN_GPE_ENABLED |
+			       MLX5_FLEX_PARSER_GENEVE_ENABLED |
+			       MLX5_FLEX_PARSER_GTPU_ENABLED;
+	caps->flex_parser_id_icmp_dw0 = 4;
+	caps->flex_parser_id_icmp_dw1 = 5;
+	caps->flex_parser_id_icmpv6_dw0 = 4;
+	caps->flex_parser_id_icmpv6_dw1 = 5;
+	caps->max_ft_level = 64;
+	caps->log_icm_size = DR_CHUNK_SIZE_1024K + DR_STE_LOG_SIZE;
+	caps->log_modify_hdr_icm_size = DR_CHUNK_SIZE_4K + DR_MODIFY_ACTION_LOG_SIZE + 4;
+	caps->nic_rx_drop_address = DR_EMU_NIC_RX_DROP_ADDR;
+	caps->nic_tx_drop_address = DR_EMU_NIC_TX_DROP_ADDR;
+	caps->nic_tx_allow_address = DR_EMU_NIC_TX_ALLOW_ADDR;
+	caps->rx_sw_owner = true;
+	caps->tx_sw_owner = true;
+	caps->fdb_sw_owner = true;
+	dmn->info.supp_sw_steering = true;
+
+	switch (dmn->type) {
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
+		dmn->info.rx.ste_type = DR_STE_TYPE_RX;
+		dmn->info.rx.default_icm_addr = caps->nic_rx_drop_address;
+		dmn->info.rx.drop_icm_addr = caps->nic_rx_drop_address;
+		break;
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_TX:
+		dmn->info.tx.ste_type = DR_STE_TYPE_TX;
+		dmn->info.tx.default_icm_addr = caps->nic_tx_allow_address;
+		dmn->info.tx.drop_icm_addr = caps->nic_tx_drop_address;
+		break;
+	case MLX5DV_DR_DOMAIN_TYPE_FDB:
+		/* vport 0 is the eswitch manager, followed by the uplink */
+		caps->vports_caps = calloc(2, sizeof(*caps->vports_caps));
+		if (!caps->vports_caps) {
+			errno = ENOMEM;
+			return errno;
+		}
+
+		caps->eswitch_manager = true;
+		caps->num_vports = 1;
+		caps->vports_caps[0].icm_address_rx = DR_EMU_VPORT_RX_ADDR;
+		caps->vports_caps[0].icm_address_tx = DR_EMU_VPORT_TX_ADDR;
+		caps->vports_caps[1].icm_address_rx = DR_EMU_UPLINK_RX_ADDR;
+		caps->vports_caps[1].icm_address_tx = DR_EMU_UPLINK_TX_ADDR;
+		caps->vports_caps[1].gvmi = 1;
+		caps->esw_rx_drop_address = DR_EMU_ESW_RX_DROP_ADDR;
+		caps->esw_tx_drop_address = DR_EMU_ESW_TX_DROP_ADDR;
+
+		dmn->info.rx.ste_type = DR_STE_TYPE_RX;
+		dmn->info.tx.ste_type = DR_STE_TYPE_TX;
+		dmn->info.rx.default_icm_addr = caps->vports_caps[0].icm_address_rx;
+		dmn->info.tx.default_icm_addr = caps->vports_caps[0].icm_address_tx;
+		dmn->info.rx.drop_icm_addr = caps->esw_rx_drop_address;
+		dmn->info.tx.drop_icm_addr = caps->esw_tx_drop_address;
+		break;
+	default:
+		errno = EINVAL;
+		return errno;
+	}
+
+	return 0;
+}
+
+int dr_emu_icm_alloc(struct dr_emu *emu, size_t size, uint32_t *key,
+		     uint64_t *icm_addr)
+{
+	struct dr_emu_region *region = NULL;
+	uint64_t addr;
+	uint32_t i;
+
+	pthread_mutex_lock(&emu->mutex);
+
+	/* Reuse the address range of a released region of the same size */
+	for (i = 0; i < emu->num_regions; i++) {
+		if (!emu->regions[i].buf && emu->regions[i].size == size) {
+			region = &emu->regions[i];
+			break;
+		}
+	}
+
+	if (!region) {
+		/* ICM buddies are aligned to their size */
+		addr = (emu->next_icm_addr + size - 1) & ~((uint64_t)size - 1);
+		if (emu->num_regions == DR_EMU_MAX_REGIONS ||
+		    addr + size > DR_EMU_ICM_LIMIT) {
+			errno = ENOMEM;
+			goto out_unlock;
+		}
+
+		region = &emu->regions[emu->num_regions++];
+		region->icm_addr = addr;
+		region->size = size;
+		emu->next_icm_addr = addr + size;
+	}
+
+	region->buf = calloc(1, size);
+	if (!region->buf) {
+		errno = ENOMEM;
+		goto out_unlock;
+	}
+
+	emu->stats.icm_bytes += size;
+	*key = region - emu->regions;
+	*icm_addr = region->icm_addr;
+	pthread_mutex_unlock(&emu->mutex);
+
+	return 0;
+
+out_unlock:
+	pthread_mutex_unlock(&emu->mutex);
+	return errno;
+}
+
+void dr_emu_icm_free(struct dr_emu *emu, uint32_t key)
+{
+	struct dr_emu_region *region = &emu->regions[key];
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->stats.icm_bytes -= region->size;
+	free(region->ste_map);
+	region->ste_map = NULL;
+	free(region->buf);
+	region->buf = NULL;
+	pthread_mutex_unlock(&emu->mutex);
+}
+
+void dr_emu_icm_map_ste(struct dr_emu *emu, uint32_t key, uint64_t offset,
+			struct dr_ste *ste_arr, uint32_t num_of_entries)
+{
+	struct dr_emu_region *region = &emu->regions[key];
+	uint64_t index = offset / DR_STE_SIZE;
+	uint32_t i;
+
+	pthread_mutex_lock(&emu->mutex);
+	if (!region->ste_map) {
+		if (!ste_arr)
+			goto out_unlock;
+
+		region->ste_map = calloc(region->size / DR_STE_SIZE,
+					 sizeof(*region->ste_map));
+		/* Without the map the walker just can't report the rule */
+		if (!region->ste_map)
+			goto out_unlock;
+	}
+
+	for (i = 0; i < num_of_entries; i++)
+		region->ste_map[index + i] = ste_arr ? &ste_arr[i] : NULL;
+
+out_unlock:
+	pthread_mutex_unlock(&emu->mutex);
+}
+
+int dr_emu_icm_write(struct dr_emu *emu, uint32_t key, uint64_t offset,
+		     const void *data, uint32_t length)
+{
+	struct dr_emu_region *region;
+
+	pthread_mutex_lock(&emu->mutex);
+	/* num_regions grows under the mutex as other pools allocate */
+	if (key >= emu->num_regions) {
+		pthread_mutex_unlock(&emu->mutex);
+		errno = EINVAL;
+		return errno;
+	}
+
+	region = &emu->regions[key];
+	if (!region->buf || offset + length > region->size) {
+		pthread_mutex_unlock(&emu->mutex);
+		errno = EINVAL;
+		return errno;
+	}
+
+	memcpy(region->buf + offset, data, length);
+	emu->stats.write_ops++;
+	emu->stats.write_bytes += length;
+	pthread_mutex_unlock(&emu->mutex);
+
+	return 0;
+}
+
+static struct dr_emu_region *dr_emu_find_region(struct dr_emu *emu,
+						uint64_t icm_addr)
+{
+	struct dr_emu_region *region;
+	uint32_t i;
+
+	for (i = 0; i < emu->num_regions; i++) {
+		region = &emu->regions[i];
+		if (region->buf && icm_addr >= region->icm_addr &&
+		    icm_addr < region->icm_addr + region->size)
+			return region;
+	}
+
+	return NULL;
+}
+
+static int dr_emu_build_one(struct mlx5dv_dr_domain *dmn,
+			    struct dr_ste_build *sb,
+			    enum dr_emu_builder type,
+			    bool inner, bool rx)
+{
+	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
+	struct dr_devx_caps *caps = &dmn->info.caps;
+	struct dr_match_param mask;
+
+	memset(&mask, 0xff, sizeof(mask));
+
+	switch (type) {
+	case DR_EMU_SB_ETH_L2_SRC_DST:
+		dr_ste_build_eth_l2_src_dst(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L3_IPV6_DST:
+		dr_ste_build_eth_l3_ipv6_dst(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L3_IPV6_SRC:
+		dr_ste_build_eth_l3_ipv6_src(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L3_IPV4_5_TUPLE:
+		dr_ste_build_eth_l3_ipv4_5_tuple(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L2_SRC:
+		dr_ste_build_eth_l2_src(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L2_DST:
+		dr_ste_build_eth_l2_dst(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L2_TNL:
+		dr_ste_build_eth_l2_tnl(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L3_IPV4_MISC:
+		dr_ste_build_eth_l3_ipv4_misc(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_IPV6_L3_L4:
+		dr_ste_build_eth_ipv6_l3_l4(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_MPLS:
+		dr_ste_build_mpls(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_TNL_GRE:
+		dr_ste_build_tnl_gre(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_TNL_MPLS:
+		dr_ste_build_tnl_mpls(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ICMP:
+		return dr_ste_build_icmp(ste_ctx, sb, &mask, caps, inner, rx);
+	case DR_EMU_SB_GENERAL_PURPOSE:
+		dr_ste_build_general_purpose(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_ETH_L4_MISC:
+		dr_ste_build_eth_l4_misc(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_TNL_VXLAN_GPE:
+		dr_ste_build_tnl_vxlan_gpe(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_TNL_GENEVE:
+		dr_ste_build_tnl_geneve(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_TNL_GTPU:
+		dr_ste_build_tnl_gtpu(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_REGISTER_0:
+		dr_ste_build_register_0(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_REGISTER_1:
+		dr_ste_build_register_1(ste_ctx, sb, &mask, inner, rx);
+		break;
+	case DR_EMU_SB_SRC_GVMI_QPN:
+		dr_ste_build_src_gvmi_qpn(ste_ctx, sb, &mask, caps, inner, rx);
+		break;
+	default:
+		errno = EINVAL;
+		return errno;
+	}
+
+	return 0;
+}
+
+static bool dr_emu_builder_exists(struct dr_emu *emu, struct dr_ste_build *sb)
+{
+	uint32_t i;
+
+	for (i = 0; i < emu->num_sb; i++) {
+		if (emu->sb_arr[i].lu_type == sb->lu_type &&
+		    emu->sb_arr[i].rx == sb->rx &&
+		    !memcmp(emu->sb_arr[i].bit_mask, sb->bit_mask,
+			    DR_STE_SIZE_MASK))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * The device knows how to build the tag of every lookup type from the
+ * packet, while SW steering only creates builders for what a matcher
+ * masks. Create every builder once, with all fields masked, and keep one
+ * per distinct layout.
+ */
+static int dr_emu_init_builders(struct dr_emu *emu,
+				struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_ste_build sb;
+	int type, inner, rx;
+
+	emu->sb_arr = calloc(DR_EMU_SB_MAX * 4, sizeof(*emu->sb_arr));
+	if (!emu->sb_arr) {
+		errno = ENOMEM;
+		return errno;
+	}
+
+	for (rx = 0; rx < 2; rx++) {
+		for (inner = 0; inner < 2; inner++) {
+			for (type = 0; type < DR_EMU_SB_MAX; type++) {
+				memset(&sb, 0, sizeof(sb));
+				if (dr_emu_build_one(dmn, &sb, type, inner, rx))
+					continue;
+
+				if (!dr_emu_builder_exists(emu, &sb))
+					emu->sb_arr[emu->num_sb++] = sb;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Build the packet tag the device would compute for lu_type */
+static bool dr_emu_build_tag(struct dr_emu *emu, struct dr_match_param *packet,
+			     uint16_t lu_type, bool rx, uint8_t *tag)
+{
+	uint8_t sb_tag[DR_STE_SIZE_TAG];
+	struct dr_match_param param;
+	bool found = false;
+	uint32_t i, j;
+
+	memset(tag, 0, DR_STE_SIZE_TAG);
+
+	for (i = 0; i < emu->num_sb; i++) {
+		struct dr_ste_build *sb = &emu->sb_arr[i];
+
+		if (sb->lu_type != lu_type || sb->rx != rx)
+			continue;
+
+		found = true;
+		/* Tag builders consume the fields they use */
+		param = *packet;
+		memset(sb_tag, 0, sizeof(sb_tag));
+		if (sb->ste_build_tag_func(&param, sb, sb_tag))
+			continue;
+
+		for (j = 0; j < DR_STE_SIZE_TAG; j++)
+			tag[j] |= sb_tag[j];
+	}
+
+	return found;
+}
+
+static bool dr_emu_ste_hit(uint8_t *hw_ste, uint8_t *tag)
+{
+	uint8_t *ste_tag = hw_ste + DR_STE_SIZE_CTRL;
+	uint8_t *ste_mask = ste_tag + DR_STE_SIZE_TAG;
+	int i;
+
+	for (i = 0; i < DR_STE_SIZE_TAG; i++)
+		if ((tag[i] & ste_mask[i]) != ste_tag[i])
+			return false;
+
+	return true;
+}
+
+static int dr_emu_walk(struct mlx5dv_dr_domain *dmn,
+		       struct dr_table_rx_tx *nic_tbl,
+		       struct dr_match_param *packet, bool rx,
+		       struct mlx5dv_dr_emu_match_result *result)
+{
+	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
+	uint8_t hw_ste[DR_STE_SIZE] __attribute__((aligned(8)));
+	struct dr_rule_rx_tx *nic_rule = NULL;
+	struct dr_emu *emu = dmn->emu;
+	uint8_t tag[DR_STE_SIZE_TAG];
+	struct dr_emu_region *region;
+	uint16_t next_lu_type;
+	uint16_t byte_mask;
+	uint32_t ht_size;
+	uint64_t icm_addr;
+	uint64_t offset;
+	struct dr_ste *ste;
+	uint16_t lu_type;
+	bool hashed;
+	bool hit;
+
+	/* The table start anchor is a single always-hit/miss entry */
+	icm_addr = nic_tbl->s_anchor->chunk->icm_addr;
+	next_lu_type = DR_STE_LU_TYPE_DONT_CARE;
+	byte_mask = 0;
+	ht_size = 1;
+	hashed = true;
+
+	while (result->num_lookups < DR_EMU_MAX_LOOKUPS) {
+		pthread_mutex_lock(&emu->mutex);
+		region = dr_emu_find_region(emu, icm_addr);
+		if (!region) {
+			pthread_mutex_unlock(&emu->mutex);
+			break;
+		}
+
+		if (hashed) {
+			dr_emu_build_tag(emu, packet, next_lu_type, rx, tag);
+			icm_addr += (uint64_t)DR_STE_SIZE *
+				dr_ste_calc_tag_hash_index(tag, byte_mask,
+							   ht_size ? ht_size : 1);
+		}
+
+		offset = icm_addr - region->icm_addr;
+		if (offset + DR_STE_SIZE > region->size) {
+			pthread_mutex_unlock(&emu->mutex);
+			errno = EFAULT;
+			return errno;
+		}
+
+		memcpy(hw_ste, region->buf + offset, DR_STE_SIZE);
+		/* Undo the device layout conversion done before the write */
+		dr_ste_prepare_for_postsend(ste_ctx, hw_ste, DR_STE_SIZE);
+
+		result->num_lookups++;
+		lu_type = ste_ctx->get_lu_type(hw_ste);
+
+		/* Lookup types without a tag layout (action only) always hit */
+		if (lu_type == DR_STE_LU_TYPE_DONT_CARE) {
+			memset(tag, 0, sizeof(tag));
+			hit = dr_emu_ste_hit(hw_ste, tag);
+		} else if (dr_emu_build_tag(emu, packet, lu_type, rx, tag)) {
+			hit = dr_emu_ste_hit(hw_ste, tag);
+		} else {
+			hit = true;
+		}
+
+		if (hit) {
+			ste = region->ste_map ?
+				region->ste_map[offset / DR_STE_SIZE] : NULL;
+			/* Inner STEs may carry a rule too while it's being
+			 * created, only the last one identifies it.
+			 */
+			if (ste && ste->rule_rx_tx && !ste->next_htbl)
+				nic_rule = ste->rule_rx_tx;
+
+			next_lu_type = ste_ctx->get_next_lu_type(hw_ste);
+			byte_mask = ste_ctx->get_byte_mask(hw_ste);
+			icm_addr = ste_ctx->get_hit_addr(hw_ste, &ht_size);
+		} else {
+			/* Collision entries and the next matcher aren't hashed */
+			icm_addr = ste_ctx->get_miss_addr(hw_ste);
+		}
+		hashed = hit;
+		pthread_mutex_unlock(&emu->mutex);
+	}
+
+	if (result->num_lookups == DR_EMU_MAX_LOOKUPS) {
+		errno = ELOOP;
+		return errno;
+	}
+
+	if (nic_rule)
+		result->rule = rx ?
+			container_of(nic_rule, struct mlx5dv_dr_rule, rx) :
+			container_of(nic_rule, struct mlx5dv_dr_rule, tx);
+
+	result->icm_addr = icm_addr;
+	if (icm_addr == nic_tbl->nic_dmn->drop_icm_addr)
+		result->fate = MLX5DV_DR_EMU_FATE_DROP;
+	else if (icm_addr == nic_tbl->nic_dmn->default_icm_addr)
+		result->fate = MLX5DV_DR_EMU_FATE_DEFAULT;
+	else
+		result->fate = MLX5DV_DR_EMU_FATE_OTHER;
+
+	return 0;
+}
+
+int mlx5dv_dr_table_emu_match(struct mlx5dv_dr_table *tbl, uint32_t flags,
+			      struct mlx5dv_flow_match_parameters *packet,
+			      struct mlx5dv_dr_emu_match_result *result)
+{
+	struct {
+		struct mlx5dv_flow_match_parameters hdr;
+		uint8_t buf[DEVX_ST_SZ_BYTES(dr_match_param)];
+	} value = {};
+	struct mlx5dv_dr_domain *dmn = tbl->dmn;
+	struct dr_match_param param = {};
+	struct dr_table_rx_tx *nic_tbl;
+	struct dr_emu *emu = dmn->emu;
+	bool rx;
+	int ret;
+
+	if (!dr_domain_is_emu(dmn) || dr_is_root_table(tbl)) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	if (!check_comp_mask(flags, MLX5DV_DR_EMU_MATCH_FLAGS_TX) ||
+	    packet->match_sz > sizeof(value.buf)) {
+		errno = EINVAL;
+		return errno;
+	}
+
+	switch (dmn->type) {
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
+		rx = true;
+		break;
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_TX:
+		rx = false;
+		break;
+	default:
+		rx = !(flags & MLX5DV_DR_EMU_MATCH_FLAGS_TX);
+		break;
+	}
+
+	if (!rx && dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX) {
+		errno = EINVAL;
+		return errno;
+	}
+
+	/* Short packets are zero padded, as for the rule values */
+	memcpy(value.buf, packet->match_buf, packet->match_sz);
+	value.hdr.match_sz = sizeof(value.buf);
+	dr_ste_copy_param(DR_MATCHER_CRITERIA_MAX - 1, &param, &value.hdr);
+
+	pthread_mutex_lock(&emu->mutex);
+	if (!emu->sb_arr) {
+		ret = dr_emu_init_builders(emu, dmn);
+		if (ret) {
+			pthread_mutex_unlock(&emu->mutex);
+			return ret;
+		}
+	}
+	pthread_mutex_unlock(&emu->mutex);
+
+	memset(result, 0, sizeof(*result));
+	nic_tbl = rx ? &tbl->rx : &tbl->tx;
+
+	dr_domain_nic_lock(nic_tbl->nic_dmn);
+	ret = dr_emu_walk(dmn, nic_tbl, &param, rx, result);
+	dr_domain_nic_unlock(nic_tbl->nic_dmn);
+
+	return ret;
+}
+
+int mlx5dv_dr_domain_emu_query(struct mlx5dv_dr_domain *dmn,
+			       struct mlx5dv_dr_domain_emu_stats *stats)
+{
+	if (!dr_domain_is_emu(dmn)) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	pthread_mutex_lock(&dmn->emu->mutex);
+	*stats = dmn->emu->stats;
+	pthread_mutex_unlock(&dmn->emu->mutex);
+
+	return 0;
+}
@@ -34,6 +34,9 @@
 
 #define DR_ICM_MODIFY_HDR_ALIGN_BASE	64
 #define DR_ICM_SYNC_THRESHOLD_POOL (64 * 1024 * 1024)
+#define DR_ICM_CACHE_MAX_CHUNK_SZ	DR_CHUNK_SIZE_64
+#define DR_ICM_CACHE_BATCH		8
+#define DR_ICM_CACHE_HOT		16
 
 struct dr_icm_pool {
 	enum dr_icm_type	icm_type;
@@ -43,12 +46,59 @@ struct dr_icm_pool {
 	pthread_mutex_t		mutex;
 	struct list_head	buddy_mem_list;
 	uint64_t		hot_memory_size;
+	/* chunks taken from the buddies by chunk size, includes the ones
+	 * held by the caches
+	 */
+	uint64_t		num_chunks[DR_CHUNK_SIZE_MAX];
+	/* per thread caches, see dr_icm_cache_get() */
+	bool			use_cache;
+	struct list_head	cache_list;
 };
 
+/* Small chunks are allocated and freed by a thread through its own cache,
+ * taking the pool mutex once per batch instead of once per chunk.
+ */
+struct dr_icm_cache {
+	/* cleared by dr_icm_pool_destroy(), the cache is then only freed
+	 * by its thread
+	 */
+	struct dr_icm_pool	*pool;
+	struct list_node	list_node;
+	/* the other caches of the same thread */
+	struct dr_icm_cache	*thread_next;
+	/* taken by the thread and by the pool to drain the cache, the pool
+	 * mutex is never requested while holding it
+	 */
+	pthread_mutex_t		mutex;
+	/* chunks taken from the buddies, not handed out yet */
+	struct dr_icm_chunk	*chunks[DR_ICM_CACHE_MAX_CHUNK_SZ + 1]
+				       [DR_ICM_CACHE_BATCH];
+	uint32_t		num_chunks[DR_ICM_CACHE_MAX_CHUNK_SZ + 1];
+	/* freed chunks not moved yet to the hot list of their buddy */
+	struct dr_icm_chunk	*hot_chunks[DR_ICM_CACHE_HOT];
+	uint32_t		num_hot;
+};
+
+/* One key for all the pools, its value is the list of the caches of the
+ * thread, so creating domains does not use up PTHREAD_KEYS_MAX. It is never
+ * deleted: pthread_key_delete() does not wait for a destructor that already
+ * started, and after it an exiting thread would no longer free its caches.
+ */
+static pthread_once_t dr_icm_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t dr_icm_cache_key;
+static bool dr_icm_cache_key_valid;
+/* Serializes exiting threads with dr_icm_pool_destroy(), taken before the
+ * pool mutex
+ */
+static pthread_mutex_t dr_icm_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct dr_icm_mr {
 	struct ibv_mr		*mr;
 	struct ibv_dm		*dm;
 	uint64_t		icm_start_addr;
+	/* Host memory backed ICM, see dr_emu.c */
+	struct dr_emu		*emu;
+	uint32_t		emu_key;
 };
 
 static int
@@ -119,6 +169,7 @@ dr_icm_pool_mr_create(struct dr_icm_pool *pool)
 {
 	struct ibv_alloc_dm_attr dm_attr = {};
 	struct dr_icm_mr *icm_mr;
+	size_t size;
 
 	icm_mr = calloc(1, sizeof(struct dr_icm_mr));
 	if (!icm_mr) {
@@ -126,6 +177,17 @@ dr_icm_pool_mr_create(struct dr_icm_pool *pool)
 		return NULL;
 	}
 
+	if (dr_domain_is_emu(pool->dmn)) {
+		size = dr_icm_pool_chunk_size_to_byte(pool->max_log_chunk_sz,
+						      pool->icm_type);
+		icm_mr->emu = pool->dmn->emu;
+		if (dr_emu_icm_alloc(icm_mr->emu, size, &icm_mr->emu_key,
+				     &icm_mr->icm_start_addr))
+			goto free_icm_mr;
+
+		return icm_mr;
+	}
+
 	if (dr_icm_allocate_aligned_dm(pool, icm_mr, &dm_attr))
 		goto free_icm_mr;
 
@@ -152,8 +214,12 @@ free_icm_mr:
 
 static  void dr_icm_pool_mr_destroy(struct dr_icm_mr *icm_mr)
 {
-	ibv_dereg_mr(icm_mr->mr);
-	mlx5_free_dm(icm_mr->dm);
+	if (icm_mr->emu) {
+		dr_emu_icm_free(icm_mr->emu, icm_mr->emu_key);
+	} else {
+		ibv_dereg_mr(icm_mr->mr);
+		mlx5_free_dm(icm_mr->dm);
+	}
 	free(icm_mr);
 }
 
@@ -203,11 +269,17 @@ static void dr_icm_chunk_ste_cleanup(struct dr_icm_chunk *chunk)
 static void dr_icm_chunk_destroy(struct dr_icm_chunk *chunk)
 {
 	enum dr_icm_type icm_type = get_chunk_icm_type(chunk);
+	struct dr_icm_mr *icm_mr = chunk->buddy_mem->icm_mr;
 
 	list_del(&chunk->chunk_list);
 
-	if (icm_type == DR_ICM_TYPE_STE)
+	if (icm_type == DR_ICM_TYPE_STE) {
+		if (icm_mr->emu)
+			dr_emu_icm_map_ste(icm_mr->emu, icm_mr->emu_key,
+					   chunk->mr_addr, NULL,
+					   chunk->num_of_entries);
 		dr_icm_chunk_ste_cleanup(chunk);
+	}
 
 	free(chunk);
 }
@@ -268,6 +340,7 @@ dr_icm_chunk_create(struct dr_icm_pool *pool,
 		    struct dr_icm_buddy_mem *buddy_mem_pool,
 		    int seg)
 {
+	struct dr_icm_mr *icm_mr = buddy_mem_pool->icm_mr;
 	struct dr_icm_chunk *chunk;
 	int offset;
 
@@ -279,9 +352,14 @@ dr_icm_chunk_create(struct dr_icm_pool *pool,
 
 	offset = dr_icm_pool_dm_type_to_entry_size(pool->icm_type) * seg;
 
-	chunk->rkey = buddy_mem_pool->icm_mr->mr->rkey;
-	chunk->mr_addr = (uintptr_t)buddy_mem_pool->icm_mr->mr->addr + offset;
-	chunk->icm_addr = (uintptr_t)buddy_mem_pool->icm_mr->icm_start_addr + offset;
+	if (icm_mr->emu) {
+		chunk->rkey = icm_mr->emu_key;
+		chunk->mr_addr = offset;
+	} else {
+		chunk->rkey = icm_mr->mr->rkey;
+		chunk->mr_addr = (uintptr_t)icm_mr->mr->addr + offset;
+	}
+	chunk->icm_addr = (uintptr_t)icm_mr->icm_start_addr + offset;
 	chunk->num_of_entries = dr_icm_pool_chunk_size_to_entries(chunk_size);
 	chunk->byte_size = dr_icm_pool_chunk_size_to_byte(chunk_size, pool->icm_type);
 	chunk->seg = seg;
@@ -292,7 +370,12 @@ dr_icm_chunk_create(struct dr_icm_pool *pool,
 		goto out_free_chunk;
 	}
 
+	if (pool->icm_type == DR_ICM_TYPE_STE && icm_mr->emu)
+		dr_emu_icm_map_ste(icm_mr->emu, icm_mr->emu_key, offset,
+				   chunk->ste_arr, chunk->num_of_entries);
+
 	buddy_mem_pool->used_memory += chunk->byte_size;
+	pool->num_chunks[chunk_size]++;
 	chunk->buddy_mem = buddy_mem_pool;
 	list_node_init(&chunk->chunk_list);
 
@@ -306,6 +389,47 @@ out_free_chunk:
 	return NULL;
 }
 
+/* Move the memory to the waiting list AKA "hot", called with the pool locked */
+static void dr_icm_chunk_set_hot(struct dr_icm_chunk *chunk)
+{
+	struct dr_icm_buddy_mem *buddy = chunk->buddy_mem;
+
+	list_del_init(&chunk->chunk_list);
+	list_add_tail(&buddy->hot_list, &chunk->chunk_list);
+	buddy->pool->hot_memory_size += chunk->byte_size;
+	buddy->pool->num_chunks[ilog32(chunk->num_of_entries - 1)]--;
+}
+
+/* Give back a chunk that was never handed out, called with the pool locked */
+static void dr_icm_chunk_put(struct dr_icm_chunk *chunk)
+{
+	struct dr_icm_buddy_mem *buddy = chunk->buddy_mem;
+	int order = ilog32(chunk->num_of_entries - 1);
+
+	dr_buddy_free_mem(buddy, chunk->seg, order);
+	buddy->used_memory -= chunk->byte_size;
+	buddy->pool->num_chunks[order]--;
+	dr_icm_chunk_destroy(chunk);
+}
+
+/* Called with the pool locked */
+static void dr_icm_cache_drain(struct dr_icm_cache *cache, bool put_chunks)
+{
+	int i, j;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (i = 0; i < cache->num_hot; i++)
+		dr_icm_chunk_set_hot(cache->hot_chunks[i]);
+	cache->num_hot = 0;
+
+	for (i = 0; put_chunks && i <= DR_ICM_CACHE_MAX_CHUNK_SZ; i++) {
+		for (j = 0; j < cache->num_chunks[i]; j++)
+			dr_icm_chunk_put(cache->chunks[i][j]);
+		cache->num_chunks[i] = 0;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
 static bool dr_icm_pool_is_sync_required(struct dr_icm_pool *pool)
 {
 	if (pool->hot_memory_size > DR_ICM_SYNC_THRESHOLD_POOL)
@@ -316,15 +440,32 @@ static bool dr_icm_pool_is_sync_required(struct dr_icm_pool *pool)
 
 static int dr_icm_pool_sync_pool_buddies(struct dr_icm_pool *pool)
 {
+	bool reclaim = pool->dmn->flags & DR_DOMAIN_FLAG_MEMORY_RECLAIM;
 	struct dr_icm_buddy_mem *buddy, *tmp_buddy;
+	struct dr_icm_cache *cache;
 	int err;
 
-	err = dr_devx_sync_steering(pool->dmn->ctx);
+	/* Freed chunks held by the caches are synced as well, with memory
+	 * reclaim the unused ones are given back so buddies can empty.
+	 */
+	list_for_each(&pool->cache_list, cache, list_node)
+		dr_icm_cache_drain(cache, reclaim);
+
+	/* Writes to the freed chunks may still be pending on other rings */
+	err = dr_send_ring_order_writes(pool->dmn);
 	if (err) {
-		dr_dbg(pool->dmn, "Failed devx sync hw\n");
+		dr_dbg(pool->dmn, "Failed draining send rings\n");
 		return err;
 	}
 
+	if (!dr_domain_is_emu(pool->dmn)) {
+		err = dr_devx_sync_steering(pool->dmn->ctx);
+		if (err) {
+			dr_dbg(pool->dmn, "Failed devx sync hw\n");
+			return err;
+		}
+	}
+
 	list_for_each_safe(&pool->buddy_mem_list, buddy, tmp_buddy, list_node) {
 		struct dr_icm_chunk *chunk, *tmp_chunk;
 
@@ -336,8 +477,7 @@ static int dr_icm_pool_sync_pool_buddies(struct dr_icm_pool *pool)
 			dr_icm_chunk_destroy(chunk);
 		}
 
-		if ((pool->dmn->flags & DR_DOMAIN_FLAG_MEMORY_RECLAIM) &&
-		    !buddy->used_memory)
+		if (reclaim && !buddy->used_memory)
 			dr_icm_buddy_destroy(buddy);
 	}
 
@@ -397,56 +537,245 @@ out:
 	return err;
 }
 
+/* Called with the pool locked */
+static struct dr_icm_chunk *
+dr_icm_pool_alloc_chunk(struct dr_icm_pool *pool,
+			enum dr_icm_chunk_size chunk_size)
+{
+	struct dr_icm_buddy_mem *buddy;
+	struct dr_icm_chunk *chunk;
+	int seg;
+
+	/* find mem, get back the relevant buddy pool and seg in that mem */
+	if (dr_icm_handle_buddies_get_mem(pool, chunk_size, &buddy, &seg))
+		return NULL;
+
+	chunk = dr_icm_chunk_create(pool, chunk_size, buddy, seg);
+	if (!chunk)
+		dr_buddy_free_mem(buddy, seg, chunk_size);
+
+	return chunk;
+}
+
+static void dr_icm_cache_free(struct dr_icm_cache *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache);
+}
+
+/* pthread key destructor, runs when a thread that used any pool exits */
+static void dr_icm_cache_destroy(void *data)
+{
+	struct dr_icm_cache *cache = data, *next;
+	struct dr_icm_pool *pool;
+
+	pthread_mutex_lock(&dr_icm_cache_lock);
+	for (; cache; cache = next) {
+		next = cache->thread_next;
+		pool = cache->pool;
+		if (pool) {
+			pthread_mutex_lock(&pool->mutex);
+			dr_icm_cache_drain(cache, true);
+			list_del(&cache->list_node);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+		dr_icm_cache_free(cache);
+	}
+	pthread_mutex_unlock(&dr_icm_cache_lock);
+}
+
+static void dr_icm_cache_key_init(void)
+{
+	dr_icm_cache_key_valid = !pthread_key_create(&dr_icm_cache_key,
+						     dr_icm_cache_destroy);
+}
+
+static struct dr_icm_cache *dr_icm_cache_get(struct dr_icm_pool *pool)
+{
+	struct dr_icm_cache *head, *cache, **prev;
+
+	head = pthread_getspecific(dr_icm_cache_key);
+	for (cache = head; cache; cache = cache->thread_next)
+		if (__atomic_load_n(&cache->pool, __ATOMIC_RELAXED) == pool)
+			return cache;
+
+	/* On failure the thread works directly on the pool */
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->pool = pool;
+	cache->thread_next = head;
+	pthread_mutex_init(&cache->mutex, NULL);
+
+	if (pthread_setspecific(dr_icm_cache_key, cache)) {
+		dr_icm_cache_free(cache);
+		return NULL;
+	}
+
+	/* Free the caches of the pools destroyed since, they are no longer
+	 * reachable by anyone else
+	 */
+	prev = &cache->thread_next;
+	while ((head = *prev)) {
+		if (__atomic_load_n(&head->pool, __ATOMIC_RELAXED)) {
+			prev = &head->thread_next;
+			continue;
+		}
+		*prev = head->thread_next;
+		dr_icm_cache_free(head);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	list_add_tail(&pool->cache_list, &cache->list_node);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return cache;
+}
+
+static struct dr_icm_chunk *
+dr_icm_cache_alloc_chunk(struct dr_icm_cache *cache,
+			 enum dr_icm_chunk_size chunk_size)
+{
+	struct dr_icm_chunk *chunks[DR_ICM_CACHE_BATCH];
+	struct dr_icm_pool *pool = cache->pool;
+	int i, num_chunks;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (cache->num_chunks[chunk_size]) {
+		i = --cache->num_chunks[chunk_size];
+		pthread_mutex_unlock(&cache->mutex);
+		return cache->chunks[chunk_size][i];
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	/* Refill the cache, a partial batch is fine */
+	pthread_mutex_lock(&pool->mutex);
+	for (num_chunks = 0; num_chunks < DR_ICM_CACHE_BATCH; num_chunks++) {
+		chunks[num_chunks] = dr_icm_pool_alloc_chunk(pool, chunk_size);
+		if (!chunks[num_chunks])
+			break;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!num_chunks)
+		return NULL;
+
+	/* Only this thread adds chunks, the cache is still empty */
+	pthread_mutex_lock(&cache->mutex);
+	for (i = 1; i < num_chunks; i++)
+		cache->chunks[chunk_size][i - 1] = chunks[i];
+	cache->num_chunks[chunk_size] = num_chunks - 1;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return chunks[0];
+}
+
+static void dr_icm_cache_free_chunk(struct dr_icm_cache *cache,
+				    struct dr_icm_chunk *chunk)
+{
+	struct dr_icm_chunk *hot_chunks[DR_ICM_CACHE_HOT];
+	struct dr_icm_pool *pool = cache->pool;
+	int i;
+
+	pthread_mutex_lock(&cache->mutex);
+	cache->hot_chunks[cache->num_hot++] = chunk;
+	if (cache->num_hot < DR_ICM_CACHE_HOT) {
+		pthread_mutex_unlock(&cache->mutex);
+		return;
+	}
+
+	memcpy(hot_chunks, cache->hot_chunks, sizeof(hot_chunks));
+	cache->num_hot = 0;
+	pthread_mutex_unlock(&cache->mutex);
+
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < DR_ICM_CACHE_HOT; i++)
+		dr_icm_chunk_set_hot(hot_chunks[i]);
+
+	if (dr_icm_pool_is_sync_required(pool))
+		dr_icm_pool_sync_pool_buddies(pool);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
 /* Allocate an ICM chunk, each chunk holds a piece of ICM memory and
  * also memory used for HW STE management for optimisations.
  */
 struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
 					enum dr_icm_chunk_size chunk_size)
 {
-	struct dr_icm_buddy_mem *buddy;
-	struct dr_icm_chunk *chunk = NULL;
-	int ret;
-	int seg;
+	struct dr_icm_cache *cache;
+	struct dr_icm_chunk *chunk;
 
 	if (chunk_size > pool->max_log_chunk_sz) {
 		errno = EINVAL;
 		return NULL;
 	}
 
-	pthread_mutex_lock(&pool->mutex);
-	/* find mem, get back the relevant buddy pool and seg in that mem */
-	ret = dr_icm_handle_buddies_get_mem(pool, chunk_size, &buddy, &seg);
-	if (ret)
-		goto out;
-
-	chunk = dr_icm_chunk_create(pool, chunk_size, buddy, seg);
-	if (!chunk)
-		goto out_err;
-
-	goto out;
+	if (pool->use_cache && chunk_size <= DR_ICM_CACHE_MAX_CHUNK_SZ) {
+		cache = dr_icm_cache_get(pool);
+		if (cache)
+			return dr_icm_cache_alloc_chunk(cache, chunk_size);
+	}
 
-out_err:
-	dr_buddy_free_mem(buddy, seg, chunk_size);
-out:
+	pthread_mutex_lock(&pool->mutex);
+	chunk = dr_icm_pool_alloc_chunk(pool, chunk_size);
 	pthread_mutex_unlock(&pool->mutex);
+
 	return chunk;
 }
 
 void dr_icm_free_chunk(struct dr_icm_chunk *chunk)
 {
-	struct dr_icm_buddy_mem *buddy = chunk->buddy_mem;
+	struct dr_icm_pool *pool = chunk->buddy_mem->pool;
+	struct dr_icm_cache *cache;
+
+	if (pool->use_cache &&
+	    chunk->num_of_entries <= 1 << DR_ICM_CACHE_MAX_CHUNK_SZ) {
+		cache = dr_icm_cache_get(pool);
+		if (cache) {
+			dr_icm_cache_free_chunk(cache, chunk);
+			return;
+		}
+	}
 
-	/* move the memory to the waiting list AKA "hot" */
-	pthread_mutex_lock(&buddy->pool->mutex);
-	list_del_init(&chunk->chunk_list);
-	list_add_tail(&buddy->hot_list, &chunk->chunk_list);
-	buddy->pool->hot_memory_size += chunk->byte_size;
+	pthread_mutex_lock(&pool->mutex);
+	dr_icm_chunk_set_hot(chunk);
 
 	/* Check if we have chunks that are waiting for sync-ste */
-	if (dr_icm_pool_is_sync_required(buddy->pool))
-		dr_icm_pool_sync_pool_buddies(buddy->pool);
+	if (dr_icm_pool_is_sync_required(pool))
+		dr_icm_pool_sync_pool_buddies(pool);
 
-	pthread_mutex_unlock(&buddy->pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void dr_icm_pool_query(struct dr_icm_pool *pool,
+		       struct dr_icm_pool_stats *stats)
+{
+	uint32_t entry_size = dr_icm_pool_dm_type_to_entry_size(pool->icm_type);
+	struct dr_icm_buddy_mem *buddy;
+	struct dr_icm_cache *cache;
+	struct dr_icm_chunk *chunk;
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	stats->total_bytes = 0;
+	list_for_each(&pool->buddy_mem_list, buddy, list_node)
+		stats->total_bytes += (uint64_t)entry_size << buddy->max_order;
+	memcpy(stats->num_chunks, pool->num_chunks, sizeof(stats->num_chunks));
+
+	/* Chunks held by the caches are not in use */
+	list_for_each(&pool->cache_list, cache, list_node) {
+		pthread_mutex_lock(&cache->mutex);
+		for (i = 0; i <= DR_ICM_CACHE_MAX_CHUNK_SZ; i++)
+			stats->num_chunks[i] -= cache->num_chunks[i];
+		for (i = 0; i < cache->num_hot; i++) {
+			chunk = cache->hot_chunks[i];
+			stats->num_chunks[ilog32(chunk->num_of_entries - 1)]--;
+		}
+		pthread_mutex_unlock(&cache->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
 }
 
 struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
@@ -471,15 +800,33 @@ struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
 	pool->max_log_chunk_sz = max_log_chunk_sz;
 
 	list_head_init(&pool->buddy_mem_list);
+	list_head_init(&pool->cache_list);
 
 	pthread_mutex_init(&pool->mutex, NULL);
 
+	/* Without a key every allocation goes to the pool */
+	pool->use_cache = !pthread_once(&dr_icm_cache_once,
+					dr_icm_cache_key_init) &&
+			  dr_icm_cache_key_valid;
+
 	return pool;
 }
 
 void dr_icm_pool_destroy(struct dr_icm_pool *pool)
 {
 	struct dr_icm_buddy_mem *buddy, *tmp_buddy;
+	struct dr_icm_cache *cache, *tmp_cache;
+
+	/* A thread exiting now either drains its cache first, or finds it
+	 * detached from the pool and only frees it
+	 */
+	pthread_mutex_lock(&dr_icm_cache_lock);
+	list_for_each_safe(&pool->cache_list, cache, tmp_cache, list_node) {
+		dr_icm_cache_drain(cache, true);
+		list_del(&cache->list_node);
+		__atomic_store_n(&cache->pool, NULL, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&dr_icm_cache_lock);
 
 	list_for_each_safe(&pool->buddy_mem_list, buddy, tmp_buddy, list_node)
 		dr_icm_buddy_destroy(buddy);
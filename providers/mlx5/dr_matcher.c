@@ -497,7 +497,7 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 	}
 	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn,
 					    curr_nic_matcher->e_anchor,
-					    &info, info.type == CONNECT_HIT);
+					    &info, info.type == CONNECT_HIT, 0);
 	if (ret)
 		return ret;
 
@@ -506,7 +506,7 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 	info.miss_icm_addr = curr_nic_matcher->e_anchor->chunk->icm_addr;
 	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn,
 					    curr_nic_matcher->s_htbl,
-					    &info, false);
+					    &info, false, 0);
 	if (ret)
 		return ret;
 
@@ -519,7 +519,7 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 	info.type = CONNECT_HIT;
 	info.hit_next_htbl = curr_nic_matcher->s_htbl;
 	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn, prev_htbl,
-					    &info, true);
+					    &info, true, 0);
 	if (ret)
 		return ret;
 
@@ -562,6 +562,11 @@ static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 					 struct mlx5dv_dr_matcher,
 					 matcher_list);
 
+	/* The anchors are also written by rehash of the neighbour matchers */
+	ret = dr_send_ring_order_writes(dmn);
+	if (ret)
+		return ret;
+
 	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
 	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX) {
 		ret = dr_matcher_connect(dmn, &matcher->rx,
@@ -580,6 +585,11 @@ static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 			return ret;
 	}
 
+	/* Rules of the matcher and its neighbours use the other rings */
+	ret = dr_send_ring_order_writes(dmn);
+	if (ret)
+		return ret;
+
 	if (prev_matcher)
 		list_add_after(&tbl->matcher_list,
 			       &prev_matcher->matcher_list,
@@ -596,6 +606,9 @@ static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 
 static void dr_matcher_uninit_nic(struct dr_matcher_rx_tx *nic_matcher)
 {
+	if (nic_matcher->s_htbl->rehash)
+		dr_rule_rehash_release(nic_matcher->s_htbl->rehash, true);
+
 	dr_htbl_put(nic_matcher->s_htbl);
 	dr_htbl_put(nic_matcher->e_anchor);
 }
@@ -789,9 +802,13 @@ mlx5dv_dr_matcher_create(struct mlx5dv_dr_table *tbl,
 	atomic_init(&matcher->refcount, 1);
 	list_node_init(&matcher->matcher_list);
 	list_head_init(&matcher->rule_list);
+	pthread_mutex_init(&matcher->mutex, NULL);
 
 	dr_domain_lock(tbl->dmn);
 
+	if (!dr_is_root_table(tbl))
+		matcher->ring_idx = dr_send_ring_select(tbl->dmn);
+
 	ret = dr_matcher_init(matcher, mask);
 	if (ret)
 		goto free_matcher;
@@ -808,6 +825,7 @@ matcher_uninit:
 	dr_matcher_uninit(matcher);
 free_matcher:
 	dr_domain_unlock(tbl->dmn);
+	pthread_mutex_destroy(&matcher->mutex);
 	free(matcher);
 dec_ref:
 	atomic_fetch_sub(&tbl->refcount, 1);
@@ -841,7 +859,7 @@ static int dr_matcher_disconnect(struct mlx5dv_dr_domain *dmn,
 	}
 
 	return dr_ste_htbl_init_and_postsend(dmn, nic_dmn, prev_anchor,
-					     &info, true);
+					     &info, true, 0);
 }
 
 static int dr_matcher_remove_from_tbl(struct mlx5dv_dr_matcher *matcher)
@@ -857,6 +875,11 @@ static int dr_matcher_remove_from_tbl(struct mlx5dv_dr_matcher *matcher)
 	prev_matcher = list_prev(&tbl->matcher_list, matcher, matcher_list);
 	next_matcher = list_next(&tbl->matcher_list, matcher, matcher_list);
 
+	/* Same as on connect, order the anchor writes with the other rings */
+	ret = dr_send_ring_order_writes(dmn);
+	if (ret)
+		return ret;
+
 	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
 	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX) {
 		ret = dr_matcher_disconnect(dmn, &tbl->rx,
@@ -875,6 +898,10 @@ static int dr_matcher_remove_from_tbl(struct mlx5dv_dr_matcher *matcher)
 			return ret;
 	}
 
+	ret = dr_send_ring_order_writes(dmn);
+	if (ret)
+		return ret;
+
 	list_del(&matcher->matcher_list);
 
 	return 0;
@@ -895,7 +922,181 @@ int mlx5dv_dr_matcher_destroy(struct mlx5dv_dr_matcher *matcher)
 
 	dr_domain_unlock(tbl->dmn);
 
+	pthread_mutex_destroy(&matcher->mutex);
 	free(matcher);
 
 	return 0;
 }
+
+static int dr_matcher_set_layout_nic(struct mlx5dv_dr_matcher *matcher,
+				     struct dr_matcher_rx_tx *nic_matcher,
+				     struct mlx5dv_dr_matcher_layout *layout)
+{
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	struct dr_ste_htbl *cur_htbl = nic_matcher->s_htbl;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	enum dr_icm_chunk_size chunk_size = DR_CHUNK_SIZE_1;
+	struct dr_htbl_connect_info info;
+	struct dr_ste_htbl *prev_htbl;
+	struct dr_ste_htbl *new_htbl;
+	int ret;
+
+	if (layout->flags & MLX5DV_DR_MATCHER_LAYOUT_NUM_RULE) {
+		chunk_size = min_t(uint32_t, layout->log_num_of_rules_hint,
+				   dmn->info.max_log_sw_icm_sz);
+		chunk_size = min_t(uint32_t, chunk_size, DR_CHUNK_SIZE_MAX - 1);
+	}
+
+	new_htbl = dr_ste_htbl_alloc(dmn->ste_icm_pool,
+				     chunk_size,
+				     cur_htbl->lu_type,
+				     cur_htbl->byte_mask);
+	if (!new_htbl)
+		return errno;
+
+	if (!(layout->flags & MLX5DV_DR_MATCHER_LAYOUT_RESIZABLE))
+		new_htbl->ctrl.may_grow = false;
+
+	info.type = CONNECT_MISS;
+	info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
+	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn, new_htbl,
+					    &info, false, 0);
+	if (ret)
+		goto free_htbl;
+
+	/* Replace the start table on the anchor pointing to it */
+	prev_htbl = cur_htbl->pointing_ste->htbl;
+	info.type = CONNECT_HIT;
+	info.hit_next_htbl = new_htbl;
+	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn, prev_htbl,
+					    &info, true, 0);
+	if (ret)
+		goto free_htbl;
+
+	new_htbl->pointing_ste = prev_htbl->ste_arr;
+	prev_htbl->ste_arr[0].next_htbl = new_htbl;
+
+	if (cur_htbl->rehash)
+		dr_rule_rehash_release(cur_htbl->rehash, true);
+
+	dr_htbl_get(new_htbl);
+	dr_htbl_put(cur_htbl);
+	nic_matcher->s_htbl = new_htbl;
+
+	return 0;
+
+free_htbl:
+	dr_ste_htbl_free(new_htbl);
+	return ret;
+}
+
+int mlx5dv_dr_matcher_set_layout(struct mlx5dv_dr_matcher *matcher,
+				 struct mlx5dv_dr_matcher_layout *layout)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	int ret;
+
+	if (layout->flags & ~(MLX5DV_DR_MATCHER_LAYOUT_RESIZABLE |
+			      MLX5DV_DR_MATCHER_LAYOUT_NUM_RULE)) {
+		errno = EINVAL;
+		return errno;
+	}
+
+	if (dr_is_root_table(matcher->tbl)) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	dr_domain_lock(dmn);
+
+	/* The start tables are replaced, they must be empty */
+	if (!list_empty(&matcher->rule_list)) {
+		errno = EBUSY;
+		ret = errno;
+		goto out_unlock;
+	}
+
+	/* Rules removed from the matcher may still be written on its ring */
+	ret = dr_send_ring_order_writes(dmn);
+	if (ret)
+		goto out_unlock;
+
+	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
+	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX) {
+		ret = dr_matcher_set_layout_nic(matcher, &matcher->rx, layout);
+		if (ret)
+			goto out_unlock;
+	}
+
+	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
+	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_TX) {
+		ret = dr_matcher_set_layout_nic(matcher, &matcher->tx, layout);
+		if (ret)
+			goto out_unlock;
+	}
+
+	/* New rules are written on the matcher ring */
+	ret = dr_send_ring_order_writes(dmn);
+
+out_unlock:
+	dr_domain_unlock(dmn);
+	return ret;
+}
+
+static void dr_matcher_query_stats_nic(struct dr_matcher_rx_tx *nic_matcher,
+				       struct mlx5dv_dr_matcher_stats *stats)
+{
+	struct dr_matcher_stats *nic_stats = &nic_matcher->stats;
+	struct dr_ste_htbl *s_htbl = nic_matcher->s_htbl;
+	int i;
+
+	/* Report the bigger of the FDB rx and tx tables */
+	if (s_htbl->chunk_size >= stats->log_htbl_size) {
+		stats->log_htbl_size = s_htbl->chunk_size;
+		stats->htbl_valid_entries = s_htbl->ctrl.num_of_valid_entries;
+		stats->htbl_collisions = s_htbl->ctrl.num_of_collisions;
+	}
+	stats->num_collisions += nic_stats->num_collisions;
+	for (i = 0; i < MLX5DV_DR_MISS_LIST_LEN_HIST; i++)
+		stats->miss_list_len[i] += nic_stats->miss_list_len[i];
+	stats->max_miss_list_len = max(stats->max_miss_list_len,
+				       nic_stats->max_miss_list_len);
+	stats->num_rehash += nic_stats->num_rehash;
+	stats->rehash_time_ns += nic_stats->rehash_time_ns;
+	stats->max_rehash_time_ns = max(stats->max_rehash_time_ns,
+					nic_stats->max_rehash_time_ns);
+}
+
+/* Called with the matcher or the whole domain locked */
+void dr_matcher_query_stats(struct mlx5dv_dr_matcher *matcher,
+			    struct mlx5dv_dr_matcher_stats *stats)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+
+	memset(stats, 0, sizeof(*stats));
+	/* Each rule holds a reference on its matcher */
+	stats->num_rules = atomic_load(&matcher->refcount) - 1;
+
+	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
+	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+		dr_matcher_query_stats_nic(&matcher->rx, stats);
+
+	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
+	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_TX)
+		dr_matcher_query_stats_nic(&matcher->tx, stats);
+}
+
+int mlx5dv_dr_matcher_query_stats(struct mlx5dv_dr_matcher *matcher,
+				  struct mlx5dv_dr_matcher_stats *stats)
+{
+	if (dr_is_root_table(matcher->tbl)) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	dr_matcher_lock(matcher);
+	dr_matcher_query_stats(matcher, stats);
+	dr_matcher_unlock(matcher);
+
+	return 0;
+}
@@ -31,10 +31,43 @@
  */
 
 #include <stdlib.h>
+#include <ccan/array_size.h>
 #include <ccan/minmax.h>
 #include "mlx5dv_dr.h"
 
 #define DR_RULE_MAX_STE_CHAIN (DR_RULE_MAX_STES + DR_ACTION_MAX_STES)
+/* Pending STE writes after which a bulk insertion flushes to HW */
+#define DR_RULE_BULK_MAX_PENDING 4096
+/* A table range is rewritten only if at least 1/8 of it was updated */
+#define DR_RULE_BULK_MAX_SPARSE 8
+#define DR_RULE_BULK_NO_COALESCE UINT8_MAX
+/*
+ * Work an incremental rehash does per insertion to its table: entries of
+ * the new table formatted, then old buckets migrated. Smaller steps keep
+ * the worst insertion latency down but tax more insertions.
+ */
+#define DR_RULE_REHASH_FORMAT_STES 256
+#define DR_RULE_REHASH_MIGRATE_BUCKETS 16
+
+struct dr_rule_bulk_nic {
+	struct mlx5dv_dr_matcher *matcher;
+	struct dr_matcher_rx_tx	*nic_matcher;
+	uint8_t			ring_idx;
+	/* STE writes in the order they would have been sent */
+	struct list_head	send_list;
+	uint32_t		num_pending;
+	/* Action STEs replaced by a modify, released once the batch is sent */
+	struct dr_ste		**put_arr;
+	uint32_t		num_put;
+	uint32_t		max_put;
+};
+
+struct dr_rule_bulk_htbl {
+	struct dr_ste_htbl	*htbl;
+	uint32_t		first;
+	uint32_t		last;
+	uint8_t			ste_location;
+};
 
 static int dr_rule_append_to_miss_list(struct dr_ste_ctx *ste_ctx,
 				       struct dr_ste *new_last_ste,
@@ -128,13 +161,8 @@ free_tbl:
 	return NULL;
 }
 
-static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_info,
-						 struct mlx5dv_dr_domain *dmn)
+static void dr_rule_update_hw_ste(struct dr_ste_send_info *ste_info)
 {
-	int ret;
-
-	list_del(&ste_info->send_list);
-
 	/* Copy data to ste, only reduced size or control, the last 16B (mask)
 	 * is already written to the hw.
 	 */
@@ -142,9 +170,19 @@ static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_in
 		memcpy(ste_info->ste->hw_ste, ste_info->data, DR_STE_SIZE_CTRL);
 	else
 		memcpy(ste_info->ste->hw_ste, ste_info->data, DR_STE_SIZE_REDUCED);
+}
+
+static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_info,
+						 struct mlx5dv_dr_domain *dmn,
+						 uint8_t ring_idx)
+{
+	int ret;
+
+	list_del(&ste_info->send_list);
+	dr_rule_update_hw_ste(ste_info);
 
 	ret = dr_send_postsend_ste(dmn, ste_info->ste, ste_info->data,
-				   ste_info->size, ste_info->offset);
+				   ste_info->size, ste_info->offset, ring_idx);
 	if (ret)
 		goto out;
 
@@ -155,7 +193,8 @@ out:
 
 static int dr_rule_send_update_list(struct list_head *send_ste_list,
 				    struct mlx5dv_dr_domain *dmn,
-				    bool is_reverse)
+				    bool is_reverse,
+				    uint8_t ring_idx)
 {
 	struct dr_ste_send_info *ste_info, *tmp_ste_info;
 	int ret;
@@ -164,7 +203,8 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 		list_for_each_rev_safe(send_ste_list, ste_info, tmp_ste_info,
 				       send_list) {
 			ret = dr_rule_handle_one_ste_in_update_list(ste_info,
-								    dmn);
+								    dmn,
+								    ring_idx);
 			if (ret)
 				return ret;
 		}
@@ -172,7 +212,8 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 		list_for_each_safe(send_ste_list, ste_info, tmp_ste_info,
 				   send_list) {
 			ret = dr_rule_handle_one_ste_in_update_list(ste_info,
-								    dmn);
+								    dmn,
+								    ring_idx);
 			if (ret)
 				return ret;
 		}
@@ -181,15 +222,271 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 	return 0;
 }
 
+static void dr_rule_bulk_init(struct dr_rule_bulk_nic *bulk,
+			      struct mlx5dv_dr_matcher *matcher,
+			      struct dr_matcher_rx_tx *nic_matcher)
+{
+	bulk->matcher = matcher;
+	bulk->nic_matcher = nic_matcher;
+	bulk->ring_idx = matcher->ring_idx;
+	list_head_init(&bulk->send_list);
+	bulk->num_pending = 0;
+	bulk->put_arr = NULL;
+	bulk->num_put = 0;
+	bulk->max_put = 0;
+}
+
+/*
+ * Queue the STE updates of a rule instead of sending them. The SW copy is
+ * updated right away, in the same order dr_rule_send_update_list() would,
+ * so the rest of the insertion logic sees no difference.
+ */
+static void dr_rule_bulk_append(struct dr_rule_bulk_nic *bulk,
+				struct list_head *send_ste_list)
+{
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+
+	list_for_each_rev_safe(send_ste_list, ste_info, tmp_ste_info,
+			       send_list) {
+		list_del(&ste_info->send_list);
+		dr_rule_update_hw_ste(ste_info);
+
+		/* The data may point to the caller stack */
+		if (ste_info->data != ste_info->data_cont) {
+			memcpy(ste_info->data_cont, ste_info->data,
+			       ste_info->size);
+			ste_info->data = ste_info->data_cont;
+		}
+
+		list_add_tail(&bulk->send_list, &ste_info->send_list);
+		bulk->num_pending++;
+	}
+}
+
+static int dr_rule_bulk_cmp_ste_info(const void *a, const void *b)
+{
+	const struct dr_ste_send_info *ia = *(struct dr_ste_send_info **)a;
+	const struct dr_ste_send_info *ib = *(struct dr_ste_send_info **)b;
+
+	if (ia->ste->htbl != ib->ste->htbl)
+		return ia->ste->htbl < ib->ste->htbl ? -1 : 1;
+
+	if (ia->ste != ib->ste)
+		return ia->ste < ib->ste ? -1 : 1;
+
+	return 0;
+}
+
+static int dr_rule_bulk_cmp_htbl(const void *a, const void *b)
+{
+	const struct dr_rule_bulk_htbl *ha = a;
+	const struct dr_rule_bulk_htbl *hb = b;
+
+	/* Deeper tables first, so nothing points to an unwritten STE */
+	return hb->ste_location - ha->ste_location;
+}
+
+/*
+ * Find the hash tables for which rewriting the updated range takes fewer
+ * postsends than the single STE updates. Their updates are marked by
+ * clearing size and the tables are returned in htbl_arr. info_arr is
+ * sorted in place, the send order is kept by the bulk send_list.
+ */
+static int dr_rule_bulk_coalesce(struct mlx5dv_dr_domain *dmn,
+				 struct dr_rule_bulk_nic *bulk,
+				 struct dr_ste_send_info **info_arr,
+				 struct dr_rule_bulk_htbl *htbl_arr,
+				 uint8_t from_location)
+{
+	uint32_t max_stes = dmn->send_ring[0]->max_post_send_size / DR_STE_SIZE;
+	struct dr_ste_send_info **sorted = info_arr;
+	struct dr_ste_htbl *htbl;
+	uint32_t first, last, num_stes, range;
+	uint8_t ste_location;
+	int num_htbls = 0;
+	uint32_t i, j, k;
+
+	qsort(sorted, bulk->num_pending, sizeof(*sorted),
+	      dr_rule_bulk_cmp_ste_info);
+
+	for (i = 0; i < bulk->num_pending; i = j) {
+		htbl = sorted[i]->ste->htbl;
+		ste_location = sorted[i]->ste->ste_chain_location;
+		first = sorted[i]->ste - htbl->ste_arr;
+		num_stes = 0;
+
+		for (j = i; j < bulk->num_pending &&
+		     sorted[j]->ste->htbl == htbl; j++)
+			if (j == i || sorted[j]->ste != sorted[j - 1]->ste)
+				num_stes++;
+
+		last = sorted[j - 1]->ste - htbl->ste_arr;
+		range = last - first + 1;
+
+		/*
+		 * Collision and action STEs live in single entry tables, the
+		 * free entries of a table being rehashed may miss to the old
+		 * table instead of the end anchor.
+		 */
+		if (htbl->chunk->num_of_entries == 1 || htbl->rehash ||
+		    ste_location < from_location ||
+		    ste_location > bulk->nic_matcher->num_of_builders)
+			continue;
+
+		if (DIV_ROUND_UP(range, max_stes) >= j - i ||
+		    range > num_stes * DR_RULE_BULK_MAX_SPARSE)
+			continue;
+
+		for (k = i; k < j; k++)
+			sorted[k]->size = 0;
+
+		htbl_arr[num_htbls].htbl = htbl;
+		htbl_arr[num_htbls].first = first;
+		htbl_arr[num_htbls].last = last;
+		htbl_arr[num_htbls].ste_location = ste_location;
+		num_htbls++;
+	}
+
+	qsort(htbl_arr, num_htbls, sizeof(*htbl_arr), dr_rule_bulk_cmp_htbl);
+	return num_htbls;
+}
+
+static int dr_rule_bulk_write_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_rule_bulk_nic *bulk,
+				   struct dr_rule_bulk_htbl *bulk_htbl)
+{
+	struct dr_matcher_rx_tx *nic_matcher = bulk->nic_matcher;
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	uint8_t formated_ste[DR_STE_SIZE] = {};
+	struct dr_htbl_connect_info info;
+	uint8_t *mask;
+
+	info.type = CONNECT_MISS;
+	info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
+	dr_ste_set_formated_ste(dmn->ste_ctx,
+				dmn->info.caps.gvmi,
+				nic_dmn,
+				bulk_htbl->htbl,
+				formated_ste,
+				&info);
+
+	mask = nic_matcher->ste_builder[bulk_htbl->ste_location - 1].bit_mask;
+
+	return dr_send_postsend_htbl_range(dmn, bulk_htbl->htbl,
+					   bulk_htbl->first,
+					   bulk_htbl->last - bulk_htbl->first + 1,
+					   formated_ste, mask, bulk->ring_idx);
+}
+
+/*
+ * Send the queued STE updates. The updates which aren't part of a
+ * coalesced table range are sent first and in their original order, they
+ * include the collision entries the tables may point to. The table ranges
+ * are then written from the SW copy, deeper tables first.
+ *
+ * Coalescing writes every STE in use in the range, so it's done only for
+ * tables at or after from_location: a rule insertion in progress has
+ * uncommitted STEs in the tables before the location it reached.
+ */
+static int dr_rule_bulk_flush(struct mlx5dv_dr_domain *dmn,
+			      struct dr_rule_bulk_nic *bulk,
+			      uint8_t from_location)
+{
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+	struct dr_rule_bulk_htbl *htbl_arr = NULL;
+	struct dr_ste_send_info **info_arr = NULL;
+	int num_htbls = 0;
+	uint32_t i = 0;
+	int ret = 0;
+
+	if (!bulk->num_pending)
+		return 0;
+
+	if (from_location != DR_RULE_BULK_NO_COALESCE &&
+	    bulk->num_pending > 1) {
+		info_arr = malloc(bulk->num_pending * sizeof(*info_arr));
+		htbl_arr = malloc(bulk->num_pending * sizeof(*htbl_arr));
+		if (info_arr && htbl_arr) {
+			list_for_each(&bulk->send_list, ste_info, send_list)
+				info_arr[i++] = ste_info;
+
+			num_htbls = dr_rule_bulk_coalesce(dmn, bulk, info_arr,
+							  htbl_arr,
+							  from_location);
+		}
+	}
+
+	list_for_each_safe(&bulk->send_list, ste_info, tmp_ste_info,
+			   send_list) {
+		list_del(&ste_info->send_list);
+
+		if (ste_info->size && !ret)
+			ret = dr_send_postsend_ste(dmn, ste_info->ste,
+						   ste_info->data,
+						   ste_info->size,
+						   ste_info->offset,
+						   bulk->ring_idx);
+		free(ste_info);
+	}
+	bulk->num_pending = 0;
+
+	for (i = 0; i < num_htbls && !ret; i++)
+		ret = dr_rule_bulk_write_htbl(dmn, bulk, &htbl_arr[i]);
+
+	if (ret)
+		dr_dbg(dmn, "Failed sending bulk STE updates\n");
+
+	/* Nothing points to the replaced action STEs once the batch is sent */
+	for (i = 0; i < bulk->num_put; i++)
+		dr_ste_put(bulk->put_arr[i], bulk->matcher, bulk->nic_matcher);
+	bulk->num_put = 0;
+
+	free(htbl_arr);
+	free(info_arr);
+	return ret;
+}
+
+/*
+ * Release an STE which the queued updates stop pointing to. It must stay
+ * in place until they are sent, as the device may still reach it.
+ */
+static void dr_rule_bulk_put_ste(struct mlx5dv_dr_domain *dmn,
+				 struct dr_rule_bulk_nic *bulk,
+				 struct dr_ste *ste)
+{
+	struct dr_ste **put_arr;
+	uint32_t max_put;
+
+	if (bulk->num_put == bulk->max_put) {
+		max_put = bulk->max_put ? bulk->max_put * 2 : DR_ACTION_MAX_STES;
+		put_arr = realloc(bulk->put_arr, max_put * sizeof(*put_arr));
+		if (!put_arr) {
+			dr_rule_bulk_flush(dmn, bulk, 1);
+			dr_ste_put(ste, bulk->matcher, bulk->nic_matcher);
+			return;
+		}
+
+		bulk->put_arr = put_arr;
+		bulk->max_put = max_put;
+	}
+
+	bulk->put_arr[bulk->num_put++] = ste;
+}
+
 static struct dr_ste *dr_rule_find_ste_in_miss_list(struct list_head *miss_list,
-						    uint8_t *hw_ste)
+						    uint8_t *hw_ste,
+						    uint32_t *miss_list_len)
 {
 	struct dr_ste *ste;
 
+	*miss_list_len = 0;
+
 	/* Check if hw_ste is present in the list */
-	list_for_each(miss_list, ste, miss_list_node)
+	list_for_each(miss_list, ste, miss_list_node) {
 		if (dr_ste_equal_tag(ste->hw_ste, hw_ste))
 			return ste;
+		(*miss_list_len)++;
+	}
 
 	return NULL;
 }
@@ -240,7 +537,7 @@ static void dr_rule_rehash_copy_ste_ctrl(struct mlx5dv_dr_matcher *matcher,
 	new_ste->ste_chain_location = cur_ste->ste_chain_location;
 
 	if (new_ste->next_htbl)
-		new_ste->next_htbl->pointing_ste = new_ste;
+		dr_htbl_set_pointing_ste(new_ste->next_htbl, new_ste);
 
 	/*
 	 * We need to copy the refcount since this ste
@@ -435,7 +732,8 @@ static struct dr_ste_htbl *dr_rule_rehash_htbl(struct mlx5dv_dr_rule *rule,
 		goto free_new_htbl;
 
 	if (dr_send_postsend_htbl(dmn, new_htbl, formated_ste,
-				  nic_matcher->ste_builder[ste_location - 1].bit_mask)) {
+				  nic_matcher->ste_builder[ste_location - 1].bit_mask,
+				  matcher->ring_idx)) {
 		dr_dbg(dmn, "Failed writing table to HW\n");
 		goto free_new_htbl;
 	}
@@ -445,7 +743,8 @@ static struct dr_ste_htbl *dr_rule_rehash_htbl(struct mlx5dv_dr_rule *rule,
 	 * in order to have the origin data written before the miss address of
 	 * collision entries, if exists.
 	 */
-	if (dr_rule_send_update_list(&rehash_table_send_list, dmn, false)) {
+	if (dr_rule_send_update_list(&rehash_table_send_list, dmn, false,
+				     matcher->ring_idx)) {
 		dr_dbg(dmn, "Failed updating table to HW\n");
 		goto free_ste_list;
 	}
@@ -505,6 +804,7 @@ static struct dr_ste_htbl *dr_rule_rehash(struct mlx5dv_dr_rule *rule,
 					  uint8_t ste_location,
 					  struct list_head *update_list)
 {
+	struct dr_rule_bulk_nic *bulk = nic_rule->nic_matcher->bulk;
 	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
 	enum dr_icm_chunk_size new_size;
 
@@ -514,148 +814,526 @@ static struct dr_ste_htbl *dr_rule_rehash(struct mlx5dv_dr_rule *rule,
 	if (new_size == cur_htbl->chunk_size)
 		return NULL; /* Skip rehash, we already at the max size */
 
+	/* Queued updates may target STEs of the tables about to be freed */
+	if (bulk && dr_rule_bulk_flush(dmn, bulk, ste_location))
+		return NULL;
+
 	return dr_rule_rehash_htbl(rule, nic_rule, cur_htbl, ste_location,
 				   update_list, new_size);
 }
 
-static struct dr_ste *dr_rule_handle_collision(struct mlx5dv_dr_matcher *matcher,
-					       struct dr_matcher_rx_tx *nic_matcher,
-					       struct dr_ste *ste,
-					       uint8_t *hw_ste,
-					       struct list_head *miss_list,
-					       struct list_head *send_list)
+void dr_rule_rehash_release(struct dr_ste_htbl_rehash *rehash, bool force)
 {
-	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
-	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
-	struct dr_ste_send_info *ste_info;
-	struct dr_ste *new_ste;
+	struct dr_ste_htbl *cur_htbl = rehash->cur_htbl;
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
 
-	ste_info = calloc(1, sizeof(*ste_info));
-	if (!ste_info) {
-		dr_dbg(dmn, "Failed allocating ste_info\n");
-		errno = ENOMEM;
-		return NULL;
-	}
+	/* Unless forced, wait for the tables to be held by the rehash only */
+	if (!force && (atomic_load(&cur_htbl->refcount) > 1 ||
+		       atomic_load(&new_htbl->refcount) > 1))
+		return;
 
-	new_ste = dr_rule_create_collision_entry(matcher, nic_matcher, hw_ste, ste);
-	if (!new_ste) {
-		dr_dbg(dmn, "Failed creating collision entry\n");
-		goto free_send_info;
-	}
+	cur_htbl->rehash = NULL;
+	new_htbl->rehash = NULL;
 
-	if (dr_rule_append_to_miss_list(ste_ctx, new_ste, miss_list, send_list)) {
-		dr_dbg(dmn, "Failed to update prev miss_list\n");
-		goto err_exit;
-	}
+	dr_htbl_put(cur_htbl);
+	dr_htbl_put(new_htbl);
 
-	dr_send_fill_and_append_ste_send_info(new_ste, DR_STE_SIZE, 0, hw_ste,
-					      ste_info, send_list, false);
+	free(rehash->migrated);
+	free(rehash);
+}
 
-	ste->htbl->ctrl.num_of_collisions++;
-	ste->htbl->ctrl.num_of_valid_entries++;
+/*
+ * Start an incremental rehash of cur_htbl, for tables too big to be copied
+ * and written within a single insertion. Bulk insertions, which coalesce
+ * their writes anyway, keep rehashing at once.
+ */
+static bool dr_rule_rehash_start(struct mlx5dv_dr_rule *rule,
+				 struct dr_rule_rx_tx *nic_rule,
+				 struct dr_ste_htbl *cur_htbl,
+				 uint8_t ste_location)
+{
+	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
+	struct dr_ste_htbl_rehash *rehash;
+	enum dr_icm_chunk_size new_size;
+	uint32_t max_stes;
 
-	return new_ste;
+	max_stes = dmn->send_ring[0]->max_post_send_size / DR_STE_SIZE;
 
-err_exit:
-	dr_htbl_put(new_ste->htbl);
+	new_size = dr_icm_next_higher_chunk(cur_htbl->chunk_size);
+	new_size = min_t(uint32_t, new_size, dmn->info.max_log_sw_icm_sz);
 
-free_send_info:
-	free(ste_info);
-	return NULL;
-}
+	if (new_size == cur_htbl->chunk_size || nic_rule->nic_matcher->bulk ||
+	    dr_icm_pool_chunk_size_to_entries(new_size) <= max_stes)
+		return false;
 
-static void dr_rule_remove_action_members(struct mlx5dv_dr_rule *rule)
-{
-	struct dr_rule_action_member *action_mem;
-	struct dr_rule_action_member *tmp;
+	rehash = calloc(1, sizeof(*rehash));
+	if (!rehash)
+		return false;
 
-	list_for_each_safe(&rule->rule_actions_list, action_mem, tmp, list) {
-		list_del(&action_mem->list);
-		atomic_fetch_sub(&action_mem->action->refcount, 1);
-		free(action_mem);
-	}
-}
+	rehash->migrated = bitmap_alloc0(cur_htbl->chunk->num_of_entries);
+	if (!rehash->migrated)
+		goto free_rehash;
 
-static int dr_rule_add_action_members(struct mlx5dv_dr_rule *rule,
-				      size_t num_actions,
-				      struct mlx5dv_dr_action *actions[])
-{
-	struct dr_rule_action_member *action_mem;
-	int i;
+	rehash->new_htbl = dr_ste_htbl_alloc(dmn->ste_icm_pool,
+					     new_size,
+					     cur_htbl->lu_type,
+					     cur_htbl->byte_mask);
+	if (!rehash->new_htbl) {
+		dr_dbg(dmn, "Failed to allocate new hash table\n");
+		goto free_bitmap;
+	}
 
-	for (i = 0; i < num_actions; i++) {
-		action_mem = calloc(1, sizeof(*action_mem));
-		if (!action_mem) {
-			errno = ENOMEM;
-			goto free_action_members;
-		}
+	rehash->cur_htbl = cur_htbl;
+	rehash->ste_location = ste_location;
 
-		action_mem->action = actions[i];
-		list_node_init(&action_mem->list);
-		list_add_tail(&rule->rule_actions_list, &action_mem->list);
-		atomic_fetch_add(&action_mem->action->refcount, 1);
-	}
+	/* The tables are kept until the last bucket is migrated */
+	dr_htbl_get(cur_htbl);
+	dr_htbl_get(rehash->new_htbl);
+	cur_htbl->rehash = rehash;
+	rehash->new_htbl->rehash = rehash;
 
-	return 0;
+	return true;
 
-free_action_members:
-	dr_rule_remove_action_members(rule);
-	return errno;
+free_bitmap:
+	free(rehash->migrated);
+free_rehash:
+	free(rehash);
+	return false;
 }
 
-void dr_rule_set_last_member(struct dr_rule_rx_tx *nic_rule,
-			     struct dr_ste *ste,
-			     bool force)
+/* Write the next num_stes entries of the new table, missing to the old one */
+static int dr_rule_rehash_format(struct mlx5dv_dr_matcher *matcher,
+				 struct dr_matcher_rx_tx *nic_matcher,
+				 struct dr_ste_htbl_rehash *rehash,
+				 uint32_t num_stes)
 {
-	/* Update rule member is usually done for the last STE or during rule
-	 * creation to recover from mid-creation failure (for this purpose the
-	 * force flag is used)
-	 */
-	if (ste->next_htbl && !force)
-		return;
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	uint8_t formated_ste[DR_STE_SIZE] = {};
+	struct dr_htbl_connect_info info;
+	int ret;
 
-	/* Update is required since each rule keeps track of its last STE */
-	ste->rule_rx_tx = nic_rule;
-	nic_rule->last_rule_ste = ste;
-}
+	num_stes = min_t(uint32_t, num_stes,
+			 new_htbl->chunk->num_of_entries - rehash->num_formated);
 
-static struct dr_ste *dr_rule_get_pointed_ste(struct dr_ste *curr_ste)
-{
-	struct dr_ste *first_ste;
+	info.type = CONNECT_MISS;
+	info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
+	dr_ste_set_formated_ste(dmn->ste_ctx,
+				dmn->info.caps.gvmi,
+				nic_dmn,
+				new_htbl,
+				formated_ste,
+				&info);
 
-	first_ste = list_top(dr_ste_get_miss_list(curr_ste), struct dr_ste,
-			     miss_list_node);
+	ret = dr_send_postsend_formated_htbl_range(dmn, new_htbl,
+						   rehash->num_formated,
+						   num_stes, formated_ste,
+						   rehash->cur_htbl,
+						   matcher->ring_idx);
+	if (ret)
+		return ret;
 
-	return first_ste->htbl->pointing_ste;
+	rehash->num_formated += num_stes;
+	return 0;
 }
 
-void dr_rule_get_reverse_rule_members(struct dr_ste **ste_arr,
-				      struct dr_ste *curr_ste,
-				      int *num_of_stes)
+/* Point the previous STE to the new table, replacing the old one */
+static int dr_rule_rehash_connect(struct mlx5dv_dr_matcher *matcher,
+				  struct dr_matcher_rx_tx *nic_matcher,
+				  struct dr_ste_htbl_rehash *rehash)
 {
-	bool first = false;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_ste_htbl *cur_htbl = rehash->cur_htbl;
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
+	struct dr_ste *ste_to_update;
 
-	*num_of_stes = 0;
+	new_htbl->pointing_ste = cur_htbl->pointing_ste;
+	new_htbl->pointing_ste->next_htbl = new_htbl;
 
-	if (curr_ste == NULL)
-		return;
+	if (rehash->ste_location == 1) {
+		/* The previous table is an anchor, anchors size is always one STE */
+		struct dr_ste_htbl *prev_htbl = cur_htbl->pointing_ste->htbl;
 
-	/* Iterate from last to first */
-	while (!first) {
-		first = curr_ste->ste_chain_location == 1;
-		ste_arr[*num_of_stes] = curr_ste;
-		*num_of_stes += 1;
-		curr_ste = dr_rule_get_pointed_ste(curr_ste);
-	}
-}
+		/* On matcher s_anchor we keep an extra refcount */
+		dr_htbl_get(new_htbl);
+		dr_htbl_put(cur_htbl);
 
-static void dr_rule_clean_rule_members(struct mlx5dv_dr_rule *rule,
-				       struct dr_rule_rx_tx *nic_rule)
-{
-	struct dr_ste *ste_arr[DR_RULE_MAX_STES + DR_ACTION_MAX_STES];
-	struct dr_ste *curr_ste = nic_rule->last_rule_ste;
+		nic_matcher->s_htbl = new_htbl;
+
+		dr_ste_set_hit_addr(dmn->ste_ctx,
+				    prev_htbl->ste_arr[0].hw_ste,
+				    new_htbl->chunk->icm_addr,
+				    new_htbl->chunk->num_of_entries);
+
+		ste_to_update = &prev_htbl->ste_arr[0];
+	} else {
+		dr_ste_set_hit_addr_by_next_htbl(dmn->ste_ctx,
+						 cur_htbl->pointing_ste->hw_ste,
+						 new_htbl);
+		ste_to_update = cur_htbl->pointing_ste;
+	}
+
+	rehash->connected = true;
+
+	return dr_send_postsend_ste(dmn, ste_to_update, ste_to_update->hw_ste,
+				    DR_STE_SIZE_CTRL, 0, matcher->ring_idx);
+}
+
+/*
+ * Write num_buckets buckets of the new table, starting at first_bucket of
+ * the old one. Each old bucket maps to one bucket in every old table sized
+ * part of the new table. The collision entries are written before the
+ * bucket heads that bring them in use, tail first.
+ */
+static int dr_rule_rehash_write_buckets(struct mlx5dv_dr_matcher *matcher,
+					struct dr_matcher_rx_tx *nic_matcher,
+					struct dr_ste_htbl_rehash *rehash,
+					uint32_t first_bucket,
+					uint32_t num_buckets)
+{
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	uint32_t cur_entries = rehash->cur_htbl->chunk->num_of_entries;
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	uint8_t formated_ste[DR_STE_SIZE] = {};
+	uint8_t hw_ste[DR_STE_SIZE] = {};
+	struct dr_htbl_connect_info info;
+	struct list_head *miss_list;
+	struct dr_ste *head, *ste;
+	uint32_t i, part;
+	uint8_t *mask;
+	int ret;
+
+	mask = nic_matcher->ste_builder[rehash->ste_location - 1].bit_mask;
+	info.type = CONNECT_MISS;
+	info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
+
+	for (part = 0; part < new_htbl->chunk->num_of_entries; part += cur_entries) {
+		for (i = first_bucket; i < first_bucket + num_buckets; i++) {
+			head = &new_htbl->ste_arr[part + i];
+			if (dr_ste_is_not_used(head))
+				continue;
+
+			miss_list = dr_ste_get_miss_list(head);
+			list_for_each_rev(miss_list, ste, miss_list_node) {
+				if (ste == head)
+					break;
+
+				memcpy(hw_ste, ste->hw_ste, DR_STE_SIZE_REDUCED);
+				memcpy(hw_ste + DR_STE_SIZE_REDUCED, mask,
+				       DR_STE_SIZE_MASK);
+
+				ret = dr_send_postsend_ste(dmn, ste, hw_ste,
+							   DR_STE_SIZE, 0,
+							   matcher->ring_idx);
+				if (ret)
+					return ret;
+			}
+		}
+
+		/* The formated STE is converted in place when sent */
+		dr_ste_set_formated_ste(dmn->ste_ctx,
+					dmn->info.caps.gvmi,
+					nic_dmn,
+					new_htbl,
+					formated_ste,
+					&info);
+
+		ret = dr_send_postsend_htbl_range(dmn, new_htbl,
+						  part + first_bucket,
+						  num_buckets, formated_ste,
+						  mask, matcher->ring_idx);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Move the STEs of an old table bucket to the new table, SW only */
+static int dr_rule_rehash_migrate_bucket(struct mlx5dv_dr_matcher *matcher,
+					 struct dr_matcher_rx_tx *nic_matcher,
+					 struct dr_ste_htbl_rehash *rehash,
+					 uint32_t bucket)
+{
+	struct dr_ste_htbl *cur_htbl = rehash->cur_htbl;
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+	struct dr_ste *cur_ste = &cur_htbl->ste_arr[bucket];
+	struct list_head *miss_list;
+	LIST_HEAD(update_list);
+	struct dr_ste *ste;
+	int num_stes = 0;
+	int ret;
+
+	if (bitmap_test_bit(rehash->migrated, bucket))
+		return 0;
+
+	bitmap_set_bit(rehash->migrated, bucket);
+	rehash->num_migrated++;
+
+	if (dr_ste_is_not_used(cur_ste))
+		return 0;
+
+	miss_list = dr_ste_get_miss_list(cur_ste);
+	list_for_each(miss_list, ste, miss_list_node)
+		num_stes++;
+
+	ret = dr_rule_rehash_copy_miss_list(matcher, nic_matcher, miss_list,
+					    rehash->new_htbl, &update_list);
+
+	/* The migrated buckets are written from the SW copy */
+	list_for_each_safe(&update_list, ste_info, tmp_ste_info, send_list) {
+		list_del(&ste_info->send_list);
+		free(ste_info);
+	}
+
+	if (ret)
+		return ret;
+
+	cur_htbl->ctrl.num_of_valid_entries -= num_stes;
+	cur_htbl->ctrl.num_of_collisions -= num_stes - 1;
+	atomic_init(&cur_ste->refcount, 0);
+	cur_ste->next_htbl = NULL;
+
+	return 0;
+}
+
+/*
+ * Advance the incremental rehash of htbl on an insertion of hw_ste to it,
+ * returns the table to insert to. Until the new table is fully written
+ * the rule goes to the old one, after that the bucket of the rule is
+ * migrated first. A bulk insertion completes the rehash at once.
+ */
+static struct dr_ste_htbl *dr_rule_rehash_step(struct mlx5dv_dr_rule *rule,
+					       struct dr_rule_rx_tx *nic_rule,
+					       struct dr_ste_htbl *htbl,
+					       uint8_t *hw_ste,
+					       uint8_t ste_location)
+{
+	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
+	struct dr_rule_bulk_nic *bulk = nic_matcher->bulk;
+	struct dr_ste_htbl_rehash *rehash = htbl->rehash;
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	uint32_t cur_entries, bucket, num_buckets, i;
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
+	int ret;
+
+	cur_entries = rehash->cur_htbl->chunk->num_of_entries;
+
+	/* Queued updates may target STEs of the buckets about to move */
+	if (bulk && dr_rule_bulk_flush(dmn, bulk, ste_location))
+		return NULL;
+
+	if (!rehash->connected) {
+		ret = dr_rule_rehash_format(matcher, nic_matcher, rehash,
+					    bulk ? UINT32_MAX :
+						   DR_RULE_REHASH_FORMAT_STES);
+		if (ret)
+			goto err_step;
+
+		if (rehash->num_formated < new_htbl->chunk->num_of_entries)
+			return rehash->cur_htbl;
+
+		ret = dr_rule_rehash_connect(matcher, nic_matcher, rehash);
+		if (ret)
+			goto err_step;
+	}
+
+	bucket = dr_ste_calc_hash_index(hw_ste, new_htbl) % cur_entries;
+	if (!bitmap_test_bit(rehash->migrated, bucket)) {
+		ret = dr_rule_rehash_migrate_bucket(matcher, nic_matcher,
+						    rehash, bucket);
+		if (!ret)
+			ret = dr_rule_rehash_write_buckets(matcher, nic_matcher,
+							   rehash, bucket, 1);
+		if (ret)
+			goto err_step;
+	}
+
+	bucket = rehash->next_bucket;
+	num_buckets = cur_entries - bucket;
+	if (!bulk)
+		num_buckets = min_t(uint32_t, num_buckets,
+				    DR_RULE_REHASH_MIGRATE_BUCKETS);
+
+	for (i = bucket; i < bucket + num_buckets; i++) {
+		ret = dr_rule_rehash_migrate_bucket(matcher, nic_matcher,
+						    rehash, i);
+		if (ret)
+			goto err_step;
+	}
+
+	if (num_buckets) {
+		ret = dr_rule_rehash_write_buckets(matcher, nic_matcher, rehash,
+						   bucket, num_buckets);
+		if (ret)
+			goto err_step;
+
+		rehash->next_bucket += num_buckets;
+	}
+
+	if (rehash->num_migrated == cur_entries)
+		dr_rule_rehash_release(rehash, true);
+
+	return new_htbl;
+
+err_step:
+	dr_dbg(dmn, "Failed incremental rehash, htbl-log_size: %d\n",
+	       rehash->cur_htbl->chunk_size);
+	return NULL;
+}
+
+static struct dr_ste *dr_rule_handle_collision(struct mlx5dv_dr_matcher *matcher,
+					       struct dr_matcher_rx_tx *nic_matcher,
+					       struct dr_ste *ste,
+					       uint8_t *hw_ste,
+					       struct list_head *miss_list,
+					       struct list_head *send_list)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
+	struct dr_ste_send_info *ste_info;
+	struct dr_ste *new_ste;
+
+	ste_info = calloc(1, sizeof(*ste_info));
+	if (!ste_info) {
+		dr_dbg(dmn, "Failed allocating ste_info\n");
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	new_ste = dr_rule_create_collision_entry(matcher, nic_matcher, hw_ste, ste);
+	if (!new_ste) {
+		dr_dbg(dmn, "Failed creating collision entry\n");
+		goto free_send_info;
+	}
+
+	if (dr_rule_append_to_miss_list(ste_ctx, new_ste, miss_list, send_list)) {
+		dr_dbg(dmn, "Failed to update prev miss_list\n");
+		goto err_exit;
+	}
+
+	dr_send_fill_and_append_ste_send_info(new_ste, DR_STE_SIZE, 0, hw_ste,
+					      ste_info, send_list, false);
+
+	ste->htbl->ctrl.num_of_collisions++;
+	ste->htbl->ctrl.num_of_valid_entries++;
+
+	return new_ste;
+
+err_exit:
+	dr_htbl_put(new_ste->htbl);
+
+free_send_info:
+	free(ste_info);
+	return NULL;
+}
+
+static void dr_rule_put_action_members(struct list_head *actions_list)
+{
+	struct dr_rule_action_member *action_mem;
+	struct dr_rule_action_member *tmp;
+
+	list_for_each_safe(actions_list, action_mem, tmp, list) {
+		list_del(&action_mem->list);
+		atomic_fetch_sub(&action_mem->action->refcount, 1);
+		free(action_mem);
+	}
+}
+
+static void dr_rule_remove_action_members(struct mlx5dv_dr_rule *rule)
+{
+	dr_rule_put_action_members(&rule->rule_actions_list);
+}
+
+static int dr_rule_add_action_members(struct mlx5dv_dr_rule *rule,
+				      size_t num_actions,
+				      struct mlx5dv_dr_action *actions[])
+{
+	struct dr_rule_action_member *action_mem;
+	int i;
+
+	for (i = 0; i < num_actions; i++) {
+		action_mem = calloc(1, sizeof(*action_mem));
+		if (!action_mem) {
+			errno = ENOMEM;
+			goto free_action_members;
+		}
+
+		action_mem->action = actions[i];
+		list_node_init(&action_mem->list);
+		list_add_tail(&rule->rule_actions_list, &action_mem->list);
+		atomic_fetch_add(&action_mem->action->refcount, 1);
+	}
+
+	return 0;
+
+free_action_members:
+	dr_rule_remove_action_members(rule);
+	return errno;
+}
+
+void dr_rule_set_last_member(struct dr_rule_rx_tx *nic_rule,
+			     struct dr_ste *ste,
+			     bool force)
+{
+	/* Update rule member is usually done for the last STE or during rule
+	 * creation to recover from mid-creation failure (for this purpose the
+	 * force flag is used)
+	 */
+	if (ste->next_htbl && !force)
+		return;
+
+	/* Update is required since each rule keeps track of its last STE */
+	ste->rule_rx_tx = nic_rule;
+	nic_rule->last_rule_ste = ste;
+}
+
+static struct dr_ste *dr_rule_get_pointed_ste(struct dr_ste *curr_ste)
+{
+	struct dr_ste *first_ste;
+
+	first_ste = list_top(dr_ste_get_miss_list(curr_ste), struct dr_ste,
+			     miss_list_node);
+
+	return first_ste->htbl->pointing_ste;
+}
+
+void dr_rule_get_reverse_rule_members(struct dr_ste **ste_arr,
+				      struct dr_ste *curr_ste,
+				      int *num_of_stes)
+{
+	bool first = false;
+
+	*num_of_stes = 0;
+
+	if (curr_ste == NULL)
+		return;
+
+	/* Iterate from last to first */
+	while (!first) {
+		first = curr_ste->ste_chain_location == 1;
+		ste_arr[*num_of_stes] = curr_ste;
+		*num_of_stes += 1;
+		curr_ste = dr_rule_get_pointed_ste(curr_ste);
+	}
+}
+
+static void dr_rule_clean_rule_members(struct mlx5dv_dr_rule *rule,
+				       struct dr_rule_rx_tx *nic_rule)
+{
+	struct dr_ste *ste_arr[DR_RULE_MAX_STES + DR_ACTION_MAX_STES];
+	struct dr_rule_bulk_nic *bulk = nic_rule->nic_matcher->bulk;
+	struct dr_ste *curr_ste = nic_rule->last_rule_ste;
 	int i;
 
+	/* Freeing STEs sends updates directly, keep them ordered */
+	if (bulk)
+		dr_rule_bulk_flush(rule->matcher->tbl->dmn, bulk,
+				   DR_RULE_BULK_NO_COALESCE);
+
 	dr_rule_get_reverse_rule_members(ste_arr, curr_ste, &i);
 
 	while (i--)
@@ -683,7 +1361,7 @@ static bool dr_rule_need_enlarge_hash(struct dr_ste_htbl *htbl,
 	if (dmn->info.max_log_sw_icm_sz <= htbl->chunk_size)
 		return false;
 
-	if (!ctrl->may_grow)
+	if (!ctrl->may_grow || htbl->rehash)
 		return false;
 
 	if (dr_get_bits_per_mask(htbl->byte_mask) * CHAR_BIT <= htbl->chunk_size)
@@ -822,6 +1500,15 @@ clean_ste_setting:
 	return ENOMEM;
 }
 
+static void dr_rule_rehash_stats_update(struct dr_matcher_stats *stats,
+					uint64_t start_ns)
+{
+	uint64_t time_ns = dr_time_ns() - start_ns;
+
+	stats->rehash_time_ns += time_ns;
+	stats->max_rehash_time_ns = max(stats->max_rehash_time_ns, time_ns);
+}
+
 static struct dr_ste *dr_rule_handle_ste_branch(struct mlx5dv_dr_rule *rule,
 						struct dr_rule_rx_tx *nic_rule,
 						struct list_head *send_ste_list,
@@ -834,14 +1521,26 @@ static struct dr_ste *dr_rule_handle_ste_branch(struct mlx5dv_dr_rule *rule,
 	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
 	struct mlx5dv_dr_matcher *matcher = rule->matcher;
 	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_matcher_stats *stats = &nic_matcher->stats;
 	struct dr_ste_htbl *new_htbl;
 	struct list_head *miss_list;
 	struct dr_ste *matched_ste;
 	bool skip_rehash = false;
+	uint32_t miss_list_len;
+	uint64_t start_ns;
 	struct dr_ste *ste;
 	int index;
 
 again:
+	if (cur_htbl->rehash) {
+		start_ns = dr_time_ns();
+		cur_htbl = dr_rule_rehash_step(rule, nic_rule, cur_htbl,
+					       hw_ste, ste_location);
+		dr_rule_rehash_stats_update(stats, start_ns);
+		if (!cur_htbl)
+			return NULL;
+	}
+
 	index = dr_ste_calc_hash_index(hw_ste, cur_htbl);
 	miss_list = &cur_htbl->chunk->miss_list[index];
 	ste = &cur_htbl->ste_arr[index];
@@ -852,9 +1551,12 @@ again:
 					       hw_ste, miss_list,
 					       send_ste_list))
 			return NULL;
+
+		dr_matcher_stats_add_ste(stats, 1);
 	} else {
 		/* Hash table index in use, check if this ste is in the miss list */
-		matched_ste = dr_rule_find_ste_in_miss_list(miss_list, hw_ste);
+		matched_ste = dr_rule_find_ste_in_miss_list(miss_list, hw_ste,
+							    &miss_list_len);
 		if (matched_ste) {
 			/*
 			 * if it is last STE in the chain, and has the same tag
@@ -871,6 +1573,15 @@ again:
 			/* Hash table index in use, try to resize of the hash */
 			skip_rehash = true;
 
+			/* Big tables migrate over the following insertions */
+			start_ns = dr_time_ns();
+			if (dr_rule_rehash_start(rule, nic_rule, cur_htbl,
+						 ste_location)) {
+				stats->num_rehash++;
+				dr_rule_rehash_stats_update(stats, start_ns);
+				goto again;
+			}
+
 			/*
 			 * Hold the table till we update.
 			 * Release in dr_rule_create_rule_nr()
@@ -885,8 +1596,10 @@ again:
 				dr_dbg(dmn, "Failed creating rehash table, htbl-log_size: %d\n",
 				       cur_htbl->chunk_size);
 			} else {
+				stats->num_rehash++;
 				cur_htbl = new_htbl;
 			}
+			dr_rule_rehash_stats_update(stats, start_ns);
 			goto again;
 		} else {
 			/* Hash table index in use, add another collision (miss) */
@@ -901,6 +1614,9 @@ again:
 				       index);
 				return NULL;
 			}
+
+			stats->num_collisions++;
+			dr_matcher_stats_add_ste(stats, miss_list_len + 1);
 		}
 	}
 	return ste;
@@ -998,9 +1714,7 @@ static bool dr_rule_verify(struct mlx5dv_dr_matcher *matcher,
 static int dr_rule_destroy_rule_nic(struct mlx5dv_dr_rule *rule,
 				    struct dr_rule_rx_tx *nic_rule)
 {
-	dr_domain_nic_lock(nic_rule->nic_matcher->nic_tbl->nic_dmn);
 	dr_rule_clean_rule_members(rule, nic_rule);
-	dr_domain_nic_unlock(nic_rule->nic_matcher->nic_tbl->nic_dmn);
 	return 0;
 }
 
@@ -1011,13 +1725,20 @@ static int dr_rule_destroy_rule_fdb(struct mlx5dv_dr_rule *rule)
 	return 0;
 }
 
-static int dr_rule_destroy_rule(struct mlx5dv_dr_rule *rule)
+/*
+ * The locked argument, here and in the create path, is set by the bulk
+ * operations which hold the matcher lock for the whole batch.
+ */
+static int dr_rule_destroy_rule(struct mlx5dv_dr_rule *rule, bool locked)
 {
-	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	int ret = 0;
+
+	if (!locked)
+		dr_matcher_lock(matcher);
 
-	dr_domain_lock(dmn);
 	list_del(&rule->rule_list);
-	dr_domain_unlock(dmn);
 
 	switch (dmn->type) {
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
@@ -1031,10 +1752,17 @@ static int dr_rule_destroy_rule(struct mlx5dv_dr_rule *rule)
 		break;
 	default:
 		assert(false);
-		errno = EINVAL;
-		return errno;
+		ret = EINVAL;
+		errno = ret;
+		break;
 	}
 
+	if (!locked)
+		dr_matcher_unlock(matcher);
+
+	if (ret)
+		return ret;
+
 	dr_rule_remove_action_members(rule);
 
 	free(rule);
@@ -1109,8 +1837,6 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 	if (ret)
 		return ret;
 
-	dr_domain_nic_lock(nic_rule->nic_matcher->nic_tbl->nic_dmn);
-
 	cur_htbl = nic_matcher->s_htbl;
 
 	/*
@@ -1147,16 +1873,21 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 		dr_dbg(dmn, "Failed apply actions\n");
 		goto free_rule;
 	}
-	ret = dr_rule_send_update_list(&send_ste_list, dmn, true);
-	if (ret) {
-		dr_dbg(dmn, "Failed sending ste!\n");
-		goto free_rule;
+	if (nic_matcher->bulk) {
+		dr_rule_bulk_append(nic_matcher->bulk, &send_ste_list);
+	} else {
+		ret = dr_rule_send_update_list(&send_ste_list, dmn, true,
+					       matcher->ring_idx);
+		if (ret) {
+			dr_dbg(dmn, "Failed sending ste!\n");
+			goto free_rule;
+		}
 	}
 
 	if (htbl)
 		dr_htbl_put(htbl);
 
-	goto out_unlock;
+	goto out;
 
 free_rule:
 	dr_rule_clean_rule_members(rule, nic_rule);
@@ -1165,8 +1896,7 @@ free_rule:
 		list_del(&ste_info->send_list);
 		free(ste_info);
 	}
-out_unlock:
-	dr_domain_nic_unlock(nic_rule->nic_matcher->nic_tbl->nic_dmn);
+out:
 	return ret;
 }
 
@@ -1206,7 +1936,8 @@ static struct mlx5dv_dr_rule *
 dr_rule_create_rule(struct mlx5dv_dr_matcher *matcher,
 		    struct mlx5dv_flow_match_parameters *value,
 		    size_t num_actions,
-		    struct mlx5dv_dr_action *actions[])
+		    struct mlx5dv_dr_action *actions[],
+		    bool locked)
 {
 	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
 	struct dr_match_param param = {};
@@ -1230,6 +1961,9 @@ dr_rule_create_rule(struct mlx5dv_dr_matcher *matcher,
 	if (ret)
 		goto free_rule;
 
+	if (!locked)
+		dr_matcher_lock(matcher);
+
 	switch (dmn->type) {
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
 		rule->rx.nic_matcher = &matcher->rx;
@@ -1254,15 +1988,18 @@ dr_rule_create_rule(struct mlx5dv_dr_matcher *matcher,
 	}
 
 	if (ret)
-		goto remove_action_members;
+		goto unlock;
 
-	dr_domain_lock(dmn);
 	list_add_tail(&matcher->rule_list, &rule->rule_list);
-	dr_domain_unlock(dmn);
+
+	if (!locked)
+		dr_matcher_unlock(matcher);
 
 	return rule;
 
-remove_action_members:
+unlock:
+	if (!locked)
+		dr_matcher_unlock(matcher);
 	dr_rule_remove_action_members(rule);
 free_rule:
 	free(rule);
@@ -1346,7 +2083,8 @@ struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 	if (dr_is_root_table(matcher->tbl))
 		rule = dr_rule_create_rule_root(matcher, value, num_actions, actions);
 	else
-		rule = dr_rule_create_rule(matcher, value, num_actions, actions);
+		rule = dr_rule_create_rule(matcher, value, num_actions, actions,
+					   false);
 
 	if (!rule)
 		atomic_fetch_sub(&matcher->refcount, 1);
@@ -1363,9 +2101,593 @@ int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule)
 	if (dr_is_root_table(tbl))
 		ret = dr_rule_destroy_rule_root(rule);
 	else
-		ret = dr_rule_destroy_rule(rule);
+		ret = dr_rule_destroy_rule(rule, false);
 
 	if (!ret)
 		atomic_fetch_sub(&matcher->refcount, 1);
 	return ret;
 }
+
+static int dr_rule_bulk_flush_all(struct mlx5dv_dr_domain *dmn,
+				  struct dr_rule_bulk_nic *rx_bulk,
+				  struct dr_rule_bulk_nic *tx_bulk,
+				  bool coalesce)
+{
+	uint8_t from_location = coalesce ? 1 : DR_RULE_BULK_NO_COALESCE;
+	int ret, ret_tx;
+
+	ret = dr_rule_bulk_flush(dmn, rx_bulk, from_location);
+	ret_tx = dr_rule_bulk_flush(dmn, tx_bulk, from_location);
+
+	return ret ? ret : ret_tx;
+}
+
+static void dr_rule_bulk_start(struct mlx5dv_dr_matcher *matcher,
+			       struct dr_rule_bulk_nic *rx_bulk,
+			       struct dr_rule_bulk_nic *tx_bulk)
+{
+	dr_rule_bulk_init(rx_bulk, matcher, &matcher->rx);
+	dr_rule_bulk_init(tx_bulk, matcher, &matcher->tx);
+
+	dr_matcher_lock(matcher);
+	matcher->rx.bulk = rx_bulk;
+	matcher->tx.bulk = tx_bulk;
+}
+
+static int dr_rule_bulk_end(struct mlx5dv_dr_matcher *matcher,
+			    struct dr_rule_bulk_nic *rx_bulk,
+			    struct dr_rule_bulk_nic *tx_bulk,
+			    bool coalesce)
+{
+	int ret;
+
+	ret = dr_rule_bulk_flush_all(matcher->tbl->dmn, rx_bulk, tx_bulk,
+				     coalesce);
+
+	matcher->rx.bulk = NULL;
+	matcher->tx.bulk = NULL;
+	dr_matcher_unlock(matcher);
+
+	free(rx_bulk->put_arr);
+	free(tx_bulk->put_arr);
+	return ret;
+}
+
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       size_t num_rules,
+			       struct mlx5dv_dr_rule_bulk_attr *attr,
+			       struct mlx5dv_dr_rule *rules[])
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_rule_bulk_nic rx_bulk, tx_bulk;
+	size_t i;
+	int ret = 0;
+
+	if (dr_is_root_table(matcher->tbl)) {
+		/* FW rules, nothing to batch */
+		for (i = 0; i < num_rules; i++) {
+			rules[i] = mlx5dv_dr_rule_create(matcher,
+							 attr[i].value,
+							 attr[i].num_actions,
+							 attr[i].actions);
+			if (!rules[i]) {
+				ret = errno;
+				goto destroy_rules;
+			}
+		}
+		return 0;
+	}
+
+	dr_rule_bulk_start(matcher, &rx_bulk, &tx_bulk);
+
+	for (i = 0; i < num_rules; i++) {
+		atomic_fetch_add(&matcher->refcount, 1);
+
+		rules[i] = dr_rule_create_rule(matcher, attr[i].value,
+					       attr[i].num_actions,
+					       attr[i].actions, true);
+		if (!rules[i]) {
+			atomic_fetch_sub(&matcher->refcount, 1);
+			ret = errno;
+			break;
+		}
+
+		if (rx_bulk.num_pending + tx_bulk.num_pending >=
+		    DR_RULE_BULK_MAX_PENDING) {
+			ret = dr_rule_bulk_flush_all(dmn, &rx_bulk, &tx_bulk,
+						     true);
+			if (ret) {
+				i++;
+				break;
+			}
+		}
+	}
+
+	if (!ret)
+		ret = dr_rule_bulk_end(matcher, &rx_bulk, &tx_bulk, true);
+	else
+		dr_rule_bulk_end(matcher, &rx_bulk, &tx_bulk, false);
+
+	if (!ret)
+		return 0;
+
+destroy_rules:
+	/* All or nothing, remove the rules created so far */
+	mlx5dv_dr_rule_destroy_bulk(i, rules);
+	memset(rules, 0, num_rules * sizeof(*rules));
+	errno = ret;
+	return ret;
+}
+
+int mlx5dv_dr_rule_destroy_bulk(size_t num_rules,
+				struct mlx5dv_dr_rule *rules[])
+{
+	struct mlx5dv_dr_matcher *locked_matcher = NULL;
+	struct mlx5dv_dr_matcher *matcher;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < num_rules; i++) {
+		if (!rules[i])
+			continue;
+
+		matcher = rules[i]->matcher;
+
+		if (dr_is_root_table(matcher->tbl)) {
+			ret = dr_rule_destroy_rule_root(rules[i]);
+			if (ret)
+				break;
+		} else {
+			/* Take the matcher lock once per run of rules */
+			if (matcher != locked_matcher) {
+				if (locked_matcher)
+					dr_matcher_unlock(locked_matcher);
+				dr_matcher_lock(matcher);
+				locked_matcher = matcher;
+			}
+			dr_rule_destroy_rule(rules[i], true);
+		}
+
+		atomic_fetch_sub(&matcher->refcount, 1);
+		rules[i] = NULL;
+	}
+
+	if (locked_matcher)
+		dr_matcher_unlock(locked_matcher);
+
+	return ret;
+}
+
+/*
+ * State of a rule side while its actions are replaced. The new action STEs
+ * are created and linked in SW first, the rule's last match STE then moves
+ * to them with a single control write, so the device uses either the old
+ * or the new actions and the match STEs are never rewritten.
+ */
+struct dr_rule_modify_nic {
+	struct dr_rule_rx_tx	*nic_rule;
+	uint8_t			hw_ste_arr[DR_RULE_MAX_STE_CHAIN * DR_STE_SIZE];
+	struct dr_ste		*ste_arr[DR_RULE_MAX_STE_CHAIN];
+	int			num_action_stes;
+	struct dr_ste		*last_ste;
+	struct dr_ste		*old_last_rule_ste;
+	struct dr_ste_htbl	*old_next_htbl;
+	uint8_t			old_ctrl[DR_STE_SIZE_CTRL];
+	struct list_head	send_ste_list;
+};
+
+static void dr_rule_modify_actions_abort(struct mlx5dv_dr_rule *rule,
+					 struct dr_rule_modify_nic *mod)
+{
+	struct dr_matcher_rx_tx *nic_matcher = mod->nic_rule->nic_matcher;
+	struct dr_ste *ste_arr[DR_RULE_MAX_STE_CHAIN];
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+	int i;
+
+	list_for_each_safe(&mod->send_ste_list, ste_info, tmp_ste_info,
+			   send_list) {
+		list_del(&ste_info->send_list);
+		free(ste_info);
+	}
+
+	/* The device never reached the new action STEs */
+	dr_rule_get_reverse_rule_members(ste_arr, mod->nic_rule->last_rule_ste,
+					 &i);
+	i -= nic_matcher->num_of_builders;
+	while (i-- > 0)
+		dr_ste_put(ste_arr[i], rule->matcher, nic_matcher);
+
+	memcpy(mod->last_ste->hw_ste, mod->old_ctrl, DR_STE_SIZE_CTRL);
+	mod->last_ste->next_htbl = mod->old_next_htbl;
+	dr_rule_set_last_member(mod->nic_rule, mod->old_last_rule_ste, true);
+}
+
+static int dr_rule_modify_actions_prepare(struct mlx5dv_dr_rule *rule,
+					  struct dr_rule_modify_nic *mod,
+					  size_t num_actions,
+					  struct mlx5dv_dr_action *actions[])
+{
+	struct dr_matcher_rx_tx *nic_matcher = mod->nic_rule->nic_matcher;
+	uint8_t num_of_builders = nic_matcher->num_of_builders;
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	struct dr_ste_send_info *ste_info;
+	uint32_t new_hw_ste_arr_sz;
+	uint8_t *last_hw_ste;
+	int num_stes, ret;
+
+	list_head_init(&mod->send_ste_list);
+	mod->old_last_rule_ste = mod->nic_rule->last_rule_ste;
+
+	dr_rule_get_reverse_rule_members(mod->ste_arr, mod->old_last_rule_ste,
+					 &num_stes);
+	mod->num_action_stes = num_stes - num_of_builders;
+	mod->last_ste = mod->ste_arr[mod->num_action_stes];
+	mod->old_next_htbl = mod->last_ste->next_htbl;
+	memcpy(mod->old_ctrl, mod->last_ste->hw_ste, DR_STE_SIZE_CTRL);
+
+	/* The action setters only add to the STE, start from a clean one */
+	memset(mod->hw_ste_arr, 0, sizeof(mod->hw_ste_arr));
+	last_hw_ste = mod->hw_ste_arr + (num_of_builders - 1) * DR_STE_SIZE;
+	dr_ste_build_last_ste(matcher, nic_matcher, mod->last_ste, last_hw_ste);
+
+	ret = dr_actions_build_ste_arr(matcher, nic_matcher, actions,
+				       num_actions, mod->hw_ste_arr,
+				       &new_hw_ste_arr_sz);
+	if (ret)
+		return ret;
+
+	ste_info = calloc(1, sizeof(*ste_info));
+	if (!ste_info) {
+		errno = ENOMEM;
+		return errno;
+	}
+
+	/* The list is sent in reverse, the switch goes after the new STEs */
+	dr_send_fill_and_append_ste_send_info(mod->last_ste, DR_STE_SIZE_CTRL,
+					      0, last_hw_ste, ste_info,
+					      &mod->send_ste_list, false);
+
+	mod->last_ste->next_htbl = NULL;
+	dr_rule_set_last_member(mod->nic_rule, mod->last_ste, true);
+
+	ret = dr_rule_handle_action_stes(rule, mod->nic_rule,
+					 &mod->send_ste_list, mod->last_ste,
+					 mod->hw_ste_arr, new_hw_ste_arr_sz);
+	if (ret) {
+		dr_rule_modify_actions_abort(rule, mod);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int dr_rule_modify_actions_commit(struct mlx5dv_dr_rule *rule,
+					 struct dr_rule_modify_nic *mod)
+{
+	struct dr_matcher_rx_tx *nic_matcher = mod->nic_rule->nic_matcher;
+	struct dr_rule_bulk_nic *bulk = nic_matcher->bulk;
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	int i, ret;
+
+	if (bulk) {
+		dr_rule_bulk_append(bulk, &mod->send_ste_list);
+	} else {
+		ret = dr_rule_send_update_list(&mod->send_ste_list, dmn, true,
+					       matcher->ring_idx);
+		if (ret) {
+			dr_dbg(dmn, "Failed sending ste!\n");
+			dr_rule_modify_actions_abort(rule, mod);
+			return ret;
+		}
+	}
+
+	/* Release the old action STEs, first to last */
+	for (i = mod->num_action_stes - 1; i >= 0; i--) {
+		if (bulk)
+			dr_rule_bulk_put_ste(dmn, bulk, mod->ste_arr[i]);
+		else
+			dr_ste_put(mod->ste_arr[i], matcher, nic_matcher);
+	}
+
+	return 0;
+}
+
+static int dr_rule_modify_actions(struct mlx5dv_dr_rule *rule,
+				  size_t num_actions,
+				  struct mlx5dv_dr_action *actions[])
+{
+	struct dr_rule_rx_tx *nic_rules[] = { &rule->rx, &rule->tx };
+	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
+	struct dr_rule_modify_nic mod_arr[ARRAY_SIZE(nic_rules)];
+	struct dr_rule_modify_nic *mod[ARRAY_SIZE(nic_rules)] = {};
+	bool committed = false;
+	LIST_HEAD(old_actions);
+	int i, ret;
+
+	list_append_list(&old_actions, &rule->rule_actions_list);
+
+	ret = dr_rule_add_action_members(rule, num_actions, actions);
+	if (ret)
+		goto restore_actions;
+
+	/* An FDB rule switches its sides only once both are ready */
+	for (i = 0; i < ARRAY_SIZE(nic_rules); i++) {
+		/* Side not used by the domain, or skipped by the rule */
+		if (!nic_rules[i]->nic_matcher || !nic_rules[i]->last_rule_ste)
+			continue;
+
+		mod_arr[i].nic_rule = nic_rules[i];
+		ret = dr_rule_modify_actions_prepare(rule, &mod_arr[i],
+						     num_actions, actions);
+		if (ret) {
+			dr_dbg(dmn, "Failed preparing the new actions\n");
+			goto abort;
+		}
+		mod[i] = &mod_arr[i];
+	}
+
+	for (i = 0; i < ARRAY_SIZE(nic_rules); i++) {
+		if (!mod[i])
+			continue;
+
+		ret = dr_rule_modify_actions_commit(rule, mod[i]);
+		mod[i] = NULL;
+		if (ret)
+			goto abort;
+		committed = true;
+	}
+
+	dr_rule_put_action_members(&old_actions);
+	return 0;
+
+abort:
+	for (i = 0; i < ARRAY_SIZE(nic_rules); i++)
+		if (mod[i])
+			dr_rule_modify_actions_abort(rule, mod[i]);
+
+	/* A side already uses the new actions, keep a reference to both */
+	if (!committed)
+		dr_rule_remove_action_members(rule);
+restore_actions:
+	list_append_list(&rule->rule_actions_list, &old_actions);
+	errno = ret;
+	return ret;
+}
+
+int mlx5dv_dr_rule_modify_actions(struct mlx5dv_dr_rule *rule,
+				  size_t num_actions,
+				  struct mlx5dv_dr_action *actions[])
+{
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	int ret;
+
+	/* FW rules can't be updated in place */
+	if (dr_is_root_table(matcher->tbl)) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	dr_matcher_lock(matcher);
+	ret = dr_rule_modify_actions(rule, num_actions, actions);
+	dr_matcher_unlock(matcher);
+
+	return ret;
+}
+
+int mlx5dv_dr_rule_modify_actions_bulk(size_t num_rules,
+				       struct mlx5dv_dr_rule_modify_attr *attr)
+{
+	struct mlx5dv_dr_matcher *locked_matcher = NULL;
+	struct dr_rule_bulk_nic rx_bulk, tx_bulk;
+	struct mlx5dv_dr_matcher *matcher;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < num_rules; i++) {
+		matcher = attr[i].rule->matcher;
+
+		if (dr_is_root_table(matcher->tbl)) {
+			ret = EOPNOTSUPP;
+			break;
+		}
+
+		/* A batch per run of rules of the same matcher */
+		if (matcher != locked_matcher) {
+			if (locked_matcher) {
+				ret = dr_rule_bulk_end(locked_matcher, &rx_bulk,
+						       &tx_bulk, true);
+				locked_matcher = NULL;
+				if (ret)
+					break;
+			}
+			dr_rule_bulk_start(matcher, &rx_bulk, &tx_bulk);
+			locked_matcher = matcher;
+		}
+
+		ret = dr_rule_modify_actions(attr[i].rule, attr[i].num_actions,
+					     attr[i].actions);
+		if (ret)
+			break;
+
+		if (rx_bulk.num_pending + tx_bulk.num_pending >=
+		    DR_RULE_BULK_MAX_PENDING) {
+			ret = dr_rule_bulk_flush_all(matcher->tbl->dmn,
+						     &rx_bulk, &tx_bulk, true);
+			if (ret)
+				break;
+		}
+	}
+
+	if (locked_matcher) {
+		if (ret)
+			dr_rule_bulk_end(locked_matcher, &rx_bulk, &tx_bulk,
+					 false);
+		else
+			ret = dr_rule_bulk_end(locked_matcher, &rx_bulk,
+					       &tx_bulk, true);
+	}
+
+	if (ret)
+		errno = ret;
+
+	return ret;
+}
+
+struct mlx5dv_dr_rule_queue *
+mlx5dv_dr_rule_queue_create(struct mlx5dv_dr_domain *dmn, uint32_t size)
+{
+	struct mlx5dv_dr_rule_queue *queue;
+
+	if (!size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	queue->ops = calloc(size, sizeof(*queue->ops));
+	if (!queue->ops) {
+		errno = ENOMEM;
+		goto free_queue;
+	}
+
+	queue->dmn = dmn;
+	queue->size = size;
+	atomic_fetch_add(&dmn->refcount, 1);
+
+	return queue;
+
+free_queue:
+	free(queue);
+	return NULL;
+}
+
+int mlx5dv_dr_rule_queue_destroy(struct mlx5dv_dr_rule_queue *queue)
+{
+	/* Completions must be polled before the queue goes away */
+	if (queue->num_ops)
+		return EBUSY;
+
+	atomic_fetch_sub(&queue->dmn->refcount, 1);
+	free(queue->ops);
+	free(queue);
+
+	return 0;
+}
+
+static void dr_rule_queue_add(struct mlx5dv_dr_rule_queue *queue,
+			      struct mlx5dv_dr_matcher *matcher,
+			      enum mlx5dv_dr_rule_queue_op op,
+			      struct mlx5dv_dr_rule *rule,
+			      void *user_data)
+{
+	struct dr_rule_queue_op *queue_op;
+
+	queue_op = &queue->ops[(queue->head + queue->num_ops) % queue->size];
+	queue_op->user_data = user_data;
+	queue_op->rule = rule;
+	queue_op->op = op;
+	queue_op->done = dr_is_root_table(matcher->tbl);
+	queue_op->ring_idx = matcher->ring_idx;
+	if (!queue_op->done)
+		queue_op->tx_mark = dr_send_ring_get_mark(queue->dmn,
+							  matcher->ring_idx);
+	queue->num_ops++;
+}
+
+struct mlx5dv_dr_rule *
+mlx5dv_dr_rule_create_async(struct mlx5dv_dr_rule_queue *queue,
+			    struct mlx5dv_dr_matcher *matcher,
+			    struct mlx5dv_flow_match_parameters *value,
+			    size_t num_actions,
+			    struct mlx5dv_dr_action *actions[],
+			    void *user_data)
+{
+	struct mlx5dv_dr_rule *rule;
+
+	if (matcher->tbl->dmn != queue->dmn) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (queue->num_ops == queue->size) {
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	rule = mlx5dv_dr_rule_create(matcher, value, num_actions, actions);
+	if (!rule)
+		return NULL;
+
+	dr_rule_queue_add(queue, matcher, MLX5DV_DR_RULE_QUEUE_OP_CREATE,
+			  rule, user_data);
+	return rule;
+}
+
+int mlx5dv_dr_rule_destroy_async(struct mlx5dv_dr_rule_queue *queue,
+				 struct mlx5dv_dr_rule *rule,
+				 void *user_data)
+{
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	int ret;
+
+	if (matcher->tbl->dmn != queue->dmn)
+		return EINVAL;
+
+	if (queue->num_ops == queue->size)
+		return EAGAIN;
+
+	/* The rule holds the matcher until it is destroyed */
+	atomic_fetch_add(&matcher->refcount, 1);
+
+	ret = mlx5dv_dr_rule_destroy(rule);
+	if (!ret)
+		dr_rule_queue_add(queue, matcher,
+				  MLX5DV_DR_RULE_QUEUE_OP_DESTROY,
+				  NULL, user_data);
+
+	atomic_fetch_sub(&matcher->refcount, 1);
+	return ret;
+}
+
+int mlx5dv_dr_rule_queue_poll(struct mlx5dv_dr_rule_queue *queue,
+			      struct mlx5dv_dr_rule_queue_comp comps[],
+			      uint32_t num_comps)
+{
+	struct dr_rule_queue_op *queue_op;
+	uint32_t num_polled = 0;
+	int ret;
+
+	while (num_polled < num_comps && queue->num_ops) {
+		queue_op = &queue->ops[queue->head];
+
+		if (!queue_op->done) {
+			ret = dr_send_ring_poll_mark(queue->dmn,
+						     queue_op->ring_idx,
+						     queue_op->tx_mark,
+						     &queue_op->done);
+			if (ret) {
+				errno = EIO;
+				return -EIO;
+			}
+
+			if (!queue_op->done)
+				break;
+		}
+
+		comps[num_polled].user_data = queue_op->user_data;
+		comps[num_polled].rule = queue_op->rule;
+		comps[num_polled].op = queue_op->op;
+		num_polled++;
+
+		queue->head = (queue->head + 1) % queue->size;
+		queue->num_ops--;
+	}
+
+	return num_polled;
+}
@@ -562,13 +562,17 @@ static bool dr_is_device_fatal(struct mlx5dv_dr_domain *dmn)
 static int dr_handle_pending_wc(struct mlx5dv_dr_domain *dmn,
 				struct dr_send_ring *send_ring)
 {
+	uint64_t start_ns = 0;
 	bool is_drain = false;
 	int ne;
 
 	if (send_ring->pending_wqe >= send_ring->signal_th) {
 		/* Queue is full start drain it */
-		if (send_ring->pending_wqe >= dmn->send_ring->signal_th * TH_NUMS_TO_DRAIN)
+		if (send_ring->pending_wqe >= send_ring->signal_th * TH_NUMS_TO_DRAIN) {
 			is_drain = true;
+			send_ring->num_stalls++;
+			start_ns = dr_time_ns();
+		}
 
 		do {
 			/*
@@ -586,6 +590,9 @@ static int dr_handle_pending_wc(struct mlx5dv_dr_domain *dmn,
 				send_ring->pending_wqe -= send_ring->signal_th;
 			}
 		} while (is_drain && send_ring->pending_wqe);
+
+		if (is_drain)
+			send_ring->stall_time_ns += dr_time_ns() - start_ns;
 	}
 
 	return 0;
@@ -626,19 +633,26 @@ static void dr_fill_data_segs(struct dr_send_ring *send_ring,
 }
 
 static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
-				struct postsend_info *send_info)
+				struct postsend_info *send_info,
+				uint8_t ring_idx)
 {
-	struct dr_send_ring *send_ring = dmn->send_ring;
+	struct dr_send_ring *send_ring = dmn->send_ring[ring_idx];
 	uint32_t buff_offset;
 	int ret;
 
+	if (dr_domain_is_emu(dmn))
+		return dr_emu_icm_write(dmn->emu, send_info->rkey,
+					send_info->remote_addr,
+					(void *)(uintptr_t)send_info->write.addr,
+					send_info->write.length);
+
 	pthread_mutex_lock(&send_ring->mutex);
 	ret = dr_handle_pending_wc(dmn, send_ring);
 	if (ret)
 		goto out_unlock;
 
 	if (send_info->write.length > dmn->info.max_inline_size) {
-		buff_offset = (send_ring->tx_head & (dmn->send_ring->signal_th - 1)) *
+		buff_offset = (send_ring->tx_head & (send_ring->signal_th - 1)) *
 			send_ring->max_post_send_size;
 		/* Copy to ring mr */
 		memcpy(send_ring->buf + buff_offset,
@@ -664,11 +678,12 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
 				   int *iterations,
 				   int *num_stes)
 {
+	uint32_t max_post_send_size = dmn->send_ring[0]->max_post_send_size;
 	int alloc_size;
 
-	if (htbl->chunk->byte_size > dmn->send_ring->max_post_send_size) {
-		*iterations = htbl->chunk->byte_size / dmn->send_ring->max_post_send_size;
-		*byte_size = dmn->send_ring->max_post_send_size;
+	if (htbl->chunk->byte_size > max_post_send_size) {
+		*iterations = htbl->chunk->byte_size / max_post_send_size;
+		*byte_size = max_post_send_size;
 		alloc_size = *byte_size;
 		*num_stes = *byte_size / DR_STE_SIZE;
 	} else {
@@ -696,11 +711,13 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
  *     size    - data size for writing.
  *     offset  - The offset from the icm mapped data to start write to.
  *               this for write only part of the buffer.
+ *     ring_idx - The send ring to post on.
  *
  * Return: 0 on success.
  */
 int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
-			 uint8_t *data, uint16_t size, uint16_t offset)
+			 uint8_t *data, uint16_t size, uint16_t offset,
+			 uint8_t ring_idx)
 {
 	struct postsend_info send_info = {};
 
@@ -712,31 +729,42 @@ int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
 	send_info.remote_addr   = dr_ste_get_mr_addr(ste) + offset;
 	send_info.rkey          = ste->htbl->chunk->rkey;
 
-	return dr_postsend_icm_data(dmn, &send_info);
+	return dr_postsend_icm_data(dmn, &send_info, ring_idx);
 }
 
-int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
-			  uint8_t *formated_ste, uint8_t *mask)
+/*
+ * dr_send_postsend_htbl_range: write num_stes STEs of htbl, starting at
+ * start_index, from the SW copy. Entries not in use are written as
+ * formated_ste, the ones in use get the given bit mask.
+ */
+int dr_send_postsend_htbl_range(struct mlx5dv_dr_domain *dmn,
+				struct dr_ste_htbl *htbl,
+				uint32_t start_index, uint32_t num_stes,
+				uint8_t *formated_ste, uint8_t *mask,
+				uint8_t ring_idx)
 {
-	uint32_t byte_size = htbl->chunk->byte_size;
-	int i, j, num_stes_per_iter, iterations;
+	uint32_t max_stes = dmn->send_ring[0]->max_post_send_size / DR_STE_SIZE;
+	uint32_t i, j, iter_stes;
 	uint8_t *data;
-	int ret;
+	int ret = 0;
 
-	ret = dr_get_tbl_copy_details(dmn, htbl, &data, &byte_size,
-				      &iterations, &num_stes_per_iter);
-	if (ret)
-		return ret;
+	data = calloc(min_t(uint32_t, num_stes, max_stes), DR_STE_SIZE);
+	if (!data) {
+		errno = ENOMEM;
+		return errno;
+	}
 
 	dr_ste_prepare_for_postsend(dmn->ste_ctx, formated_ste, DR_STE_SIZE);
 
-	/* Send the data iteration times */
-	for (i = 0; i < iterations; i++) {
-		uint32_t ste_index = i * (byte_size / DR_STE_SIZE);
+	/* Send the data in max_post_send_size pieces */
+	for (i = 0; i < num_stes; i += iter_stes) {
+		uint32_t ste_index = start_index + i;
 		struct postsend_info send_info = {};
 
+		iter_stes = min_t(uint32_t, num_stes - i, max_stes);
+
 		/* Copy all ste's on the data buffer, need to add the bit_mask */
-		for (j = 0; j < num_stes_per_iter; j++) {
+		for (j = 0; j < iter_stes; j++) {
 			if (dr_ste_is_not_used(&htbl->ste_arr[ste_index + j])) {
 				memcpy(data + (j * DR_STE_SIZE),
 				       formated_ste, DR_STE_SIZE);
@@ -756,26 +784,35 @@ int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl
 		}
 
 		send_info.write.addr	= (uintptr_t) data;
-		send_info.write.length	= byte_size;
+		send_info.write.length	= iter_stes * DR_STE_SIZE;
 		send_info.write.lkey	= 0;
 		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
 		send_info.rkey		= htbl->chunk->rkey;
 
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, &send_info, ring_idx);
 		if (ret)
-			goto out_free;
+			break;
 	}
 
-out_free:
 	free(data);
 	return ret;
 }
 
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
+			  uint8_t *formated_ste, uint8_t *mask,
+			  uint8_t ring_idx)
+{
+	return dr_send_postsend_htbl_range(dmn, htbl, 0,
+					   htbl->chunk->num_of_entries,
+					   formated_ste, mask, ring_idx);
+}
+
 /* Initialize htble with default STEs */
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t *ste_init_data,
-				   bool update_hw_ste)
+				   bool update_hw_ste,
+				   uint8_t ring_idx)
 {
 	uint32_t byte_size = htbl->chunk->byte_size;
 	int i, num_stes, iterations, ret;
@@ -814,7 +851,7 @@ int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
 		send_info.rkey		= htbl->chunk->rkey;
 
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, &send_info, ring_idx);
 		if (ret)
 			goto out_free;
 	}
@@ -824,10 +861,129 @@ out_free:
 	return ret;
 }
 
+/*
+ * dr_send_postsend_formated_htbl_range: write num_stes copies of
+ * formated_ste to htbl, starting at start_index. When miss_htbl is given,
+ * each STE misses to the miss_htbl entry of the same hash index instead,
+ * miss_htbl being a smaller table hashed with the same mask.
+ */
+int dr_send_postsend_formated_htbl_range(struct mlx5dv_dr_domain *dmn,
+					 struct dr_ste_htbl *htbl,
+					 uint32_t start_index,
+					 uint32_t num_stes,
+					 uint8_t *formated_ste,
+					 struct dr_ste_htbl *miss_htbl,
+					 uint8_t ring_idx)
+{
+	uint32_t max_stes = dmn->send_ring[0]->max_post_send_size / DR_STE_SIZE;
+	uint32_t i, j, iter_stes, miss_index;
+	uint8_t *data, *ste_data;
+	int ret = 0;
+
+	data = calloc(min_t(uint32_t, num_stes, max_stes), DR_STE_SIZE);
+	if (!data) {
+		errno = ENOMEM;
+		return errno;
+	}
+
+	for (i = 0; i < num_stes; i += iter_stes) {
+		uint32_t ste_index = start_index + i;
+		struct postsend_info send_info = {};
+
+		iter_stes = min_t(uint32_t, num_stes - i, max_stes);
+
+		for (j = 0; j < iter_stes; j++) {
+			ste_data = data + j * DR_STE_SIZE;
+			memcpy(ste_data, formated_ste, DR_STE_SIZE);
+
+			if (miss_htbl) {
+				miss_index = (ste_index + j) %
+					     miss_htbl->chunk->num_of_entries;
+				dr_ste_set_miss_addr(dmn->ste_ctx, ste_data,
+						     miss_htbl->chunk->icm_addr +
+						     DR_STE_SIZE * miss_index);
+			}
+
+			dr_ste_prepare_for_postsend(dmn->ste_ctx, ste_data,
+						    DR_STE_SIZE);
+		}
+
+		send_info.write.addr	= (uintptr_t) data;
+		send_info.write.length	= iter_stes * DR_STE_SIZE;
+		send_info.write.lkey	= 0;
+		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
+		send_info.rkey		= htbl->chunk->rkey;
+
+		ret = dr_postsend_icm_data(dmn, &send_info, ring_idx);
+		if (ret)
+			break;
+	}
+
+	free(data);
+	return ret;
+}
+
+/* Post writes of the sync buffer, each completing a WQE pair on the ring */
+static int dr_send_ring_post_nops(struct mlx5dv_dr_domain *dmn,
+				  uint8_t ring_idx, int num_nops)
+{
+	struct dr_send_ring *send_ring = dmn->send_ring[ring_idx];
+	struct postsend_info send_info = {};
+	uint8_t data[DR_STE_SIZE];
+	int i, ret;
+
+	send_info.write.addr	= (uintptr_t) data;
+	send_info.write.length	= DR_STE_SIZE;
+	send_info.write.lkey	= 0;
+	/* Using the sync_mr in order to write/read */
+	send_info.remote_addr	= (uintptr_t) send_ring->sync_mr->addr;
+	send_info.rkey		= send_ring->sync_mr->rkey;
+
+	for (i = 0; i < num_nops; i++) {
+		ret = dr_postsend_icm_data(dmn, &send_info, ring_idx);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int dr_send_ring_drain(struct mlx5dv_dr_domain *dmn, uint8_t ring_idx)
+{
+	struct dr_send_ring *send_ring = dmn->send_ring[ring_idx];
+	bool drained;
+	int ret;
+
+	/* Emulated writes complete when posted */
+	if (dr_domain_is_emu(dmn))
+		return 0;
+
+	/* Nothing was posted since the last drain */
+	pthread_mutex_lock(&send_ring->mutex);
+	drained = send_ring->tx_head == send_ring->drained_tx_head;
+	pthread_mutex_unlock(&send_ring->mutex);
+	if (drained)
+		return 0;
+
+	/* Sending this amount of requests makes sure we will get drain */
+	ret = dr_send_ring_post_nops(dmn, ring_idx,
+				     send_ring->signal_th * TH_NUMS_TO_DRAIN / 2);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&send_ring->mutex);
+	ret = dr_handle_pending_wc(dmn, send_ring);
+	if (!ret)
+		send_ring->drained_tx_head = send_ring->tx_head;
+	pthread_mutex_unlock(&send_ring->mutex);
+	return ret;
+}
+
 int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
 			    struct mlx5dv_dr_action *action)
 {
 	struct postsend_info send_info = {};
+	int ret;
 
 	send_info.write.addr	= (uintptr_t) action->rewrite.data;
 	send_info.write.length	= action->rewrite.num_of_actions *
@@ -836,7 +992,12 @@ int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
 	send_info.remote_addr	= action->rewrite.chunk->mr_addr;
 	send_info.rkey		= action->rewrite.chunk->rkey;
 
-	return dr_postsend_icm_data(dmn, &send_info);
+	ret = dr_postsend_icm_data(dmn, &send_info, 0);
+	if (ret || dmn->num_send_rings == 1)
+		return ret;
+
+	/* Rules using the action may be written on other rings */
+	return dr_send_ring_drain(dmn, 0);
 }
 
 bool dr_send_allow_fl(struct dr_devx_caps *caps)
@@ -847,11 +1008,11 @@ bool dr_send_allow_fl(struct dr_devx_caps *caps)
 		 caps->roce_caps.fl_rc_qp_when_roce_disabled));
 }
 
-static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn)
+static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn,
+				struct dr_qp *dr_qp)
 {
 	struct dr_devx_qp_rts_attr rts_attr = {};
 	struct dr_devx_qp_rtr_attr rtr_attr = {};
-	struct dr_qp *dr_qp = dmn->send_ring->qp;
 	enum ibv_mtu mtu = IBV_MTU_1024;
 	uint16_t gid_index = 0;
 	int port = 1;
@@ -902,9 +1063,10 @@ static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn)
 	return 0;
 }
 
-/* Each domain has its own ib resources */
+/* Each domain has its own ib resources, a ring is added per call */
 int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 {
+	struct dr_send_ring *send_ring;
 	struct dr_qp_init_attr init_attr = {};
 	struct mlx5dv_pd mlx5_pd = {};
 	struct mlx5dv_cq mlx5_cq = {};
@@ -915,35 +1077,47 @@ int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 			   IBV_ACCESS_REMOTE_READ;
 	int ret;
 
-	dmn->send_ring = calloc(1, sizeof(*dmn->send_ring));
-	if (!dmn->send_ring) {
+	send_ring = calloc(1, sizeof(*send_ring));
+	if (!send_ring) {
 		dr_dbg(dmn, "Couldn't allocate send-ring\n");
 		errno = ENOMEM;
 		return errno;
 	}
 
-	pthread_mutex_init(&dmn->send_ring->mutex, NULL);
+	pthread_mutex_init(&send_ring->mutex, NULL);
+
+	/* Emulated ICM is written directly, only the sizes are needed */
+	if (dr_domain_is_emu(dmn)) {
+		dmn->info.max_send_wr = QUEUE_SIZE;
+		dmn->info.max_inline_size = DR_STE_SIZE;
+		send_ring->signal_th = QUEUE_SIZE / SIGNAL_PER_DIV_QUEUE;
+		send_ring->max_post_send_size =
+			dr_icm_pool_chunk_size_to_byte(DR_CHUNK_SIZE_1K,
+						       DR_ICM_TYPE_STE);
+		dmn->send_ring[dmn->num_send_rings++] = send_ring;
+		return 0;
+	}
 
 	cq_size = QUEUE_SIZE + 1;
-	dmn->send_ring->cq.ibv_cq = ibv_create_cq(dmn->ctx, cq_size, NULL, NULL, 0);
-	if (!dmn->send_ring->cq.ibv_cq) {
+	send_ring->cq.ibv_cq = ibv_create_cq(dmn->ctx, cq_size, NULL, NULL, 0);
+	if (!send_ring->cq.ibv_cq) {
 		dr_dbg(dmn, "Failed to create CQ with %u entries\n", cq_size);
 		ret = ENODEV;
 		errno = ENODEV;
 		goto free_send_ring;
 	}
 
-	obj.cq.in = dmn->send_ring->cq.ibv_cq;
+	obj.cq.in = send_ring->cq.ibv_cq;
 	obj.cq.out = &mlx5_cq;
 
 	ret = mlx5dv_init_obj(&obj, MLX5DV_OBJ_CQ);
 	if (ret)
 		goto clean_cq;
 
-	dmn->send_ring->cq.buf = mlx5_cq.buf;
-	dmn->send_ring->cq.db = mlx5_cq.dbrec;
-	dmn->send_ring->cq.ncqe = mlx5_cq.cqe_cnt;
-	dmn->send_ring->cq.cqe_sz = mlx5_cq.cqe_size;
+	send_ring->cq.buf = mlx5_cq.buf;
+	send_ring->cq.db = mlx5_cq.dbrec;
+	send_ring->cq.ncqe = mlx5_cq.cqe_cnt;
+	send_ring->cq.cqe_sz = mlx5_cq.cqe_size;
 
 	obj.pd.in = dmn->pd;
 	obj.pd.out = &mlx5_pd;
@@ -965,80 +1139,86 @@ int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 	if (dr_send_allow_fl(&dmn->info.caps))
 		init_attr.isolate_vl_tc = dmn->info.caps.isolate_vl_tc;
 
-	dmn->send_ring->qp = dr_create_rc_qp(dmn->ctx, &init_attr);
-	if (!dmn->send_ring->qp)  {
+	send_ring->qp = dr_create_rc_qp(dmn->ctx, &init_attr);
+	if (!send_ring->qp)  {
 		dr_dbg(dmn, "Couldn't create QP\n");
 		ret = errno;
 		goto clean_cq;
 	}
-	dmn->send_ring->cq.qp = dmn->send_ring->qp;
+	send_ring->cq.qp = send_ring->qp;
 
 	dmn->info.max_send_wr = QUEUE_SIZE;
-	dmn->info.max_inline_size = min(dmn->send_ring->qp->max_inline_data,
+	dmn->info.max_inline_size = min(send_ring->qp->max_inline_data,
 					DR_STE_SIZE);
 
-	dmn->send_ring->signal_th = dmn->info.max_send_wr / SIGNAL_PER_DIV_QUEUE;
+	send_ring->signal_th = dmn->info.max_send_wr / SIGNAL_PER_DIV_QUEUE;
 
 	/* Prepare qp to be used */
-	ret = dr_prepare_qp_to_rts(dmn);
+	ret = dr_prepare_qp_to_rts(dmn, send_ring->qp);
 	if (ret) {
 		dr_dbg(dmn, "Couldn't prepare QP\n");
 		goto clean_qp;
 	}
 
-	dmn->send_ring->max_post_send_size =
+	send_ring->max_post_send_size =
 		dr_icm_pool_chunk_size_to_byte(DR_CHUNK_SIZE_1K, DR_ICM_TYPE_STE);
 
 	/* Allocating the max size as a buffer for writing */
-	size = dmn->send_ring->signal_th * dmn->send_ring->max_post_send_size;
+	size = send_ring->signal_th * send_ring->max_post_send_size;
 	page_size = sysconf(_SC_PAGESIZE);
-	ret = posix_memalign(&dmn->send_ring->buf, page_size, size);
+	ret = posix_memalign(&send_ring->buf, page_size, size);
 	if (ret) {
 		dr_dbg(dmn, "Couldn't allocate send-ring buf.\n");
 		errno = ret;
 		goto clean_qp;
 	}
 
-	memset(dmn->send_ring->buf, 0, size);
-	dmn->send_ring->buf_size = size;
+	memset(send_ring->buf, 0, size);
+	send_ring->buf_size = size;
 
-	dmn->send_ring->mr = ibv_reg_mr(dmn->pd, dmn->send_ring->buf, size,
+	send_ring->mr = ibv_reg_mr(dmn->pd, send_ring->buf, size,
 					access_flags);
-	if (!dmn->send_ring->mr) {
+	if (!send_ring->mr) {
 		dr_dbg(dmn, "Couldn't register send-ring MR\n");
 		ret = errno;
 		goto free_mem;
 	}
 
-	dmn->send_ring->sync_mr = ibv_reg_mr(dmn->pd, dmn->send_ring->sync_buff,
+	send_ring->sync_mr = ibv_reg_mr(dmn->pd, send_ring->sync_buff,
 					     MIN_READ_SYNC,
 					     IBV_ACCESS_LOCAL_WRITE |
 					     IBV_ACCESS_REMOTE_READ |
 					     IBV_ACCESS_REMOTE_WRITE);
-	if (!dmn->send_ring->sync_mr) {
+	if (!send_ring->sync_mr) {
 		dr_dbg(dmn, "Couldn't register sync mr\n");
 		ret = errno;
 		goto clean_mr;
 	}
 
+	dmn->send_ring[dmn->num_send_rings++] = send_ring;
 	return 0;
 
 clean_mr:
-	ibv_dereg_mr(dmn->send_ring->mr);
+	ibv_dereg_mr(send_ring->mr);
 free_mem:
-	free(dmn->send_ring->buf);
+	free(send_ring->buf);
 clean_qp:
-	dr_destroy_qp(dmn->send_ring->qp);
+	dr_destroy_qp(send_ring->qp);
 clean_cq:
-	ibv_destroy_cq(dmn->send_ring->cq.ibv_cq);
+	ibv_destroy_cq(send_ring->cq.ibv_cq);
 free_send_ring:
-	free(dmn->send_ring);
+	free(send_ring);
 
 	return ret;
 }
 
 void dr_send_ring_free(struct dr_send_ring *send_ring)
 {
+	if (!send_ring->qp) {
+		free(send_ring);
+		return;
+	}
+
 	dr_destroy_qp(send_ring->qp);
 	ibv_destroy_cq(send_ring->cq.ibv_cq);
 	ibv_dereg_mr(send_ring->sync_mr);
@@ -1047,33 +1227,112 @@ void dr_send_ring_free(struct dr_send_ring *send_ring)
 	free(send_ring);
 }
 
-int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
+/*
+ * Rules of a matcher are written on the ring of the matcher, the rest on ring
+ * 0. Called on matcher creation with the domain locked.
+ */
+uint8_t dr_send_ring_select(struct mlx5dv_dr_domain *dmn)
 {
-	struct dr_send_ring *send_ring = dmn->send_ring;
-	struct postsend_info send_info = {};
-	uint8_t data[DR_STE_SIZE];
-	int i, num_of_sends_req;
-	int ret;
+	uint8_t ring_idx = dmn->next_send_ring++ % DR_MAX_SEND_RINGS;
 
-	/* Sending this amount of requests makes sure we will get drain */
-	num_of_sends_req = send_ring->signal_th * TH_NUMS_TO_DRAIN / 2;
+	/* Add rings on demand, on failure share one of the existing rings */
+	if (ring_idx == dmn->num_send_rings && dr_send_ring_alloc(dmn))
+		dr_dbg(dmn, "Couldn't add send-ring, sharing an existing one\n");
 
-	/* Send fake requests forcing the last to be signaled */
-	send_info.write.addr	= (uintptr_t) data;
-	send_info.write.length	= DR_STE_SIZE;
-	send_info.write.lkey	= 0;
-	/* Using the sync_mr in order to write/read */
-	send_info.remote_addr	= (uintptr_t) send_ring->sync_mr->addr;
-	send_info.rkey		= send_ring->sync_mr->rkey;
+	return ring_idx % dmn->num_send_rings;
+}
 
+int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
+{
+	int i, ret;
 
-	for (i = 0; i < num_of_sends_req; i++) {
-		ret = dr_postsend_icm_data(dmn, &send_info);
+	for (i = 0; i < dmn->num_send_rings; i++) {
+		ret = dr_send_ring_drain(dmn, i);
 		if (ret)
 			return ret;
 	}
+
+	return 0;
+}
+
+/*
+ * Writes on different rings may complete out of order. Before a write on one
+ * ring depends on writes made on others (connecting tables, reusing freed
+ * ICM), the other rings must be drained.
+ */
+int dr_send_ring_order_writes(struct mlx5dv_dr_domain *dmn)
+{
+	if (dmn->num_send_rings == 1)
+		return 0;
+
+	return dr_send_ring_force_drain(dmn);
+}
+
+void dr_send_ring_query(struct dr_send_ring *send_ring,
+			uint64_t *num_stalls, uint64_t *stall_time_ns)
+{
 	pthread_mutex_lock(&send_ring->mutex);
-	ret = dr_handle_pending_wc(dmn, send_ring);
+	*num_stalls = send_ring->num_stalls;
+	*stall_time_ns = send_ring->stall_time_ns;
 	pthread_mutex_unlock(&send_ring->mutex);
-	return ret;
+}
+
+/* Position on the ring right after the last write posted so far */
+uint32_t dr_send_ring_get_mark(struct mlx5dv_dr_domain *dmn, uint8_t ring_idx)
+{
+	struct dr_send_ring *send_ring = dmn->send_ring[ring_idx];
+	uint32_t mark;
+
+	if (dr_domain_is_emu(dmn))
+		return 0;
+
+	pthread_mutex_lock(&send_ring->mutex);
+	mark = send_ring->qp->sq.head;
+	pthread_mutex_unlock(&send_ring->mutex);
+
+	return mark;
+}
+
+/*
+ * Checks without waiting whether the HW executed the writes posted on a ring
+ * before @mark was taken. Only every signal_th WQE asks for a completion, so
+ * when none follows the mark the ring is padded up to the next signaled one.
+ */
+int dr_send_ring_poll_mark(struct mlx5dv_dr_domain *dmn, uint8_t ring_idx,
+			   uint32_t mark, bool *done)
+{
+	struct dr_send_ring *send_ring = dmn->send_ring[ring_idx];
+	uint32_t unsignaled;
+	int ne = 0;
+
+	*done = true;
+	if (dr_domain_is_emu(dmn) || dr_is_device_fatal(dmn))
+		return 0;
+
+	pthread_mutex_lock(&send_ring->mutex);
+	while (send_ring->pending_wqe >= send_ring->signal_th) {
+		ne = dr_poll_cq(&send_ring->cq, 1);
+		if (ne <= 0)
+			break;
+		send_ring->pending_wqe -= send_ring->signal_th;
+	}
+
+	*done = (int32_t)(send_ring->qp->sq.tail - mark) >= 0;
+	unsignaled = send_ring->pending_wqe % send_ring->signal_th;
+	if (*done ||
+	    (int32_t)(send_ring->qp->sq.head - unsignaled - mark) >= 0)
+		unsignaled = 0;
+	pthread_mutex_unlock(&send_ring->mutex);
+
+	if (ne < 0) {
+		dr_dbg(dmn, "poll CQ failed\n");
+		return ne;
+	}
+
+	if (!unsignaled)
+		return 0;
+
+	/* A WQE pair is posted per write, the last read gets signaled */
+	return dr_send_ring_post_nops(dmn, ring_idx,
+				      (send_ring->signal_th - unsignaled) / 2);
 }
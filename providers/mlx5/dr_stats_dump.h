@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0 OR Linux-OpenIB */
+/*
+ * Binary format written by mlx5dv_dump_dr_domain_stats() and read by the
+ * mlx5dv_dr_stats tool.
+ *
+ * A dump is a header followed by records. A record is its type and number
+ * of values, followed by the values, everything little endian and the
+ * values 64 bit wide. Values are only ever appended to a record, readers
+ * skip the ones past those they know and record types they don't know.
+ */
+
+#ifndef _DR_STATS_DUMP_H_
+#define _DR_STATS_DUMP_H_
+
+#include <linux/types.h>
+#include "mlx5dv.h"
+
+#define DR_STATS_DUMP_MAGIC	0x5244354d /* "M5DR" */
+#define DR_STATS_DUMP_VERSION	1
+
+struct dr_stats_dump_hdr {
+	__le32	magic;
+	__le32	version;
+};
+
+struct dr_stats_dump_rec {
+	__le16	type;
+	__le16	num_vals;
+};
+
+enum dr_stats_dump_rec_type {
+	DR_STATS_DUMP_REC_DOMAIN = 1,
+	DR_STATS_DUMP_REC_TABLE = 2,
+	DR_STATS_DUMP_REC_MATCHER = 3,
+};
+
+enum dr_stats_dump_domain {
+	DR_STATS_DUMP_DOMAIN_ID,
+	DR_STATS_DUMP_DOMAIN_TYPE,
+	DR_STATS_DUMP_DOMAIN_STE_ICM_TOTAL,
+	DR_STATS_DUMP_DOMAIN_ACTION_ICM,
+	DR_STATS_DUMP_DOMAIN_ACTION_ICM_TOTAL,
+	DR_STATS_DUMP_DOMAIN_SEND_STALLS,
+	DR_STATS_DUMP_DOMAIN_SEND_STALL_NS,
+	/* STE ICM in use, one value per chunk size */
+	DR_STATS_DUMP_DOMAIN_STE_ICM,
+	DR_STATS_DUMP_DOMAIN_NUM_VALS =
+		DR_STATS_DUMP_DOMAIN_STE_ICM + MLX5DV_DR_ICM_CHUNK_SIZES,
+};
+
+enum dr_stats_dump_table {
+	DR_STATS_DUMP_TABLE_ID,
+	DR_STATS_DUMP_TABLE_LEVEL,
+	DR_STATS_DUMP_TABLE_NUM_VALS,
+};
+
+enum dr_stats_dump_matcher {
+	DR_STATS_DUMP_MATCHER_ID,
+	DR_STATS_DUMP_MATCHER_TABLE_ID,
+	DR_STATS_DUMP_MATCHER_PRIO,
+	DR_STATS_DUMP_MATCHER_NUM_RULES,
+	DR_STATS_DUMP_MATCHER_LOG_HTBL_SIZE,
+	DR_STATS_DUMP_MATCHER_HTBL_VALID_ENTRIES,
+	DR_STATS_DUMP_MATCHER_HTBL_COLLISIONS,
+	DR_STATS_DUMP_MATCHER_NUM_COLLISIONS,
+	DR_STATS_DUMP_MATCHER_MAX_MISS_LIST_LEN,
+	DR_STATS_DUMP_MATCHER_NUM_REHASH,
+	DR_STATS_DUMP_MATCHER_REHASH_NS,
+	DR_STATS_DUMP_MATCHER_MAX_REHASH_NS,
+	/* Histogram of miss list lengths */
+	DR_STATS_DUMP_MATCHER_MISS_LIST_LEN,
+	DR_STATS_DUMP_MATCHER_NUM_VALS =
+		DR_STATS_DUMP_MATCHER_MISS_LIST_LEN +
+		MLX5DV_DR_MISS_LIST_LEN_HIST,
+};
+
+#endif /* _DR_STATS_DUMP_H_ */
@@ -38,34 +38,33 @@ struct dr_hw_ste_format {
 	uint8_t mask[DR_STE_SIZE_MASK];
 };
 
-uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p,
-				struct dr_ste_htbl *htbl)
+uint32_t dr_ste_calc_tag_hash_index(uint8_t *tag, uint16_t byte_mask,
+				    uint32_t num_of_entries)
 {
-	struct dr_hw_ste_format *hw_ste = (struct dr_hw_ste_format *)hw_ste_p;
-	uint8_t masked[DR_STE_SIZE_TAG] = {};
+	uint8_t masked[DR_STE_SIZE_TAG];
 	uint32_t crc32, index;
-	uint16_t bit;
-	int i;
 
 	/* Don't calculate CRC if the result is predicted */
-	if (htbl->chunk->num_of_entries == 1 || htbl->byte_mask == 0)
+	if (num_of_entries == 1 || byte_mask == 0)
 		return 0;
 
-	/* Mask tag using byte mask, bit per byte */
-	bit = 1 << (DR_STE_SIZE_TAG - 1);
-	for (i = 0; i < DR_STE_SIZE_TAG; i++) {
-		if (htbl->byte_mask & bit)
-			masked[i] = hw_ste->tag[i];
+	dr_ste_mask_tag(masked, tag, byte_mask);
 
-		bit = bit >> 1;
-	}
-
-	crc32 = dr_crc32_slice8_calc(masked, DR_STE_SIZE_TAG);
-	index = crc32 % htbl->chunk->num_of_entries;
+	crc32 = dr_crc32_tag_calc(masked);
+	index = crc32 % num_of_entries;
 
 	return index;
 }
 
+uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p,
+				struct dr_ste_htbl *htbl)
+{
+	struct dr_hw_ste_format *hw_ste = (struct dr_hw_ste_format *)hw_ste_p;
+
+	return dr_ste_calc_tag_hash_index(hw_ste->tag, htbl->byte_mask,
+					  htbl->chunk->num_of_entries);
+}
+
 uint16_t dr_ste_conv_bit_to_byte_mask(uint8_t *bit_mask)
 {
 	uint16_t byte_mask = 0;
@@ -187,7 +186,7 @@ static void dr_ste_replace(struct dr_ste *dst, struct dr_ste *src)
 	memcpy(dst->hw_ste, src->hw_ste, DR_STE_SIZE_REDUCED);
 	dst->next_htbl = src->next_htbl;
 	if (dst->next_htbl)
-		dst->next_htbl->pointing_ste = dst;
+		dr_htbl_set_pointing_ste(dst->next_htbl, dst);
 
 	atomic_init(&dst->refcount, atomic_load(&src->refcount));
 }
@@ -313,12 +312,14 @@ void dr_ste_free(struct dr_ste *ste,
 	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
 	struct dr_ste_send_info ste_info_head;
 	struct dr_ste *next_ste, *first_ste;
+	struct dr_ste_htbl_rehash *rehash;
 	bool put_on_origin_table = true;
 	struct dr_ste_htbl *stats_tbl;
 	LIST_HEAD(send_ste_list);
 
 	first_ste = list_top(dr_ste_get_miss_list(ste), struct dr_ste, miss_list_node);
 	stats_tbl = first_ste->htbl;
+	rehash = stats_tbl->rehash;
 	/*
 	 * Two options:
 	 * 1. ste is head:
@@ -352,11 +353,15 @@ void dr_ste_free(struct dr_ste *ste,
 		list_del(&cur_ste_info->send_list);
 		dr_send_postsend_ste(dmn, cur_ste_info->ste,
 				     cur_ste_info->data, cur_ste_info->size,
-				     cur_ste_info->offset);
+				     cur_ste_info->offset, matcher->ring_idx);
 	}
 
 	if (put_on_origin_table)
 		dr_htbl_put(ste->htbl);
+
+	/* The last rule of a table being rehashed is gone, drop both copies */
+	if (rehash)
+		dr_rule_rehash_release(rehash, false);
 }
 
 bool dr_ste_equal_tag(void *src, void *dst)
@@ -406,7 +411,8 @@ int dr_ste_htbl_init_and_postsend(struct mlx5dv_dr_domain *dmn,
 				  struct dr_domain_rx_tx *nic_dmn,
 				  struct dr_ste_htbl *htbl,
 				  struct dr_htbl_connect_info *connect_info,
-				  bool update_hw_ste)
+				  bool update_hw_ste,
+				  uint8_t ring_idx)
 {
 	uint8_t formated_ste[DR_STE_SIZE] = {};
 
@@ -417,7 +423,8 @@ int dr_ste_htbl_init_and_postsend(struct mlx5dv_dr_domain *dmn,
 				formated_ste,
 				connect_info);
 
-	return dr_send_postsend_formated_htbl(dmn, htbl, formated_ste, update_hw_ste);
+	return dr_send_postsend_formated_htbl(dmn, htbl, formated_ste,
+					      update_hw_ste, ring_idx);
 }
 
 int dr_ste_create_next_htbl(struct mlx5dv_dr_matcher *matcher,
@@ -452,7 +459,8 @@ int dr_ste_create_next_htbl(struct mlx5dv_dr_matcher *matcher,
 		info.type = CONNECT_MISS;
 		info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
 		if (dr_ste_htbl_init_and_postsend(dmn, nic_dmn, next_htbl,
-						  &info, false)) {
+						  &info, false,
+						  matcher->ring_idx)) {
 			dr_dbg(dmn, "Failed writing table to HW\n");
 			goto free_table;
 		}
@@ -724,6 +732,33 @@ int dr_ste_build_ste_arr(struct mlx5dv_dr_matcher *matcher,
 	return 0;
 }
 
+/*
+ * Rebuild the last match STE of a rule as dr_ste_build_ste_arr() does,
+ * before any action is set on it. The tag and the miss address are taken
+ * from the STE in use, ste.
+ */
+void dr_ste_build_last_ste(struct mlx5dv_dr_matcher *matcher,
+			   struct dr_matcher_rx_tx *nic_matcher,
+			   struct dr_ste *ste,
+			   uint8_t *hw_ste)
+{
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
+	struct dr_ste_build *sb;
+
+	sb = &nic_matcher->ste_builder[nic_matcher->num_of_builders - 1];
+	ste_ctx->ste_init(hw_ste,
+			  sb->lu_type,
+			  nic_dmn->ste_type,
+			  dmn->info.caps.gvmi);
+
+	dr_ste_set_bit_mask(hw_ste, sb->bit_mask);
+	memcpy(dr_ste_get_tag(hw_ste), dr_ste_get_tag(ste->hw_ste),
+	       DR_STE_SIZE_TAG);
+	ste_ctx->set_miss_addr(hw_ste, ste_ctx->get_miss_addr(ste->hw_ste));
+}
+
 static void dr_ste_copy_mask_misc(char *mask, struct dr_match_misc *spec)
 {
 	spec->gre_c_present = DEVX_GET(dr_match_set_misc, mask, gre_c_present);
@@ -33,6 +33,11 @@
 #ifndef	_DR_STE_
 #define	_DR_STE_
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <ccan/array_size.h>
 #include "mlx5dv_dr.h"
 
@@ -57,6 +62,45 @@
 #define HDR_LEN_L2        (HDR_LEN_L2_MACS + HDR_LEN_L2_ETHER)
 #define HDR_LEN_L2_W_VLAN (HDR_LEN_L2 + HDR_LEN_L2_VLAN)
 
+/* Mask tag using byte mask, bit per byte, MSB for the first byte */
+static inline void dr_ste_mask_tag(uint8_t *masked, const uint8_t *tag,
+				   uint16_t byte_mask)
+{
+#if defined(__SSE2__)
+	const __m128i bits = _mm_set_epi8(0x01, 0x02, 0x04, 0x08,
+					  0x10, 0x20, 0x40, (char)0x80,
+					  0x01, 0x02, 0x04, 0x08,
+					  0x10, 0x20, 0x40, (char)0x80);
+	__m128i sel;
+
+	/* Second byte of the mask for the first 8 bytes, first for the rest */
+	sel = _mm_set_epi64x((byte_mask & 0xff) * 0x0101010101010101ULL,
+			     (byte_mask >> 8) * 0x0101010101010101ULL);
+	sel = _mm_cmpeq_epi8(_mm_and_si128(sel, bits), bits);
+	sel = _mm_and_si128(_mm_loadu_si128((const __m128i *)tag), sel);
+	_mm_storeu_si128((__m128i *)masked, sel);
+#elif defined(__ARM_NEON)
+	static const uint8_t bits[DR_STE_SIZE_TAG] = {
+		0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+		0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+	};
+	uint8x16_t sel;
+
+	sel = vcombine_u8(vdup_n_u8(byte_mask >> 8), vdup_n_u8(byte_mask & 0xff));
+	sel = vtstq_u8(sel, vld1q_u8(bits));
+	vst1q_u8(masked, vandq_u8(vld1q_u8(tag), sel));
+#else
+	uint16_t bit;
+	int i;
+
+	bit = 1 << (DR_STE_SIZE_TAG - 1);
+	for (i = 0; i < DR_STE_SIZE_TAG; i++) {
+		masked[i] = (byte_mask & bit) ? tag[i] : 0;
+		bit = bit >> 1;
+	}
+#endif
+}
+
 /* Read from layout struct */
 #define DR_STE_GET(typ, p, fld) DEVX_GET(ste_##typ, p, fld)
 
@@ -162,11 +206,13 @@ struct dr_ste_ctx {
 	/* Getters and Setters */
 	void (*ste_init)(uint8_t *hw_ste_p, uint16_t lu_type,
 			 uint8_t entry_type, uint16_t gvmi);
+	uint16_t (*get_lu_type)(uint8_t *hw_ste_p);
 	void (*set_next_lu_type)(uint8_t *hw_ste_p, uint16_t lu_type);
 	uint16_t (*get_next_lu_type)(uint8_t *hw_ste_p);
 	void (*set_miss_addr)(uint8_t *hw_ste_p, uint64_t miss_addr);
 	uint64_t (*get_miss_addr)(uint8_t *hw_ste_p);
 	void (*set_hit_addr)(uint8_t *hw_ste_p, uint64_t icm_addr, uint32_t ht_size);
+	uint64_t (*get_hit_addr)(uint8_t *hw_ste_p, uint32_t *ht_size);
 	void (*set_byte_mask)(uint8_t *hw_ste_p, uint16_t byte_mask);
 	uint16_t (*get_byte_mask)(uint8_t *hw_ste_p);
 
@@ -315,6 +315,14 @@ static void dr_ste_v1_set_lu_type(uint8_t *hw_ste_p, uint16_t lu_type)
 	DR_STE_SET(match_bwc_v1, hw_ste_p, match_definer_ctx_idx, lu_type & 0xFF);
 }
 
+static uint16_t dr_ste_v1_get_lu_type(uint8_t *hw_ste_p)
+{
+	uint8_t mode = DR_STE_GET(match_bwc_v1, hw_ste_p, entry_format);
+	uint8_t index = DR_STE_GET(match_bwc_v1, hw_ste_p, match_definer_ctx_idx);
+
+	return (mode << 8 | index);
+}
+
 static void dr_ste_v1_set_next_lu_type(uint8_t *hw_ste_p, uint16_t lu_type)
 {
 	DR_STE_SET(match_bwc_v1, hw_ste_p, next_entry_format, lu_type >> 8);
@@ -337,6 +345,18 @@ static void dr_ste_v1_set_hit_addr(uint8_t *hw_ste_p, uint64_t icm_addr, uint32_
 	DR_STE_SET(match_bwc_v1, hw_ste_p, next_table_base_31_5_size, index);
 }
 
+static uint64_t dr_ste_v1_get_hit_addr(uint8_t *hw_ste_p, uint32_t *ht_size)
+{
+	uint64_t index =
+		(DR_STE_GET(match_bwc_v1, hw_ste_p, next_table_base_31_5_size) |
+		 (uint64_t)DR_STE_GET(match_bwc_v1, hw_ste_p, next_table_base_39_32_size) << 27);
+
+	/* The table is aligned to its size, so the size is the lowest set bit */
+	*ht_size = index & -index;
+
+	return (index & ~(uint64_t)*ht_size) << 5;
+}
+
 static void dr_ste_v1_init(uint8_t *hw_ste_p, uint16_t lu_type,
 			   uint8_t entry_type, uint16_t gvmi)
 {
@@ -1638,11 +1658,13 @@ static struct dr_ste_ctx ste_ctx_v1 = {
 	.build_src_gvmi_qpn_init	= &dr_ste_v1_build_src_gvmi_qpn_init,
 	/* Getters and Setters */
 	.ste_init			= &dr_ste_v1_init,
+	.get_lu_type			= &dr_ste_v1_get_lu_type,
 	.set_next_lu_type		= &dr_ste_v1_set_next_lu_type,
 	.get_next_lu_type		= &dr_ste_v1_get_next_lu_type,
 	.set_miss_addr			= &dr_ste_v1_set_miss_addr,
 	.get_miss_addr			= &dr_ste_v1_get_miss_addr,
 	.set_hit_addr			= &dr_ste_v1_set_hit_addr,
+	.get_hit_addr			= &dr_ste_v1_get_hit_addr,
 	.set_byte_mask			= &dr_ste_v1_set_byte_mask,
 	.get_byte_mask			= &dr_ste_v1_get_byte_mask,
 	/* Actions */
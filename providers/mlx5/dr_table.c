@@ -78,7 +78,7 @@ static int dr_table_init_nic(struct mlx5dv_dr_domain *dmn,
 	info.type = CONNECT_MISS;
 	info.miss_icm_addr = nic_dmn->default_icm_addr;
 	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn, nic_tbl->s_anchor,
-					    &info, true);
+					    &info, true, 0);
 	if (ret)
 		goto free_s_anchor;
 
@@ -145,6 +145,10 @@ static int dr_table_create_devx_tbl(struct mlx5dv_dr_table *tbl)
 {
 	struct dr_devx_flow_table_attr ft_attr = {};
 
+	/* Emulated ICM tables are only reachable through the SW walker */
+	if (dr_domain_is_emu(tbl->dmn))
+		return 0;
+
 	ft_attr.type = tbl->table_type;
 	ft_attr.level = tbl->dmn->info.caps.max_ft_level - 1;
 	ft_attr.sw_owner = true;
@@ -170,7 +174,8 @@ struct mlx5dv_dr_table *mlx5dv_dr_table_create(struct mlx5dv_dr_domain *dmn,
 
 	atomic_fetch_add(&dmn->refcount, 1);
 
-	if (level && !dmn->info.supp_sw_steering) {
+	if ((level && !dmn->info.supp_sw_steering) ||
+	    (!level && dr_domain_is_emu(dmn))) {
 		errno = EOPNOTSUPP;
 		goto dec_ref;
 	}
@@ -190,6 +195,11 @@ struct mlx5dv_dr_table *mlx5dv_dr_table_create(struct mlx5dv_dr_domain *dmn,
 		if (ret)
 			goto free_tbl;
 
+		/* Rules pointing to the table may be written on any ring */
+		ret = dr_send_ring_order_writes(dmn);
+		if (ret)
+			goto uninit_tbl;
+
 		ret = dr_table_create_devx_tbl(tbl);
 		if (ret)
 			goto uninit_tbl;
@@ -219,7 +229,7 @@ int mlx5dv_dr_table_destroy(struct mlx5dv_dr_table *tbl)
 	if (atomic_load(&tbl->refcount) > 1)
 		return EBUSY;
 
-	if (!dr_is_root_table(tbl)) {
+	if (!dr_is_root_table(tbl) && tbl->devx_obj) {
 		ret = mlx5dv_devx_obj_destroy(tbl->devx_obj);
 		if (ret)
 			return ret;
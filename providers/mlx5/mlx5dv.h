@@ -1471,11 +1471,48 @@ int mlx5dv_dr_domain_sync(struct mlx5dv_dr_domain *domain, uint32_t flags);
 void mlx5dv_dr_domain_set_reclaim_device_memory(struct mlx5dv_dr_domain *dmn,
 						bool enable);
 
+enum mlx5dv_dr_domain_emu_flags {
+	MLX5DV_DR_DOMAIN_EMU_FLAGS_STE_V1	= 1 << 0,
+};
+
+struct mlx5dv_dr_domain *
+mlx5dv_dr_domain_create_emu(enum mlx5dv_dr_domain_type type, uint32_t flags);
+
+struct mlx5dv_dr_domain_emu_stats {
+	uint64_t	icm_bytes;
+	uint64_t	write_ops;
+	uint64_t	write_bytes;
+};
+
+int mlx5dv_dr_domain_emu_query(struct mlx5dv_dr_domain *domain,
+			       struct mlx5dv_dr_domain_emu_stats *stats);
+
 struct mlx5dv_dr_table *
 mlx5dv_dr_table_create(struct mlx5dv_dr_domain *domain, uint32_t level);
 
 int mlx5dv_dr_table_destroy(struct mlx5dv_dr_table *table);
 
+enum mlx5dv_dr_emu_match_flags {
+	MLX5DV_DR_EMU_MATCH_FLAGS_TX	= 1 << 0,
+};
+
+enum mlx5dv_dr_emu_fate {
+	MLX5DV_DR_EMU_FATE_DROP,
+	MLX5DV_DR_EMU_FATE_DEFAULT,
+	MLX5DV_DR_EMU_FATE_OTHER,
+};
+
+struct mlx5dv_dr_emu_match_result {
+	struct mlx5dv_dr_rule	*rule;
+	enum mlx5dv_dr_emu_fate	fate;
+	uint64_t		icm_addr;
+	uint32_t		num_lookups;
+};
+
+int mlx5dv_dr_table_emu_match(struct mlx5dv_dr_table *table, uint32_t flags,
+			      struct mlx5dv_flow_match_parameters *packet,
+			      struct mlx5dv_dr_emu_match_result *result);
+
 struct mlx5dv_dr_matcher *
 mlx5dv_dr_matcher_create(struct mlx5dv_dr_table *table,
 			 uint16_t priority,
@@ -1484,6 +1521,19 @@ mlx5dv_dr_matcher_create(struct mlx5dv_dr_table *table,
 
 int mlx5dv_dr_matcher_destroy(struct mlx5dv_dr_matcher *matcher);
 
+enum mlx5dv_dr_matcher_layout_flags {
+	MLX5DV_DR_MATCHER_LAYOUT_RESIZABLE	= 1 << 0,
+	MLX5DV_DR_MATCHER_LAYOUT_NUM_RULE	= 1 << 1,
+};
+
+struct mlx5dv_dr_matcher_layout {
+	uint32_t	flags; /* use enum mlx5dv_dr_matcher_layout_flags */
+	uint32_t	log_num_of_rules_hint;
+};
+
+int mlx5dv_dr_matcher_set_layout(struct mlx5dv_dr_matcher *matcher,
+				 struct mlx5dv_dr_matcher_layout *layout);
+
 struct mlx5dv_dr_rule *
 mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 		      struct mlx5dv_flow_match_parameters *value,
@@ -1492,6 +1542,67 @@ mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 
 int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule);
 
+struct mlx5dv_dr_rule_bulk_attr {
+	struct mlx5dv_flow_match_parameters	*value;
+	size_t					num_actions;
+	struct mlx5dv_dr_action			**actions;
+};
+
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       size_t num_rules,
+			       struct mlx5dv_dr_rule_bulk_attr *attr,
+			       struct mlx5dv_dr_rule *rules[]);
+
+int mlx5dv_dr_rule_destroy_bulk(size_t num_rules,
+				struct mlx5dv_dr_rule *rules[]);
+
+int mlx5dv_dr_rule_modify_actions(struct mlx5dv_dr_rule *rule,
+				  size_t num_actions,
+				  struct mlx5dv_dr_action *actions[]);
+
+struct mlx5dv_dr_rule_modify_attr {
+	struct mlx5dv_dr_rule		*rule;
+	size_t				num_actions;
+	struct mlx5dv_dr_action		**actions;
+};
+
+int mlx5dv_dr_rule_modify_actions_bulk(size_t num_rules,
+				       struct mlx5dv_dr_rule_modify_attr *attr);
+
+struct mlx5dv_dr_rule_queue;
+
+enum mlx5dv_dr_rule_queue_op {
+	MLX5DV_DR_RULE_QUEUE_OP_CREATE,
+	MLX5DV_DR_RULE_QUEUE_OP_DESTROY,
+};
+
+struct mlx5dv_dr_rule_queue_comp {
+	void				*user_data;
+	struct mlx5dv_dr_rule		*rule; /* NULL for destroy */
+	enum mlx5dv_dr_rule_queue_op	op;
+};
+
+struct mlx5dv_dr_rule_queue *
+mlx5dv_dr_rule_queue_create(struct mlx5dv_dr_domain *domain, uint32_t size);
+
+int mlx5dv_dr_rule_queue_destroy(struct mlx5dv_dr_rule_queue *queue);
+
+struct mlx5dv_dr_rule *
+mlx5dv_dr_rule_create_async(struct mlx5dv_dr_rule_queue *queue,
+			    struct mlx5dv_dr_matcher *matcher,
+			    struct mlx5dv_flow_match_parameters *value,
+			    size_t num_actions,
+			    struct mlx5dv_dr_action *actions[],
+			    void *user_data);
+
+int mlx5dv_dr_rule_destroy_async(struct mlx5dv_dr_rule_queue *queue,
+				 struct mlx5dv_dr_rule *rule,
+				 void *user_data);
+
+int mlx5dv_dr_rule_queue_poll(struct mlx5dv_dr_rule_queue *queue,
+			      struct mlx5dv_dr_rule_queue_comp comps[],
+			      uint32_t num_comps);
+
 enum mlx5dv_dr_action_flags {
 	MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL	= 1 << 0,
 };
@@ -1577,6 +1688,41 @@ int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *domain);
 int mlx5dv_dump_dr_table(FILE *fout, struct mlx5dv_dr_table *table);
 int mlx5dv_dump_dr_matcher(FILE *fout, struct mlx5dv_dr_matcher *matcher);
 int mlx5dv_dump_dr_rule(FILE *fout, struct mlx5dv_dr_rule *rule);
+int mlx5dv_dump_dr_domain_stats(FILE *fout, struct mlx5dv_dr_domain *domain);
+
+#define MLX5DV_DR_ICM_CHUNK_SIZES	22
+#define MLX5DV_DR_MISS_LIST_LEN_HIST	8
+
+struct mlx5dv_dr_domain_stats {
+	/* STE ICM in use by chunks of 2^i entries */
+	uint64_t	ste_icm_bytes[MLX5DV_DR_ICM_CHUNK_SIZES];
+	uint64_t	ste_icm_total_bytes;
+	uint64_t	action_icm_bytes;
+	uint64_t	action_icm_total_bytes;
+	uint64_t	num_send_stalls;
+	uint64_t	send_stall_time_ns;
+};
+
+int mlx5dv_dr_domain_query_stats(struct mlx5dv_dr_domain *domain,
+				 struct mlx5dv_dr_domain_stats *stats);
+
+struct mlx5dv_dr_matcher_stats {
+	uint64_t	num_rules;
+	/* First hash table of the matcher */
+	uint32_t	log_htbl_size;
+	uint32_t	htbl_valid_entries;
+	uint32_t	htbl_collisions;
+	/* Collision entries added to all the matcher tables */
+	uint64_t	num_collisions;
+	uint64_t	miss_list_len[MLX5DV_DR_MISS_LIST_LEN_HIST];
+	uint32_t	max_miss_list_len;
+	uint64_t	num_rehash;
+	uint64_t	rehash_time_ns;
+	uint64_t	max_rehash_time_ns;
+};
+
+int mlx5dv_dr_matcher_query_stats(struct mlx5dv_dr_matcher *matcher,
+				  struct mlx5dv_dr_matcher_stats *stats);
 
 struct mlx5dv_pp {
 	uint16_t index;
@@ -37,12 +37,14 @@
 #include <ccan/minmax.h>
 #include <ccan/bitmap.h>
 #include <stdatomic.h>
+#include <time.h>
 #include "mlx5dv.h"
 #include "mlx5_ifc.h"
 #include "mlx5.h"
 
 #define DR_RULE_MAX_STES	17
 #define DR_ACTION_MAX_STES	5
+#define DR_MAX_SEND_RINGS	8
 #define WIRE_PORT		0xFFFF
 #define DR_STE_SVLAN		0x1
 #define DR_STE_CVLAN		0x2
@@ -51,6 +53,14 @@
 
 #define dr_dbg(dmn, arg...) dr_dbg_ctx((dmn)->ctx, ##arg)
 
+static inline uint64_t dr_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 #define dr_dbg_ctx(ctx, arg...)					\
 	mlx5_dbg(to_mctx(ctx)->dbg_fp, MLX5_DBG_DR, ##arg);
 
@@ -162,6 +172,7 @@ struct dr_match_param;
 struct dr_devx_caps;
 struct dr_rule_rx_tx;
 struct dr_matcher_rx_tx;
+struct dr_rule_bulk_nic;
 struct dr_ste_ctx;
 
 struct dr_data_seg {
@@ -224,6 +235,29 @@ struct dr_ste_htbl {
 	struct dr_ste		*pointing_ste;
 
 	struct dr_ste_htbl_ctrl ctrl;
+
+	/* set on both tables while an incremental rehash is in progress */
+	struct dr_ste_htbl_rehash *rehash;
+};
+
+/*
+ * Incremental rehash of cur_htbl into new_htbl. new_htbl is first written
+ * to HW, a slice per insertion, with each entry missing to the cur_htbl
+ * bucket of the same hash index. Once connected in place of cur_htbl, the
+ * buckets are migrated a few per insertion, and always before an insertion
+ * that lands on them. Both tables are held until the last bucket moves.
+ */
+struct dr_ste_htbl_rehash {
+	struct dr_ste_htbl	*cur_htbl;
+	struct dr_ste_htbl	*new_htbl;
+	uint8_t			ste_location;
+	bool			connected;
+	/* new_htbl entries written to HW while not connected */
+	uint32_t		num_formated;
+	/* cur_htbl buckets moved to new_htbl */
+	bitmap			*migrated;
+	uint32_t		num_migrated;
+	uint32_t		next_bucket;
 };
 
 struct dr_ste_send_info {
@@ -269,7 +303,20 @@ static inline void dr_htbl_get(struct dr_ste_htbl *htbl)
 	atomic_fetch_add(&htbl->refcount, 1);
 }
 
+/* Both tables of an incremental rehash hang from the same STE */
+static inline void dr_htbl_set_pointing_ste(struct dr_ste_htbl *htbl,
+					    struct dr_ste *ste)
+{
+	htbl->pointing_ste = ste;
+	if (htbl->rehash) {
+		htbl->rehash->cur_htbl->pointing_ste = ste;
+		htbl->rehash->new_htbl->pointing_ste = ste;
+	}
+}
+
 /* STE utils */
+uint32_t dr_ste_calc_tag_hash_index(uint8_t *tag, uint16_t byte_mask,
+				    uint32_t num_of_entries);
 uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p, struct dr_ste_htbl *htbl);
 void dr_ste_set_miss_addr(struct dr_ste_ctx *ste_ctx, uint8_t *hw_ste_p,
 			  uint64_t miss_addr);
@@ -382,6 +429,10 @@ int dr_ste_build_ste_arr(struct mlx5dv_dr_matcher *matcher,
 			 struct dr_matcher_rx_tx *nic_matcher,
 			 struct dr_match_param *value,
 			 uint8_t *ste_arr);
+void dr_ste_build_last_ste(struct mlx5dv_dr_matcher *matcher,
+			   struct dr_matcher_rx_tx *nic_matcher,
+			   struct dr_ste *ste,
+			   uint8_t *hw_ste);
 void dr_ste_build_eth_l2_src_dst(struct dr_ste_ctx *ste_ctx,
 				 struct dr_ste_build *sb,
 				 struct dr_match_param *mask,
@@ -715,8 +766,11 @@ struct dr_domain_rx_tx {
 	uint64_t		drop_icm_addr;
 	uint64_t		default_icm_addr;
 	enum dr_ste_entry_type	ste_type;
-	/* protect rx/tx domain */
-	pthread_mutex_t		mutex;
+	/*
+	 * protect rx/tx domain, rule operations take it shared and
+	 * serialize on their matcher mutex
+	 */
+	pthread_rwlock_t	lock;
 };
 
 struct dr_domain_info {
@@ -744,20 +798,42 @@ struct mlx5dv_dr_domain {
 	atomic_int			refcount;
 	struct dr_icm_pool		*ste_icm_pool;
 	struct dr_icm_pool		*action_icm_pool;
-	struct dr_send_ring		*send_ring;
+	/* Rings are added on demand, one per matcher up to the max */
+	struct dr_send_ring		*send_ring[DR_MAX_SEND_RINGS];
+	uint8_t				num_send_rings;
+	uint8_t				next_send_ring;
 	struct dr_domain_info		info;
 	struct list_head		tbl_list;
 	uint32_t			flags;
+	/* Set when ICM is emulated in host memory, see dr_emu.c */
+	struct dr_emu			*emu;
 };
 
+static inline bool dr_domain_is_emu(struct mlx5dv_dr_domain *dmn)
+{
+	return !!dmn->emu;
+}
+
+static inline void dr_domain_nic_lock_init(struct dr_domain_rx_tx *nic_dmn)
+{
+	pthread_rwlockattr_t attr;
+
+	/* Keep a stream of rule insertions from starving table changes */
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+				      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&nic_dmn->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+}
+
 static inline void dr_domain_nic_lock(struct dr_domain_rx_tx *nic_dmn)
 {
-	pthread_mutex_lock(&nic_dmn->mutex);
+	pthread_rwlock_wrlock(&nic_dmn->lock);
 }
 
 static inline void dr_domain_nic_unlock(struct dr_domain_rx_tx *nic_dmn)
 {
-	pthread_mutex_unlock(&nic_dmn->mutex);
+	pthread_rwlock_unlock(&nic_dmn->lock);
 }
 
 static inline void dr_domain_lock(struct mlx5dv_dr_domain *dmn)
@@ -789,6 +865,29 @@ struct mlx5dv_dr_table {
 	struct list_node		tbl_list;
 };
 
+/* Always on counters of a matcher side, protected by the matcher */
+struct dr_matcher_stats {
+	uint64_t	num_collisions;
+	/* STE insertions by the length of the miss list they joined */
+	uint64_t	miss_list_len[MLX5DV_DR_MISS_LIST_LEN_HIST];
+	uint32_t	max_miss_list_len;
+	uint64_t	num_rehash;
+	uint64_t	rehash_time_ns;
+	uint64_t	max_rehash_time_ns;
+};
+
+static inline void dr_matcher_stats_add_ste(struct dr_matcher_stats *stats,
+					    uint32_t miss_list_len)
+{
+	stats->miss_list_len[min_t(uint32_t, miss_list_len,
+				   MLX5DV_DR_MISS_LIST_LEN_HIST) - 1]++;
+	stats->max_miss_list_len = max(stats->max_miss_list_len,
+				       miss_list_len);
+}
+
+void dr_matcher_query_stats(struct mlx5dv_dr_matcher *matcher,
+			    struct mlx5dv_dr_matcher_stats *stats);
+
 struct dr_matcher_rx_tx {
 	struct dr_ste_htbl		*s_htbl;
 	struct dr_ste_htbl		*e_anchor;
@@ -796,6 +895,9 @@ struct dr_matcher_rx_tx {
 	uint8_t				num_of_builders;
 	uint64_t			default_icm_addr;
 	struct dr_table_rx_tx		*nic_tbl;
+	/* STE writes deferred by a bulk insertion, protected by the matcher */
+	struct dr_rule_bulk_nic		*bulk;
+	struct dr_matcher_stats		stats;
 };
 
 struct mlx5dv_dr_matcher {
@@ -809,8 +911,30 @@ struct mlx5dv_dr_matcher {
 	atomic_int			refcount;
 	struct mlx5dv_flow_matcher	*dv_matcher;
 	struct list_head		rule_list;
+	/* protect the matcher rules, taken under the shared domain lock */
+	pthread_mutex_t			mutex;
+	/* send ring used for the matcher rules */
+	uint8_t				ring_idx;
 };
 
+static inline void dr_matcher_lock(struct mlx5dv_dr_matcher *matcher)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+
+	pthread_rwlock_rdlock(&dmn->info.rx.lock);
+	pthread_rwlock_rdlock(&dmn->info.tx.lock);
+	pthread_mutex_lock(&matcher->mutex);
+}
+
+static inline void dr_matcher_unlock(struct mlx5dv_dr_matcher *matcher)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+
+	pthread_mutex_unlock(&matcher->mutex);
+	pthread_rwlock_unlock(&dmn->info.tx.lock);
+	pthread_rwlock_unlock(&dmn->info.rx.lock);
+}
+
 struct dr_ste_action_modify_field {
 	uint16_t hw_field;
 	uint8_t start;
@@ -952,6 +1076,26 @@ struct mlx5dv_dr_rule {
 	struct list_node	rule_list;
 };
 
+struct dr_rule_queue_op {
+	void				*user_data;
+	struct mlx5dv_dr_rule		*rule;
+	/* Ring position the HW must pass for the op to complete */
+	uint32_t			tx_mark;
+	uint8_t				ring_idx;
+	/* FW and emulated rules are in place once the call returns */
+	bool				done;
+	enum mlx5dv_dr_rule_queue_op	op;
+};
+
+struct mlx5dv_dr_rule_queue {
+	struct mlx5dv_dr_domain		*dmn;
+	struct dr_rule_queue_op		*ops;
+	uint32_t			size;
+	/* Oldest op not yet reported, ops are completed in order */
+	uint32_t			head;
+	uint32_t			num_ops;
+};
+
 void dr_rule_set_last_member(struct dr_rule_rx_tx *nic_rule,
 			     struct dr_ste *ste,
 			     bool force);
@@ -959,6 +1103,7 @@ void dr_rule_set_last_member(struct dr_rule_rx_tx *nic_rule,
 void dr_rule_get_reverse_rule_members(struct dr_ste **ste_arr,
 				      struct dr_ste *curr_ste,
 				      int *num_of_stes);
+void dr_rule_rehash_release(struct dr_ste_htbl_rehash *rehash, bool force);
 
 struct dr_icm_chunk {
 	struct dr_icm_buddy_mem *buddy_mem;
@@ -1130,6 +1275,16 @@ struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
 void dr_icm_pool_destroy(struct dr_icm_pool *pool);
 int dr_icm_pool_sync_pool(struct dr_icm_pool *pool);
 
+struct dr_icm_pool_stats {
+	/* Memory allocated from the device */
+	uint64_t	total_bytes;
+	/* Chunks in use, by chunk size */
+	uint64_t	num_chunks[DR_CHUNK_SIZE_MAX];
+};
+
+void dr_icm_pool_query(struct dr_icm_pool *pool,
+		       struct dr_icm_pool_stats *stats);
+
 struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
 					enum dr_icm_chunk_size chunk_size);
 void dr_icm_free_chunk(struct dr_icm_chunk *chunk);
@@ -1139,7 +1294,8 @@ int dr_ste_htbl_init_and_postsend(struct mlx5dv_dr_domain *dmn,
 				  struct dr_domain_rx_tx *nic_dmn,
 				  struct dr_ste_htbl *htbl,
 				  struct dr_htbl_connect_info *connect_info,
-				  bool update_hw_ste);
+				  bool update_hw_ste,
+				  uint8_t ring_idx);
 void dr_ste_set_formated_ste(struct dr_ste_ctx *ste_ctx,
 			     uint16_t gvmi,
 			     struct dr_domain_rx_tx *nic_dmn,
@@ -1152,6 +1308,7 @@ void dr_ste_copy_param(uint8_t match_criteria,
 
 void dr_crc32_init_table(void);
 uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length);
+uint32_t dr_crc32_tag_calc(const uint8_t *tag);
 
 struct dr_wq {
 	unsigned	*wqe_head;
@@ -1207,6 +1364,8 @@ struct dr_send_ring {
 	uint32_t		max_post_send_size;
 	/* manage the send queue */
 	uint32_t		tx_head;
+	/* tx_head when the ring was last drained */
+	uint32_t		drained_tx_head;
 	/* protect QP/CQ operations */
 	pthread_mutex_t         mutex;
 	void			*buf;
@@ -1214,20 +1373,45 @@ struct dr_send_ring {
 	struct ibv_wc		wc[MAX_SEND_CQE];
 	uint8_t			sync_buff[MIN_READ_SYNC];
 	struct ibv_mr		*sync_mr;
+	/* Posts that found the ring full and waited for it to drain */
+	uint64_t		num_stalls;
+	uint64_t		stall_time_ns;
 };
 
 int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn);
 void dr_send_ring_free(struct dr_send_ring *send_ring);
+uint8_t dr_send_ring_select(struct mlx5dv_dr_domain *dmn);
 int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn);
+int dr_send_ring_order_writes(struct mlx5dv_dr_domain *dmn);
+void dr_send_ring_query(struct dr_send_ring *send_ring,
+			uint64_t *num_stalls, uint64_t *stall_time_ns);
+uint32_t dr_send_ring_get_mark(struct mlx5dv_dr_domain *dmn, uint8_t ring_idx);
+int dr_send_ring_poll_mark(struct mlx5dv_dr_domain *dmn, uint8_t ring_idx,
+			   uint32_t mark, bool *done);
 bool dr_send_allow_fl(struct dr_devx_caps *caps);
 int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
-			 uint8_t *data, uint16_t size, uint16_t offset);
+			 uint8_t *data, uint16_t size, uint16_t offset,
+			 uint8_t ring_idx);
 int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
-			  uint8_t *formated_ste, uint8_t *mask);
+			  uint8_t *formated_ste, uint8_t *mask,
+			  uint8_t ring_idx);
+int dr_send_postsend_htbl_range(struct mlx5dv_dr_domain *dmn,
+				struct dr_ste_htbl *htbl,
+				uint32_t start_index, uint32_t num_stes,
+				uint8_t *formated_ste, uint8_t *mask,
+				uint8_t ring_idx);
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t *ste_init_data,
-				   bool update_hw_ste);
+				   bool update_hw_ste,
+				   uint8_t ring_idx);
+int dr_send_postsend_formated_htbl_range(struct mlx5dv_dr_domain *dmn,
+					 struct dr_ste_htbl *htbl,
+					 uint32_t start_index,
+					 uint32_t num_stes,
+					 uint8_t *formated_ste,
+					 struct dr_ste_htbl *miss_htbl,
+					 uint8_t ring_idx);
 int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
 			    struct mlx5dv_dr_action *action);
 /* buddy functions & structure */
@@ -1237,6 +1421,8 @@ struct dr_icm_buddy_mem {
 	bitmap			**bits;
 	unsigned int		*num_free;
 	bitmap			**set_bit;
+	/* No free segment below these set_bit words */
+	uint32_t		*set_bit_hint;
 	uint32_t		max_order;
 	struct list_node	list_node;
 	struct dr_icm_mr	*icm_mr;
@@ -1257,4 +1443,16 @@ int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order);
 void dr_buddy_cleanup(struct dr_icm_buddy_mem *buddy);
 int dr_buddy_alloc_mem(struct dr_icm_buddy_mem *buddy, int order);
 void dr_buddy_free_mem(struct dr_icm_buddy_mem *buddy, uint32_t seg, int order);
+
+struct dr_emu *dr_emu_create(uint32_t flags);
+void dr_emu_destroy(struct dr_emu *emu);
+struct ibv_context *dr_emu_get_ctx(struct dr_emu *emu);
+int dr_emu_caps_init(struct dr_emu *emu, struct mlx5dv_dr_domain *dmn);
+int dr_emu_icm_alloc(struct dr_emu *emu, size_t size, uint32_t *key,
+		     uint64_t *icm_addr);
+void dr_emu_icm_free(struct dr_emu *emu, uint32_t key);
+void dr_emu_icm_map_ste(struct dr_emu *emu, uint32_t key, uint64_t offset,
+			struct dr_ste *ste_arr, uint32_t num_of_entries);
+int dr_emu_icm_write(struct dr_emu *emu, uint32_t key, uint64_t offset,
+		     const void *data, uint32_t length);
 #endif
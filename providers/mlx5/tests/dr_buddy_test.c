@@ -0,0 +1,164 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Check the ICM buddy allocator against a map of the owned segments.
+ *
+ * Random allocations and frees of mixed orders must return aligned,
+ * disjoint segments, and freeing everything must coalesce back into a
+ * single block.  The allocator must also hand out the lowest free segment
+ * first, which the first level bitmap and its hint rely on.  Finally the
+ * time to allocate from a large, fragmented buddy is measured, which is
+ * where the word scan matters.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ccan/array_size.h>
+
+#include "../dr_buddy.c"
+
+#define MODEL_ORDER	16
+#define MODEL_OPS	2000000
+#define MAX_ALLOC_ORDER	6
+#define FRAG_ORDER	22
+
+static uint8_t owned[1 << MODEL_ORDER];
+static uint32_t segs[1 << MODEL_ORDER];
+static uint8_t orders[1 << MODEL_ORDER];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void mark(uint32_t seg, int order, uint8_t val)
+{
+	memset(&owned[seg], val, 1 << order);
+}
+
+static int check_random(struct dr_icm_buddy_mem *buddy)
+{
+	unsigned int live = 0, i, j;
+	int order, seg, bad = 0;
+
+	for (i = 0; i < MODEL_OPS; i++) {
+		if (live && (rand() % 100 < 48 || live == ARRAY_SIZE(segs))) {
+			j = rand() % live;
+			mark(segs[j], orders[j], 0);
+			dr_buddy_free_mem(buddy, segs[j], orders[j]);
+			live--;
+			segs[j] = segs[live];
+			orders[j] = orders[live];
+			continue;
+		}
+
+		order = rand() % 100 < 80 ? 0 : rand() % (MAX_ALLOC_ORDER + 1);
+		seg = dr_buddy_alloc_mem(buddy, order);
+		if (seg == -1)
+			continue;
+		if (seg & ((1 << order) - 1) ||
+		    memchr(&owned[seg], 1, 1 << order)) {
+			if (bad++ < 3)
+				fprintf(stderr, "order %d got segment %d\n",
+					order, seg);
+			continue;
+		}
+		mark(seg, order, 1);
+		segs[live] = seg;
+		orders[live] = order;
+		live++;
+	}
+
+	while (live--)
+		dr_buddy_free_mem(buddy, segs[live], orders[live]);
+
+	for (order = 0; order < MODEL_ORDER; order++)
+		if (buddy->num_free[order])
+			bad++;
+	if (buddy->num_free[MODEL_ORDER] != 1) {
+		fprintf(stderr, "buddy did not coalesce\n");
+		bad++;
+	}
+	return bad;
+}
+
+static int check_lowest_first(struct dr_icm_buddy_mem *buddy)
+{
+	unsigned int i;
+
+	for (i = 0; i < 1 << MODEL_ORDER; i++)
+		if (dr_buddy_alloc_mem(buddy, 0) != i)
+			goto err;
+	if (dr_buddy_alloc_mem(buddy, 0) != -1)
+		goto err;
+
+	for (i = 0; i < 1 << MODEL_ORDER; i += 2)
+		dr_buddy_free_mem(buddy, i, 0);
+	for (i = 0; i < 1 << MODEL_ORDER; i += 2)
+		if (dr_buddy_alloc_mem(buddy, 0) != i)
+			goto err;
+	return 0;
+
+err:
+	fprintf(stderr, "order 0 allocation %u out of order\n", i);
+	return 1;
+}
+
+/* Keep the low 15/16th full and reuse every other segment of the rest */
+static int time_fragmented(int rounds)
+{
+	struct dr_icm_buddy_mem buddy = {};
+	uint32_t n = 1 << FRAG_ORDER, i;
+	double start, elapsed = 0;
+	int bad = 0, k;
+
+	if (dr_buddy_init(&buddy, FRAG_ORDER))
+		return 1;
+
+	for (i = 0; i < n; i++)
+		if (dr_buddy_alloc_mem(&buddy, 0) != i)
+			bad++;
+
+	for (k = 0; k < rounds; k++) {
+		for (i = n - n / 16; i < n; i += 2)
+			dr_buddy_free_mem(&buddy, i, 0);
+		start = now_ns();
+		for (i = n - n / 16; i < n; i += 2)
+			if (dr_buddy_alloc_mem(&buddy, 0) != i)
+				bad++;
+		elapsed += now_ns() - start;
+	}
+	printf("fragmented order 0 alloc: %.1f ns\n",
+	       elapsed / ((double)rounds * n / 32));
+	dr_buddy_cleanup(&buddy);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	struct dr_icm_buddy_mem buddy = {};
+	int rounds = argc > 1 ? atoi(argv[1]) : 10;
+	int bad;
+
+	srand(1);
+	if (dr_buddy_init(&buddy, MODEL_ORDER))
+		return 1;
+
+	bad = check_random(&buddy);
+	if (!bad) {
+		/* check_random() left one max order block */
+		if (dr_buddy_alloc_mem(&buddy, MODEL_ORDER) != 0)
+			bad++;
+		dr_buddy_free_mem(&buddy, 0, MODEL_ORDER);
+		bad += check_lowest_first(&buddy);
+	}
+	dr_buddy_cleanup(&buddy);
+	if (bad)
+		return 1;
+
+	return time_fragmented(rounds) ? 1 : 0;
+}
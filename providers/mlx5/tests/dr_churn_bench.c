@@ -0,0 +1,250 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Replace rules continuously from several threads in an emulated domain.
+ *
+ * Every rule has its own destination MAC, so it owns a size 1 hash table in
+ * the next level and each replacement frees and allocates small ICM chunks.
+ * Each thread keeps a window of live rules and destroys the oldest one
+ * before inserting the next.  At the end the last window of every thread
+ * must still be reachable, and once all rules are gone no STE ICM may be in
+ * use.  Pass -r to let the domain return unused ICM to the device.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <infiniband/mlx5dv.h>
+
+#include "../mlx5_ifc.h"
+
+#define PARAM_SZ	DEVX_ST_SZ_BYTES(dr_match_param)
+#define WINDOW		1024
+#define MAX_THREADS	4
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int n;
+	int err;
+	struct mlx5dv_dr_matcher *matcher;
+	struct mlx5dv_dr_action *drop;
+	struct mlx5dv_dr_rule *rules[WINDOW];
+};
+
+static struct mlx5dv_flow_match_parameters *alloc_param(void)
+{
+	struct mlx5dv_flow_match_parameters *param;
+
+	param = calloc(1, sizeof(*param) + PARAM_SZ);
+	if (param)
+		param->match_sz = PARAM_SZ;
+	return param;
+}
+
+static void set_packet(struct mlx5dv_flow_match_parameters *param,
+		       uint32_t id, uint32_t i)
+{
+	void *buf = param->match_buf;
+
+	memset(buf, 0, PARAM_SZ);
+	DEVX_SET(dr_match_param, buf, outer.dmac_47_16, id);
+	DEVX_SET(dr_match_param, buf, outer.dmac_15_0, i & 0xffff);
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.ip_protocol, 17);
+	DEVX_SET(dr_match_param, buf, outer.dst_ip_31_0, i);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, 80);
+}
+
+static void *worker_run(void *arg)
+{
+	struct mlx5dv_flow_match_parameters *param;
+	struct worker *w = arg;
+	struct mlx5dv_dr_rule **rule;
+	int i;
+
+	param = alloc_param();
+	if (!param) {
+		w->err = ENOMEM;
+		return NULL;
+	}
+
+	for (i = 0; i < w->n; i++) {
+		rule = &w->rules[i % WINDOW];
+		if (*rule && mlx5dv_dr_rule_destroy(*rule)) {
+			w->err = errno;
+			break;
+		}
+		set_packet(param, w->id, i);
+		*rule = mlx5dv_dr_rule_create(w->matcher, param, 1, &w->drop);
+		if (!*rule) {
+			w->err = errno;
+			break;
+		}
+	}
+	free(param);
+	return NULL;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_window(struct mlx5dv_dr_table *tbl, struct worker *w,
+			struct mlx5dv_flow_match_parameters *param)
+{
+	struct mlx5dv_dr_emu_match_result res;
+	int i, bad = 0;
+
+	for (i = w->n - WINDOW; i < w->n; i++) {
+		set_packet(param, w->id, i);
+		if (mlx5dv_dr_table_emu_match(tbl, 0, param, &res) ||
+		    res.rule != w->rules[i % WINDOW])
+			bad++;
+	}
+	return bad;
+}
+
+static int run(int nthreads, int n, bool reclaim)
+{
+	struct mlx5dv_flow_match_parameters *param;
+	struct mlx5dv_dr_domain_stats stats;
+	struct worker *w;
+	struct mlx5dv_dr_action *drop = NULL;
+	struct mlx5dv_dr_table *tbl = NULL;
+	struct mlx5dv_dr_domain *dmn;
+	uint64_t in_use = 0;
+	int i, j, bad = 0;
+	bool started[MAX_THREADS] = {};
+	double start, elapsed;
+
+	w = calloc(nthreads, sizeof(*w));
+	param = alloc_param();
+	dmn = mlx5dv_dr_domain_create_emu(MLX5DV_DR_DOMAIN_TYPE_NIC_RX,
+					  MLX5DV_DR_DOMAIN_EMU_FLAGS_STE_V1);
+	if (!w || !param || !dmn)
+		goto err;
+
+	mlx5dv_dr_domain_set_reclaim_device_memory(dmn, reclaim);
+	tbl = mlx5dv_dr_table_create(dmn, 1);
+	drop = mlx5dv_dr_action_create_drop();
+	if (!tbl || !drop)
+		goto err;
+
+	DEVX_SET(dr_match_param, param->match_buf, outer.dmac_47_16,
+		 0xffffffff);
+	DEVX_SET(dr_match_param, param->match_buf, outer.dmac_15_0, 0xffff);
+	DEVX_SET(dr_match_param, param->match_buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, param->match_buf, outer.ip_protocol, 0xff);
+	DEVX_SET(dr_match_param, param->match_buf, outer.dst_ip_31_0,
+		 0xffffffff);
+	DEVX_SET(dr_match_param, param->match_buf, outer.udp_dport, 0xffff);
+	for (i = 0; i < nthreads; i++) {
+		w[i].id = i + 1;
+		w[i].n = n;
+		w[i].drop = drop;
+		w[i].matcher = mlx5dv_dr_matcher_create(tbl, i, 1, param);
+		if (!w[i].matcher)
+			goto err;
+	}
+
+	start = now_sec();
+	for (i = 0; i < nthreads; i++) {
+		w[i].err = pthread_create(&w[i].thread, NULL, worker_run,
+					  &w[i]);
+		started[i] = !w[i].err;
+	}
+	for (i = 0; i < nthreads; i++)
+		if (started[i])
+			pthread_join(w[i].thread, NULL);
+	elapsed = now_sec() - start;
+
+	for (i = 0; i < nthreads; i++) {
+		if (w[i].err)
+			goto err;
+		bad += check_window(tbl, &w[i], param);
+	}
+
+	mlx5dv_dr_domain_query_stats(dmn, &stats);
+	for (i = 0; i < MLX5DV_DR_ICM_CHUNK_SIZES; i++)
+		in_use += stats.ste_icm_bytes[i];
+	printf("%d threads: %8.0f rule replacements/s, STE ICM %" PRIu64
+	       " KiB in use of %" PRIu64 " KiB\n", nthreads,
+	       (double)nthreads * n / elapsed, in_use / 1024,
+	       stats.ste_icm_total_bytes / 1024);
+	if (bad)
+		fprintf(stderr, "%d threads: %d packets reached the wrong rule\n",
+			nthreads, bad);
+	goto out;
+
+err:
+	fprintf(stderr, "%d threads: failed: %s\n", nthreads, strerror(errno));
+	for (i = 0; w && i < nthreads; i++)
+		if (w[i].err)
+			fprintf(stderr, "thread %d failed: %s\n", w[i].id,
+				strerror(w[i].err));
+	bad = 1;
+out:
+	for (i = 0; w && i < nthreads; i++) {
+		for (j = 0; j < WINDOW; j++)
+			if (w[i].rules[j])
+				mlx5dv_dr_rule_destroy(w[i].rules[j]);
+		if (w[i].matcher)
+			mlx5dv_dr_matcher_destroy(w[i].matcher);
+	}
+	if (drop)
+		mlx5dv_dr_action_destroy(drop);
+	if (tbl)
+		mlx5dv_dr_table_destroy(tbl);
+	if (dmn) {
+		mlx5dv_dr_domain_sync(dmn, MLX5DV_DR_DOMAIN_SYNC_FLAGS_MEM);
+		mlx5dv_dr_domain_query_stats(dmn, &stats);
+		for (i = 0; i < MLX5DV_DR_ICM_CHUNK_SIZES; i++) {
+			if (!stats.ste_icm_bytes[i])
+				continue;
+			fprintf(stderr, "%" PRIu64 " bytes of STE ICM leaked in %u entry chunks\n",
+				stats.ste_icm_bytes[i], 1U << i);
+			bad = 1;
+		}
+		if (mlx5dv_dr_domain_destroy(dmn))
+			bad = 1;
+	}
+	free(param);
+	free(w);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	bool reclaim = false;
+	int nthreads, n, c, ret = 0;
+
+	while ((c = getopt(argc, argv, "r")) != -1) {
+		switch (c) {
+		case 'r':
+			reclaim = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r] [REPLACEMENTS]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	n = optind < argc ? atoi(argv[optind]) : 50000;
+	if (n < WINDOW)
+		n = WINDOW;
+
+	for (nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2)
+		if (run(nthreads, n, reclaim))
+			ret = 1;
+	return ret;
+}
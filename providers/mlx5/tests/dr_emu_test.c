@@ -0,0 +1,316 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Insert rules into an emulated steering domain and check that packets walk
+ * the tables to the expected rule and fate.
+ *
+ * Table 1 matches on IP protocol, destination address and UDP port.  Odd rules
+ * drop and even rules jump to table 2, which drops dport 53 and
+ * otherwise leaves the packet to the domain default.  Every domain type and
+ * STE format the emulator supports is run, then half of the rules are
+ * removed and the lookups repeated.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <infiniband/mlx5dv.h>
+#include <ccan/array_size.h>
+
+#include "../mlx5_ifc.h"
+
+#define PARAM_SZ	DEVX_ST_SZ_BYTES(dr_match_param)
+#define BASE_IP		0x0a000000
+#define NUM_MISSES	100
+
+struct emu_config {
+	const char *name;
+	enum mlx5dv_dr_domain_type type;
+	uint32_t flags;
+};
+
+static const struct emu_config configs[] = {
+	{"NIC_RX", MLX5DV_DR_DOMAIN_TYPE_NIC_RX, 0},
+	{"NIC_RX STE_V1", MLX5DV_DR_DOMAIN_TYPE_NIC_RX,
+	 MLX5DV_DR_DOMAIN_EMU_FLAGS_STE_V1},
+	{"FDB", MLX5DV_DR_DOMAIN_TYPE_FDB, 0},
+	{"NIC_TX STE_V1", MLX5DV_DR_DOMAIN_TYPE_NIC_TX,
+	 MLX5DV_DR_DOMAIN_EMU_FLAGS_STE_V1},
+};
+
+static struct mlx5dv_flow_match_parameters *alloc_param(void)
+{
+	struct mlx5dv_flow_match_parameters *param;
+
+	param = calloc(1, sizeof(*param) + PARAM_SZ);
+	if (param)
+		param->match_sz = PARAM_SZ;
+	return param;
+}
+
+static void set_packet(struct mlx5dv_flow_match_parameters *param,
+		       uint32_t dip, uint16_t dport)
+{
+	void *buf = param->match_buf;
+
+	memset(buf, 0, PARAM_SZ);
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.ip_protocol, 17);
+	DEVX_SET(dr_match_param, buf, outer.dst_ip_31_0, dip);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, dport);
+}
+
+static uint16_t rule_dport(int i)
+{
+	return i % 3 ? 80 : 53;
+}
+
+struct emu_ctx {
+	const struct emu_config *cfg;
+	struct mlx5dv_dr_domain *dmn;
+	struct mlx5dv_dr_table *tbl1, *tbl2;
+	struct mlx5dv_dr_matcher *m1, *m2;
+	struct mlx5dv_dr_action *drop, *tag, *go_tbl2;
+	struct mlx5dv_dr_rule **rules;
+	struct mlx5dv_dr_rule *drop53;
+	struct mlx5dv_flow_match_parameters *param;
+	int n;
+};
+
+static int setup(struct emu_ctx *ctx)
+{
+	void *buf;
+
+	ctx->dmn = mlx5dv_dr_domain_create_emu(ctx->cfg->type,
+					       ctx->cfg->flags);
+	if (!ctx->dmn)
+		return errno;
+
+	ctx->tbl1 = mlx5dv_dr_table_create(ctx->dmn, 1);
+	ctx->tbl2 = mlx5dv_dr_table_create(ctx->dmn, 2);
+	if (!ctx->tbl1 || !ctx->tbl2)
+		return errno;
+
+	/* The root table lives in firmware, which is not emulated */
+	if (mlx5dv_dr_table_create(ctx->dmn, 0)) {
+		fprintf(stderr, "%s: root table created\n", ctx->cfg->name);
+		return EINVAL;
+	}
+
+	buf = ctx->param->match_buf;
+	memset(buf, 0, PARAM_SZ);
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.ip_protocol, 0xff);
+	DEVX_SET(dr_match_param, buf, outer.dst_ip_31_0, 0xffffffff);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, 0xffff);
+	ctx->m1 = mlx5dv_dr_matcher_create(ctx->tbl1, 1, 1, ctx->param);
+
+	memset(buf, 0, PARAM_SZ);
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, 0xffff);
+	ctx->m2 = mlx5dv_dr_matcher_create(ctx->tbl2, 1, 1, ctx->param);
+	if (!ctx->m1 || !ctx->m2)
+		return errno;
+
+	ctx->drop = mlx5dv_dr_action_create_drop();
+	ctx->tag = mlx5dv_dr_action_create_tag(7);
+	ctx->go_tbl2 = mlx5dv_dr_action_create_dest_table(ctx->tbl2);
+	if (!ctx->drop || !ctx->tag || !ctx->go_tbl2)
+		return errno;
+
+	memset(buf, 0, PARAM_SZ);
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, 53);
+	ctx->drop53 = mlx5dv_dr_rule_create(ctx->m2, ctx->param, 1,
+					    &ctx->drop);
+	if (!ctx->drop53)
+		return errno;
+
+	return 0;
+}
+
+static void teardown(struct emu_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; ctx->rules && i < ctx->n; i++)
+		if (ctx->rules[i])
+			mlx5dv_dr_rule_destroy(ctx->rules[i]);
+	if (ctx->drop53)
+		mlx5dv_dr_rule_destroy(ctx->drop53);
+	if (ctx->go_tbl2)
+		mlx5dv_dr_action_destroy(ctx->go_tbl2);
+	if (ctx->tag)
+		mlx5dv_dr_action_destroy(ctx->tag);
+	if (ctx->drop)
+		mlx5dv_dr_action_destroy(ctx->drop);
+	if (ctx->m2)
+		mlx5dv_dr_matcher_destroy(ctx->m2);
+	if (ctx->m1)
+		mlx5dv_dr_matcher_destroy(ctx->m1);
+	if (ctx->tbl2)
+		mlx5dv_dr_table_destroy(ctx->tbl2);
+	if (ctx->tbl1)
+		mlx5dv_dr_table_destroy(ctx->tbl1);
+	if (ctx->dmn)
+		mlx5dv_dr_domain_destroy(ctx->dmn);
+}
+
+static int insert_rules(struct emu_ctx *ctx)
+{
+	struct mlx5dv_dr_action *actions[2];
+	size_t num_actions;
+	int i;
+
+	for (i = 0; i < ctx->n; i++) {
+		set_packet(ctx->param, BASE_IP + i, rule_dport(i));
+		if (i % 2) {
+			actions[0] = ctx->drop;
+			num_actions = 1;
+		} else if (ctx->cfg->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX) {
+			actions[0] = ctx->tag;
+			actions[1] = ctx->go_tbl2;
+			num_actions = 2;
+		} else {
+			actions[0] = ctx->go_tbl2;
+			num_actions = 1;
+		}
+		ctx->rules[i] = mlx5dv_dr_rule_create(ctx->m1, ctx->param,
+						      num_actions, actions);
+		if (!ctx->rules[i])
+			return errno;
+	}
+	return 0;
+}
+
+/* RX drops what no rule forwards, TX and FDB pass it to the wire */
+static enum mlx5dv_dr_emu_fate default_fate(struct emu_ctx *ctx)
+{
+	return ctx->cfg->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX ?
+		MLX5DV_DR_EMU_FATE_DROP : MLX5DV_DR_EMU_FATE_DEFAULT;
+}
+
+static int check_matches(struct emu_ctx *ctx, uint64_t *lookups)
+{
+	struct mlx5dv_dr_emu_match_result res;
+	enum mlx5dv_dr_emu_fate fate;
+	struct mlx5dv_dr_rule *rule;
+	int i, bad = 0;
+
+	for (i = 0; i < ctx->n + NUM_MISSES; i++) {
+		set_packet(ctx->param, BASE_IP + i, rule_dport(i));
+		if (mlx5dv_dr_table_emu_match(ctx->tbl1, 0, ctx->param, &res))
+			return -1;
+		*lookups += res.num_lookups;
+
+		if (i >= ctx->n || !ctx->rules[i]) {
+			rule = NULL;
+			fate = default_fate(ctx);
+		} else if (i % 2) {
+			rule = ctx->rules[i];
+			fate = MLX5DV_DR_EMU_FATE_DROP;
+		} else if (rule_dport(i) == 53) {
+			rule = ctx->drop53;
+			fate = MLX5DV_DR_EMU_FATE_DROP;
+		} else {
+			rule = ctx->rules[i];
+			fate = default_fate(ctx);
+		}
+		if (res.rule == rule && res.fate == fate)
+			continue;
+		if (bad++ < 3)
+			fprintf(stderr, "%s: packet %d hit %p fate %d, expected %p fate %d\n",
+				ctx->cfg->name, i, res.rule, res.fate, rule,
+				fate);
+	}
+
+	/* Same address and port but TCP must not match the UDP rule */
+	set_packet(ctx->param, BASE_IP + 1, rule_dport(1));
+	DEVX_SET(dr_match_param, ctx->param->match_buf, outer.ip_protocol, 6);
+	if (mlx5dv_dr_table_emu_match(ctx->tbl1, 0, ctx->param, &res) ||
+	    res.rule) {
+		fprintf(stderr, "%s: TCP packet matched\n", ctx->cfg->name);
+		bad++;
+	}
+	return bad;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(const struct emu_config *cfg, int n)
+{
+	struct mlx5dv_dr_domain_emu_stats stats = {};
+	struct emu_ctx ctx = {
+		.cfg = cfg,
+		.n = n,
+	};
+	uint64_t lookups = 0;
+	double start, elapsed;
+	int ret, bad, i;
+
+	ctx.param = alloc_param();
+	ctx.rules = calloc(n, sizeof(*ctx.rules));
+	if (!ctx.param || !ctx.rules) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	ret = setup(&ctx);
+	if (ret) {
+		fprintf(stderr, "%s: setup failed: %s\n", cfg->name,
+			strerror(ret));
+		goto out;
+	}
+
+	start = now_sec();
+	ret = insert_rules(&ctx);
+	elapsed = now_sec() - start;
+	if (ret) {
+		fprintf(stderr, "%s: rule insert failed: %s\n", cfg->name,
+			strerror(ret));
+		goto out;
+	}
+
+	bad = check_matches(&ctx, &lookups);
+	mlx5dv_dr_domain_emu_query(ctx.dmn, &stats);
+	printf("%-14s %8.0f rules/s  %5.2f lookups/pkt  icm %" PRIu64
+	       " writes %" PRIu64 "\n", cfg->name, n / elapsed,
+	       (double)lookups / (n + NUM_MISSES), stats.icm_bytes,
+	       stats.write_ops);
+
+	for (i = 0; i < n; i += 2) {
+		mlx5dv_dr_rule_destroy(ctx.rules[i]);
+		ctx.rules[i] = NULL;
+	}
+	lookups = 0;
+	bad += check_matches(&ctx, &lookups);
+	ret = bad ? EINVAL : 0;
+out:
+	teardown(&ctx);
+	free(ctx.rules);
+	free(ctx.param);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 5000;
+	unsigned int i;
+	int ret = 0;
+
+	if (n <= 0)
+		n = 5000;
+
+	for (i = 0; i < ARRAY_SIZE(configs); i++)
+		if (run(&configs[i], n))
+			ret = 1;
+	return ret;
+}
@@ -0,0 +1,174 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Check the STE hash index helpers against plain references and time them.
+ *
+ * dr_ste_mask_tag() is compared with a byte loop for every byte mask, and
+ * dr_crc32_tag_calc(), which uses PCLMULQDQ or the ARMv8 crc32 instructions
+ * when the CPU has them, with a bitwise CRC and with the slice-by-8 tables.
+ * Nothing is timed unless all of them agree.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../dr_crc32.c"
+#include "../dr_ste.h"
+
+#define NUM_TAGS	4096
+#define NUM_SAMPLES	1000000
+
+static uint8_t tags[NUM_TAGS][DR_STE_SIZE_TAG];
+static volatile uint32_t sink;
+
+static void ref_mask_tag(uint8_t *masked, const uint8_t *tag,
+			 uint16_t byte_mask)
+{
+	int i;
+
+	for (i = 0; i < DR_STE_SIZE_TAG; i++)
+		masked[i] = byte_mask & (1 << (DR_STE_SIZE_TAG - 1 - i)) ?
+			    tag[i] : 0;
+}
+
+/* Same convention as the tables: no inversion, result byte swapped */
+static uint32_t ref_crc32(const uint8_t *buf, size_t len)
+{
+	uint32_t crc = 0;
+	int bit;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (bit = 0; bit < 8; bit++)
+			crc = crc & 1 ? (crc >> 1) ^ DR_STE_CRC_POLY : crc >> 1;
+	}
+	return __builtin_bswap32(crc);
+}
+
+static void random_tag(uint8_t *tag)
+{
+	int i;
+
+	for (i = 0; i < DR_STE_SIZE_TAG; i++)
+		tag[i] = rand();
+}
+
+static int check_mask(void)
+{
+	uint8_t tag[DR_STE_SIZE_TAG], masked[DR_STE_SIZE_TAG];
+	uint8_t expected[DR_STE_SIZE_TAG];
+	uint32_t byte_mask;
+
+	for (byte_mask = 0; byte_mask <= UINT16_MAX; byte_mask++) {
+		random_tag(tag);
+		ref_mask_tag(expected, tag, byte_mask);
+		dr_ste_mask_tag(masked, tag, byte_mask);
+		if (memcmp(masked, expected, sizeof(masked))) {
+			fprintf(stderr, "mask 0x%04x differs\n", byte_mask);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int check_crc(void)
+{
+	uint8_t tag[DR_STE_SIZE_TAG];
+	uint32_t expected;
+	int i;
+
+	for (i = 0; i < NUM_SAMPLES; i++) {
+		/* Single bits first, they exercise each folding constant */
+		if (i < DR_STE_SIZE_TAG * 8) {
+			memset(tag, 0, sizeof(tag));
+			tag[i / 8] = 1 << (i % 8);
+		} else {
+			random_tag(tag);
+		}
+
+		expected = ref_crc32(tag, sizeof(tag));
+		if (dr_crc32_slice8_calc(tag, sizeof(tag)) != expected ||
+		    dr_crc32_tag_calc(tag) != expected) {
+			fprintf(stderr, "CRC of sample %d differs\n", i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The hash index as computed before the SIMD mask and the CRC dispatch */
+static uint32_t ref_hash_index(const uint8_t *tag, uint16_t byte_mask)
+{
+	uint8_t masked[DR_STE_SIZE_TAG];
+
+	ref_mask_tag(masked, tag, byte_mask);
+	return dr_crc32_slice8_calc(masked, DR_STE_SIZE_TAG);
+}
+
+static uint32_t hash_index(const uint8_t *tag, uint16_t byte_mask)
+{
+	uint8_t masked[DR_STE_SIZE_TAG];
+
+	dr_ste_mask_tag(masked, tag, byte_mask);
+	return dr_crc32_tag_calc(masked);
+}
+
+static double time_index(uint32_t (*fn)(const uint8_t *, uint16_t),
+			 int iters)
+{
+	uint32_t sum = 0;
+	double start;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < iters; i++)
+		sum += fn(tags[i % NUM_TAGS], 0xfff0 ^ (i & 0xf));
+	sink = sum;
+	return (now_ns() - start) / iters;
+}
+
+static double time_crc(uint32_t (*fn)(const uint8_t *), int iters)
+{
+	uint32_t sum = 0;
+	double start;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < iters; i++)
+		sum += fn(tags[i % NUM_TAGS]);
+	sink = sum;
+	return (now_ns() - start) / iters;
+}
+
+int main(int argc, char **argv)
+{
+	int iters = argc > 1 ? atoi(argv[1]) : 10000000;
+	int i;
+
+	srand(1);
+	dr_crc32_init_table();
+	if (check_mask() || check_crc())
+		return 1;
+
+	for (i = 0; i < NUM_TAGS; i++)
+		random_tag(tags[i]);
+
+	printf("CRC: %s\n", dr_crc32_tag_calc_fn == dr_crc32_tag_calc_sw ?
+	       "tables" : "instructions");
+	printf("%-24s %6.2f ns\n", "crc tables",
+	       time_crc(dr_crc32_tag_calc_sw, iters));
+	printf("%-24s %6.2f ns\n", "crc dispatched",
+	       time_crc(dr_crc32_tag_calc, iters));
+	printf("%-24s %6.2f ns\n", "index loop + tables",
+	       time_index(ref_hash_index, iters));
+	printf("%-24s %6.2f ns\n", "index mask + dispatched",
+	       time_index(hash_index, iters));
+	return 0;
+}
@@ -0,0 +1,637 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Replace the actions of live rules in an emulated domain and check that
+ * packets follow the new actions.
+ *
+ * Rules cycle between a few action sets, which need different numbers of
+ * action STEs, one at a time and in bulk, while the matcher grows and
+ * rehashes.  Replacing the actions with the same ones must leave the match
+ * STE as it was, an invalid action set must leave the rule untouched, and
+ * a failing entry stops a bulk call with the earlier entries applied.
+ * Once every rule is back to its first set, the rules must use as much STE
+ * ICM as newly created ones.  This looks at the rule internals, so it has
+ * to be built from the same tree as the provider.
+ *
+ * Afterwards replacing actions in place is timed against destroying and
+ * recreating the rules.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <ccan/array_size.h>
+
+#include "../mlx5dv_dr.h"
+
+#define PARAM_SZ	DEVX_ST_SZ_BYTES(dr_match_param)
+#define BASE_IP		0x0a000000
+#define NUM_SETS	4
+#define MAX_SET_ACTIONS	3
+#define PARTIAL_BATCH	10
+
+struct action_set {
+	size_t num;
+	struct mlx5dv_dr_action *actions[MAX_SET_ACTIONS];
+	enum mlx5dv_dr_emu_fate fate;
+};
+
+struct mod_config {
+	const char *name;
+	enum mlx5dv_dr_domain_type type;
+	/* Also match on the destination MAC, two match STEs per rule */
+	bool wide;
+};
+
+static const struct mod_config configs[] = {
+	{"NIC_RX", MLX5DV_DR_DOMAIN_TYPE_NIC_RX, false},
+	{"NIC_RX wide", MLX5DV_DR_DOMAIN_TYPE_NIC_RX, true},
+	{"NIC_TX", MLX5DV_DR_DOMAIN_TYPE_NIC_TX, false},
+	{"NIC_TX wide", MLX5DV_DR_DOMAIN_TYPE_NIC_TX, true},
+	{"FDB", MLX5DV_DR_DOMAIN_TYPE_FDB, false},
+	{"FDB wide", MLX5DV_DR_DOMAIN_TYPE_FDB, true},
+};
+
+struct mod_ctx {
+	const struct mod_config *cfg;
+	struct mlx5dv_dr_domain *dmn;
+	struct mlx5dv_dr_table *tbl1, *tbl2;
+	struct mlx5dv_dr_matcher *matcher;
+	struct mlx5dv_dr_action *drop, *go_tbl2, *tag, *modify, *push, *pop;
+	struct action_set sets[NUM_SETS];
+	struct mlx5dv_flow_match_parameters *param;
+	struct mlx5dv_dr_rule **rules;
+	struct mlx5dv_dr_rule_modify_attr *attr;
+	int *cur;
+	int n;
+	int bad;
+};
+
+static void set_packet(struct mod_ctx *ctx, uint32_t i)
+{
+	void *buf = ctx->param->match_buf;
+
+	memset(buf, 0, PARAM_SZ);
+	if (ctx->cfg->wide) {
+		DEVX_SET(dr_match_param, buf, outer.dmac_47_16, 0x00112233);
+		DEVX_SET(dr_match_param, buf, outer.dmac_15_0, i % 4);
+	}
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.ip_protocol, 17);
+	DEVX_SET(dr_match_param, buf, outer.dst_ip_31_0, BASE_IP + i);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, 80);
+}
+
+static void set_mask(struct mod_ctx *ctx)
+{
+	void *buf = ctx->param->match_buf;
+
+	memset(buf, 0, PARAM_SZ);
+	if (ctx->cfg->wide) {
+		DEVX_SET(dr_match_param, buf, outer.dmac_47_16, 0xffffffff);
+		DEVX_SET(dr_match_param, buf, outer.dmac_15_0, 0xffff);
+	}
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.ip_protocol, 0xff);
+	DEVX_SET(dr_match_param, buf, outer.dst_ip_31_0, 0xffffffff);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, 0xffff);
+}
+
+static void report(struct mod_ctx *ctx, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void report(struct mod_ctx *ctx, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (ctx->bad++ >= 5)
+		return;
+	fprintf(stderr, "%s: ", ctx->cfg->name);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+}
+
+static int setup(struct mod_ctx *ctx)
+{
+	enum mlx5dv_dr_emu_fate fwd_fate = MLX5DV_DR_EMU_FATE_DEFAULT;
+	__be64 set_smac[1] = {};
+	struct action_set *sets = ctx->sets;
+	int i;
+
+	ctx->dmn = mlx5dv_dr_domain_create_emu(ctx->cfg->type, 0);
+	if (!ctx->dmn)
+		return errno;
+
+	ctx->tbl1 = mlx5dv_dr_table_create(ctx->dmn, 1);
+	ctx->tbl2 = mlx5dv_dr_table_create(ctx->dmn, 2);
+	if (!ctx->tbl1 || !ctx->tbl2)
+		return errno;
+
+	set_mask(ctx);
+	ctx->matcher = mlx5dv_dr_matcher_create(ctx->tbl1, 1, 1, ctx->param);
+	if (!ctx->matcher)
+		return errno;
+
+	DEVX_SET(set_action_in, set_smac, action_type, MLX5_ACTION_TYPE_SET);
+	DEVX_SET(set_action_in, set_smac, field,
+		 MLX5_ACTION_IN_FIELD_OUT_SMAC_47_16);
+	DEVX_SET(set_action_in, set_smac, data, 0x12345678);
+
+	ctx->drop = mlx5dv_dr_action_create_drop();
+	ctx->go_tbl2 = mlx5dv_dr_action_create_dest_table(ctx->tbl2);
+	ctx->tag = mlx5dv_dr_action_create_tag(0x1234);
+	ctx->modify = mlx5dv_dr_action_create_modify_header(ctx->dmn, 0,
+							    sizeof(set_smac),
+							    set_smac);
+	ctx->pop = mlx5dv_dr_action_create_pop_vlan();
+	if (!ctx->drop || !ctx->go_tbl2 || !ctx->tag || !ctx->modify ||
+	    !ctx->pop)
+		return errno;
+	if (ctx->cfg->type == MLX5DV_DR_DOMAIN_TYPE_NIC_TX) {
+		ctx->push = mlx5dv_dr_action_create_push_vlan(ctx->dmn,
+							      htonl(0x81000064));
+		if (!ctx->push)
+			return errno;
+	}
+
+	/* Table 2 is empty, what it gets falls to the domain default */
+	if (ctx->cfg->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+		fwd_fate = MLX5DV_DR_EMU_FATE_DROP;
+
+	sets[0] = (struct action_set){1, {ctx->drop}, MLX5DV_DR_EMU_FATE_DROP};
+	sets[1] = (struct action_set){1, {ctx->go_tbl2}, fwd_fate};
+	switch (ctx->cfg->type) {
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
+		sets[2] = (struct action_set)
+			{3, {ctx->modify, ctx->tag, ctx->go_tbl2}, fwd_fate};
+		sets[3] = (struct action_set)
+			{3, {ctx->pop, ctx->pop, ctx->go_tbl2}, fwd_fate};
+		break;
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_TX:
+		sets[2] = (struct action_set)
+			{3, {ctx->modify, ctx->push, ctx->go_tbl2}, fwd_fate};
+		sets[3] = (struct action_set)
+			{3, {ctx->push, ctx->push, ctx->go_tbl2}, fwd_fate};
+		break;
+	default:
+		sets[2] = (struct action_set)
+			{2, {ctx->modify, ctx->go_tbl2}, fwd_fate};
+		sets[3] = (struct action_set){1, {ctx->modify}, fwd_fate};
+		break;
+	}
+
+	for (i = 0; i < NUM_SETS; i++)
+		if (!sets[i].num)
+			return EINVAL;
+	return 0;
+}
+
+static void teardown(struct mod_ctx *ctx)
+{
+	struct mlx5dv_dr_action *actions[] = {
+		ctx->drop, ctx->go_tbl2, ctx->tag, ctx->modify, ctx->push,
+		ctx->pop,
+	};
+	int i;
+
+	if (ctx->rules)
+		mlx5dv_dr_rule_destroy_bulk(ctx->n, ctx->rules);
+	for (i = 0; i < ARRAY_SIZE(actions); i++)
+		if (actions[i])
+			mlx5dv_dr_action_destroy(actions[i]);
+	if (ctx->matcher && mlx5dv_dr_matcher_destroy(ctx->matcher))
+		report(ctx, "matcher destroy failed");
+	if (ctx->tbl2)
+		mlx5dv_dr_table_destroy(ctx->tbl2);
+	if (ctx->tbl1)
+		mlx5dv_dr_table_destroy(ctx->tbl1);
+	if (ctx->dmn && mlx5dv_dr_domain_destroy(ctx->dmn))
+		report(ctx, "domain destroy failed");
+}
+
+static int num_members(struct mlx5dv_dr_rule *rule)
+{
+	struct dr_rule_action_member *member;
+	int n = 0;
+
+	list_for_each(&rule->rule_actions_list, member, list)
+		n++;
+	return n;
+}
+
+/* Send every live rule its packet on each side the domain has */
+static void check_rules(struct mod_ctx *ctx, int n, const char *what)
+{
+	struct mlx5dv_dr_emu_match_result res;
+	enum mlx5dv_dr_emu_fate fate;
+	uint32_t flags;
+	int i, tx;
+
+	for (i = 0; i < n; i++) {
+		if (!ctx->rules[i])
+			continue;
+		set_packet(ctx, i);
+		fate = ctx->sets[ctx->cur[i]].fate;
+		for (tx = 0; tx < 2; tx++) {
+			if (ctx->cfg->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX && tx)
+				continue;
+			if (ctx->cfg->type == MLX5DV_DR_DOMAIN_TYPE_NIC_TX && !tx)
+				continue;
+
+			flags = tx ? MLX5DV_DR_EMU_MATCH_FLAGS_TX : 0;
+			memset(&res, 0, sizeof(res));
+			if (mlx5dv_dr_table_emu_match(ctx->tbl1, flags,
+						      ctx->param, &res) ||
+			    res.rule != ctx->rules[i] || res.fate != fate)
+				report(ctx, "%s: rule %d %s hit %p fate %d, expected %p fate %d",
+				       what, i, tx ? "TX" : "RX", res.rule,
+				       res.fate, ctx->rules[i], fate);
+		}
+	}
+}
+
+static void check_same_actions(struct mod_ctx *ctx)
+{
+	uint8_t before[2][DR_STE_SIZE_REDUCED];
+	struct mlx5dv_dr_action *invalid[] = {ctx->drop, ctx->go_tbl2};
+	struct dr_rule_rx_tx *nic_rules[2];
+	struct action_set *set;
+	struct mlx5dv_dr_rule *rule;
+	int s, i;
+
+	for (s = 0; s < NUM_SETS; s++) {
+		set = &ctx->sets[s];
+		set_packet(ctx, 0);
+		rule = mlx5dv_dr_rule_create(ctx->matcher, ctx->param,
+					     set->num, set->actions);
+		if (!rule) {
+			report(ctx, "set %d: rule create failed: %s", s,
+			       strerror(errno));
+			continue;
+		}
+
+		nic_rules[0] = &rule->rx;
+		nic_rules[1] = &rule->tx;
+		for (i = 0; i < 2; i++)
+			if (nic_rules[i]->last_rule_ste)
+				memcpy(before[i],
+				       nic_rules[i]->last_rule_ste->hw_ste,
+				       DR_STE_SIZE_REDUCED);
+
+		if (mlx5dv_dr_rule_modify_actions(rule, set->num,
+						  set->actions))
+			report(ctx, "set %d: same actions failed: %s", s,
+			       strerror(errno));
+		for (i = 0; i < 2; i++)
+			if (nic_rules[i]->last_rule_ste &&
+			    memcmp(before[i],
+				   nic_rules[i]->last_rule_ste->hw_ste,
+				   DR_STE_SIZE_REDUCED))
+				report(ctx, "set %d: STE changed", s);
+
+		if (!mlx5dv_dr_rule_modify_actions(rule, ARRAY_SIZE(invalid),
+						   invalid))
+			report(ctx, "set %d: invalid actions accepted", s);
+		if (num_members(rule) != set->num)
+			report(ctx, "set %d: rule has %d actions", s,
+			       num_members(rule));
+
+		ctx->rules[0] = rule;
+		ctx->cur[0] = s;
+		check_rules(ctx, 1, "same actions");
+		mlx5dv_dr_rule_destroy(rule);
+		ctx->rules[0] = NULL;
+	}
+}
+
+static void set_attr(struct mod_ctx *ctx, int i, int s)
+{
+	ctx->attr[i].rule = ctx->rules[i];
+	ctx->attr[i].num_actions = ctx->sets[s].num;
+	ctx->attr[i].actions = ctx->sets[s].actions;
+	ctx->cur[i] = s;
+}
+
+static int create_rule(struct mod_ctx *ctx, int i)
+{
+	struct action_set *set;
+
+	ctx->cur[i] = i % NUM_SETS;
+	set = &ctx->sets[ctx->cur[i]];
+	set_packet(ctx, i);
+	ctx->rules[i] = mlx5dv_dr_rule_create(ctx->matcher, ctx->param,
+					      set->num, set->actions);
+	return ctx->rules[i] ? 0 : errno;
+}
+
+/* Replace every rule by a new one with its first action set */
+static int create_rules(struct mod_ctx *ctx, bool destroy)
+{
+	int i, ret;
+
+	if (destroy)
+		mlx5dv_dr_rule_destroy_bulk(ctx->n, ctx->rules);
+	for (i = 0; i < ctx->n; i++) {
+		ret = create_rule(ctx, i);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Grow in quarters, so that modifies also run while the table rehashes */
+static int check_modify(struct mod_ctx *ctx)
+{
+	int phase, from, to, i, j, k, s, ret;
+
+	for (phase = 0; phase < 4; phase++) {
+		from = ctx->n * phase / 4;
+		to = ctx->n * (phase + 1) / 4;
+		for (i = from; i < to; i++) {
+			ret = create_rule(ctx, i);
+			if (ret)
+				return ret;
+
+			if (i % 3)
+				continue;
+			/* An older rule */
+			j = (i * 7) % (i + 1);
+			s = (ctx->cur[j] + 1) % NUM_SETS;
+			if (mlx5dv_dr_rule_modify_actions(ctx->rules[j],
+							  ctx->sets[s].num,
+							  ctx->sets[s].actions))
+				return errno;
+			ctx->cur[j] = s;
+		}
+		check_rules(ctx, to, "insert");
+
+		for (k = 0; k < NUM_SETS; k++) {
+			for (i = 0; i < to; i++)
+				set_attr(ctx, i, (ctx->cur[i] + 1 + k) % NUM_SETS);
+			if (k & 1) {
+				for (i = 0; i < to; i++)
+					if (mlx5dv_dr_rule_modify_actions(
+						    ctx->rules[i],
+						    ctx->attr[i].num_actions,
+						    ctx->attr[i].actions))
+						return errno;
+			} else if (mlx5dv_dr_rule_modify_actions_bulk(to,
+								       ctx->attr)) {
+				return errno;
+			}
+			check_rules(ctx, to, k & 1 ? "modify" : "bulk modify");
+		}
+	}
+
+	for (i = 0; i < ctx->n; i++)
+		if (num_members(ctx->rules[i]) != ctx->sets[ctx->cur[i]].num)
+			report(ctx, "rule %d has %d actions", i,
+			       num_members(ctx->rules[i]));
+	return 0;
+}
+
+static void check_partial(struct mod_ctx *ctx)
+{
+	struct mlx5dv_dr_action *invalid[] = {ctx->drop, ctx->go_tbl2};
+	int failed = PARTIAL_BATCH / 2;
+	int i, prev[PARTIAL_BATCH];
+
+	for (i = 0; i < PARTIAL_BATCH; i++) {
+		prev[i] = ctx->cur[i];
+		set_attr(ctx, i, (ctx->cur[i] + 1) % NUM_SETS);
+	}
+	ctx->attr[failed].num_actions = ARRAY_SIZE(invalid);
+	ctx->attr[failed].actions = invalid;
+
+	if (!mlx5dv_dr_rule_modify_actions_bulk(PARTIAL_BATCH, ctx->attr))
+		report(ctx, "bulk modify with invalid actions accepted");
+	for (i = failed; i < PARTIAL_BATCH; i++)
+		ctx->cur[i] = prev[i];
+
+	check_rules(ctx, PARTIAL_BATCH, "partial bulk modify");
+	for (i = 0; i < PARTIAL_BATCH; i++)
+		if (num_members(ctx->rules[i]) != ctx->sets[ctx->cur[i]].num)
+			report(ctx, "partial: rule %d has %d actions", i,
+			       num_members(ctx->rules[i]));
+}
+
+static int run(const struct mod_config *cfg, int n)
+{
+	struct mlx5dv_dr_domain_stats modified, created;
+	struct mod_ctx ctx = {
+		.cfg = cfg,
+		.n = n,
+	};
+	int i, ret;
+
+	ctx.param = calloc(1, sizeof(*ctx.param) + PARAM_SZ);
+	ctx.rules = calloc(n, sizeof(*ctx.rules));
+	ctx.attr = calloc(n, sizeof(*ctx.attr));
+	ctx.cur = calloc(n, sizeof(*ctx.cur));
+	if (!ctx.param || !ctx.rules || !ctx.attr || !ctx.cur) {
+		ret = ENOMEM;
+		goto out;
+	}
+	ctx.param->match_sz = PARAM_SZ;
+
+	ret = setup(&ctx);
+	if (ret)
+		goto out;
+
+	check_same_actions(&ctx);
+
+	ret = check_modify(&ctx);
+	if (ret)
+		goto out;
+	check_partial(&ctx);
+
+	/* Back to the first sets, as if the rules had just been created */
+	for (i = 0; i < n; i++)
+		set_attr(&ctx, i, i % NUM_SETS);
+	if (mlx5dv_dr_rule_modify_actions_bulk(n, ctx.attr)) {
+		ret = errno;
+		goto out;
+	}
+	check_rules(&ctx, n, "restore");
+	mlx5dv_dr_domain_sync(ctx.dmn, MLX5DV_DR_DOMAIN_SYNC_FLAGS_SW);
+	mlx5dv_dr_domain_query_stats(ctx.dmn, &modified);
+
+	/* Recreating them must take as many action STEs */
+	ret = create_rules(&ctx, true);
+	if (ret)
+		goto out;
+	mlx5dv_dr_domain_sync(ctx.dmn, MLX5DV_DR_DOMAIN_SYNC_FLAGS_SW);
+	mlx5dv_dr_domain_query_stats(ctx.dmn, &created);
+	if (modified.ste_icm_bytes[0] != created.ste_icm_bytes[0])
+		report(&ctx, "size 1 STE ICM is %" PRIu64 " after modifies, %" PRIu64 " when created",
+		       modified.ste_icm_bytes[0], created.ste_icm_bytes[0]);
+
+out:
+	if (ret)
+		fprintf(stderr, "%s: failed: %s\n", cfg->name, strerror(ret));
+	teardown(&ctx);
+	free(ctx.cur);
+	free(ctx.attr);
+	free(ctx.rules);
+	free(ctx.param);
+	return ret || ctx.bad;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+enum bench_mode {
+	BENCH_RECREATE,
+	BENCH_MODIFY,
+	BENCH_MODIFY_BULK,
+	BENCH_MAX,
+};
+
+static const char * const bench_names[] = {
+	[BENCH_RECREATE] = "destroy + create",
+	[BENCH_MODIFY] = "modify",
+	[BENCH_MODIFY_BULK] = "bulk modify",
+};
+
+/* Move every rule between two destination tables */
+static int bench(int n)
+{
+	const struct mod_config cfg = {"NIC_TX", MLX5DV_DR_DOMAIN_TYPE_NIC_TX, false};
+	struct mlx5dv_dr_domain_emu_stats start, end;
+	struct mlx5dv_dr_action *dest[2] = {};
+	struct mlx5dv_dr_table *tbl3 = NULL;
+	struct mod_ctx ctx = {
+		.cfg = &cfg,
+		.n = n,
+	};
+	struct mlx5dv_dr_action **next;
+	enum bench_mode mode;
+	int i, ret = ENOMEM;
+	double t;
+
+	ctx.param = calloc(1, sizeof(*ctx.param) + PARAM_SZ);
+	ctx.rules = calloc(n, sizeof(*ctx.rules));
+	ctx.attr = calloc(n, sizeof(*ctx.attr));
+	if (!ctx.param || !ctx.rules || !ctx.attr)
+		goto out;
+	ctx.param->match_sz = PARAM_SZ;
+
+	ret = EINVAL;
+	ctx.dmn = mlx5dv_dr_domain_create_emu(cfg.type, 0);
+	if (!ctx.dmn)
+		goto out;
+	ctx.tbl1 = mlx5dv_dr_table_create(ctx.dmn, 1);
+	ctx.tbl2 = mlx5dv_dr_table_create(ctx.dmn, 2);
+	tbl3 = mlx5dv_dr_table_create(ctx.dmn, 3);
+	if (!ctx.tbl1 || !ctx.tbl2 || !tbl3)
+		goto out;
+	set_mask(&ctx);
+	ctx.matcher = mlx5dv_dr_matcher_create(ctx.tbl1, 1, 1, ctx.param);
+	dest[0] = mlx5dv_dr_action_create_dest_table(ctx.tbl2);
+	dest[1] = mlx5dv_dr_action_create_dest_table(tbl3);
+	if (!ctx.matcher || !dest[0] || !dest[1])
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		set_packet(&ctx, i);
+		ctx.rules[i] = mlx5dv_dr_rule_create(ctx.matcher, ctx.param, 1,
+						     &dest[0]);
+		if (!ctx.rules[i])
+			goto out;
+	}
+
+	for (mode = 0; mode < BENCH_MAX; mode++) {
+		next = &dest[(mode + 1) % 2];
+		mlx5dv_dr_domain_emu_query(ctx.dmn, &start);
+		t = now_ns();
+		switch (mode) {
+		case BENCH_RECREATE:
+			for (i = 0; i < n; i++) {
+				mlx5dv_dr_rule_destroy(ctx.rules[i]);
+				set_packet(&ctx, i);
+				ctx.rules[i] = mlx5dv_dr_rule_create(
+					ctx.matcher, ctx.param, 1, next);
+				if (!ctx.rules[i])
+					goto out;
+			}
+			break;
+		case BENCH_MODIFY:
+			for (i = 0; i < n; i++)
+				if (mlx5dv_dr_rule_modify_actions(ctx.rules[i],
+								  1, next))
+					goto out;
+			break;
+		default:
+			for (i = 0; i < n; i++) {
+				ctx.attr[i].rule = ctx.rules[i];
+				ctx.attr[i].num_actions = 1;
+				ctx.attr[i].actions = next;
+			}
+			if (mlx5dv_dr_rule_modify_actions_bulk(n, ctx.attr))
+				goto out;
+			break;
+		}
+		t = now_ns() - t;
+		mlx5dv_dr_domain_emu_query(ctx.dmn, &end);
+		printf("%-18s %7.0f ns/rule  %.2f writes/rule  %.1f bytes/rule\n",
+		       bench_names[mode], t / n,
+		       (double)(end.write_ops - start.write_ops) / n,
+		       (double)(end.write_bytes - start.write_bytes) / n);
+	}
+	ret = 0;
+
+out:
+	if (ctx.rules)
+		mlx5dv_dr_rule_destroy_bulk(n, ctx.rules);
+	for (i = 0; i < ARRAY_SIZE(dest); i++)
+		if (dest[i])
+			mlx5dv_dr_action_destroy(dest[i]);
+	if (ctx.matcher)
+		mlx5dv_dr_matcher_destroy(ctx.matcher);
+	if (tbl3)
+		mlx5dv_dr_table_destroy(tbl3);
+	if (ctx.tbl2)
+		mlx5dv_dr_table_destroy(ctx.tbl2);
+	if (ctx.tbl1)
+		mlx5dv_dr_table_destroy(ctx.tbl1);
+	if (ctx.dmn)
+		mlx5dv_dr_domain_destroy(ctx.dmn);
+	if (ret)
+		fprintf(stderr, "benchmark failed\n");
+	free(ctx.attr);
+	free(ctx.rules);
+	free(ctx.param);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 3000;
+	int bench_n = argc > 2 ? atoi(argv[2]) : 100000;
+	unsigned int i;
+	int ret = 0;
+
+	if (n < PARTIAL_BATCH)
+		n = PARTIAL_BATCH;
+
+	for (i = 0; i < ARRAY_SIZE(configs); i++)
+		if (run(&configs[i], n))
+			ret = 1;
+	if (ret)
+		return ret;
+
+	if (bench_n > 0 && bench(bench_n))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,226 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Insert and destroy rules from several threads at once in an emulated
+ * domain.  Each thread owns a matcher, so rule operations only share the
+ * domain lock and the send rings.  After the inserts every rule must be
+ * reachable, and after the destroys none of them may be.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <infiniband/mlx5dv.h>
+
+#include "../mlx5_ifc.h"
+
+#define PARAM_SZ	DEVX_ST_SZ_BYTES(dr_match_param)
+#define MAX_THREADS	8
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int n;
+	bool destroy;
+	bool started;
+	int err;
+	struct mlx5dv_dr_matcher *matcher;
+	struct mlx5dv_dr_action *drop;
+	struct mlx5dv_dr_rule **rules;
+};
+
+static struct mlx5dv_flow_match_parameters *alloc_param(void)
+{
+	struct mlx5dv_flow_match_parameters *param;
+
+	param = calloc(1, sizeof(*param) + PARAM_SZ);
+	if (param)
+		param->match_sz = PARAM_SZ;
+	return param;
+}
+
+static void set_packet(struct mlx5dv_flow_match_parameters *param,
+		       int id, int i)
+{
+	void *buf = param->match_buf;
+
+	memset(buf, 0, PARAM_SZ);
+	DEVX_SET(dr_match_param, buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, buf, outer.ip_protocol, 17);
+	DEVX_SET(dr_match_param, buf, outer.dst_ip_31_0, (id << 24) | i);
+	DEVX_SET(dr_match_param, buf, outer.udp_dport, 80);
+}
+
+static void *worker_run(void *arg)
+{
+	struct mlx5dv_flow_match_parameters *param;
+	struct worker *w = arg;
+	int i;
+
+	param = alloc_param();
+	if (!param) {
+		w->err = ENOMEM;
+		return NULL;
+	}
+
+	for (i = 0; i < w->n; i++) {
+		if (w->destroy) {
+			if (w->rules[i] && mlx5dv_dr_rule_destroy(w->rules[i]))
+				w->err = errno;
+			w->rules[i] = NULL;
+			continue;
+		}
+		set_packet(param, w->id, i);
+		w->rules[i] = mlx5dv_dr_rule_create(w->matcher, param, 1,
+						    &w->drop);
+		if (!w->rules[i]) {
+			w->err = errno;
+			break;
+		}
+	}
+	free(param);
+	return NULL;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run every worker in its own thread and return the elapsed time */
+static double run_workers(struct worker *w, int nthreads, bool destroy)
+{
+	double start;
+	int i;
+
+	start = now_sec();
+	for (i = 0; i < nthreads; i++) {
+		w[i].destroy = destroy;
+		w[i].err = pthread_create(&w[i].thread, NULL, worker_run,
+					  &w[i]);
+		w[i].started = !w[i].err;
+	}
+	for (i = 0; i < nthreads; i++)
+		if (w[i].started)
+			pthread_join(w[i].thread, NULL);
+	return now_sec() - start;
+}
+
+static int check_rules(struct mlx5dv_dr_table *tbl, struct worker *w,
+		       int nthreads, struct mlx5dv_flow_match_parameters *param)
+{
+	struct mlx5dv_dr_emu_match_result res;
+	int i, j, bad = 0;
+
+	for (i = 0; i < nthreads; i++)
+		for (j = 0; j < w[i].n; j++) {
+			set_packet(param, w[i].id, j);
+			if (mlx5dv_dr_table_emu_match(tbl, 0, param, &res) ||
+			    res.rule != w[i].rules[j])
+				bad++;
+		}
+	return bad;
+}
+
+static int run(int nthreads, int n)
+{
+	struct mlx5dv_flow_match_parameters *param;
+	struct worker w[MAX_THREADS] = {};
+	struct mlx5dv_dr_action *drop = NULL;
+	struct mlx5dv_dr_table *tbl = NULL;
+	struct mlx5dv_dr_domain *dmn;
+	double ins, del;
+	int i, bad = 0;
+
+	param = alloc_param();
+	dmn = mlx5dv_dr_domain_create_emu(MLX5DV_DR_DOMAIN_TYPE_NIC_RX,
+					  MLX5DV_DR_DOMAIN_EMU_FLAGS_STE_V1);
+	if (!param || !dmn)
+		goto err;
+
+	tbl = mlx5dv_dr_table_create(dmn, 1);
+	drop = mlx5dv_dr_action_create_drop();
+	if (!tbl || !drop)
+		goto err;
+
+	DEVX_SET(dr_match_param, param->match_buf, outer.ip_version, 4);
+	DEVX_SET(dr_match_param, param->match_buf, outer.ip_protocol, 0xff);
+	DEVX_SET(dr_match_param, param->match_buf, outer.dst_ip_31_0,
+		 0xffffffff);
+	DEVX_SET(dr_match_param, param->match_buf, outer.udp_dport, 0xffff);
+	for (i = 0; i < nthreads; i++) {
+		w[i].id = i + 1;
+		w[i].n = n;
+		w[i].drop = drop;
+		w[i].rules = calloc(n, sizeof(*w[i].rules));
+		w[i].matcher = mlx5dv_dr_matcher_create(tbl, i, 1, param);
+		if (!w[i].rules || !w[i].matcher)
+			goto err;
+	}
+
+	ins = run_workers(w, nthreads, false);
+	for (i = 0; i < nthreads; i++)
+		if (w[i].err)
+			goto err;
+	bad += check_rules(tbl, w, nthreads, param);
+
+	del = run_workers(w, nthreads, true);
+	for (i = 0; i < nthreads; i++)
+		if (w[i].err)
+			goto err;
+	bad += check_rules(tbl, w, nthreads, param);
+
+	printf("%d threads %7d rules: insert %8.0f rules/s  destroy %8.0f rules/s\n",
+	       nthreads, nthreads * n, nthreads * n / ins,
+	       nthreads * n / del);
+	if (bad)
+		fprintf(stderr, "%d threads: %d packets reached the wrong rule\n",
+			nthreads, bad);
+	goto out;
+
+err:
+	fprintf(stderr, "%d threads: failed: %s\n", nthreads, strerror(errno));
+	for (i = 0; i < nthreads; i++)
+		if (w[i].err)
+			fprintf(stderr, "thread %d failed: %s\n", w[i].id,
+				strerror(w[i].err));
+	bad = 1;
+out:
+	for (i = 0; i < nthreads; i++) {
+		if (w[i].rules) {
+			w[i].destroy = true;
+			worker_run(&w[i]);
+		}
+		if (w[i].matcher)
+			mlx5dv_dr_matcher_destroy(w[i].matcher);
+		free(w[i].rules);
+	}
+	if (drop)
+		mlx5dv_dr_action_destroy(drop);
+	if (tbl)
+		mlx5dv_dr_table_destroy(tbl);
+	if (dmn && mlx5dv_dr_domain_destroy(dmn))
+		bad = 1;
+	free(param);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 5000;
+	int nthreads, ret = 0;
+
+	if (n <= 0)
+		n = 5000;
+
+	for (nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2)
+		if (run(nthreads, n))
+			ret = 1;
+	return ret;
+}
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: GPL-2.0 OR Linux-OpenIB */
+/*
+ * Turn a binary dump of mlx5dv_dump_dr_domain_stats() into a report.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <endian.h>
+#include <inttypes.h>
+
+#include "../dr_stats_dump.h"
+
+#define MAX_REC_VALS	UINT16_MAX
+
+static const char *domain_type_str(uint64_t type)
+{
+	switch (type) {
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
+		return "NIC_RX";
+	case MLX5DV_DR_DOMAIN_TYPE_NIC_TX:
+		return "NIC_TX";
+	case MLX5DV_DR_DOMAIN_TYPE_FDB:
+		return "FDB";
+	default:
+		return "unknown";
+	}
+}
+
+static double mib(uint64_t bytes)
+{
+	return bytes / (1024.0 * 1024.0);
+}
+
+static double pct(uint64_t part, uint64_t total)
+{
+	return total ? 100.0 * part / total : 0;
+}
+
+static void report_domain(const uint64_t *v)
+{
+	uint64_t ste_icm = 0;
+	int i;
+
+	for (i = 0; i < MLX5DV_DR_ICM_CHUNK_SIZES; i++)
+		ste_icm += v[DR_STATS_DUMP_DOMAIN_STE_ICM + i];
+
+	printf("domain 0x%" PRIx64 " type %s\n", v[DR_STATS_DUMP_DOMAIN_ID],
+	       domain_type_str(v[DR_STATS_DUMP_DOMAIN_TYPE]));
+	printf("  STE ICM: %.1f MiB in use of %.1f MiB (%.1f%%)\n",
+	       mib(ste_icm), mib(v[DR_STATS_DUMP_DOMAIN_STE_ICM_TOTAL]),
+	       pct(ste_icm, v[DR_STATS_DUMP_DOMAIN_STE_ICM_TOTAL]));
+	for (i = 0; i < MLX5DV_DR_ICM_CHUNK_SIZES; i++) {
+		if (!v[DR_STATS_DUMP_DOMAIN_STE_ICM + i])
+			continue;
+		printf("    %8u entry chunks: %10.3f MiB\n", 1U << i,
+		       mib(v[DR_STATS_DUMP_DOMAIN_STE_ICM + i]));
+	}
+	printf("  action ICM: %.1f MiB in use of %.1f MiB\n",
+	       mib(v[DR_STATS_DUMP_DOMAIN_ACTION_ICM]),
+	       mib(v[DR_STATS_DUMP_DOMAIN_ACTION_ICM_TOTAL]));
+	printf("  send ring stalls: %" PRIu64 ", %.3f ms waiting\n",
+	       v[DR_STATS_DUMP_DOMAIN_SEND_STALLS],
+	       v[DR_STATS_DUMP_DOMAIN_SEND_STALL_NS] / 1e6);
+}
+
+static void report_table(const uint64_t *v)
+{
+	printf("\ntable 0x%" PRIx64 " level %" PRIu64 "\n",
+	       v[DR_STATS_DUMP_TABLE_ID], v[DR_STATS_DUMP_TABLE_LEVEL]);
+}
+
+static int report_matcher(const uint64_t *v)
+{
+	uint64_t num_rehash = v[DR_STATS_DUMP_MATCHER_NUM_REHASH];
+	int i;
+
+	if (v[DR_STATS_DUMP_MATCHER_LOG_HTBL_SIZE] >= 64) {
+		fprintf(stderr, "Corrupt matcher record\n");
+		return 1;
+	}
+
+	printf("  matcher 0x%" PRIx64 " prio %" PRIu64 ": %" PRIu64 " rules\n",
+	       v[DR_STATS_DUMP_MATCHER_ID], v[DR_STATS_DUMP_MATCHER_PRIO],
+	       v[DR_STATS_DUMP_MATCHER_NUM_RULES]);
+	printf("    first hash table: %llu entries, %" PRIu64
+	       " valid, %" PRIu64 " collisions (%.1f%%)\n",
+	       1ULL << v[DR_STATS_DUMP_MATCHER_LOG_HTBL_SIZE],
+	       v[DR_STATS_DUMP_MATCHER_HTBL_VALID_ENTRIES],
+	       v[DR_STATS_DUMP_MATCHER_HTBL_COLLISIONS],
+	       pct(v[DR_STATS_DUMP_MATCHER_HTBL_COLLISIONS],
+		   v[DR_STATS_DUMP_MATCHER_HTBL_VALID_ENTRIES]));
+	printf("    collision entries added: %" PRIu64
+	       ", longest miss list: %" PRIu64 "\n",
+	       v[DR_STATS_DUMP_MATCHER_NUM_COLLISIONS],
+	       v[DR_STATS_DUMP_MATCHER_MAX_MISS_LIST_LEN]);
+	printf("    STEs by miss list length:");
+	for (i = 0; i < MLX5DV_DR_MISS_LIST_LEN_HIST; i++)
+		printf(" %d%s:%" PRIu64, i + 1,
+		       i == MLX5DV_DR_MISS_LIST_LEN_HIST - 1 ? "+" : "",
+		       v[DR_STATS_DUMP_MATCHER_MISS_LIST_LEN + i]);
+	printf("\n    rehash: %" PRIu64 ", %.3f ms total, %.3f ms longest\n",
+	       num_rehash, v[DR_STATS_DUMP_MATCHER_REHASH_NS] / 1e6,
+	       v[DR_STATS_DUMP_MATCHER_MAX_REHASH_NS] / 1e6);
+	return 0;
+}
+
+static int report(FILE *f)
+{
+	static uint64_t vals[MAX_REC_VALS];
+	struct dr_stats_dump_hdr hdr;
+	struct dr_stats_dump_rec rec;
+	uint16_t num_vals, type;
+	int i;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    le32toh(hdr.magic) != DR_STATS_DUMP_MAGIC) {
+		fprintf(stderr, "Not a DR stats dump\n");
+		return 1;
+	}
+
+	if (le32toh(hdr.version) != DR_STATS_DUMP_VERSION) {
+		fprintf(stderr, "Unsupported dump version %u\n",
+			le32toh(hdr.version));
+		return 1;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		type = le16toh(rec.type);
+		num_vals = le16toh(rec.num_vals);
+
+		/* Values this tool doesn't know read as 0 */
+		memset(vals, 0, sizeof(vals));
+		if (fread(vals, sizeof(*vals), num_vals, f) != num_vals) {
+			fprintf(stderr, "Truncated dump\n");
+			return 1;
+		}
+		for (i = 0; i < num_vals; i++)
+			vals[i] = le64toh(vals[i]);
+
+		switch (type) {
+		case DR_STATS_DUMP_REC_DOMAIN:
+			report_domain(vals);
+			break;
+		case DR_STATS_DUMP_REC_TABLE:
+			report_table(vals);
+			break;
+		case DR_STATS_DUMP_REC_MATCHER:
+			if (report_matcher(vals))
+				return 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [FILE]\n", argv0);
+	printf("\n");
+	printf("Report the DR steering counters saved by mlx5dv_dump_dr_domain_stats(),\n");
+	printf("read from FILE or from the standard input.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f = stdin;
+	int ret;
+
+	while (1) {
+		static const struct option long_options[] = {
+			{ .name = "help", .has_arg = no_argument, .val = 'h' },
+			{}
+		};
+		int c;
+
+		c = getopt_long(argc, argv, "h", long_options, NULL);
+		if (c == -1)
+			break;
+
+		usage(argv[0]);
+		return c == 'h' ? 0 : 1;
+	}
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "rb");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	ret = report(f);
+
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
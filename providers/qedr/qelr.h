@@ -139,6 +139,7 @@ struct qelr_devctx {
 	uint32_t		db_size;
 	enum qelr_dpm_flags	dpm_flags;
 	uint32_t		kernel_page_size;
+	struct dma_arena	dma_arena;
 	uint16_t		ldpm_limit_size;
 	uint16_t		edpm_limit_size;
 	uint8_t			edpm_trans_size;
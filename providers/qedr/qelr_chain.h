@@ -36,6 +36,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+struct qelr_devctx;
+
 struct qelr_chain {
 	void		*first_addr;	/* Address of first element in chain */
 	void		*last_addr;	/* Address of last element in chain */
@@ -161,8 +163,8 @@ static inline void qelr_chain_set_prod(
 
 void *qelr_chain_get_last_elem(struct qelr_chain *p_chain);
 void qelr_chain_reset(struct qelr_chain *p_chain);
-int qelr_chain_alloc(struct qelr_chain *chain, int chain_size, int page_size,
-		     uint16_t elem_size);
-void qelr_chain_free(struct qelr_chain *buf);
+int qelr_chain_alloc(struct qelr_devctx *cxt, struct qelr_chain *chain,
+		     int chain_size, int page_size, uint16_t elem_size);
+void qelr_chain_free(struct qelr_devctx *cxt, struct qelr_chain *buf);
 
 #endif /* __QELR_CHAIN_H__ */
@@ -252,6 +252,9 @@ static struct verbs_context *qelr_alloc_context(struct ibv_device *ibdev,
 		goto cmd_err;
 	}
 
+	if (dma_arena_init(&ctx->dma_arena, ibdev, ctx->kernel_page_size))
+		goto arena_err;
+
 	v_ctx->create_qp_ex = qelr_create_qp_ex;
 	v_ctx->open_xrcd = qelr_open_xrcd;
 	v_ctx->close_xrcd = qelr_close_xrcd;
@@ -260,6 +263,8 @@ static struct verbs_context *qelr_alloc_context(struct ibv_device *ibdev,
 
 	return &ctx->ibv_ctx;
 
+arena_err:
+	munmap(ctx->db_addr, ctx->db_size);
 cmd_err:
 	qelr_err("%s: Failed to allocate context for device.\n", __func__);
 	qelr_close_debug_file(ctx);
@@ -275,6 +280,7 @@ static void qelr_free_context(struct ibv_context *ibctx)
 	if (ctx->db_addr)
 		munmap(ctx->db_addr, ctx->db_size);
 
+	dma_arena_cleanup(&ctx->dma_arena);
 	free(ctx->srq_table);
 	qelr_close_debug_file(ctx);
 	verbs_uninit_context(&ctx->ibv_ctx);
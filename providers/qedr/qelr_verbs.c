@@ -242,8 +242,8 @@ struct ibv_cq *qelr_create_cq(struct ibv_context *context, int cqe,
 
 	/* allocate CQ buffer */
 	chain_size = qelr_cq_entries(cqe) * QELR_CQE_SIZE;
-	rc = qelr_chain_alloc(&cq->chain, chain_size, cxt->kernel_page_size,
-			      QELR_CQE_SIZE);
+	rc = qelr_chain_alloc(cxt, &cq->chain, chain_size,
+			      cxt->kernel_page_size, QELR_CQE_SIZE);
 	if (rc)
 		goto err_0;
 
@@ -296,7 +296,7 @@ struct ibv_cq *qelr_create_cq(struct ibv_context *context, int cqe,
 	return &cq->ibv_cq;
 
 err_1:
-	qelr_chain_free(&cq->chain);
+	qelr_chain_free(cxt, &cq->chain);
 err_0:
 	free(cq);
 
@@ -319,7 +319,7 @@ int qelr_destroy_cq(struct ibv_cq *ibv_cq)
 		return rc;
 	}
 
-	qelr_chain_free(&cq->chain);
+	qelr_chain_free(cxt, &cq->chain);
 	if (cq->db_rec_map)
 		munmap(cq->db_rec_map, cxt->kernel_page_size);
 
@@ -357,19 +357,14 @@ int qelr_modify_srq(struct ibv_srq *srq, struct ibv_srq_attr *attr,
 
 }
 
-static void qelr_destroy_srq_buffers(struct ibv_srq *ibv_srq)
+static void qelr_destroy_srq_buffers(struct qelr_devctx *cxt,
+				     struct ibv_srq *ibv_srq)
 {
 	struct qelr_srq *srq = get_qelr_srq(ibv_srq);
-	uint32_t *virt_prod_pair_addr;
-	uint32_t prod_size;
 
-	qelr_chain_free(&srq->hw_srq.chain);
-
-	virt_prod_pair_addr = srq->hw_srq.virt_prod_pair_addr;
-	prod_size = sizeof(struct rdma_srq_producers);
-
-	ibv_dofork_range(virt_prod_pair_addr, prod_size);
-	munmap(virt_prod_pair_addr, prod_size);
+	qelr_chain_free(cxt, &srq->hw_srq.chain);
+	dma_arena_free(&cxt->dma_arena, srq->hw_srq.virt_prod_pair_addr,
+		       sizeof(struct rdma_srq_producers));
 }
 
 int qelr_destroy_srq(struct ibv_srq *ibv_srq)
@@ -385,7 +380,7 @@ int qelr_destroy_srq(struct ibv_srq *ibv_srq)
 	if (srq->is_xrc)
 		cxt->srq_table[srq->srq_id] = NULL;
 
-	qelr_destroy_srq_buffers(ibv_srq);
+	qelr_destroy_srq_buffers(cxt, ibv_srq);
 	free(srq);
 
 	return 0;
@@ -423,7 +418,7 @@ static int qelr_create_srq_buffers(struct qelr_devctx *cxt,
 	max_sges = max_wr * (cxt->sges_per_srq_wr + 1); /* +1 for header */
 	chain_size = max_sges * QELR_RQE_ELEMENT_SIZE;
 
-	rc = qelr_chain_alloc(&srq->hw_srq.chain, chain_size,
+	rc = qelr_chain_alloc(cxt, &srq->hw_srq.chain, chain_size,
 			      cxt->kernel_page_size, QELR_RQE_ELEMENT_SIZE);
 	if (rc) {
 		DP_ERR(cxt->dbg_fp,
@@ -432,20 +427,12 @@ static int qelr_create_srq_buffers(struct qelr_devctx *cxt,
 	}
 
 	prod_size = sizeof(struct rdma_srq_producers);
-	addr = mmap(NULL, prod_size, PROT_READ | PROT_WRITE,
-		    MAP_PRIVATE | MAP_ANONYMOUS, -1,
-		    0);
-	if (addr == MAP_FAILED) {
+	addr = dma_arena_alloc(&cxt->dma_arena, prod_size);
+	if (!addr) {
+		rc = errno;
 		DP_ERR(cxt->dbg_fp,
-		       "create srq: failed to map producer, got %d", errno);
-		qelr_chain_free(&srq->hw_srq.chain);
-		return errno;
-	}
-
-	rc = ibv_dontfork_range(addr, prod_size);
-	if (rc) {
-		munmap(addr, prod_size);
-		qelr_chain_free(&srq->hw_srq.chain);
+		       "create srq: failed to map producer, got %d", rc);
+		qelr_chain_free(cxt, &srq->hw_srq.chain);
 		return rc;
 	}
 
@@ -483,7 +470,7 @@ struct ibv_srq *qelr_create_srq(struct ibv_pd *pd,
 	ret = ibv_cmd_create_srq(pd, ibv_srq, init_attr, &req.ibv_cmd,
 				    sizeof(req), &resp.ibv_resp, sizeof(resp));
 	if (ret) {
-		qelr_destroy_srq_buffers(ibv_srq);
+		qelr_destroy_srq_buffers(cxt, ibv_srq);
 		free(srq);
 		return NULL;
 	}
@@ -501,14 +488,14 @@ static void qelr_free_sq(struct qelr_qp *qp)
 	free(qp->wqe_wr_id);
 }
 
-static void qelr_chain_free_sq(struct qelr_qp *qp)
+static void qelr_chain_free_sq(struct qelr_devctx *cxt, struct qelr_qp *qp)
 {
-	qelr_chain_free(&qp->sq.chain);
+	qelr_chain_free(cxt, &qp->sq.chain);
 }
 
-static void qelr_chain_free_rq(struct qelr_qp *qp)
+static void qelr_chain_free_rq(struct qelr_devctx *cxt, struct qelr_qp *qp)
 {
-	qelr_chain_free(&qp->rq.chain);
+	qelr_chain_free(cxt, &qp->rq.chain);
 }
 
 static inline bool qelr_qp_has_rq(struct qelr_qp *qp)
@@ -537,8 +524,8 @@ static inline int qelr_create_qp_buffers_sq(struct qelr_devctx *cxt,
 	max_send_buf = max_send_sges * QELR_SQE_ELEMENT_SIZE;
 
 	chain_size = max_send_buf;
-	rc = qelr_chain_alloc(&qp->sq.chain, chain_size, cxt->kernel_page_size,
-			      QELR_SQE_ELEMENT_SIZE);
+	rc = qelr_chain_alloc(cxt, &qp->sq.chain, chain_size,
+			      cxt->kernel_page_size, QELR_SQE_ELEMENT_SIZE);
 	if (rc)
 		DP_ERR(cxt->dbg_fp, "create qp: failed to map SQ chain, got %d", rc);
 
@@ -564,8 +551,8 @@ static inline int qelr_create_qp_buffers_rq(struct qelr_devctx *cxt,
 	max_recv_buf = max_recv_sges * QELR_RQE_ELEMENT_SIZE;
 
 	chain_size = max_recv_buf;
-	rc = qelr_chain_alloc(&qp->rq.chain, chain_size, cxt->kernel_page_size,
-			      QELR_RQE_ELEMENT_SIZE);
+	rc = qelr_chain_alloc(cxt, &qp->rq.chain, chain_size,
+			      cxt->kernel_page_size, QELR_RQE_ELEMENT_SIZE);
 	if (rc)
 		DP_ERR(cxt->dbg_fp, "create qp: failed to map RQ chain, got %d", rc);
 
@@ -590,7 +577,7 @@ static inline int qelr_create_qp_buffers(struct qelr_devctx *cxt,
 	if (qelr_qp_has_rq(qp)) {
 		rc = qelr_create_qp_buffers_rq(cxt, qp, attrx);
 		if (rc && qelr_qp_has_sq(qp)) {
-			qelr_chain_free_sq(qp);
+			qelr_chain_free_sq(cxt, qp);
 			if (qp->sq.db_rec_map)
 				munmap(qp->sq.db_rec_map,
 				       cxt->kernel_page_size);
@@ -1057,8 +1044,8 @@ int qelr_destroy_qp(struct ibv_qp *ibqp)
 
 	qelr_free_sq(qp);
 	qelr_free_rq(qp);
-	qelr_chain_free_sq(qp);
-	qelr_chain_free_rq(qp);
+	qelr_chain_free_sq(cxt, qp);
+	qelr_chain_free_rq(cxt, qp);
 	if (qp->sq.db_rec_map)
 		munmap(qp->sq.db_rec_map, cxt->kernel_page_size);
 	if (qp->rq.db_rec_map)
@@ -2674,7 +2661,7 @@ qelr_create_xrc_srq(struct ibv_context *context,
 	return ibv_srq;
 
 err1:
-	qelr_destroy_srq_buffers(ibv_srq);
+	qelr_destroy_srq_buffers(cxt, ibv_srq);
 	free(srq);
 err0:
 	DP_ERR(cxt->dbg_fp,
@@ -2761,10 +2748,10 @@ err2:
 		DP_ERR(cxt->dbg_fp, "create qp: fatal fault. rc=%d\n", rc);
 err1:
 	if (qelr_qp_has_sq(qp))
-		qelr_chain_free(&qp->sq.chain);
+		qelr_chain_free(cxt, &qp->sq.chain);
 
 	if (qelr_qp_has_rq(qp))
-		qelr_chain_free(&qp->rq.chain);
+		qelr_chain_free(cxt, &qp->rq.chain);
 err0:
 	free(qp);
 
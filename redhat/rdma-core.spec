@@ -586,7 +586,9 @@ fi
 
 %files -n libibverbs-utils
 %{_bindir}/ibv_*
+%{_bindir}/mlx5dv_dr_stats
 %{_mandir}/man1/ibv_*
+%{_mandir}/man1/mlx5dv_dr_stats.*
 
 %files -n ibacm
 %config(noreplace) %{_sysconfdir}/rdma/ibacm_opts.cfg
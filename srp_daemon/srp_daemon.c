@@ -60,10 +60,13 @@
 #include <pthread.h>
 #include <string.h>
 #include <signal.h>
+#include <search.h>
+#include <time.h>
 #include <sys/syslog.h>
 #include <infiniband/umad.h>
 #include <infiniband/umad_types.h>
 #include <infiniband/umad_sa.h>
+#include <ccan/list.h>
 #include "srp_ib_types.h"
 
 #include "srp_daemon.h"
@@ -216,7 +219,7 @@ static int srpd_sys_read_uint64(const char *dir_name, const char *file_name,
 
 static void usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-vVcaeon] [-d <umad device> | -i <infiniband device> [-p <port_num>]] [-t <timeout (ms)>] [-r <retries>] [-R <rescan time>] [-f <rules file>\n", argv0);
+	fprintf(stderr, "Usage: %s [-vVcaeon] [-d <umad device> | -i <infiniband device> [-p <port_num>]] [-t <timeout (ms)>] [-r <retries>] [-m <outstanding>] [-R <rescan time>] [-f <rules file>\n", argv0);
 	fprintf(stderr, "-v 			Verbose\n");
 	fprintf(stderr, "-V 			debug Verbose\n");
 	fprintf(stderr, "-c 			prints connection Commands\n");
@@ -233,6 +236,7 @@ static void usage(const char *argv0)
 	fprintf(stderr, "-f <rules file>	use rules File to set to which target(s) to connect (default: " SRP_DAEMON_CONFIG_FILE ")\n");
 	fprintf(stderr, "-t <timeout>		Timeout for mad response in milliseconds\n");
 	fprintf(stderr, "-r <retries>		number of send Retries for each mad\n");
+	fprintf(stderr, "-m <outstanding>	Maximum number of outstanding device management queries (default 16)\n");
 	fprintf(stderr, "-n 			New connection command format - use also initiator extension\n");
 	fprintf(stderr, "--systemd		Enable systemd integration.\n");
 	fprintf(stderr, "\nExample: srp_daemon -e -n -i mthca0 -p 1 -R 60\n");
@@ -881,27 +885,12 @@ static int pkey_to_pkey_index(struct umad_resources *umad_res, uint16_t h_pkey,
 	return res;
 }
 
-static int set_class_port_info(struct umad_resources *umad_res, uint16_t dlid, uint16_t h_pkey)
+static int fill_class_port_info(struct umad_resources *umad_res,
+				struct umad_class_port_info *cpi)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *out_dm_mad, *in_dm_mad;
-	struct umad_class_port_info    *cpi;
 	char val[64];
 	int i;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, UMAD_ATTR_CLASS_PORT_INFO, 0);
-
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("set_class_port_info: Unable to find pkey_index for pkey %#x\n", h_pkey);
-		return -1;
-	}
-
-	out_dm_mad = get_data_ptr(out_mad);
-	out_dm_mad->mad_hdr.method = UMAD_METHOD_SET;
-
-	cpi                = (void *) out_dm_mad->data;
-
 	if (srpd_sys_read_string(umad_res->port_sysfs_path, "lid", val, sizeof val) < 0) {
 		pr_err("Couldn't read LID\n");
 		return -1;
@@ -917,151 +906,305 @@ static int set_class_port_info(struct umad_resources *umad_res, uint16_t dlid, u
 	for (i = 0; i < 8; ++i)
 		cpi->trapgid.raw_be16[i] = htobe16(strtol(val + i * 5, NULL, 16));
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+	return 0;
+}
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("Class Port Info set returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
-	}
+/*
+ * Device Management discovery. The DM queries of all ports found by a scan
+ * are sent through the umad agent with up to config->max_dm_oust of them
+ * outstanding and matched to their responses by TID.
+ *
+ * IOUnitInfo.ChangeID changes whenever an IOC profile or service entry of
+ * the I/O unit changes, so the profiles and service entries read for a
+ * port are cached by port GUID and reused as long as the IOUnitInfo read by
+ * a later scan is the same. A rescan then costs one MAD per unchanged port.
+ */
+struct dm_ioc {
+	bool			valid;		/* profile was read */
+	struct srp_dm_ioc_prof	prof;
+	bool		       *svc_valid;
+	struct srp_dm_svc_entries *svc;		/* 4 service entries each */
+};
 
-	return 0;
+struct dm_iou {
+	uint64_t		h_guid;
+	struct srp_dm_iou_info	info;
+	bool			complete;	/* every query succeeded */
+	struct dm_ioc		ioc[];		/* info.max_controllers */
+};
+
+struct dm_port {
+	struct list_node	entry;
+	uint16_t		pkey;
+	uint16_t		dlid;
+	uint64_t		subnet_prefix;
+	uint64_t		h_guid;
+	unsigned int		pending;
+	bool			failed;
+	bool			cached;
+	struct srp_dm_iou_info	info;
+	struct dm_iou	       *iou;
+};
+
+struct dm_query {
+	struct list_node	entry;
+	struct dm_port	       *port;
+	uint32_t		tid;
+	uint8_t			method;
+	uint16_t		attr_id;
+	uint32_t		attr_mod;
+	int			ioc;
+	int			block;
+};
+
+struct dm_scan {
+	struct resources       *res;
+	struct list_head	ports;
+	struct list_head	queued;
+	struct list_head	wire;
+	int			on_wire;
+	int			nports;
+	int			cached;
+};
+
+/* struct dm_iou of every port scanned so far, keyed by port GUID */
+static void *dm_cache;
+
+static int dm_iou_cmp(const void *a, const void *b)
+{
+	const struct dm_iou *x = a, *y = b;
+
+	return x->h_guid < y->h_guid ? -1 : x->h_guid > y->h_guid;
 }
 
-static int get_iou_info(struct umad_resources *umad_res, uint16_t dlid,
-			uint16_t h_pkey, struct srp_dm_iou_info *iou_info)
+static void dm_iou_free(void *p)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	struct dm_iou *iou = p;
+	int i;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, SRP_DM_ATTR_IO_UNIT_INFO, 0);
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_iou_info: Unable to find pkey_index for pkey %#x\n", h_pkey);
-		return -1;
+	if (!iou)
+		return;
+
+	for (i = 0; i < iou->info.max_controllers; ++i) {
+		free(iou->ioc[i].svc_valid);
+		free(iou->ioc[i].svc);
 	}
+	free(iou);
+}
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+static struct dm_iou *dm_cache_find(uint64_t h_guid)
+{
+	struct dm_iou key = { .h_guid = h_guid };
+	struct dm_iou **node = tfind(&key, &dm_cache, dm_iou_cmp);
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("IO Unit Info query returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
+	return node ? *node : NULL;
+}
+
+static void dm_cache_insert(struct dm_iou *iou)
+{
+	struct dm_iou **node = tsearch(iou, &dm_cache, dm_iou_cmp);
+
+	if (!node) {
+		dm_iou_free(iou);
+		return;
 	}
+	if (*node != iou) {
+		dm_iou_free(*node);
+		*node = iou;
+	}
+}
 
-	memcpy(iou_info, in_dm_mad->data, sizeof *iou_info);
-/*
-	pr_debug("iou_info->max_controllers is %d\n", iou_info->max_controllers);
-*/
-	return 0;
+static void dm_cache_destroy(void)
+{
+	tdestroy(dm_cache, dm_iou_free);
+	dm_cache = NULL;
+}
+
+static int ioc_present(const struct srp_dm_iou_info *iou_info, int i)
+{
+	return ((iou_info->controller_list[i / 2] >> (4 * (1 - i % 2))) & 0xf) ==
+		SRP_DM_IOC_PRESENT;
 }
 
-static int get_ioc_prof(struct umad_resources *umad_res, uint16_t h_dlid, uint16_t h_pkey, int ioc,
-			struct srp_dm_ioc_prof *ioc_prof)
+static void dm_scan_init(struct dm_scan *scan, struct resources *res)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	memset(scan, 0, sizeof *scan);
+	scan->res = res;
+	list_head_init(&scan->ports);
+	list_head_init(&scan->queued);
+	list_head_init(&scan->wire);
+}
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, h_dlid, SRP_DM_ATTR_IO_CONTROLLER_PROFILE, ioc);
+static void dm_queue(struct dm_port *port, struct list_head *queued,
+		     uint8_t method, uint16_t attr_id, uint32_t attr_mod,
+		     int ioc, int block)
+{
+	struct dm_query *q = calloc(1, sizeof *q);
 
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_ioc_prof: Unable to find pkey_index for pkey %#x\n",
-		       h_pkey);
-		return -1;
+	if (!q) {
+		pr_err("Failed to allocate DM query\n");
+		port->failed = true;
+		return;
 	}
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+	q->port = port;
+	q->method = method;
+	q->attr_id = attr_id;
+	q->attr_mod = attr_mod;
+	q->ioc = ioc;
+	q->block = block;
+	list_add_tail(queued, &q->entry);
+	port->pending++;
+}
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("IO Controller Profile query returned status 0x%04x for %d\n",
-			be16toh(in_dm_mad->mad_hdr.status), ioc);
-		return -1;
+static void dm_queue_port(struct dm_scan *scan, uint16_t pkey, uint16_t dlid,
+			  uint64_t subnet_prefix, uint64_t h_guid)
+{
+	static const uint64_t topspin_oui = 0x0005ad0000000000ull;
+	static const uint64_t oui_mask    = 0xffffff0000000000ull;
+	struct dm_port *port = calloc(1, sizeof *port);
+
+	if (!port) {
+		pr_err("Failed to allocate DM port\n");
+		return;
 	}
 
-	memcpy(ioc_prof, in_dm_mad->data, sizeof *ioc_prof);
+	port->pkey = pkey;
+	port->dlid = dlid;
+	port->subnet_prefix = subnet_prefix;
+	port->h_guid = h_guid;
+	list_add_tail(&scan->ports, &port->entry);
+	scan->nports++;
 
-	return 0;
+	if ((h_guid & oui_mask) == topspin_oui)
+		dm_queue(port, &scan->queued, UMAD_METHOD_SET,
+			 UMAD_ATTR_CLASS_PORT_INFO, 0, 0, 0);
+	else
+		dm_queue(port, &scan->queued, UMAD_METHOD_GET,
+			 SRP_DM_ATTR_IO_UNIT_INFO, 0, 0, 0);
 }
 
-static int get_svc_entries(struct umad_resources *umad_res, uint16_t dlid, uint16_t h_pkey, int ioc,
-			   int start, int end, struct srp_dm_svc_entries *svc_entries)
+static int dm_send(struct dm_scan *scan, struct dm_query *q)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	struct umad_resources	       *umad_res = scan->res->umad_res;
+	struct srp_ib_user_mad		out_mad;
+	struct umad_dm_packet	       *out_dm_mad;
+	static uint32_t			tid;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, SRP_DM_ATTR_SERVICE_ENTRIES,
-			(ioc << 16) | (end << 8) | start);
+	init_srp_dm_mad(&out_mad, umad_res->agent, q->port->dlid, q->attr_id,
+			q->attr_mod);
 
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_svc_entries: Unable to find pkey_index for pkey %#x\n",
-		       h_pkey);
+	if (pkey_to_pkey_index(umad_res, q->port->pkey,
+			       &out_mad.hdr.addr.pkey_index) < 0) {
+		pr_err("dm_send: Unable to find pkey_index for pkey %#x\n",
+		       q->port->pkey);
 		return -1;
 	}
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
+	out_dm_mad = get_data_ptr(out_mad);
+	out_dm_mad->mad_hdr.method = q->method;
+	if (q->method == UMAD_METHOD_SET &&
+	    fill_class_port_info(umad_res, (void *) out_dm_mad->data))
 		return -1;
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("Service Entries query returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
+	/* Keep clear of the TIDs of send_and_get() and of TID 0. */
+	q->tid = ++tid | 0x80000000;
+	out_dm_mad->mad_hdr.tid = htobe64(q->tid);
+
+	if (umad_send(umad_res->portid, umad_res->agent, &out_mad,
+		      MAD_BLOCK_SIZE, config->timeout,
+		      config->mad_retries - 1) < 0) {
+		pr_err("umad_send to %u failed\n", q->port->dlid);
 		return -1;
 	}
-
-	memcpy(svc_entries, in_dm_mad->data, sizeof *svc_entries);
-
 	return 0;
 }
 
-static int do_port(struct resources *res, uint16_t pkey, uint16_t dlid,
-		   uint64_t subnet_prefix, uint64_t h_guid)
+static void dm_start_iocs(struct dm_scan *scan, struct dm_port *port)
 {
-	struct umad_resources 	       *umad_res = res->umad_res;
-	struct srp_dm_iou_info		iou_info;
-	struct srp_dm_svc_entries	svc_entries;
-	int				i, j, k, ret;
+	struct dm_iou *iou = dm_cache_find(port->h_guid);
+	int i;
 
-	static const uint64_t topspin_oui = 0x0005ad0000000000ull;
-	static const uint64_t oui_mask    = 0xffffff0000000000ull;
+	if (iou && iou->complete &&
+	    !memcmp(&iou->info, &port->info, sizeof port->info)) {
+		port->iou = iou;
+		port->cached = true;
+		scan->cached++;
+		return;
+	}
 
-	struct target_details *target = (struct target_details *)
-		malloc(sizeof(struct target_details));
+	iou = calloc(1, sizeof *iou +
+		     port->info.max_controllers * sizeof iou->ioc[0]);
+	if (!iou) {
+		pr_err("Failed to allocate IO unit\n");
+		port->failed = true;
+		return;
+	}
+	iou->h_guid = port->h_guid;
+	iou->info = port->info;
+	iou->complete = true;
+	port->iou = iou;
 
-	target->subnet_prefix = subnet_prefix;
-	target->h_guid = h_guid;
-	target->options = NULL;
+	for (i = 0; i < port->info.max_controllers; ++i)
+		if (ioc_present(&port->info, i))
+			dm_queue(port, &scan->queued, UMAD_METHOD_GET,
+				 SRP_DM_ATTR_IO_CONTROLLER_PROFILE, i + 1, i, 0);
+}
 
- 	pr_debug("enter do_port\n");
-	if ((target->h_guid & oui_mask) == topspin_oui &&
-	    set_class_port_info(umad_res, dlid, pkey))
-		pr_err("Warning: set of ClassPortInfo failed\n");
+static void dm_start_svc_entries(struct dm_scan *scan, struct dm_port *port,
+				 int i)
+{
+	struct dm_ioc *ioc = &port->iou->ioc[i];
+	int nblocks = (ioc->prof.service_entries + 3) / 4;
+	int j, n;
+
+	ioc->svc = calloc(nblocks, sizeof *ioc->svc);
+	ioc->svc_valid = calloc(nblocks, sizeof *ioc->svc_valid);
+	if (nblocks && (!ioc->svc || !ioc->svc_valid)) {
+		pr_err("Failed to allocate service entries\n");
+		port->iou->complete = false;
+		return;
+	}
 
-	ret = get_iou_info(umad_res, dlid, pkey, &iou_info);
-	if (ret < 0) {
-		pr_err("failed to get iou info for dlid %#x\n", dlid);
-		goto out;
+	for (j = 0; j < ioc->prof.service_entries; j += 4) {
+		n = j + 3;
+		if (n >= ioc->prof.service_entries)
+			n = ioc->prof.service_entries - 1;
+
+		dm_queue(port, &scan->queued, UMAD_METHOD_GET,
+			 SRP_DM_ATTR_SERVICE_ENTRIES,
+			 ((i + 1) << 16) | (n << 8) | j, i, j / 4);
 	}
+}
+
+static void report_port(struct resources *res, struct dm_port *port)
+{
+	struct srp_dm_iou_info	       *iou_info = &port->iou->info;
+	struct srp_dm_svc_entries      *svc_entries;
+	struct target_details	       *target;
+	struct dm_ioc		       *ioc;
+	int				i, j, k;
+
+	target = malloc(sizeof(struct target_details));
+	if (!target)
+		return;
+
+	target->subnet_prefix = port->subnet_prefix;
+	target->h_guid = port->h_guid;
+	target->options = NULL;
 
 	pr_human("IO Unit Info:\n");
-	pr_human("    port LID:        %04x\n", dlid);
+	pr_human("    port LID:        %04x\n", port->dlid);
 	pr_human("    port GID:        %016llx%016llx\n",
 		 (unsigned long long) target->subnet_prefix,
 		 (unsigned long long) target->h_guid);
-	pr_human("    change ID:       %04x\n", be16toh(iou_info.change_id));
-	pr_human("    max controllers: 0x%02x\n", iou_info.max_controllers);
+	pr_human("    change ID:       %04x\n", be16toh(iou_info->change_id));
+	pr_human("    max controllers: 0x%02x\n", iou_info->max_controllers);
 
 	if (config->verbose > 0)
-		for (i = 0; i < iou_info.max_controllers; ++i) {
+		for (i = 0; i < iou_info->max_controllers; ++i) {
 			pr_human("    controller[%3d]: ", i + 1);
-			switch ((iou_info.controller_list[i / 2] >>
+			switch ((iou_info->controller_list[i / 2] >>
 				 (4 * (1 - i % 2))) & 0xf) {
 			case SRP_DM_NO_IOC:      pr_human("not installed\n"); break;
 			case SRP_DM_IOC_PRESENT: pr_human("present\n");       break;
@@ -1070,57 +1213,59 @@ static int do_port(struct resources *res, uint16_t pkey, uint16_t dlid,
 			}
 		}
 
-	for (i = 0; i < iou_info.max_controllers; ++i) {
-		if (((iou_info.controller_list[i / 2] >> (4 * (1 - i % 2))) & 0xf) ==
-		    SRP_DM_IOC_PRESENT) {
-			pr_human("\n");
+	for (i = 0; i < iou_info->max_controllers; ++i) {
+		if (!ioc_present(iou_info, i))
+			continue;
 
-			if (get_ioc_prof(umad_res, dlid, pkey, i + 1, &target->ioc_prof))
-				continue;
+		pr_human("\n");
+
+		ioc = &port->iou->ioc[i];
+		if (!ioc->valid)
+			continue;
+		target->ioc_prof = ioc->prof;
+
+		pr_human("    controller[%3d]\n", i + 1);
 
-			pr_human("    controller[%3d]\n", i + 1);
+		pr_human("        GUID:      %016llx\n",
+			 (unsigned long long) be64toh(target->ioc_prof.guid));
+		pr_human("        vendor ID: %06x\n", be32toh(target->ioc_prof.vendor_id) >> 8);
+		pr_human("        device ID: %06x\n", be32toh(target->ioc_prof.device_id));
+		pr_human("        IO class : %04hx\n", be16toh(target->ioc_prof.io_class));
+		pr_human("        Maximum size of Send Messages in bytes: %d\n",
+			 be32toh(target->ioc_prof.send_size));
+		pr_human("        ID:        %s\n", target->ioc_prof.id);
+		pr_human("        service entries: %d\n", target->ioc_prof.service_entries);
 
-			pr_human("        GUID:      %016llx\n",
-				 (unsigned long long) be64toh(target->ioc_prof.guid));
-			pr_human("        vendor ID: %06x\n", be32toh(target->ioc_prof.vendor_id) >> 8);
-			pr_human("        device ID: %06x\n", be32toh(target->ioc_prof.device_id));
-			pr_human("        IO class : %04hx\n", be16toh(target->ioc_prof.io_class));
-			pr_human("        Maximum size of Send Messages in bytes: %d\n",
-				 be32toh(target->ioc_prof.send_size));
-			pr_human("        ID:        %s\n", target->ioc_prof.id);
-			pr_human("        service entries: %d\n", target->ioc_prof.service_entries);
+		for (j = 0; j < target->ioc_prof.service_entries; j += 4) {
+			int n;
 
-			for (j = 0; j < target->ioc_prof.service_entries; j += 4) {
-				int n;
+			n = j + 3;
+			if (n >= target->ioc_prof.service_entries)
+				n = target->ioc_prof.service_entries - 1;
 
-				n = j + 3;
-				if (n >= target->ioc_prof.service_entries)
-					n = target->ioc_prof.service_entries - 1;
+			if (!ioc->svc_valid || !ioc->svc_valid[j / 4])
+				continue;
+			svc_entries = &ioc->svc[j / 4];
 
-				if (get_svc_entries(umad_res, dlid, pkey, i + 1,
-						    j, n, &svc_entries))
+			for (k = 0; k <= n - j; ++k) {
+
+				if (sscanf(svc_entries->service[k].name,
+					   "SRP.T10:%16s",
+					   target->id_ext) != 1)
 					continue;
 
-				for (k = 0; k <= n - j; ++k) {
-
-					if (sscanf(svc_entries.service[k].name,
-						   "SRP.T10:%16s",
-						   target->id_ext) != 1)
-						continue;
-
-					pr_human("            service[%3d]: %016llx / %s\n",
-						 j + k,
-						 (unsigned long long) be64toh(svc_entries.service[k].id),
-						 svc_entries.service[k].name);
-
-					target->h_service_id = be64toh(svc_entries.service[k].id);
-					target->pkey = pkey;
-					if (is_enabled_by_rules_file(target)) {
-						if (!add_non_exist_target(target) && !config->once) {
-							target->retry_time =
-								time(NULL) + config->retry_timeout;
-							push_to_retry_list(res->sync_res, target);
-						}
+				pr_human("            service[%3d]: %016llx / %s\n",
+					 j + k,
+					 (unsigned long long) be64toh(svc_entries->service[k].id),
+					 svc_entries->service[k].name);
+
+				target->h_service_id = be64toh(svc_entries->service[k].id);
+				target->pkey = port->pkey;
+				if (is_enabled_by_rules_file(target)) {
+					if (!add_non_exist_target(target) && !config->once) {
+						target->retry_time =
+							time(NULL) + config->retry_timeout;
+						push_to_retry_list(res->sync_res, target);
 					}
 				}
 			}
@@ -1129,9 +1274,187 @@ static int do_port(struct resources *res, uint16_t pkey, uint16_t dlid,
 
 	pr_human("\n");
 
-out:
 	free(target);
-	return ret;
+}
+
+static void dm_port_done(struct dm_scan *scan, struct dm_port *port)
+{
+	if (!port->failed && port->iou)
+		report_port(scan->res, port);
+
+	if (!port->cached) {
+		if (!port->failed && port->iou && port->iou->complete)
+			dm_cache_insert(port->iou);
+		else
+			dm_iou_free(port->iou);
+	}
+	port->iou = NULL;
+}
+
+/* in_mad is NULL if the query could not be sent or timed out */
+static void dm_complete(struct dm_scan *scan, struct dm_query *q,
+			struct srp_ib_user_mad *in_mad)
+{
+	struct dm_port		       *port = q->port;
+	struct umad_dm_packet	       *in_dm_mad = NULL;
+	struct dm_ioc		       *ioc;
+	uint16_t			status = 0;
+
+	if (in_mad) {
+		in_dm_mad = get_data_ptr(*in_mad);
+		status = be16toh(in_dm_mad->mad_hdr.status);
+	}
+
+	switch (q->attr_id) {
+	case UMAD_ATTR_CLASS_PORT_INFO:
+		if (status)
+			pr_err("Class Port Info set returned status 0x%04x\n",
+			       status);
+		if (!in_mad || status)
+			pr_err("Warning: set of ClassPortInfo failed\n");
+		dm_queue(port, &scan->queued, UMAD_METHOD_GET,
+			 SRP_DM_ATTR_IO_UNIT_INFO, 0, 0, 0);
+		break;
+
+	case SRP_DM_ATTR_IO_UNIT_INFO:
+		if (status)
+			pr_err("IO Unit Info query returned status 0x%04x\n",
+			       status);
+		if (!in_mad || status) {
+			pr_err("failed to get iou info for dlid %#x\n",
+			       port->dlid);
+			port->failed = true;
+			break;
+		}
+		memcpy(&port->info, in_dm_mad->data, sizeof port->info);
+		dm_start_iocs(scan, port);
+		break;
+
+	case SRP_DM_ATTR_IO_CONTROLLER_PROFILE:
+		if (status)
+			pr_err("IO Controller Profile query returned status 0x%04x for %d\n",
+			       status, q->ioc + 1);
+		if (!in_mad || status) {
+			port->iou->complete = false;
+			break;
+		}
+		ioc = &port->iou->ioc[q->ioc];
+		memcpy(&ioc->prof, in_dm_mad->data, sizeof ioc->prof);
+		ioc->valid = true;
+		dm_start_svc_entries(scan, port, q->ioc);
+		break;
+
+	case SRP_DM_ATTR_SERVICE_ENTRIES:
+		if (status)
+			pr_err("Service Entries query returned status 0x%04x\n",
+			       status);
+		if (!in_mad || status) {
+			port->iou->complete = false;
+			break;
+		}
+		ioc = &port->iou->ioc[q->ioc];
+		memcpy(&ioc->svc[q->block], in_dm_mad->data,
+		       sizeof ioc->svc[q->block]);
+		ioc->svc_valid[q->block] = true;
+		break;
+	}
+
+	free(q);
+	if (--port->pending == 0)
+		dm_port_done(scan, port);
+}
+
+static void dm_fail_wire(struct dm_scan *scan)
+{
+	struct dm_query *q, *next;
+
+	list_for_each_safe(&scan->wire, q, next, entry) {
+		list_del(&q->entry);
+		scan->on_wire--;
+		dm_complete(scan, q, NULL);
+	}
+}
+
+static struct dm_query *dm_find_wire(struct dm_scan *scan, uint32_t tid)
+{
+	struct dm_query *q;
+
+	list_for_each(&scan->wire, q, entry)
+		if (q->tid == tid) {
+			list_del(&q->entry);
+			scan->on_wire--;
+			return q;
+		}
+	return NULL;
+}
+
+/* Run the DM queries of all ports queued on scan to completion */
+static void dm_run(struct dm_scan *scan)
+{
+	struct umad_resources	       *umad_res = scan->res->umad_res;
+	struct srp_ib_user_mad		in_mad;
+	struct umad_dm_packet	       *in_dm_mad = get_data_ptr(in_mad);
+	struct dm_query		       *q;
+	uint32_t			tid;
+	int				len, ret;
+	/* the kernel reports a timeout for every MAD sent, this is a fallback */
+	int				recv_timeout = config->timeout *
+						(config->mad_retries + 1) + 1000;
+
+	while (!list_empty(&scan->queued) || scan->on_wire) {
+		while (scan->on_wire < config->max_dm_oust &&
+		       (q = list_pop(&scan->queued, struct dm_query, entry))) {
+			if (dm_send(scan, q)) {
+				dm_complete(scan, q, NULL);
+				continue;
+			}
+			list_add_tail(&scan->wire, &q->entry);
+			scan->on_wire++;
+		}
+
+		if (!scan->on_wire)
+			continue;
+
+		len = MAD_BLOCK_SIZE;
+		ret = umad_recv(umad_res->portid, (struct ib_user_mad *) &in_mad,
+				&len, recv_timeout);
+		if (ret < 0) {
+			pr_err("umad_recv failed - %d\n", ret);
+			dm_fail_wire(scan);
+			continue;
+		}
+		if (ret != umad_res->agent) {
+			pr_debug("umad_recv returned different agent\n");
+			continue;
+		}
+
+		tid = be64toh(in_dm_mad->mad_hdr.tid);
+		q = dm_find_wire(scan, tid);
+		if (!q) {
+			pr_debug("umad_recv returned unknown transaction id %#x\n",
+				 tid);
+			continue;
+		}
+
+		ret = umad_status(&in_mad);
+		if (ret) {
+			pr_err("bad MAD status (%u) from lid %#x\n", ret,
+			       q->port->dlid);
+			dm_complete(scan, q, NULL);
+		} else
+			dm_complete(scan, q, &in_mad);
+	}
+}
+
+static void dm_scan_fini(struct dm_scan *scan)
+{
+	struct dm_port *port;
+
+	while ((port = list_pop(&scan->ports, struct dm_port, entry))) {
+		if (!port->cached)
+			dm_iou_free(port->iou);
+		free(port);
+	}
 }
 
 int get_node(struct umad_resources *umad_res, uint16_t dlid, uint64_t *guid)
@@ -1251,7 +1574,7 @@ err:
 	return -1;
 }
 
-static int do_dm_port_list(struct resources *res)
+static int do_dm_port_list(struct resources *res, struct dm_scan *scan)
 {
 	struct umad_resources 	       *umad_res = res->umad_res;
 	uint8_t                        *in_mad_buf;
@@ -1316,32 +1639,43 @@ static int do_dm_port_list(struct resources *res)
 		}
 
 		for (j = 0; j < num_pkeys; ++j)
-			do_port(res, pkeys[j], be16toh(port_info->endport_lid),
-				be64toh(port_info->subnet_prefix), guid);
+			dm_queue_port(scan, pkeys[j],
+				      be16toh(port_info->endport_lid),
+				      be64toh(port_info->subnet_prefix), guid);
 	}
 
 	free(in_mad_buf);
 	return 0;
 }
 
-void handle_port(struct resources *res, uint16_t pkey, uint16_t lid, uint64_t h_guid)
+static void queue_port(struct resources *res, struct dm_scan *scan,
+		       uint16_t pkey, uint16_t lid, uint64_t h_guid)
 {
 	struct umad_resources *umad_res = res->umad_res;
 	uint64_t subnet_prefix;
 	int isdm;
 
-	pr_debug("enter handle_port for lid %#x\n", lid);
 	if (get_port_info(umad_res, lid, &subnet_prefix, &isdm))
 		return;
 
 	if (!isdm)
 		return;
 
-	do_port(res, pkey, lid, subnet_prefix, h_guid);
+	dm_queue_port(scan, pkey, lid, subnet_prefix, h_guid);
 }
 
+void handle_port(struct resources *res, uint16_t pkey, uint16_t lid, uint64_t h_guid)
+{
+	struct dm_scan scan;
+
+	pr_debug("enter handle_port for lid %#x\n", lid);
+	dm_scan_init(&scan, res);
+	queue_port(res, &scan, pkey, lid, h_guid);
+	dm_run(&scan);
+	dm_scan_fini(&scan);
+}
 
-static int do_full_port_list(struct resources *res)
+static int do_full_port_list(struct resources *res, struct dm_scan *scan)
 {
 	struct umad_resources 	       *umad_res = res->umad_res;
 	uint8_t                        *in_mad_buf;
@@ -1394,8 +1728,8 @@ static int do_full_port_list(struct resources *res)
 		}
 
 		for (j = 0; j < num_pkeys; ++j)
-			(void) handle_port(res, pkeys[j], be16toh(node->lid),
-					   be64toh(node->port_guid));
+			queue_port(res, scan, pkeys[j], be16toh(node->lid),
+				   be64toh(node->port_guid));
 	}
 
 	free(in_mad_buf);
@@ -1414,6 +1748,7 @@ static void print_config(struct config_t *conf)
 	printf(" Mad Retries                		: %d\n", conf->mad_retries);
 	printf(" Number of outstanding WR   		: %u\n", conf->num_of_oust);
 	printf(" Mad timeout (msec)	     		: %u\n", conf->timeout);
+	printf(" Outstanding DM queries     		: %d\n", conf->max_dm_oust);
 	printf(" Prints add target command  		: %d\n", conf->cmd);
  	printf(" Executes add target command		: %d\n", conf->execute);
  	printf(" Print also connected targets 		: %d\n", conf->all);
@@ -1694,7 +2029,7 @@ static const struct option long_opts[] = {
 	{ "systemd",        0, NULL, 'S' },
 	{}
 };
-static const char short_opts[] = "caveod:i:j:p:t:r:R:T:l:Vhnf:";
+static const char short_opts[] = "caveod:i:j:p:t:r:m:R:T:l:Vhnf:";
 
 /* Check if the --systemd options was passed in very early so we can setup
  * logging properly.
@@ -1731,6 +2066,7 @@ static int get_config(struct config_t *conf, int argc, char *argv[])
 	conf->debug_verbose    		= 0;
 	conf->timeout	 		= 5000;
 	conf->mad_retries 		= 3;
+	conf->max_dm_oust		= 16;
 	conf->recalc_time 		= 0;
 	conf->retry_timeout 		= 20;
 	conf->add_target_file  		= NULL;
@@ -1813,6 +2149,14 @@ static int get_config(struct config_t *conf, int argc, char *argv[])
 				return -1;
 			}
 			break;
+		case 'm':
+			conf->max_dm_oust = atoi(optarg);
+			if (conf->max_dm_oust <= 0) {
+				pr_err("Bad number of outstanding DM queries - %s\n",
+				       optarg);
+				return -1;
+			}
+			break;
 		case 'R':
 			conf->recalc_time = atoi(optarg);
 			if (conf->recalc_time == 0) {
@@ -1899,6 +2243,7 @@ static void umad_resources_destroy(struct umad_resources *umad_res)
 		umad_close_port(umad_res->portid);
 	}
 
+	dm_cache_destroy();
 	umad_done();
 }
 
@@ -2124,6 +2469,7 @@ static int ibsrpdm(int argc, char *argv[])
 	config->num_of_oust = 10;
 	config->timeout = 5000;
 	config->mad_retries = 3;
+	config->max_dm_oust = 16;
 	config->all = 1;
 	config->once = 1;
 
@@ -2437,6 +2783,8 @@ out:
 static int recalc(struct resources *res)
 {
 	struct umad_resources *umad_res = res->umad_res;
+	struct timespec start, end;
+	struct dm_scan scan;
 	int  mask_match;
 	char val[7];
 	int ret;
@@ -2457,14 +2805,27 @@ static int recalc(struct resources *res)
 	if (ret < 0)
 		return ret;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dm_scan_init(&scan, res);
+
 	if (mask_match) {
 		pr_debug("Advanced SM, performing a capability query\n");
-		ret = do_dm_port_list(res);
+		ret = do_dm_port_list(res, &scan);
 	} else {
 		pr_debug("Old SM, performing a full node query\n");
-		ret = do_full_port_list(res);
+		ret = do_full_port_list(res, &scan);
 	}
 
+	/* Ports queued before an SA failure are still worth reporting */
+	dm_run(&scan);
+	dm_scan_fini(&scan);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pr_debug("Rescan took %ld ms, %d ports, %d unchanged\n",
+		 (long) ((end.tv_sec - start.tv_sec) * 1000 +
+			 (end.tv_nsec - start.tv_nsec) / 1000000),
+		 scan.nports, scan.cached);
+
 	return ret;
 }
 
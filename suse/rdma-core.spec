@@ -671,7 +671,9 @@ rm -rf %{buildroot}/%{_sbindir}/srp_daemon.sh
 %files -n libibverbs-utils
 %defattr(-,root,root)
 %{_bindir}/ibv_*
+%{_bindir}/mlx5dv_dr_stats
 %{_mandir}/man1/ibv_*
+%{_mandir}/man1/mlx5dv_dr_stats.*
 
 %files -n ibacm
 %defattr(-,root,root)